@@ -1 +1 @@
-OBJS+=io.o sha1.o base64.o webserv.o
+OBJS+=io.o sha1.o base64.o webserv.o udp.o
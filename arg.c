@@ -19,7 +19,7 @@ static const char* prg;
 NO_RETURN
 static void usage(FILE* out, int exit_status)
 {
-	fprintf(out, "Usage: %s [" OPTS "dir PATH] [" OPTS "connect SERVER]\n", prg);
+	fprintf(out, "Usage: %s [" OPTS "dir PATH] [" OPTS "connect SERVER] [" OPTS "rooms NAME,NAME,...] [" OPTS "hibernate SECONDS] [" OPTS "port PORT] [" OPTS "maxconn COUNT] [" OPTS "wstimeout SECONDS] [" OPTS "mimrate MIMS_PER_SECOND[,BYTES_PER_SECOND]] [" OPTS "uploadbudget MEGABYTES] [" OPTS "udp PORT] [" OPTS "join HOST:PORT]\n", prg);
 	exit(exit_status);
 }
 
@@ -37,6 +37,15 @@ static void error(void)
 
 const char* arg_dir;
 const char* arg_connect;
+const char* arg_rooms;
+const char* arg_hibernate;
+const char* arg_port;
+const char* arg_maxconn;
+const char* arg_wstimeout;
+const char* arg_mimrate;
+const char* arg_uploadbudget;
+const char* arg_udp;
+const char* arg_join;
 
 void parse_args(int argc, char** argv)
 {
@@ -64,6 +73,24 @@ void parse_args(int argc, char** argv)
 				grab = &arg_dir;
 			} else if (strcmp(rest, "connect")==0) {
 				grab = &arg_connect;
+			} else if (strcmp(rest, "rooms")==0) {
+				grab = &arg_rooms;
+			} else if (strcmp(rest, "hibernate")==0) {
+				grab = &arg_hibernate;
+			} else if (strcmp(rest, "port")==0) {
+				grab = &arg_port;
+			} else if (strcmp(rest, "maxconn")==0) {
+				grab = &arg_maxconn;
+			} else if (strcmp(rest, "wstimeout")==0) {
+				grab = &arg_wstimeout;
+			} else if (strcmp(rest, "mimrate")==0) {
+				grab = &arg_mimrate;
+			} else if (strcmp(rest, "uploadbudget")==0) {
+				grab = &arg_uploadbudget;
+			} else if (strcmp(rest, "udp")==0) {
+				grab = &arg_udp;
+			} else if (strcmp(rest, "join")==0) {
+				grab = &arg_join;
 			} else {
 				fprintf(stderr, "invalid switch %s\n", arg);
 				error();
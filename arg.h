@@ -3,7 +3,16 @@
 void parse_args(int argc, char** argv);
 
 extern const char* arg_dir;
-extern const char* arg_connect;
+extern const char* arg_connect; // HOST:PORT[/PATH]; see relay.h
+extern const char* arg_rooms; // comma-separated; see gig_add_room()
+extern const char* arg_port; // see webserv_set_port()
+extern const char* arg_maxconn; // see webserv_set_max_conn_count()
+extern const char* arg_wstimeout; // see webserv_set_websocket_timeout_ms()
+extern const char* arg_mimrate; // MIMS_PER_SECOND[,BYTES_PER_SECOND]; see webserv_set_mim_rate_limit()
+extern const char* arg_uploadbudget; // megabytes; see webserv_set_upload_budget()
+extern const char* arg_udp; // PORT; see udp_host_init()
+extern const char* arg_join; // HOST:PORT; see udp_peer_init()
+extern const char* arg_hibernate; // seconds; see gig_set_room_hibernation_timeout_us()
 
 #define ARG_H
 #endif
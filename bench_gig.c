@@ -0,0 +1,181 @@
+// run with bench_gig.sh
+
+// measures room hibernation (see gig_set_room_hibernation_timeout_us()): a
+// room is filled with documents by committing typing mims, and then
+// hibernated and resumed (gig_acquire_room()) a number of times. it reports
+// the resume latency (wall time, since resuming is mostly file I/O), and the
+// room's memory while awake and while hibernating. webserv is stubbed out
+// below.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "main.h"
+#include "io.h"
+#include "gig.h"
+#include "stb_ds.h"
+
+#define BENCH_DIR "_bench_gig.dir"
+
+int64_t get_nanoseconds_monotonic(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL;
+}
+
+int64_t get_microseconds_epoch(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000LL + (int64_t)tv.tv_usec;
+}
+
+void sleep_microseconds(int64_t us)
+{
+	struct timespec t = {
+		.tv_sec  = us / 1000000LL,
+		.tv_nsec = (us % 1000000LL) * 1000LL,
+	};
+	nanosleep(&t, NULL);
+}
+
+// webserv stubs
+
+int webserv_broadcast_journal(int room_id, int64_t until_journal_cursor)
+{
+	return 0;
+}
+
+void transmit_mim(int mim_session_id, int64_t tracer, uint8_t* data, int count)
+{
+}
+
+static void tick(void)
+{
+	while (host_tick() | io_tick()) {}
+}
+
+static void commit(int room_id, const char* mim)
+{
+	commit_mim_to_host(room_id, 1, 1, 0, (uint8_t*)mim, strlen(mim));
+}
+
+static int is_hibernating(int room_id)
+{
+	struct gig_room_stats s;
+	gig_get_room_stats(room_id, &s);
+	return s.is_hibernating;
+}
+
+static void tick_until_hibernating(int room_id)
+{
+	for (;;) {
+		tick();
+		if (is_hibernating(room_id)) return;
+		io_wait(1000L);
+	}
+}
+
+static int64_t get_room_memory(int room_id)
+{
+	struct gig_room_stats s;
+	gig_get_room_stats(room_id, &s);
+	return s.snapshot_bytes + s.packed_snapshot_bytes + s.io_buffer_bytes;
+}
+
+static int compare_int64(const void* va, const void* vb)
+{
+	const int64_t a = *(const int64_t*)va;
+	const int64_t b = *(const int64_t*)vb;
+	return (a>b) - (a<b);
+}
+
+int main(int argc, char** argv)
+{
+	const int num_docs     = (argc>1) ? atoi(argv[1]) : 4;
+	const int doc_size     = (argc>2) ? atoi(argv[2]) : (16<<10);
+	const int num_resumes  = (argc>3) ? atoi(argv[3]) : 50;
+	assert(num_docs > 0 && doc_size > 0 && num_resumes > 0);
+
+	char cmd[1<<10];
+	snprintf(cmd, sizeof cmd, "rm -rf %s", BENCH_DIR);
+	assert(0 == system(cmd));
+	assert(0 == io_mkdir(BENCH_DIR));
+
+	io_init();
+	mie_thread_init();
+	gig_init();
+	assert(gig_configure_as_host_only(BENCH_DIR) >= 0);
+	const int room_id = gig_add_room("bench", BENCH_DIR "/bench");
+	assert(room_id > 0);
+	assert(alloc_artist_id(room_id) == 1);
+
+	// type the documents, one line of code per mim
+	char mim[1<<10];
+	for (int doc=0; doc<num_docs; ++doc) {
+		// (doc 50 is in the default stub)
+		char ex[1<<8];
+		int len = 0;
+		if (doc > 0) {
+			snprintf(ex, sizeof ex, "newdoc 1 %d doc%d.mie", 50+doc, doc);
+			len += snprintf(&mim[len], sizeof(mim)-len, "%d:%s", (int)strlen(ex), ex);
+		}
+		snprintf(ex, sizeof ex, "setdoc 1 %d", 50+doc);
+		len += snprintf(&mim[len], sizeof(mim)-len, "%d:%s0,1,1c", (int)strlen(ex), ex);
+		commit(room_id, mim);
+		for (int n=0; n<doc_size; ) {
+			char line[1<<8];
+			const int nl = snprintf(line, sizeof line, "\tout = sin(phase * %d.0) * amp%d;\n", n%997, doc);
+			snprintf(mim, sizeof mim, "0,%di%s", nl, line);
+			commit(room_id, mim);
+			n += nl;
+			tick();
+		}
+	}
+	tick();
+
+	struct gig_room_stats s;
+	gig_get_room_stats(room_id, &s);
+	const int64_t journal_size = s.journal_size;
+	const int64_t awake_memory = get_room_memory(room_id);
+
+	gig_set_room_hibernation_timeout_us(1);
+	int64_t hibernate_ns = get_nanoseconds_monotonic();
+	tick_until_hibernating(room_id);
+	hibernate_ns = get_nanoseconds_monotonic() - hibernate_ns;
+	const int64_t hibernating_memory = get_room_memory(room_id);
+
+	int64_t* resume_ns = calloc(num_resumes, sizeof *resume_ns);
+	for (int i=0; i<num_resumes; ++i) {
+		const int64_t t0 = get_nanoseconds_monotonic();
+		assert(gig_acquire_room(room_id) >= 0);
+		resume_ns[i] = get_nanoseconds_monotonic() - t0;
+		gig_get_room_stats(room_id, &s);
+		assert(s.num_documents >= num_docs);
+		assert(s.journal_size == journal_size);
+		gig_release_room(room_id);
+		tick_until_hibernating(room_id);
+	}
+	qsort(resume_ns, num_resumes, sizeof *resume_ns, compare_int64);
+
+	printf("docs=%d doc_size=%d journal=%lld bytes\n", num_docs, doc_size, (long long)journal_size);
+	printf("  room memory awake:           %10lld bytes\n", (long long)awake_memory);
+	printf("  room memory hibernating:     %10lld bytes\n", (long long)hibernating_memory);
+	printf("  first hibernation:           %10.2f ms\n", (double)hibernate_ns * 1e-6);
+	printf("  resume (%d times):  min %.2f ms  median %.2f ms  max %.2f ms\n",
+		num_resumes,
+		(double)resume_ns[0] * 1e-6,
+		(double)resume_ns[num_resumes/2] * 1e-6,
+		(double)resume_ns[num_resumes-1] * 1e-6);
+	free(resume_ns);
+
+	gig_unconfigure();
+	assert(0 == system(cmd));
+
+	return EXIT_SUCCESS;
+}
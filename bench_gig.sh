@@ -0,0 +1,15 @@
+#!/usr/bin/env bash
+set -e
+cc -O2 -g -Wall \
+	stb_divide.c stb_ds.c stb_sprintf.c \
+	allocator.c utf8.c path.c arg.c \
+	mie.c \
+	io.c \
+	bufstream.c \
+	jio.c \
+	gig.c \
+	bench_gig.c \
+	-o _bench_gig \
+	-lm
+$RUNNER ./_bench_gig "$@"
+# usage: ./bench_gig.sh [num_docs] [doc_size] [num_resumes]
@@ -0,0 +1,130 @@
+// run with bench_lz.sh
+
+// measures lz.c compression ratio and encode/decode throughput the way
+// webserv uses it: the journal is compressed in updates of a given size, each
+// with the preceding journal bytes as dictionary. pass a path to a journal
+// (e.g. DO_JAM_JOURNAL) to use real data; otherwise a synthetic journal of
+// mim-like editing commands is used.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "stb_ds_sysalloc.h"
+#include "lz.h"
+
+static int64_t get_nanoseconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL;
+}
+
+static uint32_t rng_state = 1;
+static uint32_t rng(void)
+{
+	uint32_t x = rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return rng_state = x;
+}
+
+static void gen_synthetic_journal(uint8_t** out_arr, int64_t size)
+{
+	static const char* words[] = {
+		"static", "void", "int", "float", "return", "if", "else", "for",
+		"(", ")", "{", "}", ";", "=", "+", "*", "x", "y", "i", "n", "0", "1",
+		"sin", "cos", "out", "in", "freq", "amp", "phase", "\n", "\t", " ",
+	};
+	const int num_words = sizeof(words) / sizeof(words[0]);
+	int64_t ts = 0;
+	while (arrlen(*out_arr) < size) {
+		// record header-ish: sync byte, timestamp delta, artist, session
+		ts += 1 + (rng() % 5000);
+		arrput(*out_arr, 0xfa);
+		for (int64_t t=ts; t; t>>=7) arrput(*out_arr, (t & 0x7f) | ((t>>7) ? 0x80 : 0));
+		arrput(*out_arr, 1 + (rng() % 3));
+		arrput(*out_arr, 1);
+		// a mim command; mostly typing, sometimes caret movement
+		char cmd[256];
+		int n;
+		if ((rng() % 4) == 0) {
+			n = snprintf(cmd, sizeof cmd, "1,%d,%dc", 1 + (rng() % 200), 1 + (rng() % 80));
+		} else {
+			n = snprintf(cmd, sizeof cmd, "i%s", words[rng() % num_words]);
+		}
+		arrput(*out_arr, n);
+		memcpy(arraddnptr(*out_arr, n), cmd, n);
+	}
+	arrsetlen(*out_arr, size);
+}
+
+static void bench(const uint8_t* journal, int64_t journal_size, int64_t update_size)
+{
+	uint8_t* compressed = malloc(lz_compress_bound(update_size));
+	uint8_t* decompressed = malloc(LZ_MAX_DICT_SIZE + update_size);
+	int64_t total_compressed = 0;
+	int64_t encode_ns = 0;
+	int64_t decode_ns = 0;
+	int64_t num_updates = 0;
+	for (int64_t o=0; o<journal_size; o+=update_size) {
+		int64_t n = (journal_size - o);
+		if (n > update_size) n = update_size;
+		int64_t dict_size = o;
+		if (dict_size > LZ_MAX_DICT_SIZE) dict_size = LZ_MAX_DICT_SIZE;
+		const uint8_t* buf = (journal + o - dict_size);
+
+		const int64_t t0 = get_nanoseconds();
+		const int64_t nc = lz_compress(compressed, buf, dict_size, n);
+		const int64_t t1 = get_nanoseconds();
+		memcpy(decompressed, buf, dict_size);
+		const int64_t t2 = get_nanoseconds();
+		assert(lz_decompress(decompressed, dict_size, n, compressed, nc) == n);
+		const int64_t t3 = get_nanoseconds();
+		assert(0 == memcmp(decompressed + dict_size, journal + o, n));
+
+		encode_ns += (t1-t0);
+		decode_ns += (t3-t2);
+		total_compressed += nc;
+		++num_updates;
+	}
+	free(decompressed);
+	free(compressed);
+
+	printf("  update_size=%-8lld ratio=%6.3f  encode: %8.1f MB/s  decode: %8.1f MB/s  (%lld updates)\n",
+		(long long)update_size,
+		(double)journal_size / (double)total_compressed,
+		(double)journal_size / ((double)encode_ns * 1e-9) * 1e-6,
+		(double)journal_size / ((double)decode_ns * 1e-9) * 1e-6,
+		(long long)num_updates);
+}
+
+int main(int argc, char** argv)
+{
+	uint8_t* journal_arr = NULL;
+	if (argc > 1) {
+		FILE* f = fopen(argv[1], "rb");
+		if (f == NULL) {
+			fprintf(stderr, "%s: could not open\n", argv[1]);
+			exit(EXIT_FAILURE);
+		}
+		uint8_t buf[1<<16];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof buf, f)) > 0) memcpy(arraddnptr(journal_arr, n), buf, n);
+		fclose(f);
+		printf("%s: %zd bytes\n", argv[1], arrlen(journal_arr));
+	} else {
+		gen_synthetic_journal(&journal_arr, 16L << 20);
+		printf("synthetic journal: %zd bytes\n", arrlen(journal_arr));
+	}
+
+	const int64_t update_sizes[] = { 64, 256, 1<<12, 1<<16, 1<<18 };
+	for (int i=0; i<(int)(sizeof(update_sizes)/sizeof(update_sizes[0])); ++i) {
+		bench(journal_arr, arrlen(journal_arr), update_sizes[i]);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,9 @@
+#!/usr/bin/env bash
+set -e
+cc -O2 -g -Wall \
+	stb_ds.c allocator.c \
+	lz.c \
+	bench_lz.c \
+	-o _bench_lz
+$RUNNER ./_bench_lz "$@"
+# usage: ./bench_lz.sh [path/to/journal]
@@ -0,0 +1,286 @@
+// run with bench_typing.sh
+
+// measures the peer's prediction path end to end: a local artist types into a
+// host+peer (like the SDL build) with peer_set_artificial_mim_latency()
+// simulating the roundtrip, while other artists' mims are committed to the
+// host (like they arrive from websockets). for every keystroke it reports the
+// time from peer_end_mim() until the host's record is in the upstream snapshot,
+// and until the fiddle snapshot has been re-spooled on top of it (see
+// peer_take_mim_latencies()); the difference is what the peer spends
+// re-spooling unacked mims.
+//
+// idle time is skipped: when nothing has work to do, the clock jumps ahead
+// instead of sleeping (see get_nanoseconds_monotonic() below). so the
+// latencies are the artificial latency plus the real time spent ticking, and
+// a run takes a lot less time than it simulates. rand() (which picks the
+// artificial latencies) and our own generator are seeded, so runs are
+// reproducible up to the CPU time they measure. webserv is stubbed out below.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "main.h"
+#include "io.h"
+#include "gig.h"
+#include "stb_ds_sysalloc.h"
+
+#define BENCH_DIR     "_bench_typing.dir"
+#define IDLE_STEP_NS  (20000LL)
+// how far the clock jumps when idle; it's also the resolution of the
+// latencies (as far as the artificial latency is concerned)
+#define DRAIN_TIMEOUT_NS (60000000000LL)
+
+static struct {
+	int64_t skipped_ns;
+	uint64_t rng;
+} g;
+
+int64_t get_nanoseconds_monotonic(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL + g.skipped_ns;
+}
+
+int64_t get_microseconds_epoch(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000LL + (int64_t)tv.tv_usec;
+}
+
+void sleep_microseconds(int64_t us)
+{
+	g.skipped_ns += us * 1000LL;
+}
+
+// webserv stubs
+
+int webserv_broadcast_journal(int room_id, int64_t until_journal_cursor)
+{
+	return 0;
+}
+
+void transmit_mim(int mim_session_id, int64_t tracer, uint8_t* data, int count)
+{
+	assert(!"host+peer doesn't transmit");
+}
+
+static double rng_uniform(void)
+{
+	g.rng ^= g.rng >> 12;
+	g.rng ^= g.rng << 25;
+	g.rng ^= g.rng >> 27;
+	return (double)((g.rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Poisson arrivals
+static int64_t next_delay_ns(double per_second)
+{
+	return (int64_t)(-log(1.0 - rng_uniform()) * 1e9 / per_second);
+}
+
+static int compare_int64(const void* va, const void* vb)
+{
+	const int64_t a = *(const int64_t*)va;
+	const int64_t b = *(const int64_t*)vb;
+	return (a>b) - (a<b);
+}
+
+static void print_latencies(const char* name, int64_t* ns_arr)
+{
+	const int n = arrlen(ns_arr);
+	assert(n > 0);
+	qsort(ns_arr, n, sizeof *ns_arr, compare_int64);
+	printf("  %-28s p50 %8.3f  p99 %8.3f  max %8.3f ms\n",
+		name,
+		(double)ns_arr[(n-1)/2] * 1e-6,
+		(double)ns_arr[(int)((double)(n-1)*0.99)] * 1e-6,
+		(double)ns_arr[n-1] * 1e-6);
+}
+
+struct artist {
+	int artist_id;
+	int64_t tracer;
+	int64_t next_ns;
+};
+
+static void other_artist_mim(struct artist* a)
+{
+	char mim[1<<11];
+	if (a->tracer == 0) {
+		const char* ex = "setdoc 1 50";
+		snprintf(mim, sizeof mim, "%d:%s0,1,1c", (int)strlen(ex), ex);
+	} else if (rng_uniform() < 0.02) {
+		// the odd paste
+		char text[1<<10];
+		const int n = 100 + (int)(rng_uniform() * 900);
+		for (int i=0; i<n; ++i) text[i] = ((i%40) == 39) ? '\n' : 'x';
+		snprintf(mim, sizeof mim, "0,%di%.*s", n, n, text);
+	} else {
+		snprintf(mim, sizeof mim, "0,1i%c", 'a' + (int)(rng_uniform()*26));
+	}
+	commit_mim_to_host(0, a->artist_id, 1, ++a->tracer, (uint8_t*)mim, strlen(mim));
+}
+
+static void tick(void)
+{
+	while (peer_tick() | host_tick() | io_tick()) {}
+}
+
+// the document everybody types into has doc_size bytes to begin with, so
+// snapshots aren't unrealistically small
+static void prefill(int doc_size)
+{
+	const int artist_id = alloc_artist_id(0);
+	char mim[1<<13];
+	const char* ex = "setdoc 1 50";
+	snprintf(mim, sizeof mim, "%d:%s0,1,1c", (int)strlen(ex), ex);
+	int64_t tracer = 0;
+	commit_mim_to_host(0, artist_id, 1, ++tracer, (uint8_t*)mim, strlen(mim));
+	for (int n=0; n<doc_size; ) {
+		char line[1<<8];
+		const int nl = snprintf(line, sizeof line, "\tout = sin(phase * %d.0) * amp;\n", n%997);
+		snprintf(mim, sizeof mim, "0,%di%s", nl, line);
+		commit_mim_to_host(0, artist_id, 1, ++tracer, (uint8_t*)mim, strlen(mim));
+		n += nl;
+	}
+	tick();
+}
+
+static void run(double latency_mean, double latency_variance, int num_other_artists, double keys_per_second, double seconds, int doc_size)
+{
+	char cmd[1<<10];
+	snprintf(cmd, sizeof cmd, "rm -rf %s", BENCH_DIR);
+	assert(0 == system(cmd));
+	assert(0 == io_mkdir(BENCH_DIR));
+
+	srand(1);
+	g.rng = 0x9e3779b97f4a7c15ULL;
+	gig_init();
+	assert(gig_configure_as_host_and_peer(BENCH_DIR) >= 0);
+	tick(); // (the peer gets the default stub)
+	prefill(doc_size);
+	peer_set_artificial_mim_latency(latency_mean, latency_variance);
+	peer_set_mim_latency_tracking(1);
+
+	struct artist* others = calloc(num_other_artists, sizeof *others);
+	const int64_t t0 = get_nanoseconds_monotonic();
+	for (int i=0; i<num_other_artists; ++i) {
+		others[i].artist_id = alloc_artist_id(0);
+		others[i].next_ns = t0;
+	}
+
+	int64_t* end_mim_ns_arr = NULL;
+	int64_t* upstream_ns_arr = NULL;
+	int64_t* respool_ns_arr = NULL;
+	int64_t* respool_only_ns_arr = NULL;
+	int num_typed = 0;
+	int num_acked = 0;
+	int64_t next_key_ns = t0;
+	const int64_t t1 = t0 + (int64_t)(seconds * 1e9);
+	for (;;) {
+		const int64_t now = get_nanoseconds_monotonic();
+		const int is_typing = (now < t1);
+		if (!is_typing && (num_acked == num_typed)) break;
+		assert(((now - t1) < DRAIN_TIMEOUT_NS) && "mims weren't acked");
+
+		int64_t next_event_ns = now + IDLE_STEP_NS;
+		if (is_typing) {
+			if (now >= next_key_ns) {
+				const int64_t te0 = get_nanoseconds_monotonic();
+				peer_begin_mim(1);
+				if (num_typed == 0) {
+					mimex("setdoc 1 50");
+					mimf("0,1,1c");
+				} else {
+					const double r = rng_uniform();
+					mimi(0, (r < 0.05) ? "\n" : (r < 0.2) ? " " : "x");
+				}
+				peer_end_mim();
+				arrput(end_mim_ns_arr, get_nanoseconds_monotonic() - te0);
+				++num_typed;
+				next_key_ns += next_delay_ns(keys_per_second);
+			}
+			if (next_key_ns < next_event_ns) next_event_ns = next_key_ns;
+			for (int i=0; i<num_other_artists; ++i) {
+				struct artist* a = &others[i];
+				if (now >= a->next_ns) {
+					other_artist_mim(a);
+					a->next_ns += next_delay_ns(keys_per_second);
+				}
+				if (a->next_ns < next_event_ns) next_event_ns = a->next_ns;
+			}
+		}
+
+		int did_work = 0;
+		did_work |= peer_tick();
+		did_work |= host_tick();
+		did_work |= io_tick();
+
+		struct gig_mim_latency ls[64];
+		int n;
+		while ((n = peer_take_mim_latencies(ls, sizeof(ls)/sizeof(ls[0]))) > 0) {
+			for (int i=0; i<n; ++i) {
+				arrput(upstream_ns_arr, ls[i].upstream_ns);
+				arrput(respool_ns_arr, ls[i].respool_ns);
+				arrput(respool_only_ns_arr, ls[i].respool_ns - ls[i].upstream_ns);
+			}
+			num_acked += n;
+		}
+
+		if (!did_work) {
+			const int64_t t = get_nanoseconds_monotonic();
+			if (next_event_ns > t) g.skipped_ns += (next_event_ns - t);
+		}
+	}
+
+	printf("latency mean=%.0fms variance=%g, %d other artists, %.1f keys/s/artist for %.0fs, doc_size=%d: %d keystrokes\n",
+		latency_mean * 1e3, latency_variance, num_other_artists, keys_per_second, seconds, doc_size, num_typed);
+	print_latencies("peer_end_mim():", end_mim_ns_arr);
+	print_latencies("=> upstream snapshot:", upstream_ns_arr);
+	print_latencies("=> fiddle re-spool done:", respool_ns_arr);
+	print_latencies("re-spool alone:", respool_only_ns_arr);
+
+	arrfree(end_mim_ns_arr);
+	arrfree(upstream_ns_arr);
+	arrfree(respool_ns_arr);
+	arrfree(respool_only_ns_arr);
+	free(others);
+	gig_unconfigure();
+	assert(0 == system(cmd));
+}
+
+int main(int argc, char** argv)
+{
+	const double seconds          = (argc>1) ? atof(argv[1]) : 30.0;
+	const double keys_per_second  = (argc>2) ? atof(argv[2]) : 12.0;
+	const int num_other_artists   = (argc>3) ? atoi(argv[3]) : 3;
+	const int doc_size            = (argc>4) ? atoi(argv[4]) : (64<<10);
+	assert(seconds > 0 && keys_per_second > 0 && num_other_artists >= 0 && doc_size >= 0);
+
+	io_init();
+	mie_thread_init();
+	if (argc > 5) {
+		const double mean_ms = atof(argv[5]);
+		const double variance = (argc>6) ? atof(argv[6]) : 0.0;
+		run(mean_ms * 1e-3, variance, num_other_artists, keys_per_second, seconds, doc_size);
+	} else {
+		// (mean, variance) in seconds; see peer_set_artificial_mim_latency()
+		const double latencies[][2] = {
+			{ 0.0  , 0.0   },
+			{ 0.02 , 0.005 },
+			{ 0.1  , 0.02  },
+			{ 0.3  , 0.05  },
+		};
+		for (int i=0; i<(int)(sizeof(latencies)/sizeof(latencies[0])); ++i) {
+			run(latencies[i][0], latencies[i][1], num_other_artists, keys_per_second, seconds, doc_size);
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+#!/usr/bin/env bash
+set -e
+cc -O2 -g -Wall \
+	stb_divide.c stb_ds.c stb_sprintf.c \
+	allocator.c utf8.c path.c arg.c \
+	mie.c \
+	io.c \
+	bufstream.c \
+	jio.c \
+	gig.c \
+	bench_typing.c \
+	-o _bench_typing \
+	-lm
+$RUNNER ./_bench_typing "$@"
+# usage: ./bench_typing.sh [seconds] [keys_per_second] [num_other_artists] [doc_size] [latency_mean_ms latency_variance]
@@ -0,0 +1,418 @@
+// run with bench_webserv.sh
+
+// measures the host side of webserv: N websocket "spectators" connect over
+// loopback, and we time (thread CPU time) how long webserv spends fanning out
+// journal updates to them. the spectators live in this process too, but only
+// the webserv_*()/io_tick() calls are timed. gig is stubbed out below; the
+// "journal" is bytes in memory, mirrored to a file for sendfile().
+//
+// before the updates, io_tick() is timed while all the spectators are idle;
+// ideally that costs nothing no matter how many connections there are. after
+// the updates, one big catch-up update is broadcast (like when a peer
+// reconnects after being away for a while).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "stb_ds_sysalloc.h"
+#include "io.h"
+#include "webserv.h"
+#include "gig.h"
+#include "protocol.h"
+#include "leb128.h"
+#include "bufstream.h"
+
+#define PORT (6581) // see webserv_init()
+#define JOURNAL_START (32)
+#define JOURNAL_PATH "_bench_webserv.journal"
+
+static struct {
+	uint8_t* journal_arr;
+	int journal_file_id;
+	int next_artist_id;
+	int64_t tick_ns;
+	int64_t broadcast_ns;
+} g;
+
+// gig stubs
+
+int copy_journal(int room_id, void* dst, int64_t count, int64_t offset)
+{
+	assert((offset+count) <= arrlen(g.journal_arr));
+	memcpy(dst, g.journal_arr + offset, count);
+	return 0;
+}
+
+int get_journal_file_id(int room_id, int64_t* out_flushed_size)
+{
+	if (out_flushed_size) *out_flushed_size = arrlen(g.journal_arr);
+	return g.journal_file_id;
+}
+
+static void journal_append(const uint8_t* data, int64_t count)
+{
+	const int64_t offset = arrlen(g.journal_arr);
+	memcpy(arraddnptr(g.journal_arr, count), data, count);
+	assert(0 == io_pwrite(g.journal_file_id, data, count, offset));
+}
+
+int alloc_artist_id(int room_id)
+{
+	return ++g.next_artist_id;
+}
+
+void commit_mim_to_host(int room_id, int artist_id, int session_id, int64_t tracer, uint8_t* data, int count)
+{
+}
+
+static uint8_t fake_snapshot[1];
+
+const void* acquire_present_snapshot_data(int room_id, size_t* out_size, int64_t* out_journal_offset)
+{
+	if (out_size) *out_size = sizeof fake_snapshot;
+	if (out_journal_offset) *out_journal_offset = arrlen(g.journal_arr);
+	return fake_snapshot;
+}
+
+void release_present_snapshot_data(const void* data)
+{
+}
+
+int gig_find_room(const char* name)
+{
+	return -1;
+}
+
+int gig_acquire_room(int room_id)
+{
+	return 0;
+}
+
+void gig_release_room(int room_id)
+{
+}
+
+int gig_is_relay_room(int room_id)
+{
+	return 0;
+}
+
+void gig_get_room_stats(int room_id, struct gig_room_stats* out_stats)
+{
+	memset(out_stats, 0, sizeof *out_stats);
+	out_stats->journal_size = arrlen(g.journal_arr);
+}
+
+int64_t get_nanoseconds_monotonic(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL;
+}
+
+static int64_t get_thread_cpu_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL;
+}
+
+// same as what the host does every frame (see host_tick() in gig.c): a
+// connection with writes in flight is skipped by webserv_broadcast_journal(),
+// so it must be retried until everybody's caught up
+static int server_tick(void)
+{
+	int did_work = 0;
+	const int64_t t0 = get_thread_cpu_ns();
+	did_work |= webserv_tick();
+	did_work |= io_tick();
+	const int64_t t1 = get_thread_cpu_ns();
+	did_work |= webserv_broadcast_journal(0, arrlen(g.journal_arr));
+	const int64_t t2 = get_thread_cpu_ns();
+	g.tick_ns += (t1-t0);
+	g.broadcast_ns += (t2-t1);
+	return did_work;
+}
+
+struct spectator {
+	int fd;
+	int got_101;
+	int num_messages;
+	uint8_t* head_arr;
+	uint8_t frame_header[10];
+	int frame_header_size;
+	int64_t frame_remaining;
+	unsigned frame_fin :1;
+	unsigned in_journal_update :1;
+	int64_t journal_remaining;
+	int64_t journal_cursor;
+};
+
+static void spectator_send_masked(struct spectator* sp, const uint8_t* payload, int n)
+{
+	assert(n < 126);
+	uint8_t frame[256];
+	uint8_t* p = frame;
+	*(p++) = 0x80 | 2; // FIN + binary
+	*(p++) = 0x80 | n; // MASK + length
+	const uint8_t mask[4] = {1,2,3,4};
+	memcpy(p, mask, 4);
+	p += 4;
+	for (int i=0; i<n; ++i) *(p++) = payload[i] ^ mask[i&3];
+	const int nf = (p-frame);
+	assert(write(sp->fd, frame, nf) == nf);
+}
+
+// message payload (possibly fragmented) is streamed through here; journal
+// updates are verified against the journal as they arrive, so that big
+// updates needn't be buffered
+static void spectator_handle_payload(struct spectator* sp, const uint8_t* p, int64_t n, int is_end_of_msg)
+{
+	while (n > 0) {
+		if (!sp->in_journal_update) {
+			arrput(sp->head_arr, *(p++));
+			--n;
+			const int nh = arrlen(sp->head_arr);
+			if ((sp->head_arr[0] == WS1_JOURNAL_UPDATE) && (nh >= 2) && !(sp->head_arr[nh-1] & 0x80)) {
+				struct bufstream bs;
+				bufstream_init_from_memory(&bs, sp->head_arr, nh);
+				bs_skip(&bs, 1);
+				sp->journal_remaining = bs_read_leb128(&bs);
+				assert(bs.offset == nh);
+				assert((sp->journal_cursor + sp->journal_remaining) <= arrlen(g.journal_arr));
+				sp->in_journal_update = 1;
+			}
+		} else {
+			int64_t m = n;
+			if (m > sp->journal_remaining) m = sp->journal_remaining;
+			assert(m > 0 && "trailing data after journal update");
+			assert(0 == memcmp(p, g.journal_arr + sp->journal_cursor, m));
+			sp->journal_cursor += m;
+			sp->journal_remaining -= m;
+			p += m;
+			n -= m;
+		}
+	}
+	if (is_end_of_msg) {
+		assert(sp->journal_remaining == 0);
+		sp->in_journal_update = 0;
+		arrreset(sp->head_arr);
+		++sp->num_messages;
+	}
+}
+
+static void spectator_feed(struct spectator* sp, const uint8_t* p, int64_t n)
+{
+	uint8_t* hdr = sp->frame_header;
+	while (n > 0) {
+		if (sp->frame_remaining > 0) {
+			int64_t m = n;
+			if (m > sp->frame_remaining) m = sp->frame_remaining;
+			sp->frame_remaining -= m;
+			spectator_handle_payload(sp, p, m, sp->frame_fin && (sp->frame_remaining == 0));
+			p += m;
+			n -= m;
+			continue;
+		}
+		hdr[sp->frame_header_size++] = *(p++);
+		--n;
+		const int nh = sp->frame_header_size;
+		if (nh < 2) continue;
+		assert((hdr[1] & 0x80) == 0 && "server frames must not be masked");
+		const int plen7 = (hdr[1] & 0x7f);
+		const int hsize = (plen7 == 127) ? 10 : (plen7 == 126) ? 4 : 2;
+		if (nh < hsize) continue;
+		int64_t plen = plen7;
+		if (hsize > 2) {
+			plen = 0;
+			for (int i=2; i<hsize; ++i) plen = (plen << 8) | hdr[i];
+		}
+		sp->frame_fin = !!(hdr[0] & 0x80);
+		sp->frame_remaining = plen;
+		sp->frame_header_size = 0;
+		if (plen == 0) spectator_handle_payload(sp, NULL, 0, sp->frame_fin);
+	}
+}
+
+// reads whatever is available; returns number of bytes read
+static int spectator_drain(struct spectator* sp)
+{
+	uint8_t buf[1<<16];
+	int total = 0;
+	for (;;) {
+		const ssize_t n = read(sp->fd, buf, sizeof buf);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			fprintf(stderr, "read(): %s\n", strerror(errno));
+			abort();
+		}
+		if (n == 0) {
+			fprintf(stderr, "spectator disconnected\n");
+			abort();
+		}
+		if (!sp->got_101) {
+			// the 101 response and the following frames are read separately
+			// because we wait for the 101 before sending WS0_HELLO
+			assert(memcmp(buf, "HTTP/1.1 101", 12) == 0);
+			sp->got_101 = 1;
+			continue;
+		}
+		spectator_feed(sp, buf, n);
+		total += n;
+	}
+	return total;
+}
+
+// pumps until every spectator has received expected_messages, or the 101
+// response if expected_messages<0
+static void pump_until(struct spectator* sps, int num, int expected_messages)
+{
+	for (;;) {
+		server_tick();
+		int done = 1;
+		for (int i=0; i<num; ++i) {
+			struct spectator* sp = &sps[i];
+			spectator_drain(sp);
+			if (expected_messages < 0) {
+				if (!sp->got_101) done = 0;
+			} else {
+				if (sp->num_messages < expected_messages) done = 0;
+			}
+		}
+		if (done) break;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const int num_spectators = (argc>1) ? atoi(argv[1]) : 200;
+	const int num_updates    = (argc>2) ? atoi(argv[2]) : 2000;
+	const int update_size    = (argc>3) ? atoi(argv[3]) : 64;
+	const int64_t catchup_size = (argc>4) ? atoll(argv[4]) : (16LL<<20);
+	assert(num_spectators > 0 && num_updates > 0 && update_size > 0 && catchup_size >= 0);
+
+	io_init();
+	webserv_set_max_conn_count(num_spectators);
+	webserv_init();
+	(void)unlink(JOURNAL_PATH);
+	g.journal_file_id = io_open(JOURNAL_PATH, IO_CREATE, NULL);
+	assert(g.journal_file_id >= 0);
+	{
+		uint8_t header[JOURNAL_START] = {0};
+		journal_append(header, sizeof header);
+	}
+
+	struct spectator* sps = calloc(num_spectators, sizeof *sps);
+	for (int i=0; i<num_spectators; ++i) {
+		struct spectator* sp = &sps[i];
+		sp->fd = socket(AF_INET, SOCK_STREAM, 0);
+		assert(sp->fd >= 0);
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(PORT),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+		if (connect(sp->fd, (struct sockaddr*)&addr, sizeof addr) == -1) {
+			fprintf(stderr, "connect(): %s\n", strerror(errno));
+			abort();
+		}
+		int yes = 1;
+		setsockopt(sp->fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+		static const char req[] =
+			"GET /o/websocket HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Upgrade: websocket\r\n"
+			"Connection: Upgrade\r\n"
+			"Sec-WebSocket-Version: 13\r\n"
+			"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+			"\r\n";
+		assert(write(sp->fd, req, sizeof(req)-1) == (sizeof(req)-1));
+		assert(0 == fcntl(sp->fd, F_SETFL, O_NONBLOCK));
+		// accept/handshake as we go, so we don't overflow the listen backlog
+		pump_until(sps, i+1, -1);
+	}
+
+	// say hello at the current journal cursor (so no snapshot bootstrap)
+	uint8_t hello[16];
+	uint8_t* p = hello;
+	*(p++) = WS0_HELLO;
+	p = leb128_encode_int64_buf(p, arrlen(g.journal_arr));
+	for (int i=0; i<num_spectators; ++i) {
+		spectator_send_masked(&sps[i], hello, p-hello);
+		sps[i].journal_cursor = arrlen(g.journal_arr);
+	}
+	pump_until(sps, num_spectators, 1); // WS1_HELLO
+	struct webserv_stats ws_stats;
+	webserv_get_stats(&ws_stats);
+
+	const int num_idle_ticks = 10000;
+	int64_t idle_ns = 0;
+	for (int i=0; i<num_idle_ticks; ++i) {
+		const int64_t t0 = get_thread_cpu_ns();
+		const int did_work = io_tick();
+		idle_ns += (get_thread_cpu_ns() - t0);
+		assert(!did_work);
+	}
+
+	g.tick_ns = 0;
+	g.broadcast_ns = 0;
+	uint8_t* u = calloc(update_size, 1);
+	for (int i=0; i<num_updates; ++i) {
+		for (int ii=0; ii<update_size; ++ii) u[ii] = (uint8_t)(i+ii);
+		journal_append(u, update_size);
+		pump_until(sps, num_spectators, 2+i);
+	}
+	free(u);
+	for (int i=0; i<num_spectators; ++i) assert(sps[i].journal_cursor == arrlen(g.journal_arr));
+	const int64_t tick_ns = g.tick_ns;
+	const int64_t broadcast_ns = g.broadcast_ns;
+
+	g.tick_ns = 0;
+	g.broadcast_ns = 0;
+	if (catchup_size > 0) {
+		uint8_t* c = malloc(catchup_size);
+		for (int64_t i=0; i<catchup_size; ++i) c[i] = (uint8_t)(i*7 + (i>>12));
+		journal_append(c, catchup_size);
+		free(c);
+		pump_until(sps, num_spectators, 2+num_updates);
+		for (int i=0; i<num_spectators; ++i) assert(sps[i].journal_cursor == arrlen(g.journal_arr));
+	}
+
+	const int64_t total_ns = broadcast_ns + tick_ns;
+	printf("spectators=%d updates=%d update_size=%d\n", num_spectators, num_updates, update_size);
+	printf("  connection buffers:          %8.2f KB/spectator (%d small, %d large; %lld KB allocated)\n",
+		(double)ws_stats.buffer_bytes_in_use / 1024.0 / (double)num_spectators,
+		ws_stats.num_small_buffers_in_use,
+		ws_stats.num_large_buffers_in_use,
+		(long long)(ws_stats.buffer_bytes_allocated >> 10));
+	printf("  idle io_tick():              %8.2f us/tick\n", (double)idle_ns * 1e-3 / (double)num_idle_ticks);
+	printf("  webserv_broadcast_journal(): %8.2f us/update\n", (double)broadcast_ns * 1e-3 / (double)num_updates);
+	printf("  webserv_tick()+io_tick():    %8.2f us/update\n", (double)tick_ns * 1e-3 / (double)num_updates);
+	printf("  total:                       %8.2f us/update (%.3f us/update/spectator)\n",
+		(double)total_ns * 1e-3 / (double)num_updates,
+		(double)total_ns * 1e-3 / (double)num_updates / (double)num_spectators);
+	if (catchup_size > 0) {
+		const int64_t catchup_ns = g.broadcast_ns + g.tick_ns;
+		printf("catch-up of %lld bytes:\n", (long long)catchup_size);
+		printf("  webserv_broadcast_journal(): %8.2f ms\n", (double)g.broadcast_ns * 1e-6);
+		printf("  webserv_tick()+io_tick():    %8.2f ms\n", (double)g.tick_ns * 1e-6);
+		printf("  total:                       %8.2f ms (%.3f ms/spectator)\n",
+			(double)catchup_ns * 1e-6,
+			(double)catchup_ns * 1e-6 / (double)num_spectators);
+	}
+
+	io_close(g.journal_file_id);
+	(void)unlink(JOURNAL_PATH);
+
+	return EXIT_SUCCESS;
+}
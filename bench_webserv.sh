@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+set -e
+cc -O2 -g -Wall -DNO_WEBPACK \
+	stb_ds.c stb_sprintf.c allocator.c \
+	io.c jio.c bufstream.c \
+	sha1.c base64.c lz.c lonesha256.c \
+	webserv.c \
+	bench_webserv.c \
+	-o _bench_webserv
+$RUNNER ./_bench_webserv "$@"
+# usage: ./bench_webserv.sh [num_spectators] [num_updates] [update_size] [catchup_size]
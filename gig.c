@@ -32,7 +32,6 @@
 #define SNAPSHOTCACHE_DATA_MAGIC  ("DOSD0001")
 #define ACTIVITYCACHE_MAGIC       ("DOAC0001")
 #define DO_FORMAT_VERSION (10000)
-#define JOURNAL_HEADER_SIZE (8*4)
 #define SYNC (0xfa)
 #define DIR_CACHE                     "cache"
 #define FILENAME_JOURNAL              "DO_JAM_JOURNAL"
@@ -79,7 +78,10 @@ static void snapshot_copy(struct snapshot* dst, struct snapshot* src)
 		arrcpy(dstdoc->name_arr, srcdoc->name_arr);
 
 		dstdoc->docchar_arr = tmp.docchar_arr;
-		arrcpy(dstdoc->docchar_arr , srcdoc->docchar_arr);
+		// edit sequences are unique (see doc_edit()), so the same sequence
+		// means the same docchars
+		const int is_unchanged = (srcdoc->edit_sequence > 0) && (srcdoc->edit_sequence == tmp.edit_sequence);
+		if (!is_unchanged) arrcpy(dstdoc->docchar_arr , srcdoc->docchar_arr);
 	}
 	for (int i=num_src_docs; i<num_dst_docs; ++i) {
 		struct document* doc = &dst->document_arr[i];
@@ -116,8 +118,21 @@ static void snapshot_copy(struct snapshot* dst, struct snapshot* src)
 
 static void snapshot_free(struct snapshot* snap)
 {
+	arrfree(snap->book_arr);
+	const int num_docs = arrlen(snap->document_arr);
+	for (int i=0; i<num_docs; ++i) {
+		struct document* doc = &snap->document_arr[i];
+		arrfree(doc->name_arr);
+		arrfree(doc->docchar_arr);
+	}
+	arrfree(snap->document_arr);
+	const int num_ms = arrlen(snap->mim_state_arr);
+	for (int i=0; i<num_ms; ++i) {
+		struct mim_state* ms = &snap->mim_state_arr[i];
+		arrfree(ms->caret_arr);
+	}
+	arrfree(snap->mim_state_arr);
 	memset(snap, 0, sizeof *snap);
-	//TODO(free snapshot)
 }
 
 static struct location document_reverse_locate(struct document* doc, int index)
@@ -189,12 +204,45 @@ static struct mim_state* snapshot_get_or_create_mim_state_by_ids(struct snapshot
 	return ms;
 }
 
+// single producer, single consumer ring buffer between the peer (UI thread)
+// and the host (I/O thread). records are written whole; when there isn't
+// room, the writer keeps them in its "spill" (in order) and retries with
+// ringbuf_flush_spill(), so neither side ever has to wait for the other, and
+// nothing is dropped.
+// records never wrap around the end of the buffer, so the reader can use them
+// in place (see ringbuf_peek()); a record that doesn't fit before the end is
+// written at the start, and the bytes in between are zeroed. so a record must
+// not start with a zero byte, unless records can't straddle the end anyway
+// (fixed size records that divide the buffer size)
 struct ringbuf {
 	int size_log2;
 	uint8_t* buf;
 	_Atomic(int64_t) head, tail;
+	// writer only
+	uint8_t* spill_arr;
+	int64_t* spill_record_size_arr;
+	// stats (written by the writer, readable from anywhere)
+	_Atomic(int64_t) max_depth;
+	_Atomic(int64_t) max_spill;
+	_Atomic(int64_t) num_spills;
+	_Atomic(int64_t) num_bytes_copied; // into buf or the spill
+	_Atomic(int64_t) num_allocations;
 };
 
+static void stat_add(_Atomic(int64_t)* stat, int64_t n)
+{
+	atomic_fetch_add_explicit(stat, n, memory_order_relaxed);
+}
+
+// counters for the mim path, from the peer (peer_end_mim()) to the journal
+// (commit_mim_to_host()); see gig_get_mim_stats()
+static struct {
+	_Atomic(int64_t) num_mims;
+	_Atomic(int64_t) num_bytes;
+	_Atomic(int64_t) num_bytes_copied;
+	_Atomic(int64_t) num_allocations;
+} mim_stats;
+
 static void ringbuf_init(struct ringbuf* rb, int size_log2)
 {
 	memset(rb, 0, sizeof *rb);
@@ -206,50 +254,158 @@ static void ringbuf_free(struct ringbuf* rb)
 {
 	assert(rb->buf != NULL);
 	free(rb->buf);
+	arrfree(rb->spill_arr);
+	arrfree(rb->spill_record_size_arr);
 	memset(rb, 0, sizeof *rb);
 }
 
-static int ringbuf_write(struct ringbuf* rb, const uint8_t* data, int count)
+static int ringbuf_write(struct ringbuf* rb, const uint8_t* data, int64_t count)
 {
 	assert(rb->buf != NULL);
+	assert(count > 0);
 	const int size_log2 = rb->size_log2;
-	const unsigned size = 1L << size_log2;
+	const int64_t size = 1L << size_log2;
 	const uint64_t mask = size-1;
 
 	const int64_t tail = atomic_load(&rb->tail);
 	const int64_t head = atomic_load(&rb->head);
 	const int64_t writable_count = (size - (head-tail));
-	if (count > writable_count) {
+	const int64_t n_to_end = (size - (head&mask));
+	const int64_t pad = (count > n_to_end) ? n_to_end : 0;
+	if ((pad+count) > writable_count) {
 		// write all or nothing
 		return -1;
 	}
 
-	const int64_t new_head = head + count;
-	const int cycle0 = head         >> size_log2;
-	const int cycle1 = (new_head-1) >> size_log2;
-	if (cycle1 == cycle0) {
-		memcpy(rb->buf + (head&mask), data, count);
-	} else {
-		const int64_t n0 = (size - (head&mask));
-		assert(n0 > 0);
-		memcpy(rb->buf + (head&mask) , data    , n0);
-		memcpy(rb->buf               , data+n0 , count-n0);
+	if (pad > 0) {
+		assert((data[0] != 0) && "record would be mistaken for padding");
+		memset(rb->buf + (head&mask), 0, pad);
 	}
+	const int64_t new_head = head + pad + count;
+	memcpy(rb->buf + ((head+pad)&mask), data, count);
+	stat_add(&rb->num_bytes_copied, count);
 
 	atomic_store(&rb->head, new_head);
+	#ifndef __EMSCRIPTEN__
+	// the reader may be sleeping in io_wait()
+	io_wake();
+	#endif
+
+	const int64_t depth = (new_head - tail);
+	if (depth > atomic_load(&rb->max_depth)) atomic_store(&rb->max_depth, depth);
 
 	return 0;
 }
 
+// makes room for a record that doesn't fit even when the ring buffer is empty
+// (e.g. a huge paste). the reader doesn't touch buf/size_log2 until it sees
+// data, so it's safe to replace them while the ring buffer is empty. returns
+// 0 if it isn't
+static int ringbuf_grow(struct ringbuf* rb, int64_t count)
+{
+	if (atomic_load(&rb->head) != atomic_load(&rb->tail)) return 0;
+	// any record of at most half the size fits in an empty ring buffer,
+	// wherever head is
+	int size_log2 = rb->size_log2;
+	while ((1L << size_log2) < (2*count)) ++size_log2;
+	free(rb->buf);
+	rb->buf = calloc(1L << size_log2, sizeof *rb->buf);
+	rb->size_log2 = size_log2;
+	stat_add(&rb->num_allocations, 1);
+	return 1;
+}
+
+// writes as many spilled records as there's room for. returns 1 if it wrote
+// anything
+static int ringbuf_flush_spill(struct ringbuf* rb)
+{
+	const int num_records = arrlen(rb->spill_record_size_arr);
+	int n = 0;
+	int64_t offset = 0;
+	while (n < num_records) {
+		const int64_t count = rb->spill_record_size_arr[n];
+		if (ringbuf_write(rb, rb->spill_arr + offset, count) < 0) {
+			if ((n > 0) || !ringbuf_grow(rb, count)) break;
+			assert(0 == ringbuf_write(rb, rb->spill_arr + offset, count));
+		}
+		offset += count;
+		++n;
+	}
+	if (n == 0) return 0;
+	arrdeln(rb->spill_arr, 0, offset);
+	arrdeln(rb->spill_record_size_arr, 0, n);
+	return 1;
+}
+
+// writes a record, or spills it if there isn't room (or if earlier records
+// are still spilled, so the order is kept)
+static void ringbuf_write_or_spill(struct ringbuf* rb, const uint8_t* data, int64_t count)
+{
+	ringbuf_flush_spill(rb);
+	if ((arrlen(rb->spill_record_size_arr) == 0) && (0 == ringbuf_write(rb, data, count))) return;
+	const size_t cap0 = arrcap(rb->spill_arr);
+	memcpy(arraddnptr(rb->spill_arr, count), data, count);
+	if (arrcap(rb->spill_arr) != cap0) stat_add(&rb->num_allocations, 1);
+	stat_add(&rb->num_bytes_copied, count);
+	arrput(rb->spill_record_size_arr, count);
+	stat_add(&rb->num_spills, 1);
+	const int64_t spill = arrlen(rb->spill_arr);
+	if (spill > atomic_load(&rb->max_spill)) atomic_store(&rb->max_spill, spill);
+	// a record that doesn't fit in the ring buffer at all may fit after
+	// ringbuf_grow()
+	ringbuf_flush_spill(rb);
+}
+
+// returns the number of readable bytes at *out_ptr; all the records that
+// start before the end of the buffer (there may be padding after the last
+// one, see struct ringbuf). release them with ringbuf_consume()
+static int64_t ringbuf_peek(struct ringbuf* rb, uint8_t** out_ptr)
+{
+	const int64_t head = atomic_load(&rb->head);
+	int64_t tail = atomic_load(&rb->tail);
+	if (tail == head) return 0;
+	const int64_t size = (1L << rb->size_log2);
+	const uint64_t mask = size-1;
+	if (rb->buf[tail&mask] == 0) {
+		// padding until the end of the buffer
+		tail += (size - (tail&mask));
+		atomic_store(&rb->tail, tail);
+		if (tail == head) return 0;
+	}
+	int64_t n = (head - tail);
+	const int64_t n_to_end = (size - (tail&mask));
+	if (n > n_to_end) n = n_to_end;
+	*out_ptr = rb->buf + (tail&mask);
+	return n;
+}
+
+static void ringbuf_consume(struct ringbuf* rb, int64_t count)
+{
+	const int64_t tail = atomic_load(&rb->tail);
+	assert((tail + count) <= atomic_load(&rb->head));
+	atomic_store(&rb->tail, tail + count);
+}
+
 static void ringbuf_get_readable_range(struct ringbuf* rb, int64_t* out_p0, int64_t* out_p1)
 {
-	assert(rb->buf != NULL);
 	const int64_t head = atomic_load(&rb->head);
 	const int64_t tail = atomic_load(&rb->tail);
+	assert(rb->buf != NULL);
 	if (out_p0) *out_p0 = tail;
 	if (out_p1) *out_p1 = head;
 }
 
+static void ringbuf_get_stats(struct ringbuf* rb, struct gig_queue_stats* out_stats)
+{
+	if (out_stats == NULL) return;
+	memset(out_stats, 0, sizeof *out_stats);
+	if (rb->buf == NULL) return;
+	out_stats->size       = (1L << rb->size_log2);
+	out_stats->max_depth  = atomic_load(&rb->max_depth);
+	out_stats->max_spill  = atomic_load(&rb->max_spill);
+	out_stats->num_spills = atomic_load(&rb->num_spills);
+}
+
 static void ringbuf_read_range(struct ringbuf* rb, uint8_t* data, int64_t p0, int64_t p1)
 {
 	assert(rb->buf != NULL);
@@ -262,7 +418,7 @@ static void ringbuf_read_range(struct ringbuf* rb, uint8_t* data, int64_t p0, in
 	if (cycle0 == cycle1) {
 		memcpy(data, rb->buf + (p0&mask), num_bytes);
 	} else {
-		const int64_t n0 = num_bytes - (p0&mask);
+		const int64_t n0 = (size - (p0&mask));
 		assert(n0 > 0);
 		memcpy(data    , rb->buf+(p0&mask) , n0);
 		memcpy(data+n0 , rb->buf           , num_bytes-n0);
@@ -274,52 +430,106 @@ static struct {
 	unsigned is_configured :1;
 	unsigned is_host       :1;
 	unsigned is_peer       :1;
+	unsigned is_relay      :1;
 	struct ringbuf peer2host_mim_ringbuf;
 	struct ringbuf host2peer_activitycache_ringbuf;
 } g; // globals
 
 static struct {
-	const char* cache_dir;
 	int io_port_id;
+	int journal_snapshot_growth_threshold;
+	int64_t derived_file_interval_us;
+	int64_t room_hibernation_timeout_us;
+} igo; // I/O globals
+
+struct derived_doc {
+	int book_id, doc_id;
+	int64_t edit_sequence; // when its derived files were last queued
+};
+
+struct packed_snapshot {
+	uint8_t* data_arr;
+	int64_t journal_offset;
+	int refcount;
+};
+
+// a room is one jam: a journal (with its caches) and the present snapshot. a
+// headless host can serve many rooms on the same io port and webserv (see
+// gig_add_room()); the first room is the one set up by gig_configure_*(), and
+// it's the one the local peer (if any) is in. code that works on a room uses
+// the current room of its thread (see current_room())
+struct room {
+	char* name;
+	char* dir;
+	unsigned is_peer_room      :1; // the local peer's room (see peer_tick())
+	unsigned is_relay_room     :1; // mirrors an upstream host (see relay_append_journal())
+	unsigned is_falling_asleep :1; // see room_maybe_hibernate()
+	unsigned is_hibernating    :1;
+	int num_users; // see gig_acquire_room()
+	int64_t last_activity_ns;
+	char* cache_dir;
 	int64_t journal_offset_at_last_snapshotcache_push;
 	struct jio* jio_journal;
 	struct jio* jio_snapshotcache_data;
 	struct jio* jio_snapshotcache_index;
 	struct jio* jio_activitycache;
-	//int64_t journal_time_zero_epoch_us;
-	int journal_snapshot_growth_threshold;
 	_Atomic(int64_t) jam_time_offset_us;
-} igo; // I/O globals
 
-struct peer_state {
-	int artist_id;
-	uint8_t* cmdbuf_arr;
-};
-
-static struct {
 	struct snapshot present_snapshot;
 	// "present snapshot" is the "snapshot in effect"; it's always in sync with
 	// the latest data added to the journal
-	uint8_t* bb_arr;
 	int next_artist_id;
-	struct peer_state* peer_state_arr;
+	struct packed_snapshot* packed_snapshot_arr;
+	// packed present snapshots used for bootstrapping peers. the last entry
+	// is the most recent; older entries stick around while they're still
+	// referenced (e.g. by inflight websocket writes)
+	struct derived_doc* derived_doc_arr;
+	int has_unwritten_derived_files;
+	int64_t next_derived_files_ts;
+	_Atomic(int64_t) committed_journal_size;
+	// journal size after the latest host_tick(); readable without hg.mutex
+};
+
+#define MAX_ROOMS            (256)
+#define MAX_ROOM_NAME_LENGTH (64)
+
+static struct {
+	uint8_t* bb_arr;
+	struct room* rooms[MAX_ROOMS];
+	_Atomic(int) num_rooms;
+	// rooms are allocated once and never move, and room_id is the index, so
+	// rooms can be looked up without holding the lock
+	int next_commit_room_index;
 	pthread_mutex_t mutex;
 } hg; // host globals
 
-static struct peer_state* host_get_or_create_peer_state_by_artist_id(int artist_id)
-{
-	const int num = arrlen(hg.peer_state_arr);
-	for (int i=0; i<num; ++i) {
-		struct peer_state* ps = &hg.peer_state_arr[i];
-		if (ps->artist_id == artist_id) {
-			return ps;
-		}
-	}
-	struct peer_state* ps = arraddnptr(hg.peer_state_arr, 1);
-	memset(ps, 0, sizeof *ps);
-	ps->artist_id = artist_id;
-	return ps;
-}
+// derived files (.cc/.txt versions of the documents in the cache dir) are
+// written by a background thread, so commits don't wait for the disk. the
+// host only encodes documents that changed since they were last queued, at
+// most once per igo.derived_file_interval_us (see write_derived_files()), and
+// a queued file that hasn't been written yet is replaced by a newer version
+struct derived_file {
+	char* path;
+	uint8_t* data_arr;
+};
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int is_running;
+	int do_stop;
+	struct derived_file* file_arr; // oldest first
+} dfw; // derived file writer
+
+// the documents that spooling some mims touched. mims with disjoint footprints
+// can be spooled in any order with the same result, because an edit only
+// affects its own document and the carets in it (mims that may do more than
+// that are "structural")
+struct mim_footprint {
+	struct doc_ids { int book_id, doc_id; }* doc_ids_arr;
+	unsigned is_structural :1; // mimex commands, or no mim state
+};
 
 static struct {
 	int my_artist_id;
@@ -342,20 +552,59 @@ static struct {
 	double artificial_mim_latency_variance;
 	int64_t tracer_sequence;
 	uint8_t* unackd_mimbuf_arr;
+	struct mim_footprint unackd_footprint; // of the mims in unackd_mimbuf_arr
+	int64_t* unackd_end_mim_ns_arr;
+	// peer_end_mim() times of the newest unacked mims (the last one is
+	// tracer_sequence's), when peer_set_mim_latency_tracking() is on
+	struct gig_mim_latency* mim_latency_arr;
 
 	struct activitycache_entry* activitycache_entry_arr;
 
 	unsigned is_time_travelling   :1;
+	unsigned track_mim_latencies  :1;
+	unsigned is_fiddle_stale      :1;
+	// the fiddle snapshot isn't the upstream snapshot plus the unacked mims
+	// (see peer_spool_raw_journal_into_upstream_snapshot())
 } pg; // peer globals
 
 THREAD_LOCAL static struct {
+	struct room* room; // see current_room()
 	char errormsg[1<<14];
 	int in_mim;
 	//int mim_header_size;
 	uint8_t* mim_buffer_arr;
 	char* mimex_buffer_arr;
+	struct mim_footprint* footprint; // snapshot_spool() adds to it if set
 } tlg; // thread local globals
 
+static struct room* current_room(void)
+{
+	assert((tlg.room != NULL) && "no current room");
+	return tlg.room;
+}
+
+static struct room* get_room(int room_id)
+{
+	assert((0 <= room_id) && (room_id < atomic_load(&hg.num_rooms)));
+	struct room* room = hg.rooms[room_id];
+	assert(room != NULL);
+	return room;
+}
+
+// makes room the current room of this thread; returns the previous one, for
+// leave_room()
+static struct room* enter_room(struct room* room)
+{
+	struct room* prev = tlg.room;
+	tlg.room = room;
+	return prev;
+}
+
+static void leave_room(struct room* prev)
+{
+	tlg.room = prev;
+}
+
 static void dumperr(void)
 {
 	if (strlen(tlg.errormsg) == 0) return;
@@ -385,12 +634,15 @@ int peer_tick(void)
 	}
 	const int64_t jc0 = pg.journal_cursor;
 	if (g.is_peer && g.is_host) {
-		const int64_t jc1 = jio_get_size(igo.jio_journal);
+		const int did_flush = ringbuf_flush_spill(&g.peer2host_mim_ringbuf);
+
+		struct room* room = current_room();
+		const int64_t jc1 = jio_get_size(room->jio_journal);
 		if (jc1 > jc0) {
 			const int64_t size = (jc1 - jc0);
 			uint8_t** bb = &pg.bb_arr;
 			arrsetlen(*bb, size);
-			if (jio_pread(igo.jio_journal, *bb, size, jc0) < 0) {
+			if (jio_pread(room->jio_journal, *bb, size, jc0) < 0) {
 				FIXME(handle peer_tick journal read error)
 				return 1;
 			}
@@ -416,7 +668,7 @@ int peer_tick(void)
 			arrput(pg.activitycache_entry_arr, e);
 		}
 
-		return 0;
+		return did_flush;
 	} else if (g.is_peer && !g.is_host) {
 		// already handled elsewhere, no?
 		// or XXX should we read from savedir journal here?
@@ -502,10 +754,11 @@ void set_my_artist_id(int artist_id)
 	pg.my_artist_id = artist_id;
 }
 
-int alloc_artist_id(void)
+int alloc_artist_id(int room_id)
 {
-	assert((hg.next_artist_id >= 1) && "alloc_artist_id() not allowed");
-	return hg.next_artist_id++;
+	struct room* room = get_room(room_id);
+	assert((room->next_artist_id >= 1) && "alloc_artist_id() not allowed");
+	return room->next_artist_id++;
 }
 
 void free_artist_id(int artist_id)
@@ -623,7 +876,10 @@ enum d_type {
 
 static void doc_edit(struct document* doc)
 {
+	// (documents are edited by both the peer and the host thread)
+	static _Atomic(int64_t) sequence;
 	doc->snapshotcache_offset = 0;
+	doc->edit_sequence = atomic_fetch_add(&sequence, 1) + 1;
 }
 
 static void ms_edit(struct mim_state* ms)
@@ -631,6 +887,12 @@ static void ms_edit(struct mim_state* ms)
 	ms->snapshotcache_offset = 0;
 }
 
+// whether ms's carets are in doc (edits only move those)
+static int ms_is_in_doc(struct mim_state* ms, struct document* doc)
+{
+	return (ms->book_id == doc->book_id) && (ms->doc_id == doc->doc_id);
+}
+
 static void doc_opn(struct document* doc, struct snapshot* snap, struct location* cloc, int index, int count, enum d_type type)
 {
 	// update caret positions ahead of insertion index if necessary
@@ -706,6 +968,7 @@ static void doc_opn(struct document* doc, struct snapshot* snap, struct location
 			const int num_ms = arrlen(snap->mim_state_arr);
 			for (int i=0; i<num_ms; ++i) {
 				struct mim_state* ms = &snap->mim_state_arr[i];
+				if (!ms_is_in_doc(ms, doc)) continue;
 				const int num_carets = arrlen(ms->caret_arr);
 				for (int ii=0; ii<num_carets; ++ii) {
 					struct caret* c = &ms->caret_arr[ii];
@@ -770,6 +1033,7 @@ static void doc_adv(struct document* doc, struct snapshot* snap, struct location
 		const int num_ms = arrlen(snap->mim_state_arr);
 		for (int i=0; i<num_ms; ++i) {
 			struct mim_state* ms = &snap->mim_state_arr[i];
+			if (!ms_is_in_doc(ms, doc)) continue;
 			const int num_carets = arrlen(ms->caret_arr);
 			for (int ii=0; ii<num_carets; ++ii) {
 				struct caret* c = &ms->caret_arr[ii];
@@ -942,7 +1206,8 @@ static int mimex_matches(struct mimexscanner* s, const char* cmd, const char* fm
 
 int64_t get_monotonic_jam_time_us(void)
 {
-	return atomic_load(&igo.jam_time_offset_us) + get_microseconds_monotonic();
+	struct room* room = current_room();
+	return atomic_load(&room->jam_time_offset_us) + get_microseconds_monotonic();
 }
 
 // parses a mim message, typically written by mimf()/mim8()
@@ -1106,6 +1371,7 @@ static int mim_spool(struct mimop* mo, const uint8_t* input, int num_input_bytes
 									if ((fc->flags & (DC__FILL | DC_IS_DEFER)) || !is_fillable) break;
 									if (is_fillable) {
 										fc->flags |= DC__FILL;
+										doc_edit(rw_doc);
 									}
 									o += d;
 								}
@@ -1365,6 +1631,7 @@ static int mim_spool(struct mimop* mo, const uint8_t* input, int num_input_bytes
 				}
 
 			} else if (mode == EX) {
+				if (tlg.footprint) tlg.footprint->is_structural = 1;
 				struct mimexscanner s;
 				mimexscanner_init(&s, s0, s1);
 
@@ -1513,6 +1780,43 @@ void peer_set_artificial_mim_latency(double mean, double variance)
 	pg.artificial_mim_latency_variance = variance;
 }
 
+void peer_set_mim_latency_tracking(int enable)
+{
+	pg.track_mim_latencies = !!enable;
+	if (!enable) {
+		arrfree(pg.unackd_end_mim_ns_arr);
+		arrfree(pg.mim_latency_arr);
+	}
+}
+
+int peer_take_mim_latencies(struct gig_mim_latency* out_latencies, int max_count)
+{
+	const int n0 = arrlen(pg.mim_latency_arr);
+	const int n = (n0 < max_count) ? n0 : max_count;
+	if (n == 0) return 0;
+	memcpy(out_latencies, pg.mim_latency_arr, n * sizeof *out_latencies);
+	arrdeln(pg.mim_latency_arr, 0, n);
+	return n;
+}
+
+// moves the unacked mims up to max_tracer to mim_latency_arr
+static void record_acked_mim_latencies(int64_t max_tracer, int64_t upstream_ns, int64_t respool_ns)
+{
+	const int n = arrlen(pg.unackd_end_mim_ns_arr);
+	const int64_t first_tracer = pg.tracer_sequence - n + 1;
+	int i = 0;
+	while ((i < n) && ((first_tracer + i) <= max_tracer)) {
+		const int64_t t = pg.unackd_end_mim_ns_arr[i];
+		arrput(pg.mim_latency_arr, ((struct gig_mim_latency) {
+			.tracer      = first_tracer + i,
+			.upstream_ns = upstream_ns - t,
+			.respool_ns  = respool_ns - t,
+		}));
+		++i;
+	}
+	if (i > 0) arrdeln(pg.unackd_end_mim_ns_arr, 0, i);
+}
+
 static void document_to_colorchar_da(struct colorchar** arr, struct document* doc)
 {
 	const int num_src = arrlen(doc->docchar_arr);
@@ -1525,6 +1829,37 @@ static void document_to_colorchar_da(struct colorchar** arr, struct document* do
 	}
 }
 
+static void mim_footprint_reset(struct mim_footprint* fp)
+{
+	arrreset(fp->doc_ids_arr);
+	fp->is_structural = 0;
+}
+
+static void mim_footprint_add(struct mim_footprint* fp, int book_id, int doc_id)
+{
+	const int n = arrlen(fp->doc_ids_arr);
+	for (int i=0; i<n; ++i) {
+		struct doc_ids* d = &fp->doc_ids_arr[i];
+		if ((d->book_id == book_id) && (d->doc_id == doc_id)) return;
+	}
+	arrput(fp->doc_ids_arr, ((struct doc_ids){ .book_id=book_id, .doc_id=doc_id }));
+}
+
+static int mim_footprints_overlap(struct mim_footprint* a, struct mim_footprint* b)
+{
+	if (a->is_structural || b->is_structural) return 1;
+	const int na = arrlen(a->doc_ids_arr);
+	const int nb = arrlen(b->doc_ids_arr);
+	for (int ia=0; ia<na; ++ia) {
+		for (int ib=0; ib<nb; ++ib) {
+			struct doc_ids* da = &a->doc_ids_arr[ia];
+			struct doc_ids* db = &b->doc_ids_arr[ib];
+			if ((da->book_id == db->book_id) && (da->doc_id == db->doc_id)) return 1;
+		}
+	}
+	return 0;
+}
+
 static int snapshot_spool(struct snapshot* snap, uint8_t* data, int num_bytes, int artist_id, int session_id)
 {
 	if (num_bytes == 0) return 0;
@@ -1535,6 +1870,14 @@ static int snapshot_spool(struct snapshot* snap, uint8_t* data, int num_bytes, i
 		assert(artist_id == 0);
 		assert(session_id == 0);
 	}
+	if (tlg.footprint) {
+		// (a mim can only look up its mim state's document; setdoc is mimex)
+		if (mo.ms) {
+			mim_footprint_add(tlg.footprint, mo.ms->book_id, mo.ms->doc_id);
+		} else {
+			tlg.footprint->is_structural = 1;
+		}
+	}
 	int e = mim_spool(&mo, data, num_bytes);
 	if (e<0) return e;
 	#if 0
@@ -1547,7 +1890,8 @@ static int snapshot_spool(struct snapshot* snap, uint8_t* data, int num_bytes, i
 
 static int it_is_time_for_a_snapshotcache_push(uint64_t journal_offset)
 {
-	int64_t growth = (journal_offset - igo.journal_offset_at_last_snapshotcache_push);
+	struct room* room = current_room();
+	int64_t growth = (journal_offset - room->journal_offset_at_last_snapshotcache_push);
 	return growth > igo.journal_snapshot_growth_threshold;
 }
 
@@ -1632,25 +1976,101 @@ static void pack_full_snapshot(uint8_t** bb, struct snapshot* snap, int64_t jour
 	// TODO? server settings/prefs? or keep that separate?
 }
 
-void* get_present_snapshot_data(size_t* out_size)
+void* get_present_snapshot_data(int room_id, size_t* out_size)
 {
+	struct room* room = get_room(room_id);
 	uint8_t** bb = &hg.bb_arr;
 	arrreset(*bb);
-	pack_full_snapshot(bb, &hg.present_snapshot, jio_get_size(igo.jio_journal));
+	pack_full_snapshot(bb, &room->present_snapshot, jio_get_size(room->jio_journal));
 	void* data = bb_dup2plain(bb);
 	if (out_size) *out_size = arrlen(*bb);
 	return data;
 }
 
-int copy_journal(void* dst, int64_t count, int64_t offset)
+static void packed_snapshot_free(struct packed_snapshot* ps)
+{
+	assert(ps->refcount == 0);
+	arrfree(ps->data_arr);
+	memset(ps, 0, sizeof *ps);
+}
+
+static void release_unreferenced_packed_snapshots(struct room* room)
+{
+	int num = arrlen(room->packed_snapshot_arr);
+	// never release the last one; it's the cache
+	for (int i=0; i<(num-1); ++i) {
+		struct packed_snapshot* ps = &room->packed_snapshot_arr[i];
+		if (ps->refcount > 0) continue;
+		packed_snapshot_free(ps);
+		arrdel(room->packed_snapshot_arr, i);
+		--i;
+		--num;
+	}
+}
+
+const void* acquire_present_snapshot_data(int room_id, size_t* out_size, int64_t* out_journal_offset)
+{
+	struct room* room = get_room(room_id);
+	const int64_t journal_offset = jio_get_size(room->jio_journal);
+	const int num = arrlen(room->packed_snapshot_arr);
+	struct packed_snapshot* ps = (num > 0) ? &room->packed_snapshot_arr[num-1] : NULL;
+	if ((ps == NULL) || (ps->journal_offset != journal_offset)) {
+		// the journal has grown since the last pack (every commit appends to
+		// the journal, so this is also when the present snapshot changes)
+		ps = arraddnptr(room->packed_snapshot_arr, 1);
+		memset(ps, 0, sizeof *ps);
+		ps->journal_offset = journal_offset;
+		pack_full_snapshot(&ps->data_arr, &room->present_snapshot, journal_offset);
+		release_unreferenced_packed_snapshots(room);
+		ps = &room->packed_snapshot_arr[arrlen(room->packed_snapshot_arr)-1];
+	}
+	++ps->refcount;
+	if (out_size) *out_size = arrlen(ps->data_arr);
+	if (out_journal_offset) *out_journal_offset = ps->journal_offset;
+	return ps->data_arr;
+}
+
+void release_present_snapshot_data(const void* data)
+{
+	const int num_rooms = atomic_load(&hg.num_rooms);
+	for (int room_id=0; room_id<num_rooms; ++room_id) {
+		struct room* room = get_room(room_id);
+		const int num = arrlen(room->packed_snapshot_arr);
+		for (int i=0; i<num; ++i) {
+			struct packed_snapshot* ps = &room->packed_snapshot_arr[i];
+			if (ps->data_arr != data) continue;
+			assert(ps->refcount > 0);
+			--ps->refcount;
+			release_unreferenced_packed_snapshots(room);
+			return;
+		}
+	}
+	assert(!"snapshot data not found");
+}
+
+int copy_journal(int room_id, void* dst, int64_t count, int64_t offset)
+{
+	return jio_pread(get_room(room_id)->jio_journal, dst, count, offset);
+}
+
+int64_t get_committed_journal_size(int room_id)
+{
+	return atomic_load(&get_room(room_id)->committed_journal_size);
+}
+
+int get_journal_file_id(int room_id, int64_t* out_flushed_size)
 {
-	return jio_pread(igo.jio_journal, dst, count, offset);
+	struct jio* jj = get_room(room_id)->jio_journal;
+	if (jj == NULL) return -1;
+	if (out_flushed_size) *out_flushed_size = jio_get_flushed_size(jj);
+	return jio_get_file_id(jj);
 }
 
 static void snapshotcache_push(struct snapshot* snap, uint64_t journal_offset, int64_t jam_ts)
 {
-	struct jio* jdat = igo.jio_snapshotcache_data;
-	struct jio* jidx = igo.jio_snapshotcache_index;
+	struct room* room = current_room();
+	struct jio* jdat = room->jio_snapshotcache_data;
+	struct jio* jidx = room->jio_snapshotcache_index;
 	const size_t jdat0 = jio_get_size(jdat);
 
 	uint8_t** bb = &hg.bb_arr;
@@ -1707,7 +2127,7 @@ static void snapshotcache_push(struct snapshot* snap, uint64_t journal_offset, i
 	bb_append_leu64(bb, snapshot_manifest_offset);
 	jio_flush_bb(jidx, bb);
 
-	igo.journal_offset_at_last_snapshotcache_push = journal_offset;
+	room->journal_offset_at_last_snapshotcache_push = journal_offset;
 }
 
 void peer_end_mim(void)
@@ -1715,6 +2135,7 @@ void peer_end_mim(void)
 	assert(g.is_peer);
 	assert(tlg.in_mim);
 	tlg.in_mim = 0;
+	const int64_t t0 = pg.track_mim_latencies ? get_nanoseconds_monotonic() : 0;
 
 	const int num_bytes = arrlen(tlg.mim_buffer_arr);
 	if (num_bytes == 0) return;
@@ -1728,8 +2149,13 @@ void peer_end_mim(void)
 	const int tt = pg.is_time_travelling;
 	struct snapshot* snap = tt ? &pg.jiggawatt_snapshot : &pg.fiddle_snapshot;
 	(void)snapshot_get_or_create_mim_state_by_ids(snap, artist_id, session_id);
+	if (!tt) tlg.footprint = &pg.unackd_footprint;
 	const int e = snapshot_spool(snap, data, num_bytes, artist_id, session_id);
-	if (e<0) fprintf(stderr, "SPOOL ERR/0 %d!\n", e);
+	tlg.footprint = NULL;
+	if (e<0) {
+		fprintf(stderr, "SPOOL ERR/0 %d!\n", e);
+		if (!tt) pg.is_fiddle_stale = 1;
+	}
 
 	if (arrlen(snap->document_arr)>0) {
 		//TODO(proper mie/vmie document stuff)
@@ -1784,22 +2210,25 @@ void peer_end_mim(void)
 			not_before_ts = get_nanoseconds_monotonic() + (int64_t)(dt*1e9);
 		}
 
-		uint8_t** bb = &pg.bb_arr;
-		arrreset(*bb);
+		// the record goes straight into unackd_mimbuf_arr, and the host
+		// gets it from there (no intermediate buffer)
+		uint8_t** bb = &pg.unackd_mimbuf_arr;
+		const int64_t o0 = arrlen(*bb);
+		const size_t cap0 = arrcap(*bb);
 		bb_append_leb128(bb, session_id);
 		const int tracer = ++pg.tracer_sequence;
+		if (pg.track_mim_latencies) arrput(pg.unackd_end_mim_ns_arr, t0);
 		bb_append_leb128(bb, tracer);
 		bb_append_leb128(bb, not_before_ts);
 		bb_append_leb128(bb, num_bytes);
 		bb_append(bb, data, num_bytes);
+		const int64_t record_size = arrlen(*bb) - o0;
+		stat_add(&mim_stats.num_bytes_copied, record_size);
+		if (arrcap(*bb) != cap0) stat_add(&mim_stats.num_allocations, 1);
 		if (g.is_host) {
-			if (ringbuf_write(&g.peer2host_mim_ringbuf, *bb, arrlen(*bb)) < 0) {
-				fprintf(stderr, "peer2host_mim_ringbuf is full!\n");
-				abort();
-			}
+			// kept in the spill if the host is behind; see peer_tick()
+			ringbuf_write_or_spill(&g.peer2host_mim_ringbuf, *bb + o0, record_size);
 		}
-		uint8_t* p = arraddnptr(pg.unackd_mimbuf_arr, arrlen(*bb));
-		memcpy(p, *bb, arrlen(*bb));
 
 		if (!g.is_host) {
 			transmit_mim(session_id, tracer, data, num_bytes);
@@ -1856,13 +2285,14 @@ static int get_num_snapshotcache_index_entries_from_size(int64_t sz)
 
 static int snapshotcache_open(const char* dir, uint64_t journal_wax)
 {
+	struct room* room = current_room();
 	char pathbuf[1<<14];
 
 	int err;
 	STATIC_PATH_JOIN(pathbuf, dir, DIR_CACHE, FILENAME_SNAPSHOTCACHE_DATA);
 	struct jio* jdat = jio_open(pathbuf, IO_OPEN, igo.io_port_id, JIO_LARGE_LOG2, &err);
 	if (jdat == NULL) return IOERR(pathbuf, err);
-	igo.jio_snapshotcache_data = jdat;
+	room->jio_snapshotcache_data = jdat;
 	const int64_t szdat = jio_get_size(jdat);
 	if (szdat == 0) {
 		jio_close(jdat);
@@ -1872,7 +2302,7 @@ static int snapshotcache_open(const char* dir, uint64_t journal_wax)
 	STATIC_PATH_JOIN(pathbuf, dir, DIR_CACHE, FILENAME_SNAPSHOTCACHE_INDEX);
 	struct jio* jidx = jio_open(pathbuf, IO_OPEN, igo.io_port_id, JIO_LOG2, &err);
 	if (jidx == NULL) return IOERR(pathbuf, err);
-	igo.jio_snapshotcache_index = jidx;
+	room->jio_snapshotcache_index = jidx;
 	const int64_t szidx = jio_get_size(jidx);
 	if (szidx < 16) {
 		jio_close(jidx);
@@ -1936,6 +2366,7 @@ static int snapshotcache_open(const char* dir, uint64_t journal_wax)
 
 static int snapshotcache_create(const char* dir)
 {
+	struct room* room = current_room();
 	char pathbuf[1<<14];
 
 	STATIC_PATH_JOIN(pathbuf, dir, DIR_CACHE);
@@ -1947,7 +2378,7 @@ static int snapshotcache_create(const char* dir)
 	if (jdat == NULL) {
 		return IOERR(FILENAME_SNAPSHOTCACHE_DATA, err);
 	}
-	igo.jio_snapshotcache_data = jdat;
+	room->jio_snapshotcache_data = jdat;
 	uint8_t** bb = &hg.bb_arr;
 	arrreset(*bb);
 	bb_append(bb, SNAPSHOTCACHE_DATA_MAGIC, strlen(SNAPSHOTCACHE_DATA_MAGIC));
@@ -1961,7 +2392,7 @@ static int snapshotcache_create(const char* dir)
 		jio_close(jdat);
 		return IOERR(FILENAME_SNAPSHOTCACHE_INDEX, err);
 	}
-	igo.jio_snapshotcache_index = jidx;
+	room->jio_snapshotcache_index = jidx;
 	bb_append(bb, SNAPSHOTCACHE_INDEX_MAGIC, strlen(SNAPSHOTCACHE_INDEX_MAGIC));
 	bb_append_leu64(bb, /*wax=*/0);
 	jio_flush_bb(jidx, bb);
@@ -2081,14 +2512,20 @@ int64_t restore_upstream_snapshot_from_data(void* data, size_t sz)
 		dumperr();
 		TODO(handle snapshot restore error)
 	}
+	// the fiddle snapshot is otherwise only refreshed when journal data
+	// arrives, which may be a while after a bootstrap. XXX unackd mims are not
+	// re-spooled here; the snapshot doesn't say which tracers it covers
+	snapshot_copy(&pg.fiddle_snapshot, snap);
+	if (arrlen(pg.unackd_mimbuf_arr) > 0) pg.is_fiddle_stale = 1;
 	return journal_cursor;
 }
 
 static int restore_snapshot_from_disk(struct snapshot* snap, uint64_t snapshot_manifest_offset, int64_t* out_journal_offset)
 {
+	struct room* room = current_room();
 	memset(snap, 0, sizeof *snap);
 
-	struct jio* jdat = igo.jio_snapshotcache_data;
+	struct jio* jdat = room->jio_snapshotcache_data;
 
 	struct bufstream bs0,bs1;
 	uint8_t buf0[1<<8], buf1[1<<8];
@@ -2143,7 +2580,8 @@ static int restore_snapshot_from_disk(struct snapshot* snap, uint64_t snapshot_m
 
 static int can_restore_latest_snapshot(void)
 {
-	struct jio* jidx = igo.jio_snapshotcache_index;
+	struct room* room = current_room();
+	struct jio* jidx = room->jio_snapshotcache_index;
 	int64_t sz = jio_get_size(jidx);
 	if (!is_snapshotcache_index_size_valid(sz)) return 0;
 	return get_num_snapshotcache_index_entries_from_size(sz) > 0;
@@ -2151,10 +2589,11 @@ static int can_restore_latest_snapshot(void)
 
 static int snapshot_restore_latest_from_cache(struct snapshot* snap, int64_t* out_journal_offset, int64_t* out_jam_ts)
 {
+	struct room* room = current_room();
 	if (!can_restore_latest_snapshot()) {
 		return FMTERR(FILENAME_SNAPSHOTCACHE_INDEX, "bad index file");
 	}
-	struct jio* jidx = igo.jio_snapshotcache_index;
+	struct jio* jidx = room->jio_snapshotcache_index;
 	const int64_t sz = jio_get_size(jidx);
 	const int64_t o = (sz - 2*sizeof(uint64_t));
 
@@ -2183,10 +2622,14 @@ static int spool_raw_journal_bs(struct snapshot* snap, struct bufstream* bs, int
 		if ((until_timestamp >= 0) && (timestamp_us > until_timestamp)) {
 			break;
 		}
+		if (out_max_jam_ts && (timestamp_us > *out_max_jam_ts)) {
+			*out_max_jam_ts = timestamp_us;
+		}
 		const int64_t artist_id = bs_read_leb128(bs);
 		const int64_t session_id = bs_read_leb128(bs);
 		const int64_t tracer = bs_read_leb128(bs);
-		if (out_max_tracer) {
+		if (out_max_tracer && (artist_id == pg.my_artist_id)) {
+			// (other artists' tracers are their own business)
 			*out_max_tracer = tracer;
 		}
 		const int64_t num_bytes = bs_read_leb128(bs);
@@ -2204,13 +2647,14 @@ static int spool_raw_journal_bs(struct snapshot* snap, struct bufstream* bs, int
 
 static void maybe_adjust_jam_time(int64_t jam_ts)
 {
+	struct room* room = current_room();
 	assert(jam_ts >= 0);
-	const int64_t offset_us = atomic_load(&igo.jam_time_offset_us);
+	const int64_t offset_us = atomic_load(&room->jam_time_offset_us);
 	const int64_t now = get_microseconds_monotonic();
 	if (jam_ts > (now+offset_us)) {
 		// now + offset = jam_ts
 		const int64_t new_offset_us = jam_ts - now;
-		atomic_store(&igo.jam_time_offset_us, new_offset_us);
+		atomic_store(&room->jam_time_offset_us, new_offset_us);
 		fprintf(stderr, "WARNING: funky timestamps, changing jam_time_offset_us from %lld to %lld\n",
 			(long long)offset_us,
 			(long long)new_offset_us);
@@ -2218,6 +2662,66 @@ static void maybe_adjust_jam_time(int64_t jam_ts)
 	assert(get_monotonic_jam_time_us() >= 0);
 }
 
+// brings the fiddle snapshot up to date with journal data (that was just
+// spooled into the upstream snapshot) without a rebase, if it can: our own
+// records must be the oldest unacked mims, which the fiddle snapshot already
+// has, and other artists' records are spooled on top if that gives the same
+// result as spooling them before our newer unacked mims (see struct
+// mim_footprint). returns the number of acked bytes in unackd_mimbuf_arr, or
+// -1 if the fiddle snapshot needs a rebase (it may be spooled into halfway)
+static int64_t fast_forward_fiddle_snapshot(void* data, int64_t count)
+{
+	static struct mim_footprint footprint;
+	struct snapshot* fidsnap = &pg.fiddle_snapshot;
+	const int64_t num_unackd = arrlen(pg.unackd_mimbuf_arr);
+	struct bufstream bs, ubs;
+	bufstream_init_from_memory(&bs, data, count);
+	bufstream_init_from_memory(&ubs, pg.unackd_mimbuf_arr, num_unackd);
+	while (bs.offset < count) {
+		/*const uint8_t sync=*/         bs_read_u8(&bs);
+		/*const int64_t timestamp_us=*/ bs_read_leb128(&bs);
+		const int64_t artist_id       = bs_read_leb128(&bs);
+		const int64_t session_id      = bs_read_leb128(&bs);
+		const int64_t tracer          = bs_read_leb128(&bs);
+		const int64_t num_bytes       = bs_read_leb128(&bs);
+		uint8_t* mim = (uint8_t*)data + bs.offset;
+		bs_skip(&bs, num_bytes);
+
+		if (artist_id == pg.my_artist_id) {
+			if (ubs.offset >= num_unackd) return -1;
+			const int64_t u_session_id     =  bs_read_leb128(&ubs);
+			const int64_t u_tracer         =  bs_read_leb128(&ubs);
+			/*const int64_t not_before_ts=*/  bs_read_leb128(&ubs);
+			const int64_t u_num_bytes      =  bs_read_leb128(&ubs);
+			const uint8_t* u_mim = &pg.unackd_mimbuf_arr[ubs.offset];
+			bs_skip(&ubs, u_num_bytes);
+			const int is_same =
+				   (session_id == u_session_id)
+				&& (tracer     == u_tracer)
+				&& (num_bytes  == u_num_bytes)
+				&& (0 == memcmp(mim, u_mim, num_bytes));
+			if (!is_same) return -1;
+			continue;
+		}
+
+		// the record goes before our remaining unacked mims upstream, but
+		// after them here
+		const int is_reordered = (ubs.offset < num_unackd);
+		if (is_reordered) {
+			if (pg.unackd_footprint.is_structural) return -1;
+			// (a new mim state would end up after ours in mim_state_arr)
+			if (snapshot_lookup_mim_state_by_ids(fidsnap, artist_id, session_id) == NULL) return -1;
+		}
+		mim_footprint_reset(&footprint);
+		tlg.footprint = &footprint;
+		const int e = snapshot_spool(fidsnap, mim, num_bytes, artist_id, session_id);
+		tlg.footprint = NULL;
+		if (e<0) return -1;
+		if (is_reordered && mim_footprints_overlap(&pg.unackd_footprint, &footprint)) return -1;
+	}
+	return ubs.offset;
+}
+
 int peer_spool_raw_journal_into_upstream_snapshot(void* data, int64_t count)
 {
 	assert(g.is_peer);
@@ -2234,38 +2738,52 @@ int peer_spool_raw_journal_into_upstream_snapshot(void* data, int64_t count)
 		hexdump(data, count);
 		return -1;
 	}
-	assert((max_tracer != -1) && "expected tracer to be set");
 	maybe_adjust_jam_time(max_jam_ts);
-
-	// re-spool inflight mim that has not yet been ack'd
-	struct snapshot* fidsnap = &pg.fiddle_snapshot;
-	snapshot_copy(fidsnap, upsnap);
-
-	const int64_t num_total = arrlen(pg.unackd_mimbuf_arr);
-	bufstream_init_from_memory(&bs, pg.unackd_mimbuf_arr, num_total);
-	int64_t trunc_to = 0;
-	int64_t prev_tracer = -1;
-	while (bs.offset < num_total) {
-		const int64_t session_id     =  bs_read_leb128(&bs);
-		const int64_t tracer         =  bs_read_leb128(&bs);
-		/*const int64_t not_before_ts=*/bs_read_leb128(&bs); // ignored
-		const int64_t num_bytes      =  bs_read_leb128(&bs);
-		if (tracer <= prev_tracer) {
-			fprintf(stderr, "unordered tracer sequence [%ld,%ld]\n", (long)prev_tracer, (long)tracer);
-			return -1;
-		}
-		assert(tracer > prev_tracer);
-		prev_tracer = tracer;
-		if (tracer <= max_tracer) {
-			// journal received from host already covers this tracer, so skip
-			// it and continue
-			bs_skip(&bs, num_bytes);
-			assert(bs.offset > trunc_to);
-			trunc_to = bs.offset;
-		} else {
-			const int e = snapshot_spool(fidsnap, &pg.unackd_mimbuf_arr[bs.offset], num_bytes, get_my_artist_id(), session_id);
-			if (e<0) fprintf(stderr, "SPOOL ERR/1 %d!\n", e);
-			bs_skip(&bs, num_bytes);
+	const int64_t upstream_ns = pg.track_mim_latencies ? get_nanoseconds_monotonic() : 0;
+
+	// the fiddle snapshot is the upstream snapshot plus our unacked mims. when
+	// the journal only acks some of them, or only has edits that don't
+	// interfere with them, it's patched in place; otherwise it's rebased: the
+	// upstream snapshot is copied into it (only the documents that changed),
+	// and the mims that are still unacked are re-spooled
+	int64_t trunc_to = pg.is_fiddle_stale ? -1 : fast_forward_fiddle_snapshot(data, count);
+	if (trunc_to < 0) {
+		struct snapshot* fidsnap = &pg.fiddle_snapshot;
+		snapshot_copy(fidsnap, upsnap);
+		pg.is_fiddle_stale = 0;
+		mim_footprint_reset(&pg.unackd_footprint);
+
+		const int64_t num_total = arrlen(pg.unackd_mimbuf_arr);
+		bufstream_init_from_memory(&bs, pg.unackd_mimbuf_arr, num_total);
+		trunc_to = 0;
+		int64_t prev_tracer = -1;
+		while (bs.offset < num_total) {
+			const int64_t session_id     =  bs_read_leb128(&bs);
+			const int64_t tracer         =  bs_read_leb128(&bs);
+			/*const int64_t not_before_ts=*/bs_read_leb128(&bs); // ignored
+			const int64_t num_bytes      =  bs_read_leb128(&bs);
+			if (tracer <= prev_tracer) {
+				fprintf(stderr, "unordered tracer sequence [%ld,%ld]\n", (long)prev_tracer, (long)tracer);
+				return -1;
+			}
+			assert(tracer > prev_tracer);
+			prev_tracer = tracer;
+			if (tracer <= max_tracer) {
+				// journal received from host already covers this tracer, so skip
+				// it and continue
+				bs_skip(&bs, num_bytes);
+				assert(bs.offset > trunc_to);
+				trunc_to = bs.offset;
+			} else {
+				tlg.footprint = &pg.unackd_footprint;
+				const int e = snapshot_spool(fidsnap, &pg.unackd_mimbuf_arr[bs.offset], num_bytes, get_my_artist_id(), session_id);
+				tlg.footprint = NULL;
+				if (e<0) {
+					fprintf(stderr, "SPOOL ERR/1 %d!\n", e);
+					pg.is_fiddle_stale = 1;
+				}
+				bs_skip(&bs, num_bytes);
+			}
 		}
 	}
 
@@ -2273,69 +2791,177 @@ int peer_spool_raw_journal_into_upstream_snapshot(void* data, int64_t count)
 	if (trunc_to > 0) {
 		arrdeln(pg.unackd_mimbuf_arr, 0, trunc_to);
 	}
+	if (arrlen(pg.unackd_mimbuf_arr) == 0) {
+		mim_footprint_reset(&pg.unackd_footprint);
+	}
+
+	if (pg.track_mim_latencies) record_acked_mim_latencies(max_tracer, upstream_ns, get_nanoseconds_monotonic());
 
 	return 0;
 }
 
-static void write_doc_as_cc(struct document* doc, const char* path)
+static void encode_doc_as_cc(uint8_t** bb, struct document* doc)
 {
-	uint8_t** bb = &hg.bb_arr;
-	arrreset(*bb);
 	const int num_chars = arrlen(doc->docchar_arr);
 	for (int i=0; i<num_chars; ++i) {
 		struct colorchar cc = doc->docchar_arr[i].colorchar;
 		bb_append_utf8(bb, cc.codepoint);
 		bb_append_leu16(bb, cc.splash4);
 	}
-	io_write_file(path, *bb, arrlen(*bb));
 }
 
-static void write_doc_as_txt(struct document* doc, const char* path)
+static void encode_doc_as_txt(uint8_t** bb, struct document* doc)
 {
-	uint8_t** bb = &hg.bb_arr;
-	arrreset(*bb);
 	const int num_chars = arrlen(doc->docchar_arr);
 	for (int i=0; i<num_chars; ++i) {
 		struct colorchar cc = doc->docchar_arr[i].colorchar;
 		bb_append_utf8(bb, cc.codepoint);
 	}
-	io_write_file(path, *bb, arrlen(*bb));
 }
 
-static void write_snapshot_documents(struct snapshot* snap)
+static void* derived_file_writer_run(void* usr)
 {
+	(void)usr;
+	assert(0 == pthread_mutex_lock(&dfw.mutex));
+	for (;;) {
+		while ((arrlen(dfw.file_arr) == 0) && !dfw.do_stop) {
+			assert(0 == pthread_cond_wait(&dfw.cond, &dfw.mutex));
+		}
+		if (arrlen(dfw.file_arr) == 0) break;
+		struct derived_file df = dfw.file_arr[0];
+		arrdel(dfw.file_arr, 0);
+		assert(0 == pthread_mutex_unlock(&dfw.mutex));
+
+		const int e = io_write_file(df.path, df.data_arr, arrlen(df.data_arr));
+		if (e < 0) fprintf(stderr, "%s: %s\n", df.path, io_error_to_string_safe(e));
+		free(df.path);
+		arrfree(df.data_arr);
+
+		assert(0 == pthread_mutex_lock(&dfw.mutex));
+	}
+	assert(0 == pthread_mutex_unlock(&dfw.mutex));
+	return NULL;
+}
+
+// queues data_arr to be written to path (and takes ownership of it)
+static void queue_derived_file(const char* path, uint8_t* data_arr)
+{
+	assert(0 == pthread_mutex_lock(&dfw.mutex));
+	if (!dfw.is_running) {
+		dfw.do_stop = 0;
+		assert(0 == pthread_create(&dfw.thread, NULL, derived_file_writer_run, NULL));
+		dfw.is_running = 1;
+	}
+	// if an older version hasn't been written yet, it never will be
+	const int num_files = arrlen(dfw.file_arr);
+	for (int i=0; i<num_files; ++i) {
+		struct derived_file* df = &dfw.file_arr[i];
+		if (0 != strcmp(df->path, path)) continue;
+		arrfree(df->data_arr);
+		df->data_arr = data_arr;
+		assert(0 == pthread_mutex_unlock(&dfw.mutex));
+		return;
+	}
+	arrput(dfw.file_arr, ((struct derived_file) {
+		.path = strdup(path),
+		.data_arr = data_arr,
+	}));
+	assert(0 == pthread_cond_signal(&dfw.cond));
+	assert(0 == pthread_mutex_unlock(&dfw.mutex));
+}
+
+// writes what's queued, and stops the writer thread
+static void stop_derived_file_writer(void)
+{
+	assert(0 == pthread_mutex_lock(&dfw.mutex));
+	const int is_running = dfw.is_running;
+	dfw.do_stop = 1;
+	assert(0 == pthread_cond_signal(&dfw.cond));
+	assert(0 == pthread_mutex_unlock(&dfw.mutex));
+	if (!is_running) return;
+	assert(0 == pthread_join(dfw.thread, NULL));
+	dfw.is_running = 0;
+	arrfree(dfw.file_arr);
+}
+
+// queues derived files for the documents that changed since last time, if
+// any commits happened and the interval has passed (or if force is set).
+// returns 1 if it queued anything
+static int write_derived_files(int force)
+{
+	struct room* room = current_room();
+	if (!room->has_unwritten_derived_files) return 0;
+	const int64_t now = get_nanoseconds_monotonic();
+	if (!force && (now < room->next_derived_files_ts)) return 0;
+	room->has_unwritten_derived_files = 0;
+	room->next_derived_files_ts = now + (igo.derived_file_interval_us * 1000LL);
+
+	int did_queue = 0;
+	struct snapshot* snap = &room->present_snapshot;
 	const int num_docs = arrlen(snap->document_arr);
 	for (int i=0; i<num_docs; ++i) {
 		struct document* doc = &snap->document_arr[i];
 
+		struct derived_doc* dd = NULL;
+		const int num_dd = arrlen(room->derived_doc_arr);
+		for (int ii=0; ii<num_dd; ++ii) {
+			struct derived_doc* d = &room->derived_doc_arr[ii];
+			if ((d->book_id == doc->book_id) && (d->doc_id == doc->doc_id)) {
+				dd = d;
+				break;
+			}
+		}
+		if (dd == NULL) {
+			dd = arraddnptr(room->derived_doc_arr, 1);
+			dd->book_id = doc->book_id;
+			dd->doc_id = doc->doc_id;
+			dd->edit_sequence = -1;
+		}
+		if (dd->edit_sequence == doc->edit_sequence) continue;
+		dd->edit_sequence = doc->edit_sequence;
+
 		char pathbuf[1<<14];
 		char fnbuf[1<<10];
+		uint8_t* data_arr;
 
 		stbsp_snprintf(fnbuf, sizeof fnbuf, "book%d-doc%2d-%s.cc", doc->book_id, doc->doc_id, doc->name_arr);
-		STATIC_PATH_JOIN(pathbuf, igo.cache_dir, fnbuf);
-		write_doc_as_cc(doc,   pathbuf);
+		STATIC_PATH_JOIN(pathbuf, room->cache_dir, fnbuf);
+		data_arr = NULL;
+		encode_doc_as_cc(&data_arr, doc);
+		queue_derived_file(pathbuf, data_arr);
 
 		stbsp_snprintf(fnbuf, sizeof fnbuf, "book%d-doc%2d-%s.txt", doc->book_id, doc->doc_id, doc->name_arr);
-		STATIC_PATH_JOIN(pathbuf, igo.cache_dir, fnbuf);
-		write_doc_as_txt(doc,  pathbuf);
+		STATIC_PATH_JOIN(pathbuf, room->cache_dir, fnbuf);
+		data_arr = NULL;
+		encode_doc_as_txt(&data_arr, doc);
+		queue_derived_file(pathbuf, data_arr);
 
 		// TODO HTML? it's a bit cumbersome and I don't know what the value is?
 		// and it's easy to do with a few lines of python?
+
+		did_queue = 1;
 	}
+	return did_queue;
 }
 
-void commit_mim_to_host(int artist_id, int session_id, int64_t tracer, uint8_t* data, int count)
+// commits a mim to the current room
+static void commit_mim(int artist_id, int session_id, int64_t tracer, uint8_t* data, int count)
 {
-	struct snapshot* snap = &hg.present_snapshot;
+	struct room* room = current_room();
+	assert(!room->is_hibernating);
+	assert(!room->is_relay_room);
+	room->last_activity_ns = get_nanoseconds_monotonic();
+	struct snapshot* snap = &room->present_snapshot;
 	const int e = snapshot_spool(snap, data, count, artist_id, session_id);
 	if (e<0) {
 		fprintf(stderr, "SPOOL ERR/2 %d!\n", e);
 		return;
 	}
-	struct jio* jj = igo.jio_journal;
+	struct jio* jj = room->jio_journal;
 	assert(jj != NULL);
-	uint8_t** bb = &pg.bb_arr;
+	uint8_t** bb = &hg.bb_arr;
 	arrreset(*bb);
+	const size_t cap0 = arrcap(*bb);
 	bb_append_u8(bb, SYNC);
 	const int64_t ts = get_monotonic_jam_time_us();
 	bb_append_leb128(bb, ts);
@@ -2343,14 +2969,23 @@ void commit_mim_to_host(int artist_id, int session_id, int64_t tracer, uint8_t*
 	bb_append_leb128(bb, session_id);
 	bb_append_leb128(bb, tracer);
 	bb_append_leb128(bb, count);
-	bb_append(bb, data, count);
-	jio_flush_bb(jj, bb);
+	if (arrcap(*bb) != cap0) stat_add(&mim_stats.num_allocations, 1);
+	// the mim data is copied straight from where it is (e.g. the
+	// peer2host_mim_ringbuf) into the journal
+	const struct io_vec vecs[] = {
+		{ .ptr = *bb  , .count = arrlen(*bb) },
+		{ .ptr = data , .count = count       },
+	};
+	jio_appendv(jj, vecs, sizeof(vecs)/sizeof(vecs[0]));
+	stat_add(&mim_stats.num_bytes_copied, arrlen(*bb) + count);
+	stat_add(&mim_stats.num_bytes, count);
+	stat_add(&mim_stats.num_mims, 1);
 	const int64_t jsz = jio_get_size(jj);
 	if (it_is_time_for_a_snapshotcache_push(jsz)) {
 		snapshotcache_push(snap, jsz, ts);
 	}
 
-	struct jio* ja = igo.jio_activitycache;
+	struct jio* ja = room->jio_activitycache;
 	assert(ja != NULL);
 	arrreset(*bb);
 	assert(0 == arrlen(*bb));
@@ -2360,13 +2995,18 @@ void commit_mim_to_host(int artist_id, int session_id, int64_t tracer, uint8_t*
 	assert(12 == arrlen(*bb));
 	bb_append_leu32(bb, count);
 	assert(16 == arrlen(*bb));
-	if (ringbuf_write(&g.host2peer_activitycache_ringbuf, *bb, arrlen(*bb)) < 0) {
-		fprintf(stderr, "host2peer_activitycache_ringbuf is full!\n");
-		return;
-	}
+	if (room->is_peer_room) ringbuf_write_or_spill(&g.host2peer_activitycache_ringbuf, *bb, arrlen(*bb));
 	jio_flush_bb(ja, bb);
 
-	write_snapshot_documents(&hg.present_snapshot);
+	// see write_derived_files()
+	room->has_unwritten_derived_files = 1;
+}
+
+void commit_mim_to_host(int room_id, int artist_id, int session_id, int64_t tracer, uint8_t* data, int count)
+{
+	struct room* prev = enter_room(get_room(room_id));
+	commit_mim(artist_id, session_id, tracer, data, count);
+	leave_room(prev);
 }
 
 static void H_LOCK(void)
@@ -2379,92 +3019,103 @@ static void H_UNLOCK(void)
 	assert(0 == pthread_mutex_unlock(&hg.mutex));
 }
 
-int host_tick(void)
+// host_tick() stops committing after this much time, and continues in the next
+// tick, so a burst of mims (e.g. a big paste, or a peer catching up)
+// doesn't hold up the I/O sharing the thread
+#define HOST_COMMIT_BUDGET_NS (2000000LL)
+
+#ifndef __EMSCRIPTEN__
+static int room_ack(struct room* room, io_echo ec)
 {
-	H_LOCK();
+	if (room->jio_journal             && jio_ack(room->jio_journal             , ec)) return 1;
+	if (room->jio_activitycache       && jio_ack(room->jio_activitycache       , ec)) return 1;
+	if (room->jio_snapshotcache_data  && jio_ack(room->jio_snapshotcache_data  , ec)) return 1;
+	if (room->jio_snapshotcache_index && jio_ack(room->jio_snapshotcache_index , ec)) return 1;
+	return 0;
+}
+#endif
 
-	if (!g.is_host) {
-		H_UNLOCK();
-		return 0;
+// commits released mims from buf (records written by peer_end_mim()), until
+// the deadline. returns the number of bytes committed
+static int64_t commit_mims(int artist_id, uint8_t* buf, int64_t n, int64_t deadline, int* inout_did_work, int* out_is_over_budget)
+{
+	struct bufstream bs;
+	bufstream_init_from_memory(&bs, buf, n);
+	int64_t cursor = 0;
+	while (cursor < n) {
+		if (*inout_did_work && (get_nanoseconds_monotonic() > deadline)) {
+			*out_is_over_budget = 1;
+			break;
+		}
+		const int64_t session_id = bs_read_leb128(&bs);
+		const int64_t tracer = bs_read_leb128(&bs);
+		const int64_t not_before_ts  = bs_read_leb128(&bs);
+		const int is_released = (not_before_ts == 0) || (get_nanoseconds_monotonic() > not_before_ts);
+		if (!is_released) break;
+		const int64_t num_bytes  = bs_read_leb128(&bs);
+		commit_mim(artist_id, session_id, tracer, buf + bs.offset, num_bytes);
+		bs_skip(&bs, num_bytes);
+		assert(!bs.error);
+		*inout_did_work = 1;
+		cursor = bs.offset;
+		assert(cursor <= n);
 	}
+	return cursor;
+}
 
-	// handle completion events from io port
+// commits released mims from the local peer to the current room (journal,
+// snapshotcache, activitycache), publishes committed_journal_size, and queues
+// derived files. the mims are read in
+// place from the peer2host_mim_ringbuf, and only released from it once
+// committed. (mims from websockets are committed as they arrive; see
+// commit_mim_to_host())
+static int host_commit_room(int64_t deadline, int* out_is_over_budget)
+{
+	struct room* room = current_room();
+	if (room->is_hibernating) return 0;
 	int did_work = 0;
-	#ifndef __EMSCRIPTEN__
-	struct io_event ev = {0};
-	while (io_port_poll(igo.io_port_id, &ev)) {
-		did_work = 1;
-		io_echo ec = ev.echo;
-		if (igo.jio_journal             && jio_ack(igo.jio_journal             , ec)) continue;
-		if (igo.jio_activitycache       && jio_ack(igo.jio_activitycache       , ec)) continue;
-		if (igo.jio_snapshotcache_data  && jio_ack(igo.jio_snapshotcache_data  , ec)) continue;
-		if (igo.jio_snapshotcache_index && jio_ack(igo.jio_snapshotcache_index , ec)) continue;
-		assert(!"unhandled event");
-	}
-	#endif
-
-	if (g.is_peer) {
+	int is_over_budget = 0;
+	if (room->is_peer_room) {
 		const int artist_id = get_my_artist_id();
-		struct peer_state* ps = host_get_or_create_peer_state_by_artist_id(artist_id);
-		uint8_t** bb = &ps->cmdbuf_arr;
-		if (arrlen(*bb) == 0) {
-			int64_t p0,p1;
-			struct ringbuf* rb = &g.peer2host_mim_ringbuf;
-			ringbuf_get_readable_range(rb, &p0, &p1);
-			const int64_t nrb = (p1-p0);
-			if (nrb>0) {
-				assert(p1>p0);
-				arrsetlen(*bb, nrb);
-				ringbuf_read_range(rb, *bb, p0, p1);
-				did_work = 1;
-			}
+		struct ringbuf* rb = &g.peer2host_mim_ringbuf;
+		uint8_t* p;
+		int64_t n;
+		while (!is_over_budget && ((n = ringbuf_peek(rb, &p)) > 0)) {
+			const int64_t nc = commit_mims(artist_id, p, n, deadline, &did_work, &is_over_budget);
+			if (nc == 0) break;
+			ringbuf_consume(rb, nc);
+			// records never straddle the end of the ring buffer, so
+			// anything left in p is an unreleased mim
+			if (nc < n) break;
 		}
 	}
 
-	const int num_ps = arrlen(hg.peer_state_arr);
-	for (int i=0; i<num_ps; ++i) {
-		struct peer_state* ps = &hg.peer_state_arr[i];
-		const int64_t n = arrlen(ps->cmdbuf_arr);
-		if (n == 0) continue;
-		struct bufstream bs;
-		bufstream_init_from_memory(&bs, ps->cmdbuf_arr, n);
-		int64_t cursor = 0;
-		while (cursor < n) {
-			const int64_t o0 = bs.offset;
-			const int64_t session_id = bs_read_leb128(&bs);
-			const int64_t tracer = bs_read_leb128(&bs);
-			const int64_t not_before_ts  = bs_read_leb128(&bs);
-			const int is_released = (not_before_ts == 0) || (get_nanoseconds_monotonic() > not_before_ts);
-			if (!is_released) break;
-			const int64_t num_bytes  = bs_read_leb128(&bs);
-			const int64_t o1 = bs.offset;
-			cursor += (o1-o0);
-
-			commit_mim_to_host(ps->artist_id, session_id, tracer, ps->cmdbuf_arr + cursor, num_bytes);
-			bs_skip(&bs, num_bytes);
-			did_work = 1;
-			cursor += num_bytes;
-			assert(cursor <= n);
-		}
+	atomic_store(&room->committed_journal_size, jio_get_size(room->jio_journal));
 
-		assert(cursor <= n);
-		if (cursor == n) {
-			arrreset(ps->cmdbuf_arr);
-		} else if (cursor > 0) {
-			const int nn = n-cursor;
-			assert(nn > 0);
-			memmove(ps->cmdbuf_arr, ps->cmdbuf_arr + cursor, nn);
-			arrsetlen(ps->cmdbuf_arr, nn);
-		}
-	}
+	did_work |= write_derived_files(0);
 
-	#ifndef __EMSCRIPTEN__ // XXX not totally right?
-	did_work |= webserv_broadcast_journal(jio_get_size(igo.jio_journal));
-	#endif
+	if (is_over_budget) *out_is_over_budget = 1;
+	return did_work;
+}
 
-	H_UNLOCK();
+void gig_get_queue_stats(struct gig_queue_stats* out_peer2host, struct gig_queue_stats* out_host2peer)
+{
+	ringbuf_get_stats(&g.peer2host_mim_ringbuf, out_peer2host);
+	ringbuf_get_stats(&g.host2peer_activitycache_ringbuf, out_host2peer);
+}
 
-	return did_work;
+void gig_get_mim_stats(struct gig_mim_stats* out_stats)
+{
+	memset(out_stats, 0, sizeof *out_stats);
+	out_stats->num_mims         = atomic_load(&mim_stats.num_mims);
+	out_stats->num_bytes        = atomic_load(&mim_stats.num_bytes);
+	out_stats->num_bytes_copied = atomic_load(&mim_stats.num_bytes_copied);
+	out_stats->num_allocations  = atomic_load(&mim_stats.num_allocations);
+	struct ringbuf* rb = &g.peer2host_mim_ringbuf;
+	if (rb->buf != NULL) {
+		out_stats->num_bytes_copied += atomic_load(&rb->num_bytes_copied);
+		out_stats->num_allocations  += atomic_load(&rb->num_allocations);
+	}
 }
 
 static void host_begin_mim(void)
@@ -2487,7 +3138,7 @@ static void host_end_mim(void)
 	for (int i=0; i<num_bytes; ++i) printf("%c",tlg.mim_buffer_arr[i]);
 	printf("]\n");
 	#endif
-	commit_mim_to_host(0, 0, 0, tlg.mim_buffer_arr, num_bytes);
+	commit_mim(0, 0, 0, tlg.mim_buffer_arr, num_bytes);
 }
 
 static void setup_default_stub(void)
@@ -2505,9 +3156,10 @@ static void setup_default_stub(void)
 
 static void setup_jam_time(int64_t journal_time_zero_epoch_us)
 {
+	struct room* room = current_room();
 	const int64_t jam_time_now_us = (get_microseconds_epoch() - journal_time_zero_epoch_us);
 	const int64_t offset_us = jam_time_now_us - get_microseconds_monotonic();
-	atomic_store(&igo.jam_time_offset_us, offset_us);
+	atomic_store(&room->jam_time_offset_us, offset_us);
 }
 
 static uint64_t make_wax(void)
@@ -2533,21 +3185,22 @@ static uint64_t make_wax(void)
 static void setwax_all(uint64_t setwax)
 {
 	#ifndef __EMSCRIPTEN__
+	struct room* room = current_room();
 	uint8_t data[8];
 	uint8_t* p = data;
 	leu64_pencode(&p, setwax);
 	assert((p-data)==sizeof(data));
 	const int64_t offset = 8;
-	if (jio_pwrite(igo.jio_journal, data, sizeof data, offset) < 0) {
+	if (jio_pwrite(room->jio_journal, data, sizeof data, offset) < 0) {
 		fprintf(stderr, "failed to write journal wax\n");
 	}
-	if (jio_pwrite(igo.jio_snapshotcache_data, data, sizeof data, offset) < 0) {
+	if (jio_pwrite(room->jio_snapshotcache_data, data, sizeof data, offset) < 0) {
 		fprintf(stderr, "failed to write snapshotcache data wax\n");
 	}
-	if (jio_pwrite(igo.jio_snapshotcache_index, data, sizeof data, offset) < 0) {
+	if (jio_pwrite(room->jio_snapshotcache_index, data, sizeof data, offset) < 0) {
 		fprintf(stderr, "failed to write snapshotcache index wax\n");
 	}
-	if (jio_pwrite(igo.jio_activitycache, data, sizeof data, offset) < 0) {
+	if (jio_pwrite(room->jio_activitycache, data, sizeof data, offset) < 0) {
 		fprintf(stderr, "failed to write activitycache wax\n");
 	}
 	#endif
@@ -2565,16 +3218,18 @@ static void rewax_all(void)
 
 static int setup_datadir(const char* dir)
 {
+	struct room* room = current_room();
 	char pathbuf[1<<14];
 
 	STATIC_PATH_JOIN(pathbuf, dir, DIR_CACHE);
-	igo.cache_dir = strdup(pathbuf);
+	room->cache_dir = strdup(pathbuf);
 
 	STATIC_PATH_JOIN(pathbuf, dir, FILENAME_JOURNAL);
 	int err;
 	struct jio* jj = jio_open(pathbuf, IO_OPEN_OR_CREATE, igo.io_port_id, JIO_LARGE_LOG2, &err);
-	igo.jio_journal = jj;
+	room->jio_journal = jj;
 	if (jj == NULL) return IOERR(FILENAME_JOURNAL, err);
+	atomic_store(&room->committed_journal_size, jio_get_size(jj));
 
 	// TODO setup journal jio for fdatasync?
 
@@ -2630,7 +3285,7 @@ static int setup_datadir(const char* dir)
 		int64_t snapshot_jam_ts = -1;
 
 		int64_t journal_spool_offset = JOURNAL_HEADER_SIZE;
-		struct snapshot* snap = &hg.present_snapshot;
+		struct snapshot* snap = &room->present_snapshot;
 		int err = snapshotcache_open(dir, wax);
 		if (err == IO_NOT_FOUND) {
 			// OK just spool journal from beginning
@@ -2701,30 +3356,277 @@ static int setup_datadir(const char* dir)
 		}
 		assert(bs.offset == 16);
 		const int num_entries = (jasz - bs.offset) / 16;
-		arrsetlen(pg.activitycache_entry_arr, num_entries);
-		int index = 0;
-		while (bs.offset < jasz) {
-			assert((0 <= index) && (index < num_entries));
-			struct activitycache_entry* entry = &pg.activitycache_entry_arr[index];
-			entry->timestamp = bs_read_leu64(&bs);
-			entry->artist_id = bs_read_leu32(&bs);
-			entry->weight    = bs_read_leu32(&bs);
-			++index;
-		}
-		assert(index == num_entries);
-		if (bs.offset != jasz) {
+		if (room->is_peer_room) {
+			arrsetlen(pg.activitycache_entry_arr, num_entries);
+			int index = 0;
+			while (bs.offset < jasz) {
+				assert((0 <= index) && (index < num_entries));
+				struct activitycache_entry* entry = &pg.activitycache_entry_arr[index];
+				entry->timestamp = bs_read_leu64(&bs);
+				entry->artist_id = bs_read_leu32(&bs);
+				entry->weight    = bs_read_leu32(&bs);
+				++index;
+			}
+			assert(index == num_entries);
+			if (bs.offset != jasz) {
+				return FMTERR(FILENAME_ACTIVITYCACHE, "activitycache: bad EOF alignment");
+			}
+		} else if (((jasz - bs.offset) % 16) != 0) {
 			return FMTERR(FILENAME_ACTIVITYCACHE, "activitycache: bad EOF alignment");
 		}
 	}
-	igo.jio_activitycache = ja;
+	room->jio_activitycache = ja;
 
 	unwax_all();
 
-	if (is_new && g.is_host) setup_default_stub();
+	// a relay's journal is a copy of the upstream journal, so it must not
+	// begin with anything of its own
+	if (is_new && g.is_host && !room->is_relay_room) setup_default_stub();
+
+	return 0;
+}
+
+// closes and frees what setup_datadir() set up (fully or partially) in the
+// current room
+static void teardown_datadir(int rewax)
+{
+	struct room* room = current_room();
+	if (rewax) rewax_all();
+	if (room->jio_journal)             jio_close(room->jio_journal);
+	if (room->jio_snapshotcache_data)  jio_close(room->jio_snapshotcache_data);
+	if (room->jio_snapshotcache_index) jio_close(room->jio_snapshotcache_index);
+	if (room->jio_activitycache)       jio_close(room->jio_activitycache);
+	room->jio_journal = NULL;
+	room->jio_snapshotcache_data = NULL;
+	room->jio_snapshotcache_index = NULL;
+	room->jio_activitycache = NULL;
+	arrfree(room->derived_doc_arr);
+	const int num_packed_snapshots = arrlen(room->packed_snapshot_arr);
+	for (int i=0; i<num_packed_snapshots; ++i) {
+		struct packed_snapshot* ps = &room->packed_snapshot_arr[i];
+		if (ps->refcount > 0) {
+			// XXX leaking it because someone is still using it
+			continue;
+		}
+		packed_snapshot_free(ps);
+	}
+	arrfree(room->packed_snapshot_arr);
+	snapshot_free(&room->present_snapshot);
+	free(room->cache_dir);
+	room->cache_dir = NULL;
+	room->has_unwritten_derived_files = 0;
+}
+
+static void close_room(struct room* room, int rewax)
+{
+	struct room* prev = enter_room(room);
+	if (!room->is_hibernating) teardown_datadir(rewax);
+	free(room->name);
+	free(room->dir);
+	free(room);
+	leave_room(prev);
+}
 
+// returns 1 if a packed snapshot of room is still being written to a
+// connection
+static int is_packed_snapshot_in_use(struct room* room)
+{
+	const int num_packed_snapshots = arrlen(room->packed_snapshot_arr);
+	for (int i=0; i<num_packed_snapshots; ++i) {
+		if (room->packed_snapshot_arr[i].refcount > 0) return 1;
+	}
 	return 0;
 }
 
+// hibernation of an idle room happens in two steps: first the derived files
+// and a final snapshotcache entry are written, and then, once the writes have
+// landed (jio_close() refuses to close with writes in flight), the room's
+// files are closed and its memory is freed. gig_acquire_room() resumes it
+// from the snapshotcache. returns 1 if it did something
+static int room_maybe_hibernate(void)
+{
+	struct room* room = current_room();
+	if (room->is_hibernating) return 0;
+	if (room->is_peer_room || room->is_relay_room || (room->num_users > 0)) {
+		room->is_falling_asleep = 0;
+		return 0;
+	}
+	if (is_packed_snapshot_in_use(room)) return 0;
+
+	if (!room->is_falling_asleep) {
+		const int64_t idle_ns = get_nanoseconds_monotonic() - room->last_activity_ns;
+		if (idle_ns < (igo.room_hibernation_timeout_us * 1000LL)) return 0;
+		write_derived_files(1);
+		const int64_t jsz = jio_get_size(room->jio_journal);
+		if (jsz > room->journal_offset_at_last_snapshotcache_push) {
+			snapshotcache_push(&room->present_snapshot, jsz, get_monotonic_jam_time_us());
+		}
+		room->is_falling_asleep = 1;
+		return 1;
+	}
+
+	struct jio* jios[] = {
+		room->jio_journal,
+		room->jio_snapshotcache_data,
+		room->jio_snapshotcache_index,
+		room->jio_activitycache,
+	};
+	for (int i=0; i<ARRAY_LENGTH(jios); ++i) {
+		if (jio_get_flushed_size(jios[i]) != jio_get_size(jios[i])) return 0;
+	}
+	teardown_datadir(1);
+	room->is_falling_asleep = 0;
+	room->is_hibernating = 1;
+	return 1;
+}
+
+// resumes a hibernating room. hg.mutex must be held
+static int room_resume(struct room* room)
+{
+	assert(room->is_hibernating);
+	struct room* prev = enter_room(room);
+	const int e = setup_datadir(room->dir);
+	if (e<0) {
+		dumperr();
+		teardown_datadir(0);
+	} else {
+		room->is_hibernating = 0;
+	}
+	leave_room(prev);
+	return e;
+}
+
+// handles io completion events, commits mims from the local peer,
+// broadcasts journal growth to spectators, and hibernates idle rooms.
+// committing shares its time budget between the rooms, starting with a
+// different room every tick so a busy room can't starve the others
+int host_tick(void)
+{
+	H_LOCK();
+
+	if (!g.is_host) {
+		H_UNLOCK();
+		return 0;
+	}
+
+	int did_work = 0;
+	const int num_rooms = atomic_load(&hg.num_rooms);
+
+	#ifndef __EMSCRIPTEN__
+	// handle completion events from io port (shared by all rooms)
+	struct io_event ev = {0};
+	while (io_port_poll(igo.io_port_id, &ev)) {
+		did_work = 1;
+		int room_id = 0;
+		while ((room_id < num_rooms) && !room_ack(get_room(room_id), ev.echo)) ++room_id;
+		assert((room_id < num_rooms) && "unhandled event");
+	}
+	#endif
+
+	if (g.is_peer) {
+		// (the local peer's mims are committed in place from the
+		// peer2host_mim_ringbuf by host_commit_room())
+		did_work |= ringbuf_flush_spill(&g.host2peer_activitycache_ringbuf);
+	}
+
+	struct room* prev = tlg.room;
+
+	const int64_t deadline = get_nanoseconds_monotonic() + HOST_COMMIT_BUDGET_NS;
+	int is_over_budget = 0;
+	const int i0 = (num_rooms > 0) ? (hg.next_commit_room_index % num_rooms) : 0;
+	for (int i=0; (i<num_rooms) && !is_over_budget; ++i) {
+		enter_room(get_room((i0+i) % num_rooms));
+		did_work |= host_commit_room(deadline, &is_over_budget);
+	}
+	hg.next_commit_room_index = i0+1;
+
+	#ifndef __EMSCRIPTEN__ // XXX not totally right?
+	for (int room_id=0; room_id<num_rooms; ++room_id) {
+		did_work |= webserv_broadcast_journal(room_id, atomic_load(&get_room(room_id)->committed_journal_size));
+	}
+	#endif
+
+	if (igo.room_hibernation_timeout_us > 0) {
+		for (int room_id=0; room_id<num_rooms; ++room_id) {
+			enter_room(get_room(room_id));
+			did_work |= room_maybe_hibernate();
+		}
+	}
+
+	leave_room(prev);
+
+	H_UNLOCK();
+
+	return did_work;
+}
+
+int64_t gig_get_wait_timeout_us(void)
+{
+	int64_t wait_us = -1;
+	H_LOCK();
+	if (g.is_host) {
+		const int64_t now = get_nanoseconds_monotonic();
+		const int num_rooms = atomic_load(&hg.num_rooms);
+		for (int room_id=0; room_id<num_rooms; ++room_id) {
+			struct room* room = get_room(room_id);
+			int64_t at_ns = -1;
+			if (room->has_unwritten_derived_files) {
+				at_ns = room->next_derived_files_ts;
+			}
+			// see room_maybe_hibernate(); a room that is falling asleep
+			// or has a packed snapshot in use waits for writes to
+			// complete, and those wake io_wait() anyway
+			const int is_idle =
+				   !room->is_hibernating
+				&& !room->is_falling_asleep
+				&& !room->is_peer_room
+				&& !room->is_relay_room
+				&& (room->num_users == 0)
+				&& !is_packed_snapshot_in_use(room);
+			if ((igo.room_hibernation_timeout_us > 0) && is_idle) {
+				const int64_t hibernate_at_ns = room->last_activity_ns + (igo.room_hibernation_timeout_us * 1000LL);
+				if ((at_ns < 0) || (hibernate_at_ns < at_ns)) at_ns = hibernate_at_ns;
+			}
+			if (at_ns < 0) continue;
+			const int64_t dt = at_ns - now;
+			const int64_t us = (dt <= 0) ? 0 : ((dt + 999) / 1000);
+			if ((wait_us < 0) || (us < wait_us)) wait_us = us;
+		}
+	}
+	H_UNLOCK();
+	return wait_us;
+}
+
+// sets up a room in dir, and adds it to hg.rooms. hg.mutex must be held.
+// returns the room id, or <0 on error
+static int open_room(const char* name, const char* dir, int next_artist_id)
+{
+	const int room_id = atomic_load(&hg.num_rooms);
+	if (room_id >= MAX_ROOMS) {
+		errf("too many rooms (max is %d)", MAX_ROOMS);
+		dumperr();
+		return -1;
+	}
+	struct room* room = calloc(1, sizeof *room);
+	room->name = strdup(name);
+	room->dir = strdup(dir);
+	room->last_activity_ns = get_nanoseconds_monotonic();
+	room->is_peer_room = (g.is_peer && (room_id == 0));
+	room->is_relay_room = (g.is_relay && (room_id == 0));
+	room->next_artist_id = next_artist_id;
+	struct room* prev = enter_room(room);
+	const int e = setup_datadir(dir);
+	leave_room(prev);
+	if (e<0) {
+		dumperr();
+		close_room(room, 0);
+		return e;
+	}
+	hg.rooms[room_id] = room;
+	atomic_store(&hg.num_rooms, room_id+1);
+	return room_id;
+}
+
 int gig_configure_as_host_and_peer(const char* rootdir)
 {
 	assert(!g.is_configured);
@@ -2733,17 +3635,13 @@ int gig_configure_as_host_and_peer(const char* rootdir)
 	g.is_host = 1;
 	g.is_peer = 1;
 	pg.my_artist_id = 1;
-	hg.next_artist_id = 2;
 	ringbuf_init(&g.peer2host_mim_ringbuf, 16);
 	ringbuf_init(&g.host2peer_activitycache_ringbuf, 12);
-	int e = setup_datadir(rootdir);
-	if (e<0) {
-		dumperr();
-		return e;
-	}
+	const int e = open_room("", rootdir, 2);
+	if (e >= 0) enter_room(get_room(0));
 	H_UNLOCK();
-	//snapshot_copy(&pg.upstream_snapshot, &hg.present_snapshot);
-	return 0;
+	//snapshot_copy(&pg.upstream_snapshot, &room->present_snapshot);
+	return (e<0) ? e : 0;
 }
 
 int gig_configure_as_host_only(const char* rootdir)
@@ -2752,10 +3650,23 @@ int gig_configure_as_host_only(const char* rootdir)
 	g.is_configured = 1;
 	H_LOCK();
 	g.is_host = 1;
-	hg.next_artist_id = 1;
-	const int e = setup_datadir(rootdir);
+	const int e = open_room("", rootdir, 1);
+	if (e >= 0) enter_room(get_room(0));
 	H_UNLOCK();
-	return e;
+	return (e<0) ? e : 0;
+}
+
+int gig_configure_as_relay(const char* rootdir)
+{
+	assert(!g.is_configured);
+	g.is_configured = 1;
+	H_LOCK();
+	g.is_host = 1;
+	g.is_relay = 1;
+	const int e = open_room("", rootdir, -1);
+	if (e >= 0) enter_room(get_room(0));
+	H_UNLOCK();
+	return (e<0) ? e : 0;
 }
 
 int gig_configure_as_peer_only(const char* savedir)
@@ -2764,12 +3675,244 @@ int gig_configure_as_peer_only(const char* savedir)
 	g.is_configured = 1;
 	H_LOCK();
 	g.is_peer = 1;
-	hg.next_artist_id = -1;
-	const int e = setup_datadir(savedir);
+	const int e = open_room("", savedir, -1);
+	if (e >= 0) enter_room(get_room(0));
+	H_UNLOCK();
+	return (e<0) ? e : 0;
+}
+
+static int is_valid_room_name(const char* name)
+{
+	const size_t n = strlen(name);
+	if ((n == 0) || (n > MAX_ROOM_NAME_LENGTH)) return 0;
+	for (size_t i=0; i<n; ++i) {
+		const char c = name[i];
+		const int ok =
+			   (('a' <= c) && (c <= 'z'))
+			|| (('A' <= c) && (c <= 'Z'))
+			|| (('0' <= c) && (c <= '9'))
+			|| (c == '-') || (c == '_');
+		if (!ok) return 0;
+	}
+	return 1;
+}
+
+int gig_add_room(const char* name, const char* dir)
+{
+	assert(g.is_configured);
+	assert(g.is_host);
+	if (g.is_relay) {
+		errf("a relay has only one room");
+		dumperr();
+		return -1;
+	}
+	if (!is_valid_room_name(name)) {
+		errf("invalid room name [%s]", name);
+		dumperr();
+		return -1;
+	}
+	H_LOCK();
+	int e;
+	if (gig_find_room(name) >= 0) {
+		errf("room [%s] already exists", name);
+		dumperr();
+		e = -1;
+	} else {
+		(void)io_mkdir(dir);
+		e = open_room(name, dir, 1);
+	}
+	H_UNLOCK();
+	return e;
+}
+
+int gig_find_room(const char* name)
+{
+	const int num_rooms = atomic_load(&hg.num_rooms);
+	for (int room_id=0; room_id<num_rooms; ++room_id) {
+		if (strcmp(get_room(room_id)->name, name) == 0) return room_id;
+	}
+	return -1;
+}
+
+int gig_get_num_rooms(void)
+{
+	return atomic_load(&hg.num_rooms);
+}
+
+int gig_is_relay_room(int room_id)
+{
+	return get_room(room_id)->is_relay_room;
+}
+
+int64_t relay_get_journal_cursor(void)
+{
+	assert(g.is_relay);
+	H_LOCK();
+	const int64_t jsz = jio_get_size(get_room(0)->jio_journal);
+	H_UNLOCK();
+	return jsz;
+}
+
+// returns the size of the journal record at the start of data, 0 if data ends
+// before the record does, or <0 if it's not a record
+static int64_t get_journal_record_size(const uint8_t* data, int64_t count)
+{
+	if (count == 0) return 0;
+	struct bufstream bs;
+	bufstream_init_from_memory(&bs, data, count);
+	if (bs_read_u8(&bs) != SYNC) return FMTERR(FILENAME_JOURNAL, "expected SYNC");
+	for (int i=0; i<4; ++i) bs_read_leb128(&bs); // timestamp, artist, session, tracer
+	const int64_t num_bytes = bs_read_leb128(&bs);
+	if (bs.error) return 0;
+	const int64_t size = bs.offset + num_bytes;
+	return (size <= count) ? size : 0;
+}
+
+int64_t get_whole_journal_records_size(const void* data, int64_t count)
+{
+	const uint8_t* p = data;
+	int64_t n = 0;
+	for (;;) {
+		const int64_t rn = get_journal_record_size(p+n, count-n);
+		if (rn < 0) return rn;
+		if (rn == 0) return n;
+		n += rn;
+	}
+}
+
+int64_t relay_append_journal(const void* data, int64_t count)
+{
+	assert(g.is_relay);
+	H_LOCK();
+	struct room* room = get_room(0);
+	struct room* prev = enter_room(room);
+	struct jio* jj = room->jio_journal;
+	// only whole records are taken, and only as many as fit in the
+	// journal's ring buffer right now (jio_append() doesn't wait for room)
+	const int64_t room_in_jio = jio_get_buffer_size(jj) - (jio_get_size(jj) - jio_get_flushed_size(jj));
+	const uint8_t* p = data;
+	int64_t n = 0;
+	int64_t e = 0;
+	for (;;) {
+		const int64_t rn = get_journal_record_size(p+n, count-n);
+		if (rn < 0) {
+			e = rn;
+			break;
+		}
+		if (rn > jio_get_buffer_size(jj)) {
+			e = errf("journal record of %lld bytes can never fit in the journal ring buffer", (long long)rn);
+			break;
+		}
+		if ((rn == 0) || ((n+rn) > room_in_jio)) break;
+		n += rn;
+	}
+	if ((e >= 0) && (n > 0)) {
+		struct bufstream bs;
+		bufstream_init_from_memory(&bs, data, n);
+		int64_t max_jam_ts = 0;
+		e = spool_raw_journal_bs(&room->present_snapshot, &bs, n, -1, NULL, &max_jam_ts);
+		if (e >= 0) {
+			// the journal data is appended as-is, so relay journal
+			// offsets are the same as upstream's, and spectators can
+			// continue from them like they would upstream
+			jio_append(jj, data, n);
+			room->last_activity_ns = get_nanoseconds_monotonic();
+			// our jam time follows upstream's; the journal timestamps
+			// are upstream's (see maybe_adjust_jam_time(), which is
+			// the same thing, but noisy because peers don't expect it)
+			const int64_t now = get_microseconds_monotonic();
+			if (max_jam_ts > (now + atomic_load(&room->jam_time_offset_us))) {
+				atomic_store(&room->jam_time_offset_us, max_jam_ts - now);
+			}
+			const int64_t jsz = jio_get_size(jj);
+			if (it_is_time_for_a_snapshotcache_push(jsz)) {
+				snapshotcache_push(&room->present_snapshot, jsz, max_jam_ts);
+			}
+			// see write_derived_files()
+			room->has_unwritten_derived_files = 1;
+		}
+		// XXX if spooling failed, the present snapshot may be partially
+		// spooled; there's no recovering from that short of starting the
+		// relay over
+	}
+	if (e < 0) dumperr();
+	leave_room(prev);
+	H_UNLOCK();
+	return (e < 0) ? e : n;
+}
+
+int gig_acquire_room(int room_id)
+{
+	H_LOCK();
+	struct room* room = get_room(room_id);
+	int e = 0;
+	if (room->is_hibernating) e = room_resume(room);
+	if (e >= 0) {
+		++room->num_users;
+		room->last_activity_ns = get_nanoseconds_monotonic();
+	}
 	H_UNLOCK();
 	return e;
 }
 
+void gig_release_room(int room_id)
+{
+	H_LOCK();
+	struct room* room = get_room(room_id);
+	assert(room->num_users > 0);
+	--room->num_users;
+	room->last_activity_ns = get_nanoseconds_monotonic();
+	H_UNLOCK();
+}
+
+static int64_t snapshot_get_memory_usage(struct snapshot* snap)
+{
+	int64_t n = 0;
+	n += arrcap(snap->book_arr) * sizeof(*snap->book_arr);
+	n += arrcap(snap->document_arr) * sizeof(*snap->document_arr);
+	const int num_docs = arrlen(snap->document_arr);
+	for (int i=0; i<num_docs; ++i) {
+		struct document* doc = &snap->document_arr[i];
+		n += arrcap(doc->name_arr) * sizeof(*doc->name_arr);
+		n += arrcap(doc->docchar_arr) * sizeof(*doc->docchar_arr);
+	}
+	n += arrcap(snap->mim_state_arr) * sizeof(*snap->mim_state_arr);
+	const int num_mim_states = arrlen(snap->mim_state_arr);
+	for (int i=0; i<num_mim_states; ++i) {
+		struct mim_state* ms = &snap->mim_state_arr[i];
+		n += arrcap(ms->caret_arr) * sizeof(*ms->caret_arr);
+	}
+	return n;
+}
+
+void gig_get_room_stats(int room_id, struct gig_room_stats* out_stats)
+{
+	memset(out_stats, 0, sizeof *out_stats);
+	H_LOCK();
+	struct room* room = get_room(room_id);
+	struct snapshot* snap = &room->present_snapshot;
+	out_stats->is_hibernating = room->is_hibernating;
+	out_stats->journal_size = room->is_hibernating
+		? atomic_load(&room->committed_journal_size)
+		: jio_get_size(room->jio_journal);
+	out_stats->num_documents = arrlen(snap->document_arr);
+	out_stats->snapshot_bytes = snapshot_get_memory_usage(snap);
+	const int num_packed_snapshots = arrlen(room->packed_snapshot_arr);
+	for (int i=0; i<num_packed_snapshots; ++i) {
+		out_stats->packed_snapshot_bytes += arrcap(room->packed_snapshot_arr[i].data_arr);
+	}
+	struct jio* jios[] = {
+		room->jio_journal,
+		room->jio_snapshotcache_data,
+		room->jio_snapshotcache_index,
+		room->jio_activitycache,
+	};
+	for (int i=0; i<ARRAY_LENGTH(jios); ++i) {
+		if (jios[i] != NULL) out_stats->io_buffer_bytes += jio_get_buffer_size(jios[i]);
+	}
+	H_UNLOCK();
+}
+
 void gig_unconfigure(void)
 {
 	assert(g.is_configured);
@@ -2777,28 +3920,37 @@ void gig_unconfigure(void)
 
 	H_LOCK();
 
+	const int num_rooms = atomic_load(&hg.num_rooms);
+	if (g.is_host) {
+		struct room* prev = tlg.room;
+		for (int room_id=0; room_id<num_rooms; ++room_id) {
+			enter_room(get_room(room_id));
+			write_derived_files(1);
+		}
+		leave_room(prev);
+	}
+	stop_derived_file_writer();
+
+	for (int room_id=0; room_id<num_rooms; ++room_id) {
+		close_room(get_room(room_id), 1);
+	}
+	tlg.room = NULL;
+
 	// globals (g)
 	if (g.is_host && g.is_peer) {
 		ringbuf_free(&g.peer2host_mim_ringbuf);
 		ringbuf_free(&g.host2peer_activitycache_ringbuf);
 	}
+	memset(&mim_stats, 0, sizeof mim_stats);
 	assert(g.peer2host_mim_ringbuf.buf == NULL);
 	assert(g.host2peer_activitycache_ringbuf.buf == NULL);
 	memset(&g, 0, sizeof g);
 
-	rewax_all();
-
 	// I/O globals (igo)
-	jio_close(igo.jio_journal);
-	jio_close(igo.jio_snapshotcache_data);
-	jio_close(igo.jio_snapshotcache_index);
-	jio_close(igo.jio_activitycache);
 	memset(&igo, 0, sizeof igo);
 
 	// host globals
 	arrfree(hg.bb_arr);
-	arrfree(hg.peer_state_arr);
-	snapshot_free(&hg.present_snapshot);
 	pthread_mutex_t tmp = hg.mutex;
 	memset(&hg, 0, sizeof hg);
 	hg.mutex = tmp;
@@ -2808,6 +3960,10 @@ void gig_unconfigure(void)
 	// peer globals
 	arrfree(pg.bb_arr);
 	arrfree(pg.unackd_mimbuf_arr);
+	arrfree(pg.unackd_footprint.doc_ids_arr);
+	arrfree(pg.unackd_end_mim_ns_arr);
+	arrfree(pg.mim_latency_arr);
+	arrfree(pg.activitycache_entry_arr);
 	snapshot_free(&pg.upstream_snapshot);
 	snapshot_free(&pg.fiddle_snapshot);
 	snapshot_free(&pg.jiggawatt_snapshot);
@@ -2820,15 +3976,30 @@ void gig_set_journal_snapshot_growth_threshold(int t)
 	igo.journal_snapshot_growth_threshold = t;
 }
 
+void gig_set_derived_file_interval_us(int64_t us)
+{
+	assert(us >= 0);
+	igo.derived_file_interval_us = us;
+}
+
+void gig_set_room_hibernation_timeout_us(int64_t us)
+{
+	assert(us >= 0);
+	igo.room_hibernation_timeout_us = us;
+}
+
 void gig_init(void)
 {
 	assert(0 == pthread_mutex_init(&hg.mutex, NULL));
+	assert(0 == pthread_mutex_init(&dfw.mutex, NULL));
+	assert(0 == pthread_cond_init(&dfw.cond, NULL));
 	#ifdef __EMSCRIPTEN__
 	igo.io_port_id = -1;
 	#else
 	igo.io_port_id = io_port_create();
 	#endif
 	gig_set_journal_snapshot_growth_threshold(2000);
+	gig_set_derived_file_interval_us(500000);
 }
 
 void get_time_travel_range(int64_t* out_ts0, int64_t* out_ts1)
@@ -2911,6 +4082,7 @@ void render_activity(uint8_t* image1d, int image1d_width, int64_t ts0, int64_t t
 
 static void suspend_time_ex(int64_t seek_ts)
 {
+	struct room* room = current_room();
 	if (seek_ts < 0) {
 		pg.is_time_travelling = 0;
 		return;
@@ -2920,7 +4092,7 @@ static void suspend_time_ex(int64_t seek_ts)
 	struct snapshot* snap = &pg.jiggawatt_snapshot;
 	snapshot_free(snap);
 
-	struct jio* jidx = igo.jio_snapshotcache_index;
+	struct jio* jidx = room->jio_snapshotcache_index;
 	const int64_t size = jio_get_size(jidx);
 	const int num = get_num_snapshotcache_index_entries_from_size(size);
 	int left = 0;
@@ -2956,7 +4128,7 @@ static void suspend_time_ex(int64_t seek_ts)
 		restore_snapshot_from_disk(snap, snapshot_manifest_offset, &journal_spool_offset);
 	}
 
-	struct jio* jj = igo.jio_journal;
+	struct jio* jj = room->jio_journal;
 
 	const int64_t jjsz = jio_get_size(jj);
 	if (journal_spool_offset  > jjsz) {
@@ -2989,11 +4161,6 @@ void unsuspend_time(void)
 	suspend_time_ex(-1);
 }
 
-// TODO: optimize snapshot_copy() by using content hashing or maybe even some
-// merkel-chain stuff to avoid having to hash the entire document for every
-// single edit (although I'm okay with large docs, like stdlib.mie, being less
-// performant when editing them, so content hashing is probably fine)
-
 // TODO: optimize suspend_time_at(): the previous call should know which time
 // interval it ended up restoring, so if the following call is within the same
 // interval, it's a no-op and should return immediately
@@ -111,6 +111,7 @@ struct book {
 struct document {
 	int book_id, doc_id;
 	uint64_t snapshotcache_offset;
+	int64_t edit_sequence; // changes on every edit; see doc_edit()
 	// (update snapshot_copy() when adding arr-fields here:)
 	char* name_arr;
 	struct docchar* docchar_arr;
@@ -163,6 +164,39 @@ void gig_init(void);
 void gig_set_journal_snapshot_growth_threshold(int);
 int peer_tick(void);
 int host_tick(void);
+int64_t gig_get_wait_timeout_us(void);
+// how long io_wait() may sleep before host_tick() has something to do that
+// isn't triggered by I/O (writing debounced derived files, or hibernating an
+// idle room); -1 if nothing
+
+void gig_set_derived_file_interval_us(int64_t);
+// derived files (.cc/.txt versions of the documents, in the cache dir) are
+// written by a background thread at most this often (default: 500ms), and
+// only for documents that changed. they're also written by gig_unconfigure()
+
+struct gig_queue_stats {
+	int64_t size;       // current ring buffer size, in bytes
+	int64_t max_depth;  // high-water mark of bytes in the ring buffer
+	int64_t max_spill;  // high-water mark of bytes kept by the writer because
+	                    // the ring buffer was full
+	int64_t num_spills; // number of records that had to be kept
+};
+void gig_get_queue_stats(struct gig_queue_stats* out_peer2host, struct gig_queue_stats* out_host2peer);
+// stats for the queues between the peer and the host when both run in the
+// same process (peer2host: mims, host2peer: activitycache entries). either
+// can be NULL
+
+struct gig_mim_stats {
+	int64_t num_mims;         // mims committed to the journal
+	int64_t num_bytes;        // mim data committed to the journal
+	int64_t num_bytes_copied; // bytes copied on the way (headers included)
+	int64_t num_allocations;  // buffer (re)allocations on the way
+};
+void gig_get_mim_stats(struct gig_mim_stats* out_stats);
+// counters for the path mims take from the local peer (or a websocket) to the
+// journal, since gig_configure_*(). a local peer's mim is copied into its
+// unacknowledged mims, into the peer2host queue, and into the journal write
+// buffer, so num_bytes_copied should stay around 3*num_bytes
 
 int gig_configure_as_host_and_peer(const char* rootdir);
 // configure gig to be both host and peer (example: you're performing with the
@@ -175,13 +209,78 @@ int gig_configure_as_peer_only(const char* savedir);
 // configure gig to be peer-only (example: you join somebody else's host,
 // whether on LAN or over internet)
 
+int gig_configure_as_relay(const char* rootdir);
+// configure gig to be a relay: a host whose only room is a read-only copy of
+// a room on an upstream host, fed with relay_append_journal(). its webserv
+// serves spectators (snapshot bootstraps and journal updates) without
+// bothering the upstream host with them (see relay.h)
+
 void gig_unconfigure(void);
 
+int gig_add_room(const char* name, const char* dir);
+// adds a room to a host: a separate jam with its own journal in dir (created
+// if it doesn't exist), served by the same io port and webserv as the other
+// rooms (example: a headless server hosting many small jams). returns the
+// room id, or <0 on error. the room set up by gig_configure_*() is room 0 (and
+// its name is ""); names are [A-Za-z0-9_-]. rooms stay until
+// gig_unconfigure()
+
+int gig_find_room(const char* name);
+// returns the room id for name, or -1 if there's no such room
+int gig_get_num_rooms(void);
+
+int gig_is_relay_room(int room_id);
+// returns 1 if room_id is a relay's room; its spectators can't commit mims
+
+int64_t relay_get_journal_cursor(void);
+// the relay's journal size, which is also the upstream journal offset to
+// continue from
+int64_t relay_append_journal(const void* data, int64_t count);
+// spools upstream journal data into the relay room and appends it to its
+// journal. only whole records are taken, and not more than the journal can
+// buffer right now; returns how many bytes were taken (call again with the
+// rest later), or <0 on error (bad data)
+
+int gig_acquire_room(int room_id);
+void gig_release_room(int room_id);
+// a room is in use while it's acquired (e.g. by a websocket connection).
+// gig_acquire_room() resumes the room if it's hibernating, and returns <0 if
+// that failed
+
+void gig_set_room_hibernation_timeout_us(int64_t);
+// rooms that aren't in use (see gig_acquire_room()) and haven't had commits
+// for this long hibernate: a final snapshotcache entry is written, the journal
+// and caches are closed, and the present snapshot is freed. the local peer's
+// room never hibernates. 0 (the default) disables hibernation
+
+struct gig_room_stats {
+	int is_hibernating;
+	int64_t journal_size;
+	int num_documents;
+	int64_t snapshot_bytes;        // memory used by the present snapshot
+	int64_t packed_snapshot_bytes; // packed snapshots for bootstrapping peers
+	int64_t io_buffer_bytes;       // journal and cache write buffers
+};
+void gig_get_room_stats(int room_id, struct gig_room_stats* out_stats);
+// per-room memory accounting (allocated sizes, not just used sizes)
+
 void peer_set_artificial_mim_latency(double mean, double variance);
 // latency to add to mim commands for simulating roundtrip latency. values are
 // in seconds: mean is mu in the normal distribution, and variance is
 // sigma-squared
 
+struct gig_mim_latency {
+	int64_t tracer;
+	int64_t upstream_ns; // until the host's record was in the upstream snapshot
+	int64_t respool_ns;  // until the fiddle snapshot was re-spooled after that
+};
+void peer_set_mim_latency_tracking(int enable);
+int peer_take_mim_latencies(struct gig_mim_latency* out_latencies, int max_count);
+// with tracking enabled, the time from every peer_end_mim() until the mim
+// came back from the host is recorded (see get_nanoseconds_monotonic()).
+// peer_take_mim_latencies() moves up to max_count of them out, oldest first,
+// and returns how many. for benchmarking the prediction path
+
 
 //void gig_maybe_setup_stub(void);
 
@@ -223,20 +322,46 @@ struct snapshot* get_snapshot(void);
 int get_my_artist_id(void);
 void set_my_artist_id(int);
 
-int alloc_artist_id(void);
+int alloc_artist_id(int room_id);
 void free_artist_id(int);
 
-int copy_journal(void* dst, int64_t count, int64_t offset);
+#define JOURNAL_HEADER_SIZE (8*4)
+// journal data (records) starts after the header; it's the journal cursor of
+// an empty journal
+
+int copy_journal(int room_id, void* dst, int64_t count, int64_t offset);
+int get_journal_file_id(int room_id, int64_t* out_flushed_size);
+// returns the file id of DO_JAM_JOURNAL for reading it directly (e.g. with
+// io_port_sendfile()), or -1 if there's no journal. journal data beyond
+// out_flushed_size may not be in the file yet; use copy_journal() for that
+
+int64_t get_committed_journal_size(int room_id);
+// journal data before this has been committed by host_tick(), and can be
+// sent to peers (it's what webserv_broadcast_journal() is given)
 
-void commit_mim_to_host(int artist_id, int session_id, int64_t tracer, uint8_t* data, int count);
+int64_t get_whole_journal_records_size(const void* data, int64_t count);
+// returns how many bytes at the start of data are whole journal records (the
+// rest is the start of a record that isn't complete yet), or <0 if data isn't
+// journal data. peer_spool_raw_journal_into_upstream_snapshot() only takes
+// whole records
+
+void commit_mim_to_host(int room_id, int artist_id, int session_id, int64_t tracer, uint8_t* data, int count);
 
 int64_t restore_upstream_snapshot_from_data(void* data, size_t sz);
 
 int peer_spool_raw_journal_into_upstream_snapshot(void* data, int64_t count);
 
-void* get_present_snapshot_data(size_t* out_size);
+void* get_present_snapshot_data(int room_id, size_t* out_size);
 // returns snapshot data. you're responsible for free()ing it when done
 
+const void* acquire_present_snapshot_data(int room_id, size_t* out_size, int64_t* out_journal_offset);
+void release_present_snapshot_data(const void*);
+// like get_present_snapshot_data(), but returns a shared, cached copy that is
+// only re-packed when the present snapshot has changed. out_journal_offset is
+// the journal offset the snapshot corresponds to (peers continue from there).
+// the data remains valid until it's released; every acquire must be paired
+// with a release
+
 int64_t get_monotonic_jam_time_us(void);
 
 void get_time_travel_range(int64_t* out_ts0, int64_t* out_ts1);
@@ -3,12 +3,36 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <signal.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+
+#include <stdatomic.h>
 
 #ifdef __linux__
 #include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#endif
+
+// epoll is used on linux unless IO_USE_POLL is defined; poll(2) is the
+// portable fallback
+#if defined(__linux__) && !defined(IO_USE_POLL)
+#define IO_EPOLL
+#include <sys/epoll.h>
+#endif
+
+// with IO_URING defined, io_uring is used when the kernel supports it, and
+// epoll otherwise
+#ifdef IO_URING
+#ifndef IO_EPOLL
+#error "IO_URING needs the epoll backend (linux, and not IO_USE_POLL)"
+#endif
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 #endif
 
 #ifdef __FreeBSD__
@@ -17,9 +41,11 @@
 #endif
 
 #include <netinet/in.h>
+#include <netdb.h>
 #include <arpa/inet.h>
 
 #include "stb_ds_sysalloc.h"
+#include "lockstat.h"
 #include "io.h"
 
 const char* io_error_to_string(int error)
@@ -41,6 +67,9 @@ enum submission_type {
 	SUBMISSION_PWRITE,
 	SUBMISSION_SENDFILE,
 	SUBMISSION_SENDFILEALL,
+	SUBMISSION_WRITEV,
+	SUBMISSION_PWRITEV,
+	SUBMISSION_CONNECT, // see io_port_connect()
 	// TODO send/recv?
 	INTERNAL_ACCEPT,
 };
@@ -49,6 +78,7 @@ struct submission {
 	int port_id;
 	enum submission_type type;
 	io_echo echo;
+	int64_t num_done; // bytes of an "all" write done by earlier attempts
 	union {
 		struct {
 			void* ptr;
@@ -73,6 +103,12 @@ struct submission {
 			int64_t count;
 			int64_t src_offset;
 		} sendfile;
+		struct {
+			const struct io_vec* vecs;
+			int num_vecs;
+			int64_t skip; // bytes of vecs[0] already written
+			int64_t offset; // SUBMISSION_PWRITEV only
+		} writev;
 	};
 };
 
@@ -80,6 +116,7 @@ enum file_type {
 	DISK,
 	LISTEN,
 	SOCKET,
+	DATAGRAM, // UDP; see io_open_udp()
 };
 
 struct file {
@@ -88,46 +125,334 @@ struct file {
 	int posix_fd;
 	struct submission* submission_arr;
 	struct sockaddr_in addr;
-	int is_pipe_destination;
-	int num_pipe_destinations;
-	int num_close;
+	int num_pipe_destinations; // pending sendfile submissions reading from this file
+	// POLLIN/POLLOUT known to be ready. with poll(2) it's only valid during
+	// io_tick(); with epoll it's kept up to date with edge-triggered events
+	int revents;
 	int do_close;
+	unsigned is_unpollable :1; // always ready (epoll doesn't do regular files)
+	#ifdef IO_EPOLL
+	unsigned is_registered :1; // added to the epoll set
+	unsigned is_kicked     :1; // in g.kick_file_id_arr
+	unsigned is_collecting :1;
+	#endif
+	#ifdef IO_URING
+	unsigned is_reading    :1; // read-type submission in flight
+	unsigned is_writing    :1; // write-type submission in flight
+	#endif
+	int num_inflight; // submissions started, but not completed (io_uring only)
 };
 
 struct listen {
 	io_echo echo;
 	int posix_fd;
+	int is_accepting; // io_uring only
 };
 
+// ports are never destroyed, and they don't move once created, so
+// io_port_poll() can find a port without G_LOCK. events have their own lock;
+// the I/O thread delivering events doesn't block the threads polling them for
+// longer than it takes to append them
+#define MAX_PORTS (1<<10)
+
 struct port {
 	int port_id;
+	pthread_mutex_t event_mutex;
+	struct lock_stats event_lock_stats;
 	struct io_event* event_arr;
-	struct listen* listen_arr;
+	int event_head; // index of the next event in event_arr
+	struct listen* listen_arr; // G_LOCK
 };
 
 struct fire {
+	int file_id;
 	int posix_fd;
 	int status;
+	int error; // errno if status is -1
+	struct sockaddr_in addr; // INTERNAL_ACCEPT
 	struct submission sub;
-	unsigned did_resub  :1;
+	// more writes done by the same syscall; see coalesce_writes()
+	struct submission* coalesced_arr;
+	struct iovec* iov_arr; // set for vectored writes
+	// number of trailing submissions (of sub and coalesced_arr) that were
+	// resubmitted; they get no events
+	int num_resubs;
+};
+
+struct file_index {
+	int key;
+	int value;
+};
+
+#ifdef IO_URING
+#define URING_ENTRIES (256)
+#define MAX_URING_OPS (4*URING_ENTRIES) // also the CQ size, so it can't overflow
+
+struct uring_op {
+	struct fire fire;
+	socklen_t addrlen; // INTERNAL_ACCEPT
 };
+#endif
 
 static struct {
-	int port_id_sequence;
 	int file_id_sequence;
 	pthread_mutex_t mutex;
+	struct lock_stats lock_stats;
 	struct file* file_arr;
-	struct port* port_arr;
+	struct file_index* file_index_map; // file_id => index in file_arr
+	struct port* ports[MAX_PORTS]; // port_id-1 => port
+	_Atomic(int) num_ports;
+	#ifdef IO_EPOLL
+	int epoll_fd;
+	int has_epoll_fd;
+	// files to look at in the next io_tick() regardless of epoll; files
+	// that can't be polled, and files that are ready to be closed
+	int* kick_file_id_arr;
+	#endif
+	// io_wait()/io_wake() state; wake_fds is an eventfd (both elements) on
+	// linux, and a pipe elsewhere
+	int wake_fds[2];
+	int has_wake_fds;
+	_Atomic(int) is_waiting;
+	_Atomic(int) is_wake_pending;
+	#ifdef IO_URING
+	struct {
+		int state; // 0: not set up yet, 1: in use, -1: not available
+		int ring_fd;
+		unsigned sq_entries;
+		unsigned* sq_head;
+		unsigned* sq_tail;
+		unsigned* sq_mask;
+		unsigned* sq_array;
+		unsigned* cq_head;
+		unsigned* cq_tail;
+		unsigned* cq_mask;
+		struct io_uring_sqe* sqes;
+		struct io_uring_cqe* cqes;
+		struct uring_op* ops;
+		int* free_op_arr;
+	} uring;
+	#endif
 } g;
 
+// at most this many iovecs are written by a single writev()/pwritev(); also
+// limits how many submissions are coalesced
+#define MAX_IOVECS (64)
+
+static int64_t get_writev_count(struct submission* sub)
+{
+	int64_t count = -sub->writev.skip;
+	for (int i=0; i<sub->writev.num_vecs; ++i) count += sub->writev.vecs[i].count;
+	return count;
+}
+
+// returns the number of bytes a write-type submission wants to write
+static int64_t get_write_count(struct submission* sub)
+{
+	switch (sub->type) {
+	case SUBMISSION_WRITE:
+	case SUBMISSION_WRITEALL:
+		return sub->write.count;
+	case SUBMISSION_PWRITE:
+		return sub->pwrite.count;
+	case SUBMISSION_WRITEV:
+	case SUBMISSION_PWRITEV:
+		return get_writev_count(sub);
+	case SUBMISSION_SENDFILE:
+	case SUBMISSION_SENDFILEALL:
+		return sub->sendfile.count;
+	default: assert(!"not a write submission");
+	}
+}
+
+// writes that can be coalesced with other writes in the same group (a write
+// that isn't "all" can't; its event must tell how much was written)
+#define WRITE_GROUP_STREAM     (1)
+#define WRITE_GROUP_POSITIONAL (2)
+static int get_write_group(struct submission* sub)
+{
+	switch (sub->type) {
+	case SUBMISSION_WRITEALL:
+	case SUBMISSION_WRITEV:
+		return WRITE_GROUP_STREAM;
+	case SUBMISSION_PWRITE:
+	case SUBMISSION_PWRITEV:
+		return WRITE_GROUP_POSITIONAL;
+	default:
+		return 0;
+	}
+}
+
+static int64_t get_pwrite_offset(struct submission* sub)
+{
+	switch (sub->type) {
+	case SUBMISSION_PWRITE:  return sub->pwrite.offset;
+	case SUBMISSION_PWRITEV: return sub->writev.offset;
+	default: assert(!"not a positional write");
+	}
+}
+
+static int get_num_iovecs(struct submission* sub)
+{
+	switch (sub->type) {
+	case SUBMISSION_WRITEV:
+	case SUBMISSION_PWRITEV:
+		return sub->writev.num_vecs;
+	default:
+		return 1;
+	}
+}
+
+static void add_iovecs(struct iovec** iov_arr, struct submission* sub)
+{
+	switch (sub->type) {
+	case SUBMISSION_WRITEALL:
+		arrput(*iov_arr, ((struct iovec) { .iov_base = (void*)sub->write.ptr, .iov_len = sub->write.count }));
+		break;
+	case SUBMISSION_PWRITE:
+		arrput(*iov_arr, ((struct iovec) { .iov_base = (void*)sub->pwrite.ptr, .iov_len = sub->pwrite.count }));
+		break;
+	case SUBMISSION_WRITEV:
+	case SUBMISSION_PWRITEV:
+		for (int i=0; i<sub->writev.num_vecs; ++i) {
+			const struct io_vec* v = &sub->writev.vecs[i];
+			const int64_t skip = (i == 0) ? sub->writev.skip : 0;
+			arrput(*iov_arr, ((struct iovec) { .iov_base = (uint8_t*)v->ptr + skip, .iov_len = v->count - skip }));
+		}
+		break;
+	default: assert(!"unhandled submission type");
+	}
+}
+
+// skips the first count bytes of a partially done "all" write
+static void advance_write(struct submission* sub, int64_t count)
+{
+	assert((0 <= count) && (count < get_write_count(sub)));
+	sub->num_done += count;
+	switch (sub->type) {
+	case SUBMISSION_WRITEALL:
+		sub->write.ptr   += count;
+		sub->write.count -= count;
+		break;
+	case SUBMISSION_PWRITE:
+		sub->pwrite.ptr    += count;
+		sub->pwrite.count  -= count;
+		sub->pwrite.offset += count;
+		break;
+	case SUBMISSION_WRITEV:
+	case SUBMISSION_PWRITEV:
+		if (sub->type == SUBMISSION_PWRITEV) sub->writev.offset += count;
+		sub->writev.skip += count;
+		while (sub->writev.skip >= sub->writev.vecs[0].count) {
+			sub->writev.skip -= sub->writev.vecs[0].count;
+			++sub->writev.vecs;
+			--sub->writev.num_vecs;
+			assert(sub->writev.num_vecs > 0);
+		}
+		break;
+	case SUBMISSION_SENDFILEALL:
+		sub->sendfile.src_offset += count;
+		sub->sendfile.count      -= count;
+		break;
+	default: assert(!"unhandled submission type");
+	}
+}
+
+// takes writes that can be done along with fire's write out of the file's
+// submissions, starting at index (where fire's submission was), so a burst of
+// small writes (e.g. websocket frames or journal appends) becomes a single
+// writev()/pwritev(). stream writes are coalesced with the following stream
+// writes, and positional writes with the following contiguous positional
+// writes. reads and closes are skipped over (they're independent of writes,
+// and closes wait anyway); anything else stops it, so write order is kept
+static void coalesce_writes(struct file* file, int index, struct fire* fire)
+{
+	const int group = get_write_group(&fire->sub);
+	if (group == 0) return;
+	int num_iovecs = get_num_iovecs(&fire->sub);
+	int64_t offset = (group == WRITE_GROUP_POSITIONAL) ? (get_pwrite_offset(&fire->sub) + get_write_count(&fire->sub)) : 0;
+	int num_subs = arrlen(file->submission_arr);
+	for (int i=index; i<num_subs; ++i) {
+		struct submission* sub = &file->submission_arr[i];
+		if ((sub->type == SUBMISSION_CLOSE) || (sub->type == SUBMISSION_READ) || (sub->type == SUBMISSION_PREAD)) continue;
+		if (get_write_group(sub) != group) break;
+		if ((group == WRITE_GROUP_POSITIONAL) && (get_pwrite_offset(sub) != offset)) break;
+		if ((num_iovecs + get_num_iovecs(sub)) > MAX_IOVECS) break;
+		num_iovecs += get_num_iovecs(sub);
+		if (group == WRITE_GROUP_POSITIONAL) offset += get_write_count(sub);
+		arrput(fire->coalesced_arr, *sub);
+		arrdel(file->submission_arr, i);
+		--i;
+		--num_subs;
+	}
+
+	if ((fire->coalesced_arr == NULL) && ((fire->sub.type == SUBMISSION_WRITEALL) || (fire->sub.type == SUBMISSION_PWRITE))) return;
+	add_iovecs(&fire->iov_arr, &fire->sub);
+	const int num_coalesced = arrlen(fire->coalesced_arr);
+	for (int i=0; i<num_coalesced; ++i) add_iovecs(&fire->iov_arr, &fire->coalesced_arr[i]);
+	assert(arrlen(fire->iov_arr) == num_iovecs);
+}
+
+static int get_fire_num_subs(struct fire* fire)
+{
+	return 1 + arrlen(fire->coalesced_arr);
+}
+
+static struct submission* get_fire_sub(struct fire* fire, int index)
+{
+	assert((0 <= index) && (index < get_fire_num_subs(fire)));
+	return (index == 0) ? &fire->sub : &fire->coalesced_arr[index-1];
+}
+
+static int64_t get_fire_write_count(struct fire* fire)
+{
+	const int num_subs = get_fire_num_subs(fire);
+	int64_t count = 0;
+	for (int i=0; i<num_subs; ++i) count += get_write_count(get_fire_sub(fire, i));
+	return count;
+}
+
 static int alloc_file_id(void)
 {
 	return ++g.file_id_sequence;
 }
 
+static void put_file(struct file file)
+{
+	hmput(g.file_index_map, file.file_id, arrlen(g.file_arr));
+	arrput(g.file_arr, file);
+}
+
+static void del_file(int index)
+{
+	assert((0 <= index) && (index < arrlen(g.file_arr)));
+	assert(hmdel(g.file_index_map, g.file_arr[index].file_id));
+	arrdelswap(g.file_arr, index);
+	if (index < arrlen(g.file_arr)) {
+		hmput(g.file_index_map, g.file_arr[index].file_id, index);
+	}
+}
+
+static struct file* find_file(int file_id)
+{
+	assert(file_id >= 0);
+	const int i = hmgeti(g.file_index_map, file_id);
+	if (i < 0) return NULL;
+	struct file* file = &g.file_arr[g.file_index_map[i].value];
+	assert(file->file_id == file_id);
+	return file;
+}
+
+static struct file* get_file(int file_id)
+{
+	struct file* file = find_file(file_id);
+	assert((file != NULL) && "file id not found");
+	return file;
+}
+
 static void G_LOCK(void)
 {
-	assert(0 == pthread_mutex_lock(&g.mutex));
+	lockstat_mutex_lock(&g.mutex, &g.lock_stats);
 }
 
 static void G_UNLOCK(void)
@@ -135,6 +460,241 @@ static void G_UNLOCK(void)
 	assert(0 == pthread_mutex_unlock(&g.mutex));
 }
 
+// the port's events. may be taken while holding G_LOCK, but not the other way
+// around
+static void PORT_LOCK(struct port* port)
+{
+	lockstat_mutex_lock(&port->event_mutex, &port->event_lock_stats);
+}
+
+static void PORT_UNLOCK(struct port* port)
+{
+	assert(0 == pthread_mutex_unlock(&port->event_mutex));
+}
+
+static struct port* get_port(int port_id)
+{
+	assert((1 <= port_id) && (port_id <= atomic_load(&g.num_ports)) && "port id does not exist");
+	return g.ports[port_id-1];
+}
+
+// like the epoll instance, the wakeup fd is created on demand. G_LOCK must be
+// held
+static int get_wake_fd(void)
+{
+	if (!g.has_wake_fds) {
+		#ifdef __linux__
+		const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd == -1) {
+			fprintf(stderr, "eventfd(): %s\n", strerror(errno));
+			abort();
+		}
+		g.wake_fds[0] = g.wake_fds[1] = fd;
+		#else
+		if (pipe(g.wake_fds) == -1) {
+			fprintf(stderr, "pipe(): %s\n", strerror(errno));
+			abort();
+		}
+		for (int i=0; i<2; ++i) {
+			fcntl(g.wake_fds[i], F_SETFL, O_NONBLOCK);
+			fcntl(g.wake_fds[i], F_SETFD, FD_CLOEXEC);
+		}
+		#endif
+		g.has_wake_fds = 1;
+	}
+	return g.wake_fds[0];
+}
+
+#ifdef IO_EPOLL
+// the epoll instance is created on demand because not everybody calls
+// io_init() (a zeroed mutex works fine). G_LOCK must be held
+static int get_epoll_fd(void)
+{
+	if (!g.has_epoll_fd) {
+		g.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (g.epoll_fd == -1) {
+			fprintf(stderr, "epoll_create1(): %s\n", strerror(errno));
+			abort();
+		}
+		g.has_epoll_fd = 1;
+	}
+	return g.epoll_fd;
+}
+#endif
+
+#ifdef IO_URING
+static int uring_setup(void)
+{
+	struct io_uring_params p = {
+		.flags = IORING_SETUP_CQSIZE,
+		.cq_entries = MAX_URING_OPS,
+	};
+	const int ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring_fd < 0) {
+		fprintf(stderr, "io_uring_setup(): %s; using epoll\n", strerror(errno));
+		return -1;
+	}
+	// FAST_POLL (linux 5.7) means that socket I/O waits for readiness
+	// internally instead of being punted to a worker thread
+	const unsigned required_features = (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL);
+	if ((p.features & required_features) != required_features) {
+		fprintf(stderr, "io_uring lacks features (has 0x%x); using epoll\n", p.features);
+		close(ring_fd);
+		return -1;
+	}
+	assert(p.cq_entries >= MAX_URING_OPS);
+
+	size_t ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	const size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_size > ring_size) ring_size = cq_size;
+	uint8_t* ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	struct io_uring_sqe* sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if ((ring == MAP_FAILED) || (sqes == MAP_FAILED)) {
+		fprintf(stderr, "io_uring mmap(): %s; using epoll\n", strerror(errno));
+		close(ring_fd);
+		return -1;
+	}
+
+	g.uring.ring_fd    = ring_fd;
+	g.uring.sq_entries = p.sq_entries;
+	g.uring.sq_head    = (unsigned*)(ring + p.sq_off.head);
+	g.uring.sq_tail    = (unsigned*)(ring + p.sq_off.tail);
+	g.uring.sq_mask    = (unsigned*)(ring + p.sq_off.ring_mask);
+	g.uring.sq_array   = (unsigned*)(ring + p.sq_off.array);
+	g.uring.cq_head    = (unsigned*)(ring + p.cq_off.head);
+	g.uring.cq_tail    = (unsigned*)(ring + p.cq_off.tail);
+	g.uring.cq_mask    = (unsigned*)(ring + p.cq_off.ring_mask);
+	g.uring.cqes       = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+	g.uring.sqes       = sqes;
+	// ops are referenced by the kernel (accept addresses), so they must not
+	// move; hence no stb_ds array
+	g.uring.ops = calloc(MAX_URING_OPS, sizeof *g.uring.ops);
+	for (int i=MAX_URING_OPS-1; i>=0; --i) arrput(g.uring.free_op_arr, i);
+	return 0;
+}
+
+// decides between io_uring and epoll on first use (like get_epoll_fd(),
+// because io_init() is optional). G_LOCK must be held
+static int use_uring(void)
+{
+	if (g.uring.state == 0) g.uring.state = (uring_setup() == 0) ? 1 : -1;
+	return g.uring.state > 0;
+}
+
+static int is_uring_in_use(void)
+{
+	G_LOCK();
+	const int r = use_uring();
+	G_UNLOCK();
+	return r;
+}
+
+// prepares an SQE for fire (to be submitted by uring_submit()). returns -1 if
+// the SQ ring is full, or too many ops are in flight
+static int uring_prep(struct fire* fire)
+{
+	const unsigned tail = *g.uring.sq_tail;
+	const unsigned head = __atomic_load_n(g.uring.sq_head, __ATOMIC_ACQUIRE);
+	if (((tail - head) >= g.uring.sq_entries) || (arrlen(g.uring.free_op_arr) == 0)) return -1;
+	const int op_index = arrpop(g.uring.free_op_arr);
+	struct uring_op* op = &g.uring.ops[op_index];
+	op->fire = *fire;
+
+	const unsigned index = (tail & *g.uring.sq_mask);
+	struct io_uring_sqe* sqe = &g.uring.sqes[index];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->fd = fire->posix_fd;
+	sqe->user_data = op_index;
+	struct submission* sub = &fire->sub;
+	// counts are clamped, which is fine because partial reads/writes are
+	// handled anyway (except for PREAD/PWRITE which are never that big)
+	const int64_t max_count = (1L << 30);
+	if (fire->iov_arr != NULL) {
+		// vectored and/or coalesced writes (see coalesce_writes()).
+		// op->fire.iov_arr stays put until completion
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->addr = (uintptr_t)op->fire.iov_arr;
+		sqe->len = arrlen(op->fire.iov_arr);
+		sqe->off = (get_write_group(sub) == WRITE_GROUP_POSITIONAL) ? (uint64_t)get_pwrite_offset(sub) : (uint64_t)-1;
+		g.uring.sq_array[index] = index;
+		__atomic_store_n(g.uring.sq_tail, tail+1, __ATOMIC_RELEASE);
+		return 0;
+	}
+	switch (sub->type) {
+	case SUBMISSION_CLOSE:
+		sqe->opcode = IORING_OP_CLOSE;
+		break;
+	case SUBMISSION_READ:
+		sqe->opcode = IORING_OP_READ;
+		sqe->addr = (uintptr_t)sub->read.ptr;
+		sqe->len = (sub->read.count < max_count) ? sub->read.count : max_count;
+		sqe->off = (uint64_t)-1; // current position; required for sockets/pipes
+		break;
+	case SUBMISSION_WRITE:
+	case SUBMISSION_WRITEALL:
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->addr = (uintptr_t)sub->write.ptr;
+		sqe->len = (sub->write.count < max_count) ? sub->write.count : max_count;
+		sqe->off = (uint64_t)-1;
+		break;
+	case SUBMISSION_PREAD:
+		assert(sub->pread.count < max_count);
+		sqe->opcode = IORING_OP_READ;
+		sqe->addr = (uintptr_t)sub->pread.ptr;
+		sqe->len = sub->pread.count;
+		sqe->off = sub->pread.offset;
+		break;
+	case SUBMISSION_PWRITE:
+		assert(sub->pwrite.count < max_count);
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->addr = (uintptr_t)sub->pwrite.ptr;
+		sqe->len = sub->pwrite.count;
+		sqe->off = sub->pwrite.offset;
+		break;
+	case SUBMISSION_SENDFILE:
+	case SUBMISSION_SENDFILEALL:
+		// io_uring has no sendfile, and splice needs a pipe in between,
+		// which means two linked ops and leftovers in the pipe when the
+		// socket takes less than the pipe has. instead the destination is
+		// polled for writability, and sendfile(2) is done on completion
+	case SUBMISSION_CONNECT:
+		// (the connect(2) is already underway; see io_port_connect())
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLOUT;
+		break;
+	case INTERNAL_ACCEPT:
+		op->addrlen = sizeof op->fire.addr;
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->addr = (uintptr_t)&op->fire.addr;
+		sqe->addr2 = (uintptr_t)&op->addrlen;
+		sqe->accept_flags = SOCK_NONBLOCK;
+		break;
+	default: assert(!"unhandled submission type");
+	}
+	g.uring.sq_array[index] = index;
+	__atomic_store_n(g.uring.sq_tail, tail+1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// submits all prepared SQEs with one syscall. returns 1 if anything was
+// submitted
+static int uring_submit(void)
+{
+	const unsigned num_pending = (*g.uring.sq_tail - __atomic_load_n(g.uring.sq_head, __ATOMIC_ACQUIRE));
+	if (num_pending == 0) return 0;
+	const int e = syscall(__NR_io_uring_enter, g.uring.ring_fd, num_pending, 0, 0, NULL, 0);
+	if (e < 0) {
+		if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+			return 1; // try again next tick
+		}
+		fprintf(stderr, "io_uring_enter(): %s\n", strerror(errno));
+		abort();
+	}
+	return 1;
+}
+
+#endif
+
 static int pwriten(int posix_fd, const void* ptr, int64_t count, int64_t offset)
 {
 	int64_t remaining = count;
@@ -199,23 +759,60 @@ int io_mkdir(const char* path)
 
 int io_write_file(const char* path, const void* ptr, int64_t count)
 {
-	const int fd = open(path, O_WRONLY | O_CREAT, 0666);
+	// written to a temporary file which is then renamed to path, so readers
+	// see either the old or the new version, never a partial one
+	char tmp_path[1<<14];
+	if (snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path) >= (int)sizeof tmp_path) return IO_BAD_PATH;
+	const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
 	if (fd == -1) {
-		FIXME_NOW()
+		switch (errno) {
+		case EPERM:
+		case EACCES:
+			return IO_NOT_PERMITTED;
+		case ENOENT:
+		case ENOTDIR:
+			return IO_BAD_PATH;
+		default: return IO_ERROR;
+		}
 	}
-	int e = ftruncate(fd, 0);
-	if (e == -1) {
-		FIXME_NOW()
+	const int e0 = pwriten(fd, ptr, count, 0);
+	const int e1 = close(fd);
+	if ((e0 == -1) || (e1 == -1) || (rename(tmp_path, path) == -1)) {
+		unlink(tmp_path);
+		return IO_ERROR;
 	}
-	e = pwriten(fd, ptr, count, 0);
-	if (e == -1) {
-		FIXME_NOW()
+	return 0;
+}
+
+int io_rename(const char* old_path, const char* new_path)
+{
+	if (0 == rename(old_path, new_path)) return 0;
+	switch (errno) {
+	case EPERM:
+	case EACCES:
+		return IO_NOT_PERMITTED;
+	case ENOENT:
+		return IO_NOT_FOUND;
+	case ENOTDIR:
+	case EINVAL:
+		return IO_BAD_PATH;
+	default: return IO_ERROR;
 	}
-	e = close(fd);
-	if (e == -1) {
-		FIXME_NOW()
+}
+
+int io_unlink(const char* path)
+{
+	if (0 == unlink(path)) return 0;
+	switch (errno) {
+	case EPERM:
+	case EACCES:
+		return IO_NOT_PERMITTED;
+	case ENOENT:
+		return IO_NOT_FOUND;
+	case ENOTDIR:
+		return IO_BAD_PATH;
+	default: return IO_ERROR;
 	}
-	return 0;
 }
 
 int io_open(const char* path, enum io_open_mode mode, int64_t* out_filesize)
@@ -261,7 +858,7 @@ int io_open(const char* path, enum io_open_mode mode, int64_t* out_filesize)
 
 	G_LOCK();
 	const int file_id = alloc_file_id();
-	arrput(g.file_arr, ((struct file) {
+	put_file(((struct file) {
 		.type = DISK,
 		.file_id = file_id,
 		.posix_fd = posix_fd,
@@ -271,22 +868,12 @@ int io_open(const char* path, enum io_open_mode mode, int64_t* out_filesize)
 	return file_id;
 }
 
-static struct file* get_file(int file_id)
-{
-	assert(file_id >= 0);
-	const int num_files = arrlen(g.file_arr);
-	for (int i=0; i<num_files; ++i) {
-		struct file* file = &g.file_arr[i];
-		if (file->file_id == file_id) return file;
-	}
-	assert(!"file id not found");
-}
-
 static int file_id_to_posix_fd(int file_id)
 {
 	return get_file(file_id)->posix_fd;
 }
 
+#ifndef IO_EPOLL
 static struct file* get_file_by_posix_fd(int posix_fd)
 {
 	const int num_files = arrlen(g.file_arr);
@@ -297,13 +884,14 @@ static struct file* get_file_by_posix_fd(int posix_fd)
 	}
 	assert(!"posix fd not found?");
 }
+#endif
 
 
 int io_close(int file_id)
 {
 	G_LOCK();
 	struct file* file = get_file(file_id);
-	const int num_sub = arrlen(file->submission_arr);
+	const int num_sub = arrlen(file->submission_arr) + file->num_inflight;
 	G_UNLOCK();
 	if (num_sub) {
 		XXX_NOW(probably flush/spool now)
@@ -312,9 +900,18 @@ int io_close(int file_id)
 	if (close(file->posix_fd) != 0) {
 		return IO_ERROR;
 	}
-	const int i = (file - g.file_arr);
-	assert((0 <= i) && (i < arrlen(g.file_arr)));
-	arrdel(g.file_arr, i);
+	G_LOCK();
+	del_file(get_file(file_id) - g.file_arr);
+	G_UNLOCK();
+	return 0;
+}
+
+int io_shutdown(int file_id)
+{
+	G_LOCK();
+	const int posix_fd = file_id_to_posix_fd(file_id);
+	G_UNLOCK();
+	if (shutdown(posix_fd, SHUT_RDWR) != 0) return IO_ERROR;
 	return 0;
 }
 
@@ -369,7 +966,10 @@ int io_listen_tcp(int bind_port, int port_id, io_echo echo)
 		abort();
 	}
 
-	const int backlog = 25;
+	// a small backlog overflows when many peers (re)connect at once (e.g.
+	// after a host restart), and the ones that don't fit wait for SYN
+	// retransmissions (1s, 3s, ...)
+	const int backlog = SOMAXCONN;
 	e = listen(listen_fd, backlog);
 	if (e == -1) {
 		fprintf(stderr, "listen(...,%d): %s\n", backlog, strerror(errno));
@@ -378,91 +978,380 @@ int io_listen_tcp(int bind_port, int port_id, io_echo echo)
 
 	G_LOCK();
 	const int file_id = alloc_file_id();
-	arrput(g.file_arr, ((struct file) {
+	put_file(((struct file) {
 		.type = LISTEN,
 		.file_id = file_id,
 		.posix_fd = listen_fd,
 	}));
 
-	const int num_ports = arrlen(g.port_arr);
-	int found_port = 0;
-	for (int i=0; i<num_ports; ++i) {
-		struct port* port = &g.port_arr[i];
-		if (port->port_id != port_id) continue;
-		arrput(port->listen_arr, ((struct listen) {
-			.echo = echo,
-			.posix_fd = listen_fd,
-		}));
-		found_port = 1;
-		break;
+	#ifdef IO_EPOLL
+	#ifdef IO_URING
+	if (!use_uring())
+	#endif
+	{
+		struct epoll_event ev = {
+			.events = EPOLLIN,
+			.data.u64 = file_id,
+		};
+		if (epoll_ctl(get_epoll_fd(), EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+			fprintf(stderr, "epoll_ctl(): %s\n", strerror(errno));
+			abort();
+		}
 	}
-	assert(found_port);
+	#endif
+
+	arrput(get_port(port_id)->listen_arr, ((struct listen) {
+		.echo = echo,
+		.posix_fd = listen_fd,
+	}));
 	G_UNLOCK();
 
 	return file_id;
 }
 
-static void submit(int file_id, struct submission* sub)
+static struct sockaddr_in sockaddr_from_io_addr(const struct io_addr* a)
 {
-	G_LOCK();
-	struct file* file = get_file(file_id);
-	arrput(file->submission_arr, *sub);
-	G_UNLOCK();
+	return ((struct sockaddr_in) {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(a->ipv4),
+		.sin_port = htons(a->port),
+	});
 }
 
-void io_port_close(int port_id, io_echo echo, int file_id)
+static struct io_addr io_addr_from_sockaddr(const struct sockaddr_in* a)
 {
-	struct submission s = {
-		.port_id = port_id,
-		.type = SUBMISSION_CLOSE,
-		.echo = echo,
-	};
-	submit(file_id, &s);
+	return ((struct io_addr) {
+		.ipv4 = ntohl(a->sin_addr.s_addr),
+		.port = ntohs(a->sin_port),
+	});
 }
 
-void io_port_read(int port_id, io_echo echo, int file_id, void* ptr, int64_t count)
+int io_resolve(const char* host, int port, struct io_addr* out_addr)
 {
-	struct submission s = {
-		.port_id = port_id,
-		.type = SUBMISSION_READ,
-		.echo = echo,
-		.read = {
-			.ptr = ptr,
-			.count = count,
-		},
+	struct addrinfo hints = {
+		.ai_family = AF_INET,
 	};
-	submit(file_id, &s);
+	char service[16];
+	snprintf(service, sizeof service, "%d", port);
+	struct addrinfo* res = NULL;
+	if (getaddrinfo(host, service, &hints, &res) != 0 || res == NULL) {
+		return IO_NOT_FOUND;
+	}
+	assert(res->ai_addrlen == sizeof(struct sockaddr_in));
+	*out_addr = io_addr_from_sockaddr((struct sockaddr_in*)res->ai_addr);
+	freeaddrinfo(res);
+	return 0;
 }
 
-void io_port_write(int port_id, io_echo echo, int file_id, const void* ptr, int64_t count)
+// a socket connecting in the background becomes writable when it's done, and
+// SO_ERROR tells how it went. returns 0 if it's connected, otherwise -1 with
+// errno set
+static int get_connect_status(int posix_fd)
 {
-	struct submission s = {
-		.port_id = port_id,
-		.type = SUBMISSION_WRITE,
-		.echo = echo,
-		.write = {
-			.ptr = ptr,
-			.count = count,
-		},
-	};
-	submit(file_id, &s);
+	int err = 0;
+	socklen_t errlen = sizeof err;
+	if (getsockopt(posix_fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1) return -1;
+	if (err == 0) return 0;
+	errno = err;
+	return -1;
 }
 
-void io_port_writeall(int port_id, io_echo echo, int file_id, const void* ptr, int64_t count)
+int io_open_udp(int bind_port)
 {
-	struct submission s = {
-		.port_id = port_id,
-		.type = SUBMISSION_WRITEALL,
-		.echo = echo,
-		.write = {
-			.ptr = ptr,
-			.count = count,
-		},
+	const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1) return IO_ERROR;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	struct sockaddr_in my_addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = INADDR_ANY,
+		.sin_port = htons(bind_port),
 	};
-	submit(file_id, &s);
-}
+	if (bind(fd, (struct sockaddr*)&my_addr, sizeof my_addr) == -1) {
+		fprintf(stderr, "bind(): %s\n", strerror(errno));
+		close(fd);
+		return (errno == EADDRINUSE) ? IO_ALREADY_EXISTS : IO_ERROR;
+	}
+	socklen_t addrlen = sizeof my_addr;
+	if (getsockname(fd, (struct sockaddr*)&my_addr, &addrlen) == -1) {
+		close(fd);
+		return IO_ERROR;
+	}
 
-void io_port_pread(int port_id, io_echo echo, int file_id, void* ptr, int64_t count, int64_t offset)
+	G_LOCK();
+	const int file_id = alloc_file_id();
+	// (never registered with epoll, and never gets submissions; see
+	// get_wait_pollfds())
+	put_file(((struct file) {
+		.type = DATAGRAM,
+		.file_id = file_id,
+		.posix_fd = fd,
+		.addr = my_addr,
+	}));
+	G_UNLOCK();
+	return file_id;
+}
+
+int io_get_local_port(int file_id)
+{
+	G_LOCK();
+	const int port = ntohs(get_file(file_id)->addr.sin_port);
+	G_UNLOCK();
+	return port;
+}
+
+int io_udp_send(int file_id, const struct io_addr* to, const void* ptr, int64_t count)
+{
+	G_LOCK();
+	struct file* file = get_file(file_id);
+	assert(file->type == DATAGRAM);
+	const int fd = file->posix_fd;
+	G_UNLOCK();
+	struct sockaddr_in addr = sockaddr_from_io_addr(to);
+	for (;;) {
+		if (sendto(fd, ptr, count, 0, (struct sockaddr*)&addr, sizeof addr) == count) return 0;
+		if (errno == EINTR) continue;
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS)) return IO_BUFFER_FULL;
+		return IO_ERROR;
+	}
+}
+
+int io_udp_recv(int file_id, void* ptr, int64_t count, struct io_addr* out_from)
+{
+	G_LOCK();
+	struct file* file = get_file(file_id);
+	assert(file->type == DATAGRAM);
+	const int fd = file->posix_fd;
+	G_UNLOCK();
+	for (;;) {
+		struct sockaddr_in addr;
+		socklen_t addrlen = sizeof addr;
+		const ssize_t n = recvfrom(fd, ptr, count, 0, (struct sockaddr*)&addr, &addrlen);
+		if (n >= 0) {
+			if (out_from) *out_from = io_addr_from_sockaddr(&addr);
+			return n;
+		}
+		if (errno == EINTR) continue;
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return IO_PENDING;
+		// (e.g. ECONNREFUSED on linux, from an ICMP error caused by an
+		// earlier send; there may be more datagrams behind it)
+		return IO_READ_ERROR;
+	}
+}
+
+static int get_sendfile_src_file_id(struct submission* sub)
+{
+	switch (sub->type) {
+	case SUBMISSION_SENDFILE:
+	case SUBMISSION_SENDFILEALL:
+		return sub->sendfile.src_file_id;
+	default:
+		return -1;
+	}
+}
+
+// a file is "closing" when all its submissions are closes; these must wait for
+// other submissions, but once they're alone they needn't wait for anything
+static int is_closing(struct file* file)
+{
+	const int num_subs = arrlen(file->submission_arr);
+	if ((num_subs == 0) || (file->num_pipe_destinations > 0) || (file->num_inflight > 0)) return 0;
+	for (int i=0; i<num_subs; ++i) {
+		if (file->submission_arr[i].type != SUBMISSION_CLOSE) return 0;
+	}
+	return 1;
+}
+
+#ifdef IO_URING
+// returns the index of the first submission of file that can be started as
+// an op, or -1. at most one read-type and one write-type submission is in
+// flight per file, which keeps them in order
+static int uring_find_startable(struct file* file)
+{
+	if (is_closing(file)) return 0;
+	const int num_subs = arrlen(file->submission_arr);
+	for (int i=0; i<num_subs; ++i) {
+		switch (file->submission_arr[i].type) {
+		case SUBMISSION_CLOSE:
+			break;
+		case SUBMISSION_READ:
+		case SUBMISSION_PREAD:
+			if (!file->is_reading) return i;
+			break;
+		case SUBMISSION_WRITE:
+		case SUBMISSION_WRITEALL:
+		case SUBMISSION_PWRITE:
+		case SUBMISSION_WRITEV:
+		case SUBMISSION_PWRITEV:
+		case SUBMISSION_SENDFILE:
+		case SUBMISSION_SENDFILEALL:
+		case SUBMISSION_CONNECT:
+			if (!file->is_writing) return i;
+			break;
+		default: assert(!"unhandled submission type");
+		}
+	}
+	return -1;
+}
+#endif
+
+#ifdef IO_EPOLL
+// registers the file with epoll (once), and kicks it if any of its submissions
+// can be done. must be called with G_LOCK held whenever the file's submissions
+// or readiness change. files are registered edge-triggered for both reading
+// and writing, so interest never needs to be modified; readiness is tracked in
+// file->revents instead, and cleared when I/O comes up short
+static void update_file(struct file* file)
+{
+	#ifdef IO_URING
+	if (use_uring()) {
+		if (!file->is_kicked && (uring_find_startable(file) >= 0)) {
+			file->is_kicked = 1;
+			arrput(g.kick_file_id_arr, file->file_id);
+		}
+		return;
+	}
+	#endif
+
+	if (!file->is_registered && !file->is_unpollable) {
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLOUT | EPOLLET,
+			.data.u64 = file->file_id,
+		};
+		if (epoll_ctl(get_epoll_fd(), EPOLL_CTL_ADD, file->posix_fd, &ev) == 0) {
+			file->is_registered = 1;
+		} else if (errno == EPERM) {
+			// regular files can't be polled, but they're always ready
+			file->is_unpollable = 1;
+			file->revents = (POLLIN | POLLOUT);
+		} else {
+			fprintf(stderr, "epoll_ctl(%d): %s\n", file->posix_fd, strerror(errno));
+			abort();
+		}
+	}
+
+	if (file->is_kicked) return;
+	int events = 0;
+	const int num_subs = arrlen(file->submission_arr);
+	for (int i=0; i<num_subs; ++i) {
+		switch (file->submission_arr[i].type) {
+		case SUBMISSION_CLOSE:
+			break;
+		case SUBMISSION_READ:
+		case SUBMISSION_PREAD:
+			events |= POLLIN;
+			break;
+		case SUBMISSION_WRITE:
+		case SUBMISSION_WRITEALL:
+		case SUBMISSION_PWRITE:
+		case SUBMISSION_WRITEV:
+		case SUBMISSION_PWRITEV:
+		case SUBMISSION_SENDFILE:
+		case SUBMISSION_SENDFILEALL:
+		case SUBMISSION_CONNECT:
+			events |= POLLOUT;
+			break;
+		default: assert(!"unhandled submission type");
+		}
+	}
+	if ((events & file->revents) || is_closing(file)) {
+		arrput(g.kick_file_id_arr, file->file_id);
+		file->is_kicked = 1;
+	}
+}
+#endif
+
+static void submission_added(struct file* file, struct submission* sub)
+{
+	const int src_file_id = get_sendfile_src_file_id(sub);
+	if (src_file_id >= 0) {
+		struct file* src_file = get_file(src_file_id);
+		++src_file->num_pipe_destinations;
+		#ifdef IO_EPOLL
+		update_file(src_file);
+		#endif
+	}
+	#ifdef IO_EPOLL
+	update_file(file);
+	#endif
+}
+
+static void submit(int file_id, struct submission* sub)
+{
+	G_LOCK();
+	struct file* file = get_file(file_id);
+	arrput(file->submission_arr, *sub);
+	submission_added(file, sub);
+	G_UNLOCK();
+	// submissions may come from other threads than the one doing io_tick()
+	io_wake();
+}
+
+static void resubmit(int file_id, struct submission* sub)
+{
+	// the remainder of a partial write goes in front of the other
+	// submissions, otherwise a following write to the same file could
+	// overtake it
+	G_LOCK();
+	struct file* file = get_file(file_id);
+	arrins(file->submission_arr, 0, *sub);
+	submission_added(file, sub);
+	G_UNLOCK();
+}
+
+void io_port_close(int port_id, io_echo echo, int file_id)
+{
+	struct submission s = {
+		.port_id = port_id,
+		.type = SUBMISSION_CLOSE,
+		.echo = echo,
+	};
+	submit(file_id, &s);
+}
+
+void io_port_read(int port_id, io_echo echo, int file_id, void* ptr, int64_t count)
+{
+	struct submission s = {
+		.port_id = port_id,
+		.type = SUBMISSION_READ,
+		.echo = echo,
+		.read = {
+			.ptr = ptr,
+			.count = count,
+		},
+	};
+	submit(file_id, &s);
+}
+
+void io_port_write(int port_id, io_echo echo, int file_id, const void* ptr, int64_t count)
+{
+	struct submission s = {
+		.port_id = port_id,
+		.type = SUBMISSION_WRITE,
+		.echo = echo,
+		.write = {
+			.ptr = ptr,
+			.count = count,
+		},
+	};
+	submit(file_id, &s);
+}
+
+void io_port_writeall(int port_id, io_echo echo, int file_id, const void* ptr, int64_t count)
+{
+	struct submission s = {
+		.port_id = port_id,
+		.type = SUBMISSION_WRITEALL,
+		.echo = echo,
+		.write = {
+			.ptr = ptr,
+			.count = count,
+		},
+	};
+	submit(file_id, &s);
+}
+
+void io_port_pread(int port_id, io_echo echo, int file_id, void* ptr, int64_t count, int64_t offset)
 {
 	struct submission s = {
 		.port_id = port_id,
@@ -492,6 +1381,37 @@ void io_port_pwrite(int port_id, io_echo echo, int file_id, const void* ptr, int
 	submit(file_id, &s);
 }
 
+void io_port_writev(int port_id, io_echo echo, int file_id, const struct io_vec* vecs, int num_vecs)
+{
+	assert((0 < num_vecs) && (num_vecs <= MAX_IOVECS));
+	struct submission s = {
+		.port_id = port_id,
+		.type = SUBMISSION_WRITEV,
+		.echo = echo,
+		.writev = {
+			.vecs = vecs,
+			.num_vecs = num_vecs,
+		},
+	};
+	submit(file_id, &s);
+}
+
+void io_port_pwritev(int port_id, io_echo echo, int file_id, const struct io_vec* vecs, int num_vecs, int64_t offset)
+{
+	assert((0 < num_vecs) && (num_vecs <= MAX_IOVECS));
+	struct submission s = {
+		.port_id = port_id,
+		.type = SUBMISSION_PWRITEV,
+		.echo = echo,
+		.writev = {
+			.vecs = vecs,
+			.num_vecs = num_vecs,
+			.offset = offset,
+		},
+	};
+	submit(file_id, &s);
+}
+
 void io_port_sendfile(int port_id, io_echo echo, int dst_file_id, int src_file_id, int64_t count, int64_t src_offset)
 {
 	struct submission s = {
@@ -523,35 +1443,86 @@ void io_port_sendfileall(int port_id, io_echo echo, int dst_file_id, int src_fil
 }
 
 
-int io_port_create(void)
+int io_port_connect(int port_id, io_echo echo, const struct io_addr* addr)
 {
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1) return IO_ERROR;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	struct sockaddr_in sa = sockaddr_from_io_addr(addr);
+	if ((connect(fd, (struct sockaddr*)&sa, sizeof sa) == -1) && (errno != EINPROGRESS)) {
+		close(fd);
+		return IO_ERROR;
+	}
+
 	G_LOCK();
-	const int port_id = ++g.port_id_sequence;
-	arrput(g.port_arr, ((struct port) {
-		.port_id = port_id,
+	const int file_id = alloc_file_id();
+	put_file(((struct file) {
+		.type = SOCKET,
+		.file_id = file_id,
+		.posix_fd = fd,
+		.addr = sa,
 	}));
 	G_UNLOCK();
+
+	struct submission s = {
+		.port_id = port_id,
+		.type = SUBMISSION_CONNECT,
+		.echo = echo,
+	};
+	submit(file_id, &s);
+	return file_id;
+}
+
+int io_port_create(void)
+{
+	G_LOCK();
+	const int num_ports = g.num_ports;
+	assert((num_ports < MAX_PORTS) && "too many ports");
+	struct port* port = calloc(1, sizeof *port);
+	const int port_id = num_ports+1;
+	port->port_id = port_id;
+	assert(0 == pthread_mutex_init(&port->event_mutex, NULL));
+	g.ports[num_ports] = port;
+	// publishes the port to io_port_poll()
+	atomic_store(&g.num_ports, num_ports+1);
+	G_UNLOCK();
 	return port_id;
 }
 
 int io_port_poll(int port_id, struct io_event* out_ev)
+{
+	struct port* port = get_port(port_id);
+	PORT_LOCK(port);
+	const int num_events = arrlen(port->event_arr);
+	int r=0;
+	if (port->event_head < num_events) {
+		if (out_ev) *out_ev = port->event_arr[port->event_head];
+		++port->event_head;
+		r=1;
+	}
+	if (port->event_head == num_events) {
+		arrreset(port->event_arr);
+		port->event_head = 0;
+	}
+	PORT_UNLOCK(port);
+	return r;
+}
+
+void io_get_lock_stats(struct lock_stats* out_stats, struct lock_stats* out_port_stats)
 {
 	G_LOCK();
-	const int num_ports = arrlen(g.port_arr);
+	if (out_stats) *out_stats = g.lock_stats;
+	G_UNLOCK();
+	if (out_port_stats == NULL) return;
+	memset(out_port_stats, 0, sizeof *out_port_stats);
+	const int num_ports = atomic_load(&g.num_ports);
 	for (int i=0; i<num_ports; ++i) {
-		struct port* port = &g.port_arr[i];
-		if (port->port_id != port_id) continue;
-		const int num_events = arrlen(port->event_arr);
-		int r=0;
-		if (num_events > 0) {
-			if (out_ev) *out_ev = port->event_arr[0];
-			arrdel(port->event_arr, 0);
-			r=1;
-		}
-		G_UNLOCK();
-		return r;
+		struct port* port = g.ports[i];
+		PORT_LOCK(port);
+		lockstat_add(out_port_stats, &port->event_lock_stats);
+		PORT_UNLOCK(port);
 	}
-	assert(!"port id does not exist");
 }
 
 void io_addr(int file_id)
@@ -569,12 +1540,6 @@ void io_addr(int file_id)
 		port);
 }
 
-struct listenecho {
-	int port_id;
-	io_echo echo;
-};
-
-
 static int our_sendfile(int dst_fd, int src_fd, off_t offset, size_t count)
 {
 	#if defined(__linux__)
@@ -596,143 +1561,278 @@ static int our_sendfile(int dst_fd, int src_fd, off_t offset, size_t count)
 	#endif
 }
 
-int io_tick(void)
+// moves the submissions of file that can be done now to fire_arr, given the
+// events (POLLIN/POLLOUT) that are ready on it. sendfile destinations also
+// look at the revents of their source, so revents must be set on all ready
+// files before calling this. returns 1 if the file is to be closed, otherwise
+// 0
+static int collect_file_fires(struct file* file, int revents, struct fire** fire_arr)
 {
-	static struct pollfd* pollfd_arr;
-	arrreset(pollfd_arr);
-
-	static struct listenecho* listenecho_arr;
-	arrreset(listenecho_arr);
+	revents &= (POLLIN | POLLOUT); // only consider these events from here on
+	const int closing = is_closing(file);
+	int do_close = 0;
+	int num_subs = arrlen(file->submission_arr);
+	for (int i=0; (revents || closing) && i<num_subs; ++i) {
+		struct submission* sub = &file->submission_arr[i];
+		int do_fire=0;
+		switch (sub->type) {
 
-	int first_listen_index = -1;
+		case SUBMISSION_CLOSE:
+			if (closing) {
+				do_fire = 1;
+				do_close = 1;
+			}
+			break;
 
-	// populate pollfd_arr with fds/events corresponding to submission types
-	G_LOCK();
-	{
-		const int num_files = arrlen(g.file_arr);
-
-		// clear some housekeeping file fields
-		for (int i=0; i<num_files; ++i) {
-			struct file* file = &g.file_arr[i];
-			file->is_pipe_destination = 0;
-			file->num_pipe_destinations = 0;
-			file->num_close = 0;
-		}
+		case SUBMISSION_READ:
+		case SUBMISSION_PREAD: {
+			assert(!closing);
+			if (revents & POLLIN) {
+				do_fire = 1;
+				revents &= ~POLLIN;
+			}
+		}	break;
 
-		// figure out which files are sendfile sources
-		for (int i=0; i<num_files; ++i) {
-			struct file* file = &g.file_arr[i];
-			const int num_subs = arrlen(file->submission_arr);
-			for (int ii=0; ii<num_subs; ++ii) {
-				struct submission* sub = &file->submission_arr[ii];
-				int src_file_id = -1;
-
-				switch (sub->type) {
-				case SUBMISSION_SENDFILE:
-				case SUBMISSION_SENDFILEALL: {
-					src_file_id = sub->sendfile.src_file_id;
-				}	break;
-				default: break;
-				}
+		case SUBMISSION_WRITE:
+		case SUBMISSION_WRITEALL:
+		case SUBMISSION_PWRITE:
+		case SUBMISSION_WRITEV:
+		case SUBMISSION_PWRITEV:
+		case SUBMISSION_CONNECT: {
+			assert(!closing);
+			if (revents & POLLOUT) {
+				do_fire = 1;
+				revents &= ~POLLOUT;
+			}
+		}	break;
 
-				if (src_file_id >= 0) {
-					file->is_pipe_destination = 1;
-					++get_file(src_file_id)->num_pipe_destinations;
+		case SUBMISSION_SENDFILE:
+		case SUBMISSION_SENDFILEALL: {
+			assert(!closing);
+			if (revents & POLLOUT) {
+				struct file* src_file = get_file(sub->sendfile.src_file_id);
+				if (src_file->is_unpollable || (src_file->revents & POLLIN)) {
+					do_fire = 1;
+					revents &= ~POLLOUT;
+					assert(src_file->num_pipe_destinations > 0);
+					--src_file->num_pipe_destinations;
+					#ifdef IO_EPOLL
+					update_file(src_file);
+					#endif
 				}
 			}
+		}	break;
+
+		default: assert(!"unhandled submission type");
 		}
 
-		// populate pollfd data for poll(2). 3 categories:
-		// - common I/O; reads, writes...
-		// - pipes between files
-		// - tcp/ip sockets listening for new connections
-		for (int i=0; i<num_files; ++i) {
-			struct file* file = &g.file_arr[i];
-			int events = 0;
-			if (file->num_pipe_destinations) {
-				events |= POLLIN;
-				arrput(pollfd_arr, ((struct pollfd) {
-					.fd = file->posix_fd,
-					.events = events,
-				}));
-			}
+		if (!do_fire) continue;
 
-			const int num_subs = arrlen(file->submission_arr);
-			if (num_subs == 0) continue;
+		arrput(*fire_arr, ((struct fire) {
+			.file_id = file->file_id,
+			.posix_fd = file->posix_fd,
+			.sub = *sub,
+		}));
+		arrdel(file->submission_arr, i);
+		coalesce_writes(file, i, &(*fire_arr)[arrlen(*fire_arr)-1]);
+		--i;
+		num_subs = arrlen(file->submission_arr);
+	}
+	if (do_close) file->do_close = 1;
+	return do_close;
+}
 
-			// handle common I/O
-			for (int ii=0; ii<num_subs; ++ii) {
-				struct submission* sub = &file->submission_arr[ii];
-				int add=0, do_not_add=0;
+#ifdef IO_EPOLL
 
-				switch (sub->type) {
+#define MAX_EPOLL_EVENTS (256)
 
-				case SUBMISSION_CLOSE:
-					++file->num_close;
-					do_not_add = 1;
-					break;
+// epoll backend: only files that became ready (epoll events) or that have
+// submissions that can be done (kicked by update_file()) are looked at, so a
+// tick costs nothing for idle files.
+// returns 0 if there's nothing to do
+static int collect_fires(struct fire** fire_arr, int* out_num_to_close)
+{
+	G_LOCK();
+	const int epoll_fd = get_epoll_fd();
+	G_UNLOCK();
 
-				case SUBMISSION_READ:
-				case SUBMISSION_PREAD:
-					add = POLLIN;
-					break;
+	static struct epoll_event events[MAX_EPOLL_EVENTS];
+	const int num_events = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, 0);
+	if (num_events == -1) {
+		if (errno == EINTR) {
+			return 1;
+		}
+		fprintf(stderr, "epoll_wait(): %s\n", strerror(errno));
+		abort();
+	}
 
-				case SUBMISSION_WRITE:
-				case SUBMISSION_WRITEALL:
-				case SUBMISSION_PWRITE:
-				case SUBMISSION_SENDFILE:    // handling sendfile destinations here
-				case SUBMISSION_SENDFILEALL: // sources are handled above
-					add = POLLOUT;
-					break;
+	static struct file** ready_file_arr;
+	arrreset(ready_file_arr);
 
-				default: assert(!"unhandled submission type");
-				}
+	int num_to_close = 0;
 
-				if (do_not_add) continue;
-				assert(add);
-				if (!(events & add)) {
-					if (!events) {
-						events |= add;
-						arrput(pollfd_arr, ((struct pollfd) {
-							.fd = file->posix_fd,
-							.events = events,
-						}));
-					} else {
-						events |= add;
-						struct pollfd* pf = &pollfd_arr[arrlen(pollfd_arr)-1];
-						pf->events |= add;
-						assert(pf->events == events);
-					}
+	G_LOCK();
+	if ((num_events == 0) && (arrlen(g.kick_file_id_arr) == 0)) {
+		G_UNLOCK();
+		return 0;
+	}
+
+	for (int i=0; i<num_events; ++i) {
+		struct epoll_event* ev = &events[i];
+		struct file* file = get_file(ev->data.u64);
+
+		if (file->type == LISTEN) {
+			const int num_ports = g.num_ports;
+			for (int ii=0; ii<num_ports; ++ii) {
+				struct port* port = g.ports[ii];
+				const int num_listen = arrlen(port->listen_arr);
+				for (int iii=0; iii<num_listen; ++iii) {
+					struct listen* listen = &port->listen_arr[iii];
+					if (listen->posix_fd != file->posix_fd) continue;
+					arrput(*fire_arr, ((struct fire) {
+						.posix_fd = listen->posix_fd,
+						.sub = {
+							.type = INTERNAL_ACCEPT,
+							.port_id = port->port_id,
+							.echo = listen->echo,
+						},
+					}));
 				}
 			}
+			continue;
 		}
 
-		// handle listening sockets
-		first_listen_index = arrlen(pollfd_arr);
-		const int num_ports = arrlen(g.port_arr);
-		for (int i=0; i<num_ports; ++i) {
-			struct port* port = &g.port_arr[i];
-			const int num_listen = arrlen(port->listen_arr);
-			for (int ii=0; ii<num_listen; ++ii) {
-				struct listen* listen = &port->listen_arr[ii];
-				arrput(pollfd_arr, ((struct pollfd) {
-					.fd = listen->posix_fd,
-					.events = POLLIN,
-				}));
-				arrput(listenecho_arr, ((struct listenecho) {
-					.port_id = port->port_id,
-					.echo = listen->echo,
-				}));
-			}
+		// errors and hangups are reported by the reads and writes that
+		// run into them (so their submitters find out, and close the
+		// file), so they just make the file ready
+		if (ev->events & (EPOLLERR | EPOLLHUP)) file->revents |= (POLLIN | POLLOUT);
+		if (ev->events & EPOLLIN)  file->revents |= POLLIN;
+		if (ev->events & EPOLLOUT) file->revents |= POLLOUT;
+		file->is_collecting = 1;
+		arrput(ready_file_arr, file);
+	}
+
+	const int num_kicked = arrlen(g.kick_file_id_arr);
+	for (int i=0; i<num_kicked; ++i) {
+		struct file* file = find_file(g.kick_file_id_arr[i]);
+		if ((file == NULL) || file->do_close) continue;
+		file->is_kicked = 0;
+		if (file->is_collecting) continue;
+		file->is_collecting = 1;
+		arrput(ready_file_arr, file);
+	}
+	arrreset(g.kick_file_id_arr);
+
+	const int num_ready = arrlen(ready_file_arr);
+	for (int i=0; i<num_ready; ++i) {
+		struct file* file = ready_file_arr[i];
+		num_to_close += collect_file_fires(file, file->revents, fire_arr);
+	}
+	for (int i=0; i<num_ready; ++i) {
+		struct file* file = ready_file_arr[i];
+		file->is_collecting = 0;
+		update_file(file);
+	}
+	G_UNLOCK();
+
+	*out_num_to_close = num_to_close;
+	return 1;
+}
+
+#else
+
+struct listenecho {
+	int port_id;
+	io_echo echo;
+};
+
+// returns the poll(2) events the file's submissions are waiting for
+static int get_poll_events(struct file* file)
+{
+	int events = 0;
+	if (file->num_pipe_destinations > 0) events |= POLLIN;
+	const int num_subs = arrlen(file->submission_arr);
+	for (int i=0; i<num_subs; ++i) {
+		switch (file->submission_arr[i].type) {
+		case SUBMISSION_CLOSE:
+			break;
+		case SUBMISSION_READ:
+		case SUBMISSION_PREAD:
+			events |= POLLIN;
+			break;
+		case SUBMISSION_WRITE:
+		case SUBMISSION_WRITEALL:
+		case SUBMISSION_PWRITE:
+		case SUBMISSION_WRITEV:
+		case SUBMISSION_PWRITEV:
+		case SUBMISSION_SENDFILE:    // handling sendfile destinations here
+		case SUBMISSION_SENDFILEALL: // sources are handled above
+		case SUBMISSION_CONNECT:
+			events |= POLLOUT;
+			break;
+		default: assert(!"unhandled submission type");
 		}
 	}
+	return events;
+}
 
-	assert((0 <= first_listen_index) && (first_listen_index <= arrlen(pollfd_arr)));
+// poll(2) backend: the pollfd set is built from all files and submissions
+// every tick. returns 0 if there's nothing to do
+static int collect_fires(struct fire** fire_arr, int* out_num_to_close)
+{
+	static struct pollfd* pollfd_arr;
+	arrreset(pollfd_arr);
+
+	static struct listenecho* listenecho_arr;
+	arrreset(listenecho_arr);
+
+	int num_to_close = 0;
+
+	// populate pollfd_arr with fds/events corresponding to submission types
+	G_LOCK();
+	const int num_files = arrlen(g.file_arr);
+	for (int i=0; i<num_files; ++i) {
+		struct file* file = &g.file_arr[i];
+		if (is_closing(file)) {
+			// no need to wait for anything
+			num_to_close += collect_file_fires(file, 0, fire_arr);
+			continue;
+		}
+
+		const int events = get_poll_events(file);
+		if (events == 0) continue;
+		arrput(pollfd_arr, ((struct pollfd) {
+			.fd = file->posix_fd,
+			.events = events,
+		}));
+	}
+
+	// handle listening sockets
+	const int first_listen_index = arrlen(pollfd_arr);
+	const int num_ports = g.num_ports;
+	for (int i=0; i<num_ports; ++i) {
+		struct port* port = g.ports[i];
+		const int num_listen = arrlen(port->listen_arr);
+		for (int ii=0; ii<num_listen; ++ii) {
+			struct listen* listen = &port->listen_arr[ii];
+			arrput(pollfd_arr, ((struct pollfd) {
+				.fd = listen->posix_fd,
+				.events = POLLIN,
+			}));
+			arrput(listenecho_arr, ((struct listenecho) {
+				.port_id = port->port_id,
+				.echo = listen->echo,
+			}));
+		}
+	}
 	assert(arrlen(listenecho_arr) == (arrlen(pollfd_arr) - first_listen_index));
 	G_UNLOCK();
 
+	*out_num_to_close = num_to_close;
+	const int did_collect = (arrlen(*fire_arr) > 0);
+
 	const int num_pollfd = arrlen(pollfd_arr);
-	if (num_pollfd == 0) return 0;
+	if (num_pollfd == 0) return did_collect;
 
 	// execute poll(2)
 	int e = poll(pollfd_arr, num_pollfd, 0);
@@ -743,211 +1843,213 @@ int io_tick(void)
 		fprintf(stderr, "poll(): %s\n", strerror(errno));
 		abort();
 	} else if (e == 0) {
-		return 0;
+		return did_collect;
 	}
 	assert(e>0);
 
-	static struct fire* fire_arr;
-	arrreset(fire_arr);
-
-	int num_to_close = 0;
+	static struct file** ready_file_arr;
+	arrreset(ready_file_arr);
 
 	// convert poll() output to list of calls to make
 	G_LOCK();
-	for (int i=0; i<num_pollfd; ++i) {
+	for (int i=0; i<first_listen_index; ++i) {
 		struct pollfd* pollfd = &pollfd_arr[i];
-		int revents = pollfd->revents;
-		assert(first_listen_index >= 0);
-
-		if (i < first_listen_index) {
-			assert(!(revents & POLLNVAL) && "invalid fd added?");
-			struct file* file = get_file_by_posix_fd(pollfd->fd);
-			if (revents & (POLLERR | POLLHUP)) {
-				const int e = close(pollfd->fd);
-				printf("BAD revents=%d; close(%d) => %d\n", revents, pollfd->fd, e);
-				file->do_close = 1;
-				++num_to_close;
-				continue;
-			}
-			revents &= (POLLIN | POLLOUT); // only consider these events from here on
-			int num_subs = arrlen(file->submission_arr);
-			const int is_closing = (num_subs>0) && (num_subs == file->num_close);
-			for (int ii=0; (revents || is_closing) && ii<num_subs; ++ii) {
-				struct submission* sub = &file->submission_arr[ii];
-				int do_fire=0;
-				switch (sub->type) {
-
-				case SUBMISSION_CLOSE:
-					if (is_closing) {
-						do_fire = 1;
-						file->do_close = 1;
-						++num_to_close;
-					}
-					break;
-
-				case SUBMISSION_READ:
-				case SUBMISSION_PREAD: {
-					assert(!is_closing);
-					if (revents & POLLIN) {
-						do_fire = 1;
-						revents &= ~POLLIN;
-					}
-				}	break;
-
-				case SUBMISSION_WRITE:
-				case SUBMISSION_WRITEALL:
-				case SUBMISSION_PWRITE: {
-					assert(!is_closing);
-					if (revents & POLLOUT) {
-						do_fire = 1;
-						revents &= ~POLLOUT;
-					}
-				}	break;
-
-				case SUBMISSION_SENDFILE:
-				case SUBMISSION_SENDFILEALL: {
-					assert(!is_closing);
-					if (revents & POLLOUT) {
-						struct file* src_file = get_file(sub->sendfile.src_file_id);
-						int src_is_ready = 0;
-						for (int iii=0; iii<num_pollfd; ++iii) {
-							struct pollfd* other = &pollfd_arr[iii];
-							if (other->fd == src_file->posix_fd) {
-								if (other->revents & POLLIN) {
-									src_is_ready = 1;
-								}
-								break;
-							}
-						}
-						if (src_is_ready) {
-							do_fire = 1;
-							revents &= ~POLLOUT;
-						}
-					}
-				}	break;
-
-				default: assert(!"unhandled submission type");
-				}
+		const int revents = pollfd->revents;
+		if (revents == 0) continue;
+		assert(!(revents & POLLNVAL) && "invalid fd added?");
+		struct file* file = get_file_by_posix_fd(pollfd->fd);
+		// see the epoll backend's collect_fires() about errors and
+		// hangups
+		file->revents = (revents & (POLLERR | POLLHUP)) ? (POLLIN | POLLOUT) : revents;
+		arrput(ready_file_arr, file);
+	}
 
-				if (!do_fire) continue;
+	const int num_ready = arrlen(ready_file_arr);
+	for (int i=0; i<num_ready; ++i) {
+		struct file* file = ready_file_arr[i];
+		num_to_close += collect_file_fires(file, file->revents, fire_arr);
+	}
+	for (int i=0; i<num_ready; ++i) ready_file_arr[i]->revents = 0;
 
-				arrput(fire_arr, ((struct fire) {
-					.posix_fd = file->posix_fd,
-					.sub = *sub,
-				}));
-				arrdel(file->submission_arr, ii);
-				--ii;
-				--num_subs;
-			}
-		} else { // i >= first_listen_index
+	for (int i=first_listen_index; i<num_pollfd; ++i) {
+		struct pollfd* pollfd = &pollfd_arr[i];
+		if (!(pollfd->revents & POLLIN)) continue;
+		struct listenecho* le = &listenecho_arr[i - first_listen_index];
+		arrput(*fire_arr, ((struct fire) {
+			.posix_fd = pollfd->fd,
+			.sub = {
+				.type = INTERNAL_ACCEPT,
+				.port_id = le->port_id,
+				.echo = le->echo,
+			},
+		}));
+	}
+	G_UNLOCK();
 
-			if (revents & POLLIN) {
-				const int il = i - first_listen_index;
-				const int num_listenecho = arrlen(listenecho_arr);
-				assert((0 <= il) && (il < num_listenecho));
-				struct listenecho* le = &listenecho_arr[il];
-
-				arrput(fire_arr, ((struct fire) {
-					.posix_fd = pollfd->fd,
-					.sub = {
-						.type = INTERNAL_ACCEPT,
-						.port_id = le->port_id,
-						.echo = le->echo,
-					},
-				}));
+	*out_num_to_close = num_to_close;
+	return 1;
+}
+
+#endif
+
+// I/O coming up short means the kernel buffer was drained/filled, so the file
+// is no longer ready in that direction. EAGAIN means the readiness was stale
+// (possible with edge-triggered events); the submission is retried when the
+// file is ready again
+static void update_readiness(struct fire* fire)
+{
+	struct file* file = find_file(fire->file_id);
+	if ((file == NULL) || file->do_close) return;
+	struct submission* sub = &fire->sub;
+	int event = 0;
+	int64_t count = 0;
+	switch (sub->type) {
+	case SUBMISSION_READ:
+		event = POLLIN;
+		count = sub->read.count;
+		break;
+	case SUBMISSION_WRITE:
+	case SUBMISSION_WRITEALL:
+	case SUBMISSION_WRITEV:
+	case SUBMISSION_SENDFILE:
+	case SUBMISSION_SENDFILEALL:
+		event = POLLOUT;
+		count = get_fire_write_count(fire);
+		break;
+	default:
+		break;
+	}
+
+	if (event && !file->is_unpollable) {
+		const int is_stale = (fire->status == -1) && ((fire->error == EAGAIN) || (fire->error == EWOULDBLOCK));
+		if (is_stale || ((0 < fire->status) && (fire->status < count))) {
+			file->revents &= ~event;
+		}
+		if (is_stale) {
+			assert(fire->num_resubs == 0);
+			const int num_subs = get_fire_num_subs(fire);
+			for (int i=num_subs-1; i>=0; --i) {
+				struct submission* s = get_fire_sub(fire, i);
+				arrins(file->submission_arr, 0, *s);
+				submission_added(file, s);
 			}
+			fire->num_resubs = num_subs;
 		}
 	}
-	G_UNLOCK();
+	#ifdef IO_EPOLL
+	update_file(file);
+	#endif
+}
+
+static int is_all_write(struct submission* sub)
+{
+	switch (sub->type) {
+	case SUBMISSION_WRITEALL:
+	case SUBMISSION_PWRITE:
+	case SUBMISSION_WRITEV:
+	case SUBMISSION_PWRITEV:
+	case SUBMISSION_SENDFILEALL:
+		return 1;
+	default:
+		return 0;
+	}
+}
 
-	static struct sockaddr_in* addr_arr;
-	arrreset(addr_arr);
+// the "all" writes are resubmitted until everything is written; the event is
+// only generated for the last part. for coalesced writes, the submissions that
+// were written completely get their events, and the rest is resubmitted
+static void finish_fire(struct fire* fire)
+{
+	if (fire->status == -1) return;
+	const int num_subs = get_fire_num_subs(fire);
+	int64_t remaining = fire->status;
+	for (int i=0; i<num_subs; ++i) {
+		struct submission* sub = get_fire_sub(fire, i);
+		if (sub->type == SUBMISSION_PREAD) {
+			assert((fire->status == sub->pread.count) && "TODO resub");
+			return;
+		}
+		if (!is_all_write(sub)) return;
+		const int64_t count = get_write_count(sub);
+		if (remaining >= count) {
+			remaining -= count;
+			continue;
+		}
+		// resubmitted in reverse order because each goes in front
+		for (int ii=num_subs-1; ii>=i; --ii) {
+			struct submission resub = *get_fire_sub(fire, ii);
+			if (ii == i) advance_write(&resub, remaining);
+			resubmit(fire->file_id, &resub);
+		}
+		fire->num_resubs = (num_subs - i);
+		return;
+	}
+	assert(remaining == 0);
+}
 
-	// do I/O calls
+// does the I/O calls for the poll/epoll backends
+static void execute_fires(struct fire* fire_arr)
+{
 	const int num_fire = arrlen(fire_arr);
 	for (int i=0; i<num_fire; ++i) {
 		struct fire* fire = &fire_arr[i];
 		const int posix_fd = fire->posix_fd;
 		struct submission* sub = &fire->sub;
-		struct submission resub;
 
-		int resub_fd=-1;
+		if (fire->iov_arr != NULL) {
+			// vectored and/or coalesced writes (see coalesce_writes())
+			if (get_write_group(sub) == WRITE_GROUP_POSITIONAL) {
+				fire->status = pwritev(posix_fd, fire->iov_arr, arrlen(fire->iov_arr), get_pwrite_offset(sub));
+			} else {
+				fire->status = writev(posix_fd, fire->iov_arr, arrlen(fire->iov_arr));
+			}
+			if (fire->status == -1) fire->error = errno;
+			finish_fire(fire);
+			continue;
+		}
+
 		switch (sub->type) {
 
 		case SUBMISSION_CLOSE: {
 			fire->status = close(posix_fd);
-			printf("SUBCLOSE\n");
 		}	break;
 
 		case SUBMISSION_READ: {
 			fire->status = read(posix_fd, sub->read.ptr, sub->read.count);
 		}	break;
 
-		case SUBMISSION_WRITE: {
-			fire->status = write(posix_fd, sub->write.ptr, sub->write.count);
-		}	break;
-
+		case SUBMISSION_WRITE:
 		case SUBMISSION_WRITEALL: {
 			fire->status = write(posix_fd, sub->write.ptr, sub->write.count);
-			if (fire->status != -1) {
-				if (sub->write.count > fire->status) {
-					resub_fd=posix_fd;
-					resub=*sub;
-					resub.write.ptr   += fire->status;
-					resub.write.count -= fire->status;
-				} else {
-					assert(sub->write.count == fire->status);
-				}
-			}
 		}	break;
 
 		case SUBMISSION_PREAD: {
 			fire->status = pread(posix_fd, sub->pread.ptr, sub->pread.count, sub->pread.offset);
-			if (fire->status != -1) {
-				assert((fire->status == sub->pread.count) && "TODO resub");
-			}
 		}	break;
 
 		case SUBMISSION_PWRITE: {
 			fire->status = pwrite(posix_fd, sub->pwrite.ptr, sub->pwrite.count, sub->pwrite.offset);
-			if (fire->status != -1) {
-				assert((fire->status == sub->pwrite.count) && "TODO resub");
-			}
 		}	break;
 
-		case SUBMISSION_SENDFILE: {
+		case SUBMISSION_SENDFILE:
+		case SUBMISSION_SENDFILEALL: {
 			const int src_fd = file_id_to_posix_fd(sub->sendfile.src_file_id);
 			off_t o = sub->sendfile.src_offset;
 			fire->status = our_sendfile(posix_fd, src_fd, o, sub->sendfile.count);
 		}	break;
 
-		case SUBMISSION_SENDFILEALL: {
-			const int src_fd = file_id_to_posix_fd(sub->sendfile.src_file_id);
-			off_t o = sub->sendfile.src_offset;
-			fire->status = our_sendfile(posix_fd, src_fd, o, sub->sendfile.count);
-			if (fire->status != -1) {
-				if (sub->sendfile.count > fire->status) {
-					resub_fd=posix_fd;
-					resub=*sub;
-					resub.sendfile.src_offset  += fire->status;
-					resub.sendfile.count       -= fire->status;
-				} else {
-					assert(sub->sendfile.count == fire->status);
-				}
-			}
+		case SUBMISSION_CONNECT: {
+			fire->status = get_connect_status(posix_fd);
 		}	break;
 
 		case INTERNAL_ACCEPT: {
-			struct sockaddr_in addr;
-			socklen_t size = sizeof addr;
-			fire->status = accept(posix_fd, (struct sockaddr*)&addr, &size);
+			socklen_t size = sizeof fire->addr;
+			fire->status = accept(posix_fd, (struct sockaddr*)&fire->addr, &size);
 			if (fire->status >= 0) {
 				const int e = fcntl(fire->status, F_SETFL, O_NONBLOCK);
 				if (e == -1) {
 					assert(!"XXX");
 					fire->status = -1;
-				} else  {
-					arrput(addr_arr, addr);
 				}
 			}
 		}	break;
@@ -955,61 +2057,60 @@ int io_tick(void)
 		default: assert(!"unhandled submission type");
 		}
 
-		if (resub_fd>=0) {
-			fire->did_resub=1;
-			struct file* file = NULL;
-			const int num_files = arrlen(g.file_arr);
-			for (int ii=0; ii<num_files; ++ii) {
-				struct file* f = &g.file_arr[ii];
-				if (f->posix_fd != resub_fd) continue;
-				file = f;
-				break;
-			}
-			assert((file != NULL) && "fd not found?!");
-			submit(file->file_id, &resub);
-		}
+		if (fire->status == -1) fire->error = errno;
+		finish_fire(fire);
 	}
+}
 
+// puts events into ports so io_port_poll() can find them, and gets rid of
+// closed files
+static void deliver_fires(struct fire* fire_arr, int num_to_close)
+{
 	G_LOCK();
-	{ // put events into ports so io_port_poll() can find them
-		int addr_index = 0;
-		const int num_addr = arrlen(addr_arr);
-		const int num_ports = arrlen(g.port_arr);
-		for (int i=0; i<num_fire; ++i) {
-			struct fire* fire = &fire_arr[i];
-			if (fire->did_resub) continue;
-
-			if (fire->status == -1) {
-				// TODO convert status?
-				fire->status = IO_ERROR;
-			} else if (fire->sub.type == INTERNAL_ACCEPT && fire->status >= 0) {
-				const int file_id = alloc_file_id();
-				assert((0 <= addr_index) && (addr_index < num_addr));
-				arrput(g.file_arr, ((struct file) {
-					.type = SOCKET,
-					.file_id = file_id,
-					.posix_fd = fire->status,
-					.addr = addr_arr[addr_index++],
-				}));
-				fire->status = file_id;
-			}
+	const int num_fire = arrlen(fire_arr);
+	struct port* locked_port = NULL;
+	for (int i=0; i<num_fire; ++i) {
+		struct fire* fire = &fire_arr[i];
+		if (fire->file_id > 0) update_readiness(fire);
+		const int num_subs = get_fire_num_subs(fire);
+		const int num_events = (num_subs - fire->num_resubs);
+
+		if (fire->status == -1) {
+			// TODO convert status?
+			fire->status = IO_ERROR;
+		} else if (fire->sub.type == INTERNAL_ACCEPT && fire->status >= 0) {
+			const int file_id = alloc_file_id();
+			put_file(((struct file) {
+				.type = SOCKET,
+				.file_id = file_id,
+				.posix_fd = fire->status,
+				.addr = fire->addr,
+			}));
+			fire->status = file_id;
+		}
 
-			const int port_id = fire->sub.port_id;
-			int found_port = 0;
-			for (int ii=0; ii<num_ports; ++ii) {
-				struct port* port = &g.port_arr[ii];
-				if (port_id != port->port_id) continue;
-				arrput(port->event_arr, ((struct io_event) {
-					.echo = fire->sub.echo,
-					.status = fire->status,
-				}));
-				found_port = 1;
-				break;
+		for (int ii=0; ii<num_events; ++ii) {
+			struct submission* sub = get_fire_sub(fire, ii);
+			// an "all" write reports its whole size, also when it
+			// was coalesced with others, or took several attempts
+			const int status = ((fire->status < 0) || !is_all_write(sub)) ? fire->status : (sub->num_done + get_write_count(sub));
+			// consecutive events usually go to the same port, so its
+			// lock is kept until another port is needed
+			struct port* port = get_port(sub->port_id);
+			if (port != locked_port) {
+				if (locked_port) PORT_UNLOCK(locked_port);
+				PORT_LOCK(port);
+				locked_port = port;
 			}
-			assert(found_port);
+			arrput(port->event_arr, ((struct io_event) {
+				.echo = sub->echo,
+				.status = status,
+			}));
 		}
-		assert(addr_index == num_addr);
+		arrfree(fire->coalesced_arr);
+		arrfree(fire->iov_arr);
 	}
+	if (locked_port) PORT_UNLOCK(locked_port);
 
 	if (num_to_close > 0) {
 		int num_files = arrlen(g.file_arr);
@@ -1017,8 +2118,18 @@ int io_tick(void)
 		for (int ii=0; ii<num_files; ++ii) {
 			struct file* f = &g.file_arr[ii];
 			if (!f->do_close) continue;
+			const int num_subs = arrlen(f->submission_arr);
+			for (int iii=0; iii<num_subs; ++iii) {
+				const int src_file_id = get_sendfile_src_file_id(&f->submission_arr[iii]);
+				struct file* src_file = (src_file_id >= 0) ? find_file(src_file_id) : NULL;
+				if (src_file == NULL) continue;
+				--src_file->num_pipe_destinations;
+				#ifdef IO_EPOLL
+				update_file(src_file);
+				#endif
+			}
 			arrfree(f->submission_arr);
-			arrdel(g.file_arr, ii);
+			del_file(ii);
 			--ii;
 			--num_files;
 			++num_closed;
@@ -1027,11 +2138,317 @@ int io_tick(void)
 	}
 
 	G_UNLOCK();
+}
+
+#ifdef IO_URING
+
+// takes the submissions that can be started from file and prepares SQEs for
+// them. returns 0 when out of SQEs or op slots
+static int uring_start_file(struct file* file)
+{
+	int index;
+	while ((index = uring_find_startable(file)) >= 0) {
+		struct submission* sub = &file->submission_arr[index];
+		struct fire fire = {
+			.file_id = file->file_id,
+			.posix_fd = file->posix_fd,
+			.sub = *sub,
+		};
+		const int is_close = (sub->type == SUBMISSION_CLOSE);
+		const int is_read = (sub->type == SUBMISSION_READ) || (sub->type == SUBMISSION_PREAD);
+		arrdel(file->submission_arr, index);
+		coalesce_writes(file, index, &fire);
+		if (uring_prep(&fire) < 0) {
+			// put everything back as it was
+			const int num_subs = get_fire_num_subs(&fire);
+			for (int i=num_subs-1; i>=0; --i) arrins(file->submission_arr, index, *get_fire_sub(&fire, i));
+			arrfree(fire.coalesced_arr);
+			arrfree(fire.iov_arr);
+			return 0;
+		}
+		// (a sendfile source stays in num_pipe_destinations until the
+		// sendfile completes, so it isn't closed under it)
+		++file->num_inflight;
+		if (is_close) break;
+		if (is_read) {
+			file->is_reading = 1;
+		} else {
+			file->is_writing = 1;
+		}
+	}
+	return 1;
+}
+
+// io_uring backend: submissions are started as SQEs (all of them with one
+// io_uring_enter() per tick), and completions are reaped without syscalls.
+// returns 0 if there's nothing to do
+static int uring_tick(struct fire** fire_arr, int* out_num_to_close)
+{
+	static struct file** start_file_arr;
+	arrreset(start_file_arr);
+
+	G_LOCK();
+
+	// keep an accept in flight for every listening socket
+	const int num_ports = g.num_ports;
+	for (int i=0; i<num_ports; ++i) {
+		struct port* port = g.ports[i];
+		const int num_listen = arrlen(port->listen_arr);
+		for (int ii=0; ii<num_listen; ++ii) {
+			struct listen* listen = &port->listen_arr[ii];
+			if (listen->is_accepting) continue;
+			struct fire fire = {
+				.posix_fd = listen->posix_fd,
+				.sub = {
+					.type = INTERNAL_ACCEPT,
+					.port_id = port->port_id,
+					.echo = listen->echo,
+				},
+			};
+			if (uring_prep(&fire) < 0) break;
+			listen->is_accepting = 1;
+		}
+	}
+
+	int num_kicked = arrlen(g.kick_file_id_arr);
+	int num_started = 0;
+	for (; num_started<num_kicked; ++num_started) {
+		struct file* file = find_file(g.kick_file_id_arr[num_started]);
+		if (file == NULL) continue;
+		if (!uring_start_file(file)) break;
+		file->is_kicked = 0;
+		arrput(start_file_arr, file);
+	}
+	if (num_started > 0) arrdeln(g.kick_file_id_arr, 0, num_started);
+	const int num_start_files = arrlen(start_file_arr);
+	for (int i=0; i<num_start_files; ++i) update_file(start_file_arr[i]);
+
+	G_UNLOCK();
+
+	const int did_submit = uring_submit();
+
+	// reap completions
+	int num_to_close = 0;
+	const int num_fire0 = arrlen(*fire_arr);
+	unsigned head = *g.uring.cq_head;
+	const unsigned tail = __atomic_load_n(g.uring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head) {
+		struct io_uring_cqe* cqe = &g.uring.cqes[head & *g.uring.cq_mask];
+		const int op_index = cqe->user_data;
+		struct uring_op* op = &g.uring.ops[op_index];
+		struct fire fire = op->fire;
+		if (cqe->res < 0) {
+			fire.status = -1;
+			fire.error = -cqe->res;
+		} else {
+			fire.status = cqe->res;
+		}
+		if ((fire.sub.type == SUBMISSION_SENDFILE) || (fire.sub.type == SUBMISSION_SENDFILEALL)) {
+			// the completion was for polling the destination (see
+			// uring_prep()); do the sendfile now
+			if (fire.status >= 0) {
+				const int src_fd = file_id_to_posix_fd(fire.sub.sendfile.src_file_id);
+				fire.status = our_sendfile(fire.posix_fd, src_fd, fire.sub.sendfile.src_offset, fire.sub.sendfile.count);
+				if (fire.status == -1) fire.error = errno;
+			}
+		} else if (fire.sub.type == SUBMISSION_CONNECT) {
+			if (fire.status >= 0) {
+				fire.status = get_connect_status(fire.posix_fd);
+				if (fire.status == -1) fire.error = errno;
+			}
+		}
+		arrput(*fire_arr, fire);
+		arrput(g.uring.free_op_arr, op_index);
+	}
+	__atomic_store_n(g.uring.cq_head, head, __ATOMIC_RELEASE);
+
+	const int num_fire = arrlen(*fire_arr);
+	if (num_fire == num_fire0) {
+		*out_num_to_close = 0;
+		return did_submit;
+	}
+
+	G_LOCK();
+	for (int i=num_fire0; i<num_fire; ++i) {
+		struct fire* fire = &(*fire_arr)[i];
+		if (fire->sub.type == INTERNAL_ACCEPT) {
+			for (int ii=0; ii<num_ports; ++ii) {
+				struct port* port = g.ports[ii];
+				const int num_listen = arrlen(port->listen_arr);
+				for (int iii=0; iii<num_listen; ++iii) {
+					struct listen* listen = &port->listen_arr[iii];
+					if (listen->posix_fd == fire->posix_fd) listen->is_accepting = 0;
+				}
+			}
+			continue;
+		}
+		struct file* file = get_file(fire->file_id);
+		assert(file->num_inflight > 0);
+		--file->num_inflight;
+		switch (fire->sub.type) {
+		case SUBMISSION_READ:
+		case SUBMISSION_PREAD:
+			file->is_reading = 0;
+			break;
+		case SUBMISSION_CLOSE:
+			file->do_close = 1;
+			++num_to_close;
+			break;
+		default:
+			file->is_writing = 0;
+			break;
+		}
+		const int src_file_id = get_sendfile_src_file_id(&fire->sub);
+		if (src_file_id >= 0) {
+			struct file* src_file = get_file(src_file_id);
+			assert(src_file->num_pipe_destinations > 0);
+			--src_file->num_pipe_destinations;
+			update_file(src_file);
+		}
+	}
+	G_UNLOCK();
+
+	for (int i=num_fire0; i<num_fire; ++i) finish_fire(&(*fire_arr)[i]);
 
+	*out_num_to_close = num_to_close;
 	return 1;
 }
 
+#endif
+
+int io_tick(void)
+{
+	static struct fire* fire_arr;
+	arrreset(fire_arr);
+
+	int num_to_close = 0;
+
+	#ifdef IO_URING
+	if (is_uring_in_use()) {
+		if (!uring_tick(&fire_arr, &num_to_close)) return 0;
+		deliver_fires(fire_arr, num_to_close);
+		return 1;
+	}
+	#endif
+
+	if (!collect_fires(&fire_arr, &num_to_close)) return 0;
+	execute_fires(fire_arr);
+	deliver_fires(fire_arr, num_to_close);
+	return 1;
+}
+
+// adds the fds that io_tick() is waiting for to pollfd_arr. returns 0 if
+// io_tick() has work to do right away. G_LOCK must be held
+static int get_wait_pollfds(struct pollfd** pollfd_arr)
+{
+	// UDP sockets aren't handled by io_tick() (or registered with epoll or
+	// io_uring), so they're polled here; level-triggered, so datagrams that
+	// haven't been received yet wake us up too
+	const int num_files = arrlen(g.file_arr);
+	for (int i=0; i<num_files; ++i) {
+		struct file* file = &g.file_arr[i];
+		if (file->type != DATAGRAM) continue;
+		arrput(*pollfd_arr, ((struct pollfd) { .fd = file->posix_fd, .events = POLLIN }));
+	}
+
+	#ifdef IO_URING
+	if (use_uring()) {
+		// the ring fd is readable when there are completions to reap
+		if (arrlen(g.kick_file_id_arr) > 0) return 0;
+		arrput(*pollfd_arr, ((struct pollfd) { .fd = g.uring.ring_fd, .events = POLLIN }));
+		return 1;
+	}
+	#endif
+
+	#ifdef IO_EPOLL
+	// the epoll fd is readable when it has events; polling it doesn't consume
+	// them, so they're still there for collect_fires()
+	if (arrlen(g.kick_file_id_arr) > 0) return 0;
+	arrput(*pollfd_arr, ((struct pollfd) { .fd = get_epoll_fd(), .events = POLLIN }));
+	#else
+	for (int i=0; i<num_files; ++i) {
+		struct file* file = &g.file_arr[i];
+		if (is_closing(file)) return 0;
+		const int events = get_poll_events(file);
+		if (events == 0) continue;
+		arrput(*pollfd_arr, ((struct pollfd) { .fd = file->posix_fd, .events = events }));
+	}
+	const int num_ports = g.num_ports;
+	for (int i=0; i<num_ports; ++i) {
+		struct port* port = g.ports[i];
+		const int num_listen = arrlen(port->listen_arr);
+		for (int ii=0; ii<num_listen; ++ii) {
+			arrput(*pollfd_arr, ((struct pollfd) { .fd = port->listen_arr[ii].posix_fd, .events = POLLIN }));
+		}
+	}
+	#endif
+	return 1;
+}
+
+void io_wait(int64_t timeout_us)
+{
+	static struct pollfd* pollfd_arr;
+	arrreset(pollfd_arr);
+
+	G_LOCK();
+	arrput(pollfd_arr, ((struct pollfd) { .fd = get_wake_fd(), .events = POLLIN }));
+	const int can_wait = get_wait_pollfds(&pollfd_arr);
+	G_UNLOCK();
+	if (!can_wait) return;
+
+	// io_wake() only writes to the wake fd when it sees is_waiting, and we
+	// only sleep if no wakeup happened before is_waiting was set, so wakeups
+	// can't get lost in between
+	atomic_store(&g.is_waiting, 1);
+	if (atomic_exchange(&g.is_wake_pending, 0)) {
+		atomic_store(&g.is_waiting, 0);
+		return;
+	}
+	// poll(2) has millisecond resolution; round up so short timeouts don't
+	// become busy-waiting
+	const int timeout_ms = (timeout_us < 0) ? -1 : (int)((timeout_us + 999) / 1000);
+	const int e = poll(pollfd_arr, arrlen(pollfd_arr), timeout_ms);
+	atomic_store(&g.is_waiting, 0);
+	if ((e == -1) && (errno != EINTR)) {
+		fprintf(stderr, "poll(): %s\n", strerror(errno));
+		abort();
+	}
+	if ((e > 0) && (pollfd_arr[0].revents & POLLIN)) {
+		// drain; is_wake_pending is left as is, so a wakeup racing with
+		// this costs an extra tick rather than being lost
+		uint8_t buf[64];
+		while (read(pollfd_arr[0].fd, buf, sizeof buf) > 0) {}
+	}
+}
+
+void io_wake(void)
+{
+	if (atomic_exchange(&g.is_wake_pending, 1)) return;
+	if (!atomic_load(&g.is_waiting)) return;
+	const uint64_t one = 1;
+	// (8 bytes for eventfd; a pipe just gets the first byte)
+	#ifdef __linux__
+	const int n = sizeof one;
+	#else
+	const int n = 1;
+	#endif
+	if ((write(g.wake_fds[1], &one, n) == -1) && (errno != EAGAIN)) {
+		fprintf(stderr, "io_wake(): %s\n", strerror(errno));
+		abort();
+	}
+}
+
 void io_init(void)
 {
 	assert(0 == pthread_mutex_init(&g.mutex, NULL));
+	// writing to a socket the other end has closed fails with EPIPE instead
+	// of killing us
+	signal(SIGPIPE, SIG_IGN);
+	// the default soft limit (often 1024) is too low for a host with
+	// thousands of spectators (see webserv_set_max_conn_count())
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
 }
@@ -26,6 +26,11 @@ enum io_error {
 	#undef X
 };
 
+struct io_vec {
+	const void* ptr;
+	int64_t count;
+};
+
 typedef union {
 	uint64_t u64;
 	int64_t  i64;
@@ -46,6 +51,11 @@ struct io_event {
 	int status;
 };
 
+struct io_addr {
+	uint32_t ipv4; // host byte order
+	uint16_t port;
+};
+
 const char* io_error_to_string(int error);
 // returns static error string for error id, or NULL if not one of the ones in
 // the LIST_OF_IO_ERRORS X macros
@@ -58,9 +68,18 @@ static inline const char* io_error_to_string_safe(int error)
 
 int io_mkdir(const char* path);
 int io_write_file(const char* path, const void* ptr, int64_t count);
+// replaces the file at path atomically (via a temporary "<path>.tmp" file).
+// it's blocking, so don't call it where latency matters
+int io_rename(const char* old_path, const char* new_path);
+// replaces new_path atomically (rename(2))
+int io_unlink(const char* path);
 
 int io_open(const char* path, enum io_open_mode, int64_t* out_filesize);
 int io_close(int file_id);
+int io_shutdown(int file_id);
+// shuts a socket down both ways, so reads and writes waiting for the other
+// end complete (with EOF or an error) instead, and io_port_close() can close
+// it; for dropping connections whose other end has silently gone away
 
 int io_pread(int file_id, void* ptr, int64_t count, int64_t offset);
 int io_pwrite(int file_id, const void* ptr, int64_t count, int64_t offset);
@@ -72,17 +91,61 @@ int io_listen_tcp(int bind_port, int port_id, io_echo);
 
 void io_addr(int file_id);
 
+int io_resolve(const char* host, int port, struct io_addr* out_addr);
+// looks up host (blocking; don't call it where latency matters). returns 0,
+// or IO_NOT_FOUND
+
+int io_open_udp(int bind_port);
+// opens a UDP socket on :bind_port (0 picks a free port; see
+// io_get_local_port()). datagrams don't go through ports: io_udp_send() and
+// io_udp_recv() never block, and io_wait() returns when there's a datagram to
+// receive. close it with io_close(). returns a file id, or an io error
+int io_get_local_port(int file_id);
+
+int io_udp_send(int file_id, const struct io_addr* to, const void* ptr, int64_t count);
+// sends one datagram. returns 0, or IO_BUFFER_FULL if the socket's send
+// buffer is full (the datagram is dropped, like it could have been anywhere
+// else on the way), or IO_ERROR
+int io_udp_recv(int file_id, void* ptr, int64_t count, struct io_addr* out_from);
+// receives one datagram, and returns its size (longer datagrams are
+// truncated to count). returns IO_PENDING if there's nothing to receive, and
+// IO_READ_ERROR for errors that don't stop other datagrams from arriving
+// (like an ICMP "port unreachable" for something we sent)
+
 int io_port_create(void);
 int io_port_poll(int port_id, struct io_event*);
+// io_port_poll() doesn't take the lock that io_tick() and the submission
+// functions share, so polling doesn't wait for the I/O thread (or the other
+// way around)
 
 void io_port_close(int port_id, io_echo echo, int file_id);
 
+int io_port_connect(int port_id, io_echo echo, const struct io_addr* addr);
+// starts connecting to addr over TCP, and returns a file id for
+// io_port_read()/io_port_write*() like accepted connections have (or an io
+// error). the event arrives on port_id when the connection is established
+// (status 0) or has failed (status <0); the file must be io_port_close()d
+// either way. it fails when the kernel gives up (that can take minutes when
+// nothing answers), or earlier with io_shutdown()
+
 void io_port_read(int port_id, io_echo echo, int file_id, void* ptr, int64_t count);
 void io_port_write(int port_id, io_echo echo, int file_id, const void* ptr, int64_t count);
 void io_port_writeall(int port_id, io_echo echo, int file_id, const void* ptr, int64_t count);
 
 void io_port_pread(int port_id, io_echo echo, int file_id, void* ptr, int64_t count, int64_t offset);
 void io_port_pwrite(int port_id, io_echo echo, int file_id, const void* ptr, int64_t count, int64_t offset);
+void io_port_writev(int port_id, io_echo echo, int file_id, const struct io_vec* vecs, int num_vecs);
+void io_port_pwritev(int port_id, io_echo echo, int file_id, const struct io_vec* vecs, int num_vecs, int64_t offset);
+// vectored io_port_writeall() and io_port_pwrite(); all of it is written
+// before the event. vecs is not copied, so like the data it points at, it
+// must stay valid until the event. at most 64 vecs.
+// NOTE: for the "all" writes (writeall, pwrite, writev, pwritev and
+// sendfileall), short writes are resubmitted rather than reported, and the
+// event's status is the whole count (or an error)
+// NOTE: io_tick() coalesces adjacent writeall/writev submissions on the same
+// file into one writev(2), and pwrite/pwritev submissions with contiguous
+// offsets into one pwritev(2), so these are not needed just to save syscalls
+
 void io_port_sendfile(int port_id, io_echo echo, int dst_file_id, int src_file_id, int64_t count, int64_t src_offset);
 void io_port_sendfileall(int port_id, io_echo echo, int dst_file_id, int src_file_id, int64_t count, int64_t src_offset);
 // sendfile is (probably?) only guaranteed to work properly when dst_file_id is
@@ -90,6 +153,26 @@ void io_port_sendfileall(int port_id, io_echo echo, int dst_file_id, int src_fil
 
 void io_init(void);
 int io_tick(void);
+// does pending I/O and puts events into ports. returns 0 if there was nothing
+// to do
+
+void io_wait(int64_t timeout_us);
+// sleeps until io_tick() probably has something to do, io_wake() is called,
+// or timeout_us has passed (negative means no timeout). meant for the I/O
+// thread when a round of ticks did no work, instead of sleeping for a fixed
+// time
+
+void io_wake(void);
+// makes a sleeping io_wait() return, or the next one return immediately.
+// call it from any thread after producing work for the I/O thread that isn't
+// I/O (e.g. data in a ring buffer); io_port_*() submissions do it themselves.
+// it's cheap (no syscall) unless the I/O thread is actually sleeping
+
+struct lock_stats; // see lockstat.h
+void io_get_lock_stats(struct lock_stats* out_stats, struct lock_stats* out_port_stats);
+// contention counters for the lock shared by io_tick() and the io_*()
+// functions (out_stats), and for the port event locks, summed over all ports
+// (out_port_stats). either can be NULL
 
 #define IO_H
 #endif
@@ -144,6 +144,7 @@ struct jio* jio_open(const char* path, enum io_open_mode mode, int port_id, int
 			return NULL;
 		}
 		jio->head = filesize;
+		jio->tail = filesize; // existing data is already in the file
 	}
 
 	return jio;
@@ -178,6 +179,24 @@ int64_t jio_get_size(struct jio* jio)
 	return jio->filesize;
 }
 
+int64_t jio_get_flushed_size(struct jio* jio)
+{
+	const unsigned num_pending = (jio->head - jio->tail);
+	const int64_t flushed_size = (jio->filesize - num_pending);
+	assert(flushed_size >= 0);
+	return flushed_size;
+}
+
+int jio_get_file_id(struct jio* jio)
+{
+	return jio->file_id;
+}
+
+int64_t jio_get_buffer_size(struct jio* jio)
+{
+	return (1L << jio->ringbuf_size_log2);
+}
+
 int jio_ack(struct jio* jio, io_echo echo)
 {
 	if (echo.ua32 != jio->tag) return 0;
@@ -230,10 +249,15 @@ static void our_pwrite(struct jio* jio, io_echo echo, int file_id, void* buf, in
 	#endif
 }
 
-int jio_append(struct jio* jio, const void* ptr, int64_t size)
+int jio_appendv(struct jio* jio, const struct io_vec* vecs, int num_vecs)
 {
 	// ignore writes if an error has been signalled
 	if (jio->error < 0) return jio->error;
+	int64_t size = 0;
+	for (int i=0; i<num_vecs; ++i) {
+		assert(vecs[i].count >= 0);
+		size += vecs[i].count;
+	}
 	if (size == 0) return 0;
 	assert(size>0);
 	const int ringbuf_size_log2 = jio->ringbuf_size_log2;
@@ -247,13 +271,27 @@ int jio_append(struct jio* jio, const void* ptr, int64_t size)
 		return jio->error;
 	}
 
+	const unsigned mask = (ringbuf_size-1);
+	unsigned p = head;
+	for (int i=0; i<num_vecs; ++i) {
+		const uint8_t* src = vecs[i].ptr;
+		int64_t n = vecs[i].count;
+		while (n > 0) {
+			int64_t nn = (ringbuf_size - (p & mask));
+			if (nn > n) nn = n;
+			memcpy(&jio->ringbuf[p & mask], src, nn);
+			src += nn;
+			n -= nn;
+			p += nn;
+		}
+	}
+	assert(p == new_head);
+
 	const unsigned cycle0 = (head         >> ringbuf_size_log2);
 	const unsigned cycle1 = ((new_head-1) >> ringbuf_size_log2);
-	const unsigned mask = (ringbuf_size-1);
 	const int file_id = jio->file_id;
 	if (cycle0 == cycle1) {
 		void* dst = &jio->ringbuf[head & mask];
-		memcpy(dst, ptr, size);
 		io_echo echo = {
 			.ua32 = jio->tag,
 			.ub32 = new_head,
@@ -264,7 +302,6 @@ int jio_append(struct jio* jio, const void* ptr, int64_t size)
 		const unsigned remain = (cycle1 << ringbuf_size_log2) - head;
 
 		void* dst0 = &jio->ringbuf[head & mask];
-		memcpy(dst0, ptr, remain);
 		const unsigned head0 = new_head - (size-remain);
 		io_echo echo0 = {
 			.ua32 = jio->tag,
@@ -273,22 +310,26 @@ int jio_append(struct jio* jio, const void* ptr, int64_t size)
 		our_pwrite(jio, echo0, file_id, dst0, remain, jio->filesize, head0);
 
 		void* dst1 = jio->ringbuf;
-		memcpy(dst1, ptr+remain, size-remain);
 		const unsigned head1 = new_head;
 		io_echo echo1 = {
 			.ua32 = jio->tag,
 			.ub32 = head1,
 		};
-		our_pwrite(jio, echo1, file_id, dst1, size, jio->filesize+remain, head1);
+		our_pwrite(jio, echo1, file_id, dst1, size-remain, jio->filesize+remain, head1);
 	}
 
 	jio->filesize += size;
-
 	jio->head = new_head;
 
 	return 0;
 }
 
+int jio_append(struct jio* jio, const void* ptr, int64_t size)
+{
+	const struct io_vec vec = { .ptr = ptr, .count = size };
+	return jio_appendv(jio, &vec, 1);
+}
+
 int jio_pread(struct jio* jio, void* ptr, int64_t size, int64_t offset)
 {
 	// ignore read if an error has been signalled
@@ -28,7 +28,17 @@ struct jio;
 struct jio* jio_open(const char* path, enum io_open_mode, int port_id, int ringbuf_size_log2, int* out_error);
 int jio_close(struct jio*);
 int64_t jio_get_size(struct jio*);
+int64_t jio_get_flushed_size(struct jio*);
+// like jio_get_size(), but only counts data known to have been written to the
+// file (i.e. not just to the ring buffer), so it's safe to read it directly
+// from the file, e.g. with io_port_sendfile()
+int jio_get_file_id(struct jio*);
+int64_t jio_get_buffer_size(struct jio*);
+// size of the ring buffer (memory used by the jio)
 int jio_append(struct jio*, const void* ptr, int64_t size);
+int jio_appendv(struct jio*, const struct io_vec* vecs, int num_vecs);
+// appends the concatenation of vecs; it becomes visible (jio_get_size()) all
+// at once
 int jio_pread(struct jio*, void* ptr, int64_t size, int64_t offset);
 int jio_pwrite(struct jio*, const void* ptr, int64_t size, int64_t offset);
 //int jio_pread_memonly(struct jio*, void* ptr, int64_t size, int64_t offset);
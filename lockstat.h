@@ -0,0 +1,51 @@
+#ifndef LOCKSTAT_H
+
+// mutex locking with contention counters, to see whether threads actually get
+// in each other's way. the uncontended case costs one pthread_mutex_trylock();
+// the clock is only read when the lock has to be waited for.
+
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+
+struct lock_stats {
+	int64_t num_acquired;
+	int64_t num_contended; // acquisitions that had to wait for another thread
+	int64_t wait_ns;       // total time spent waiting
+	int64_t max_wait_ns;
+};
+
+static inline int64_t lockstat__get_nanoseconds(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL;
+}
+
+// the stats are updated while holding the lock, so they're protected by it
+static inline void lockstat_mutex_lock(pthread_mutex_t* mutex, struct lock_stats* stats)
+{
+	if (0 == pthread_mutex_trylock(mutex)) {
+		++stats->num_acquired;
+		return;
+	}
+	const int64_t t0 = lockstat__get_nanoseconds();
+	assert(0 == pthread_mutex_lock(mutex));
+	const int64_t dt = lockstat__get_nanoseconds() - t0;
+	++stats->num_acquired;
+	++stats->num_contended;
+	stats->wait_ns += dt;
+	if (dt > stats->max_wait_ns) stats->max_wait_ns = dt;
+}
+
+static inline void lockstat_add(struct lock_stats* dst, const struct lock_stats* src)
+{
+	dst->num_acquired  += src->num_acquired;
+	dst->num_contended += src->num_contended;
+	dst->wait_ns       += src->wait_ns;
+	if (src->max_wait_ns > dst->max_wait_ns) dst->max_wait_ns = src->max_wait_ns;
+}
+
+#define LOCKSTAT_H
+#endif
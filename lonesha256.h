@@ -20,6 +20,12 @@ lonesha256 function:
 (static|extern) int lonesha256 (unsigned char out[32], const unsigned char* in, size_t len)
     writes the sha256 hash of the first "len" bytes in buffer "in" to buffer "out"
     returns 0 on success, may return non-zero in future versions to indicate error
+
+incremental functions (for data that doesn't fit in memory, or arrives in pieces):
+(static|extern) void lonesha256_init (struct lonesha256_ctx* ctx)
+(static|extern) void lonesha256_update (struct lonesha256_ctx* ctx, const unsigned char* in, size_t len)
+(static|extern) void lonesha256_final (struct lonesha256_ctx* ctx, unsigned char out[32])
+    lonesha256(out, in, len) is the same as init, then update(in, len), then final(out)
 */
 
 //header section
@@ -36,9 +42,20 @@ lonesha256 function:
 
 //includes
 #include <stddef.h> //size_t
+#include <stdint.h> //uint32_t, uint64_t
+
+struct lonesha256_ctx {
+    uint32_t state[8];
+    uint64_t length; //in bits
+    unsigned char buf[64];
+    size_t buflen;
+};
 
-//lonesha256 declaration
+//lonesha256 declarations
 LSHA256DEF void lonesha256(unsigned char[32], const unsigned char*, size_t);
+LSHA256DEF void lonesha256_init(struct lonesha256_ctx*);
+LSHA256DEF void lonesha256_update(struct lonesha256_ctx*, const unsigned char*, size_t);
+LSHA256DEF void lonesha256_final(struct lonesha256_ctx*, unsigned char[32]);
 
 #endif //LONESHA256_H
 
@@ -81,60 +98,97 @@ LSHA256DEF void lonesha256(unsigned char[32], const unsigned char*, size_t);
 #include <stdint.h> //uint32_t, uint64_t
 #include <string.h> //memcpy
 
-//lonesha256 function
-LSHA256DEF void lonesha256 (unsigned char out[32], const unsigned char* in, size_t len) {
-    //writes the sha256 hash of the first "len" bytes in buffer "in" to buffer "out"
-    const uint32_t K[64] = {
-        0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL,
-        0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
-        0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL,
-        0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
-        0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
-        0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
-        0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL,
-        0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
-        0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL,
-        0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
-        0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL,
-        0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
-        0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL,
-        0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
-        0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
-        0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
-    };
-    uint64_t sha256_length = 0;
-    uint32_t sha256_state[8] = {
+static const uint32_t lonesha256_K[64] = {
+    0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL,
+    0x3956c25bUL, 0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL,
+    0xd807aa98UL, 0x12835b01UL, 0x243185beUL, 0x550c7dc3UL,
+    0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL, 0xc19bf174UL,
+    0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
+    0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL,
+    0x983e5152UL, 0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL,
+    0xc6e00bf3UL, 0xd5a79147UL, 0x06ca6351UL, 0x14292967UL,
+    0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL, 0x53380d13UL,
+    0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+    0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL,
+    0xd192e819UL, 0xd6990624UL, 0xf40e3585UL, 0x106aa070UL,
+    0x19a4c116UL, 0x1e376c08UL, 0x2748774cUL, 0x34b0bcb5UL,
+    0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL, 0x682e6ff3UL,
+    0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
+    0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
+};
+
+static void lonesha256_compress(uint32_t sha256_state[8], const unsigned char* in) {
+    const uint32_t* K = lonesha256_K;
+    uint32_t S[8], W[64], t0, t1, t;
+    SHA256_COMPRESS(in);
+}
+
+LSHA256DEF void lonesha256_init (struct lonesha256_ctx* ctx) {
+    static const uint32_t initial_state[8] = {
         0x6a09e667UL, 0xbb67ae85UL, 0x3c6ef372UL, 0xa54ff53aUL,
         0x510e527fUL, 0x9b05688cUL, 0x1f83d9abUL, 0x5be0cd19UL
-    }, S[8], W[64], t0, t1, t;
-    unsigned char sha256_buf[64];
+    };
+    memcpy(ctx->state, initial_state, sizeof initial_state);
+    ctx->length = 0;
+    ctx->buflen = 0;
+}
+
+LSHA256DEF void lonesha256_update (struct lonesha256_ctx* ctx, const unsigned char* in, size_t len) {
+    //top up a partial chunk first
+    if (ctx->buflen > 0) {
+        size_t n = 64 - ctx->buflen;
+        if (n > len) n = len;
+        memcpy(ctx->buf + ctx->buflen, in, n);
+        ctx->buflen += n;
+        in += n;
+        len -= n;
+        if (ctx->buflen < 64) return;
+        lonesha256_compress(ctx->state, ctx->buf);
+        ctx->length += 64 * 8;
+        ctx->buflen = 0;
+    }
     //process input in 64 byte chunks
     while (len >= 64) {
-       SHA256_COMPRESS(in);
-       sha256_length += 64 * 8;
-       in += 64;
-       len -= 64;
+        lonesha256_compress(ctx->state, in);
+        ctx->length += 64 * 8;
+        in += 64;
+        len -= 64;
     }
-    //copy remaining bytes into sha256_buf
-    memcpy(sha256_buf, in, len);
+    //keep the rest for later
+    memcpy(ctx->buf, in, len);
+    ctx->buflen = len;
+}
+
+LSHA256DEF void lonesha256_final (struct lonesha256_ctx* ctx, unsigned char out[32]) {
+    unsigned char* sha256_buf = ctx->buf;
+    size_t len = ctx->buflen;
     //finish up (len now number of bytes in sha256_buf)
-    sha256_length += len * 8;
+    ctx->length += len * 8;
     sha256_buf[len++] = 0x80;
     //pad then compress if length is above 56 bytes
     if (len > 56) {
         while (len < 64) sha256_buf[len++] = 0;
-        SHA256_COMPRESS(sha256_buf);
+        lonesha256_compress(ctx->state, sha256_buf);
         len = 0;
     }
     //pad up to 56 bytes
     while (len < 56) sha256_buf[len++] = 0;
     //store length and compress
-    STORE64H(sha256_length, sha256_buf + 56);
-    SHA256_COMPRESS(sha256_buf);
+    STORE64H(ctx->length, sha256_buf + 56);
+    lonesha256_compress(ctx->state, sha256_buf);
     //copy output
     for (int i = 0; i < 8; i++) {
-        STORE32H(sha256_state[i], out + 4*i);
+        STORE32H(ctx->state[i], out + 4*i);
     }
 }
 
+//lonesha256 function
+LSHA256DEF void lonesha256 (unsigned char out[32], const unsigned char* in, size_t len) {
+    //writes the sha256 hash of the first "len" bytes in buffer "in" to buffer "out"
+    struct lonesha256_ctx ctx;
+    lonesha256_init(&ctx);
+    lonesha256_update(&ctx, in, len);
+    lonesha256_final(&ctx, out);
+}
+
 #endif //LONESHA256_IMPLEMENTATION
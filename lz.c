@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lz.h"
+
+#define MIN_HASH_LOG2 (8)
+#define MAX_HASH_LOG2 (14)
+#define PRIME_FACTOR   (16)
+#define MIN_PRIME_SIZE (1L<<12)
+
+static inline uint32_t read_u32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline uint32_t hash4(const uint8_t* p, int hash_log2)
+{
+	return (read_u32(p) * 2654435761u) >> (32 - hash_log2);
+}
+
+static uint8_t* put_extra_length(uint8_t* op, int64_t n)
+{
+	assert(n >= 0);
+	while (n >= 255) {
+		*(op++) = 255;
+		n -= 255;
+	}
+	*(op++) = n;
+	return op;
+}
+
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* literals, int64_t num_literals, int offset, int64_t match_length)
+{
+	assert(num_literals >= 0);
+	const int64_t ml = (match_length - LZ_MIN_MATCH);
+	uint8_t* token = op++;
+	*token = ((num_literals < 15) ? num_literals : 15) << 4;
+	if (num_literals >= 15) op = put_extra_length(op, num_literals - 15);
+	memcpy(op, literals, num_literals);
+	op += num_literals;
+	if (match_length == 0) return op; // last sequence
+	assert(ml >= 0);
+	assert((0 < offset) && (offset <= LZ_MAX_DICT_SIZE));
+	*(op++) = offset & 0xff;
+	*(op++) = offset >> 8;
+	*token |= (ml < 15) ? ml : 15;
+	if (ml >= 15) op = put_extra_length(op, ml - 15);
+	return op;
+}
+
+int64_t lz_compress_bound(int64_t size)
+{
+	// worst case is (almost) all literals: tokens, size/255 extra length
+	// bytes, and the literals
+	return size + (size / 255) + 16;
+}
+
+int64_t lz_compress(uint8_t* dst, const uint8_t* buf, int64_t dict_size, int64_t size)
+{
+	assert((dict_size >= 0) && (size >= 0));
+	if (dict_size > LZ_MAX_DICT_SIZE) {
+		buf += (dict_size - LZ_MAX_DICT_SIZE);
+		dict_size = LZ_MAX_DICT_SIZE;
+	}
+	const int64_t end = (dict_size + size);
+	assert((end < INT32_MAX) && "input too big; compress it in blocks");
+
+	// indexing all of the dictionary is too slow when size is small (e.g. a
+	// 64 byte journal update with a 64kB dictionary), so only the most recent
+	// part is indexed
+	int64_t prime_size = (size * PRIME_FACTOR);
+	if (prime_size < MIN_PRIME_SIZE) prime_size = MIN_PRIME_SIZE;
+	if (prime_size > dict_size) prime_size = dict_size;
+
+	int hash_log2 = MIN_HASH_LOG2;
+	while ((hash_log2 < MAX_HASH_LOG2) && ((1L << hash_log2) < (prime_size + size))) ++hash_log2;
+	int32_t* table = calloc(1L << hash_log2, sizeof *table); // position+1 (0=none)
+
+	for (int64_t i=(dict_size - prime_size); (i+LZ_MIN_MATCH) <= dict_size; ++i) {
+		table[hash4(&buf[i], hash_log2)] = i+1;
+	}
+
+	uint8_t* op = dst;
+	int64_t anchor = dict_size;
+	int64_t i = dict_size;
+	while ((i+LZ_MIN_MATCH) <= end) {
+		const uint32_t h = hash4(&buf[i], hash_log2);
+		int64_t ref = table[h] - 1;
+		table[h] = i+1;
+		if ((ref < 0) || ((i-ref) > LZ_MAX_DICT_SIZE) || (read_u32(&buf[ref]) != read_u32(&buf[i]))) {
+			// skip faster through data that doesn't compress
+			i += 1 + ((i - anchor) >> 6);
+			continue;
+		}
+
+		// extend match backwards and forwards
+		while ((i > anchor) && (ref > 0) && (buf[i-1] == buf[ref-1])) {
+			--i;
+			--ref;
+		}
+		int64_t n = LZ_MIN_MATCH;
+		while (((i+n) < end) && (buf[ref+n] == buf[i+n])) ++n;
+
+		op = put_sequence(op, &buf[anchor], (i - anchor), (i - ref), n);
+		i += n;
+		anchor = i;
+		// matches usually continue where the previous one left off, so
+		// remember a position near the end of this one
+		if ((i-2+LZ_MIN_MATCH) <= end) table[hash4(&buf[i-2], hash_log2)] = (i-2)+1;
+	}
+	op = put_sequence(op, &buf[anchor], (end - anchor), 0, 0);
+
+	free(table);
+	const int64_t n = (op - dst);
+	assert(n <= lz_compress_bound(size));
+	return n;
+}
+
+static int get_extra_length(const uint8_t** pp, const uint8_t* end, int64_t* inout_length)
+{
+	const uint8_t* p = *pp;
+	for (;;) {
+		if (p >= end) return -1;
+		const uint8_t b = *(p++);
+		*inout_length += b;
+		if (b < 255) break;
+		if (*inout_length > INT32_MAX) return -1;
+	}
+	*pp = p;
+	return 0;
+}
+
+int64_t lz_decompress(uint8_t* buf, int64_t dict_size, int64_t size, const uint8_t* src, int64_t src_size)
+{
+	assert((dict_size >= 0) && (size >= 0) && (src_size >= 0));
+	uint8_t* op = &buf[dict_size];
+	uint8_t* const oend = (op + size);
+	const uint8_t* ip = src;
+	const uint8_t* const iend = (src + src_size);
+	for (;;) {
+		if (ip >= iend) return -1;
+		const uint8_t token = *(ip++);
+
+		int64_t num_literals = (token >> 4);
+		if ((num_literals == 15) && (get_extra_length(&ip, iend, &num_literals) < 0)) return -1;
+		if ((num_literals > (iend - ip)) || (num_literals > (oend - op))) return -1;
+		memcpy(op, ip, num_literals);
+		ip += num_literals;
+		op += num_literals;
+
+		if (ip == iend) break; // last sequence
+
+		if ((iend - ip) < 2) return -1;
+		const int64_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((offset == 0) || (offset > (op - buf))) return -1;
+		int64_t match_length = (token & 15);
+		if ((match_length == 15) && (get_extra_length(&ip, iend, &match_length) < 0)) return -1;
+		match_length += LZ_MIN_MATCH;
+		if (match_length > (oend - op)) return -1;
+		const uint8_t* ref = (op - offset);
+		if (offset >= match_length) {
+			memcpy(op, ref, match_length);
+		} else {
+			// overlapping match (e.g. offset=1 repeats a byte); memcpy()
+			// and memmove() won't do
+			for (int64_t i=0; i<match_length; ++i) op[i] = ref[i];
+		}
+		op += match_length;
+	}
+	if (op != oend) return -1;
+	return size;
+}
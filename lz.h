@@ -0,0 +1,40 @@
+#ifndef LZ_H
+
+// small LZ77 codec used for compressing websocket traffic (see WSFLAG_LZ in
+// protocol.h). the format is LZ4-like: no entropy coding, so the ratio is
+// modest, but it's fast on both ends and it's not much code.
+//
+// the data is a sequence of "sequences": a token byte (high nibble: literal
+// length, low nibble: match length minus LZ_MIN_MATCH; 15 means "more length
+// bytes follow"), extra literal length bytes, literals, a 16-bit little endian
+// match offset, and extra match length bytes. extra length bytes are added
+// together; 255 means "more length bytes follow". the last sequence only has
+// literals (the input ends there).
+//
+// both functions take a buffer where the first dict_size bytes is a
+// "dictionary"; data that both ends already have (e.g. recent journal bytes).
+// matches can refer back into the dictionary, which is what makes small inputs
+// compress at all: on bench_lz.sh's synthetic journal, 64 byte updates go from
+// a ratio of ~1.04 to ~1.4 with a dictionary (~1.47 for big updates).
+
+#include <stdint.h>
+
+#define LZ_MIN_MATCH     (4)
+#define LZ_MAX_DICT_SIZE (65535) // also the maximum match offset
+
+int64_t lz_compress_bound(int64_t size);
+// worst case compressed size of size bytes
+
+int64_t lz_compress(uint8_t* dst, const uint8_t* buf, int64_t dict_size, int64_t size);
+// compresses buf[dict_size:dict_size+size] into dst, which must have room for
+// lz_compress_bound(size) bytes. buf[0:dict_size] is the dictionary (only the
+// last LZ_MAX_DICT_SIZE bytes of it are used). returns the compressed size
+
+int64_t lz_decompress(uint8_t* buf, int64_t dict_size, int64_t size, const uint8_t* src, int64_t src_size);
+// decompresses src into buf[dict_size:dict_size+size], where buf[0:dict_size]
+// must be the same dictionary that was passed to lz_compress() (or at least
+// the last LZ_MAX_DICT_SIZE bytes of it). returns size on success, or -1 if
+// src is malformed, or doesn't decompress to exactly size bytes
+
+#define LZ_H
+#endif
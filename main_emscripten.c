@@ -24,6 +24,7 @@
 #include "bb.h"
 #include "protocol.h"
 #include "bufstream.h"
+#include "lz.h"
 
 static struct {
 	//int num_cores;
@@ -33,6 +34,9 @@ static struct {
 	int running;
 	int64_t journal_cursor;
 	uint8_t* bb;
+	uint8_t* lz_window_arr;
+	// the most recent journal data received (since WS1_HELLO2); it's the
+	// dictionary for WS1_JOURNAL_UPDATE_LZ
 	EMSCRIPTEN_WEBSOCKET_T socket;
 } g;
 
@@ -46,14 +50,6 @@ EM_JS(char*, get_websocket_url, (void), {
 	return stringToNewUTF8(url);
 })
 
-EM_JS(char*, get_info_url, (void), {
-	let loc = window.location;
-	let url = loc.protocol + "//" + loc.hostname;
-	if (loc.port) url += (":"+loc.port);
-	url += (loc.pathname + "/info");
-	return stringToNewUTF8(url);
-})
-
 EM_JS(int, canvas_get_width, (void), {
 	const e = document.getElementById("canvas");
 	const v = e.width = e.offsetWidth;
@@ -233,14 +229,16 @@ void sleep_microseconds(int64_t us)
 	assert(!"don't sleep");
 }
 
-static char *WS_URL, *INFO_URL;
+static char* WS_URL;
 
 static void request_journal(void)
 {
 	uint8_t** bb = &g.bb;
 	arrreset(*bb);
-	bb_append_u8(bb, WS0_HELLO);
+	bb_append_u8(bb, WS0_HELLO2);
+	bb_append_leb128(bb, WS_PROTOCOL_VERSION);
 	bb_append_leb128(bb, g.journal_cursor);
+	bb_append_leb128(bb, WSFLAG_LZ);
 	emscripten_websocket_send_binary(g.socket, *bb, arrlen(*bb));
 }
 
@@ -269,6 +267,24 @@ enum {
 	CLOSE_PROTOCOL_ERROR = 1002,
 };
 
+static void lz_window_trim(void)
+{
+	uint8_t** w = &g.lz_window_arr;
+	const int64_t n = arrlen(*w);
+	if (n > LZ_MAX_DICT_SIZE) arrdeln(*w, 0, n - LZ_MAX_DICT_SIZE);
+}
+
+static void lz_window_push(const uint8_t* data, int64_t count)
+{
+	if (count >= LZ_MAX_DICT_SIZE) {
+		arrreset(g.lz_window_arr);
+		data += (count - LZ_MAX_DICT_SIZE);
+		count = LZ_MAX_DICT_SIZE;
+	}
+	bb_append(&g.lz_window_arr, data, count);
+	lz_window_trim();
+}
+
 bool ws_on_message(int type, const EmscriptenWebSocketMessageEvent* e, void *usr)
 {
 	struct bufstream bs;
@@ -284,13 +300,66 @@ bool ws_on_message(int type, const EmscriptenWebSocketMessageEvent* e, void *usr
 				emscripten_websocket_close(e->socket, CLOSE_PROTOCOL_ERROR, "bad journal");
 				return 0;
 			}
+			lz_window_push(e->data + bs.offset, count);
 			bs_skip(&bs, count);
 			g.journal_cursor += count;
 		}	break;
 
-		case WS1_HELLO: {
+		case WS1_JOURNAL_UPDATE_LZ: {
+			const int64_t count = bs_read_leb128(&bs);
+			const int64_t dict_size = bs_read_leb128(&bs);
+			const int64_t compressed_size = bs_read_leb128(&bs);
+			uint8_t** w = &g.lz_window_arr;
+			const int64_t n0 = arrlen(*w);
+			if ((dict_size > n0) || (compressed_size > (e->numBytes - bs.offset))) {
+				printf("bad WS1_JOURNAL_UPDATE_LZ\n");
+				emscripten_websocket_close(e->socket, CLOSE_PROTOCOL_ERROR, "bad journal");
+				return 0;
+			}
+			arrsetlen(*w, n0 + count);
+			if (lz_decompress(*w + (n0 - dict_size), dict_size, count, e->data + bs.offset, compressed_size) < 0) {
+				printf("lz decompression failed\n");
+				emscripten_websocket_close(e->socket, CLOSE_PROTOCOL_ERROR, "bad journal");
+				return 0;
+			}
+			if (peer_spool_raw_journal_into_upstream_snapshot(*w + n0, count) < 0) {
+				printf("spool error: received bad message from host?\n");
+				emscripten_websocket_close(e->socket, CLOSE_PROTOCOL_ERROR, "bad journal");
+				return 0;
+			}
+			lz_window_trim();
+			bs_skip(&bs, compressed_size);
+			g.journal_cursor += count;
+		}	break;
+
+		case WS1_HELLO2: {
+			(void)bs_read_leb128(&bs); // WS_PROTOCOL_VERSION
 			const int64_t my_artist_id = bs_read_leb128(&bs);
 			set_my_artist_id(my_artist_id);
+			(void)bs_read_leb128(&bs); // WSFLAG_* flags
+		}	break;
+
+		case WS1_SNAPSHOT: {
+			const int64_t count = bs_read_leb128(&bs);
+			g.journal_cursor = restore_upstream_snapshot_from_data(e->data + bs.offset, count);
+			arrreset(g.lz_window_arr);
+			bs_skip(&bs, count);
+		}	break;
+
+		case WS1_SNAPSHOT_LZ: {
+			const int64_t count = bs_read_leb128(&bs);
+			const int64_t compressed_size = bs_read_leb128(&bs);
+			uint8_t* snapshot = malloc(count);
+			if ((compressed_size > (e->numBytes - bs.offset)) || (lz_decompress(snapshot, 0, count, e->data + bs.offset, compressed_size) < 0)) {
+				free(snapshot);
+				printf("bad WS1_SNAPSHOT_LZ\n");
+				emscripten_websocket_close(e->socket, CLOSE_PROTOCOL_ERROR, "bad snapshot");
+				return 0;
+			}
+			g.journal_cursor = restore_upstream_snapshot_from_data(snapshot, count);
+			free(snapshot);
+			arrreset(g.lz_window_arr);
+			bs_skip(&bs, compressed_size);
 		}	break;
 
 		default: {
@@ -311,10 +380,10 @@ bool ws_on_message(int type, const EmscriptenWebSocketMessageEvent* e, void *usr
 	return 0;
 }
 
-void info_on_load(void* usr, void* data, int size)
+static void connect_to_host(void)
 {
-	g.journal_cursor = restore_upstream_snapshot_from_data(data, size);
-
+	// we say hello with journal_cursor=0, so the host bootstraps us with a
+	// snapshot (WS1_SNAPSHOT) followed by journal updates
 	EmscriptenWebSocketCreateAttributes attr = {0};
 	emscripten_websocket_init_create_attributes(&attr);
 	attr.url = WS_URL;
@@ -327,11 +396,6 @@ void info_on_load(void* usr, void* data, int size)
 	emscripten_websocket_set_onmessage_callback(g.socket, NULL, ws_on_message);
 }
 
-void info_on_error(void* usr)
-{
-	assert(!"failed to load info");
-}
-
 void transmit_mim(int mim_session_id, int64_t tracer, uint8_t* data, int count)
 {
 	uint8_t** bb = &g.bb;
@@ -347,8 +411,7 @@ void transmit_mim(int mim_session_id, int64_t tracer, uint8_t* data, int count)
 int main(int argc, char** argv)
 {
 	WS_URL = get_websocket_url();
-	INFO_URL = get_info_url();
-	printf("WS_URL=[%s] INFO_URL=[%s]\n", WS_URL, INFO_URL);
+	printf("WS_URL=[%s]\n", WS_URL);
 	//g.num_cores = emscripten_navigator_hardware_concurrency();
 	g.start_time = emscripten_get_now();
 	assert(emscripten_websocket_is_supported());
@@ -360,7 +423,7 @@ int main(int argc, char** argv)
 	gig_configure_as_peer_only("/data");
 	gui_init();
 
-	emscripten_async_wget_data(INFO_URL, NULL, info_on_load, info_on_error);
+	connect_to_host();
 
 	open_window();
 	get_window(0)->state = WINDOW_IS_OPEN;
@@ -1,11 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <sys/time.h>
 
 #include "main.h"
 #include "arg.h"
 #include "gig.h"
+#include "io.h"
+#include "webserv.h"
+#include "relay.h"
+#include "udp.h"
 
 int64_t get_nanoseconds_monotonic(void)
 {
@@ -14,17 +20,113 @@ int64_t get_nanoseconds_monotonic(void)
 	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL;
 }
 
+int64_t get_microseconds_epoch(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000LL + (int64_t)tv.tv_usec;
+}
+
+void sleep_microseconds(int64_t us)
+{
+	struct timespec t = {
+		.tv_sec  = us / 1000000LL,
+		.tv_nsec = (us % 1000000LL) * 1000LL,
+	};
+	nanosleep(&t, NULL);
+}
+
+void transmit_mim(int mim_session_id, int64_t tracer, uint8_t* data, int count)
+{
+	assert(!"headless is host only; there's no local peer to transmit from");
+}
+
 int main(int argc, char** argv)
 {
 	parse_args(argc, argv);
 	run_selftest();
 	io_init();
-	jio_init();
+	if (arg_port != NULL) webserv_set_port(atoi(arg_port));
+	if (arg_maxconn != NULL) webserv_set_max_conn_count(atoi(arg_maxconn));
+	if (arg_wstimeout != NULL) webserv_set_websocket_timeout_ms(atoi(arg_wstimeout)*1000);
+	if (arg_mimrate != NULL) {
+		const char* bytes = strchr(arg_mimrate, ',');
+		webserv_set_mim_rate_limit(atof(arg_mimrate), (bytes != NULL) ? atof(bytes+1) : 0.0);
+	}
+	if (arg_uploadbudget != NULL) webserv_set_upload_budget((int64_t)(atof(arg_uploadbudget) * 1024.0 * 1024.0));
+	webserv_init();
 	mie_thread_init();
 	gig_init();
+
+	const char* dir = arg_dir ? arg_dir : ".";
+	if (arg_hibernate != NULL) {
+		gig_set_room_hibernation_timeout_us((int64_t)(atof(arg_hibernate) * 1e6));
+	}
+	// with -connect we're a relay for the upstream host's room (and serve
+	// nothing else)
+	if (arg_connect != NULL && (arg_rooms != NULL || arg_udp != NULL)) {
+		fprintf(stderr, "a relay can't have -rooms or -udp\n");
+		return EXIT_FAILURE;
+	}
+	if (arg_connect != NULL && relay_init(arg_connect) < 0) {
+		fprintf(stderr, "bad -connect [%s]; expected HOST:PORT[/PATH]\n", arg_connect);
+		return EXIT_FAILURE;
+	}
+	int e = (arg_connect != NULL) ? gig_configure_as_relay(dir) : gig_configure_as_host_only(dir);
+	if (e<0) {
+		fprintf(stderr, "configure failed\n");
+		return EXIT_FAILURE;
+	}
+
+	// UDP peers get room 0
+	if ((arg_udp != NULL) && (udp_host_init(atoi(arg_udp)) < 0)) {
+		fprintf(stderr, "could not serve UDP on port %s\n", arg_udp);
+		return EXIT_FAILURE;
+	}
+
+	// each room in -rooms a,b,c is served at /o/room/<name>/ and has its
+	// data in <dir>/room/<name>
+	if (arg_rooms != NULL) {
+		char path[1<<12];
+		snprintf(path, sizeof path, "%s/room", dir);
+		(void)io_mkdir(path);
+		const char* p = arg_rooms;
+		while (*p) {
+			const char* p1 = strchr(p, ',');
+			if (p1 == NULL) p1 = p + strlen(p);
+			char name[1<<8];
+			snprintf(name, sizeof name, "%.*s", (int)(p1-p), p);
+			snprintf(path, sizeof path, "%s/room/%s", dir, name);
+			if (gig_add_room(name, path) < 0) {
+				fprintf(stderr, "could not add room [%s]\n", name);
+				return EXIT_FAILURE;
+			}
+			p = (*p1) ? p1+1 : p1;
+		}
+	}
+
 	for (;;) {
-		gig_thread_tick();
-		sleep_microseconds(3000L); // 3ms
+		int did_work = 0;
+		did_work |= host_tick();
+		did_work |= webserv_tick();
+		if (arg_connect != NULL) did_work |= relay_tick();
+		if (arg_udp != NULL) did_work |= udp_host_tick();
+		did_work |= io_tick();
+		if (!did_work) {
+			// sleep until there's I/O, or until the next timed work:
+			// debounced derived files, room hibernation, deferred mims
+			// and UDP timers. relay reconnects and websocket keepalives
+			// are also driven by time alone, but they're not in a hurry,
+			// so the 1s cap covers them
+			int64_t timeout_us = 1000000L;
+			const int64_t gig_timeout_us = gig_get_wait_timeout_us();
+			if ((gig_timeout_us >= 0) && (gig_timeout_us < timeout_us)) timeout_us = gig_timeout_us;
+			const int64_t ws_timeout_us = webserv_get_wait_timeout_us();
+			if ((ws_timeout_us >= 0) && (ws_timeout_us < timeout_us)) timeout_us = ws_timeout_us;
+			const int64_t udp_timeout_us = udp_get_wait_timeout_us();
+			if ((udp_timeout_us >= 0) && (udp_timeout_us < timeout_us)) timeout_us = udp_timeout_us;
+			io_wait(timeout_us);
+		}
 	}
 	return EXIT_SUCCESS;
 }
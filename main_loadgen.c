@@ -0,0 +1,766 @@
+// headless load generator (build with Makefile.linux.loadgen). it hosts a
+// room like main_headless.c does, and stresses it from another thread with N
+// websocket connections over loopback that speak the same protocol as the web
+// client (see protocol.h): WS0_HELLO2, bootstrap from WS1_SNAPSHOT, and then
+// WS1_JOURNAL_UPDATE's. the first -artists connections also send WS0_MIM's at
+// -rate mims/s each (Poisson arrivals), either randomized typing or the lines
+// of a -script. it reports:
+//  - commit=>broadcast latency: from the record timestamp (taken when the
+//    host commits the mim) until a connection has read the record. every
+//    connection samples every record
+//  - mim roundtrip latency: from when an artist was scheduled to send a mim
+//    until its record came back. it's open loop (a slow host doesn't slow the
+//    artists down) so queueing shows up as latency, not as a lower rate
+//  - host throughput: mims and journal bytes committed, bytes broadcast, and
+//    the CPU time used by the host thread
+//  - mims deferred by the host's rate limit (which -mimrate sets; see
+//    webserv_set_mim_rate_limit())
+// the connections are raw sockets driven by ppoll() rather than io.c, so the
+// host thread runs exactly the main_headless.c loop and nothing else
+
+#define _GNU_SOURCE // ppoll()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "main.h"
+#include "gig.h"
+#include "io.h"
+#include "webserv.h"
+#include "protocol.h"
+#include "stb_ds_sysalloc.h"
+#include "bb.h"
+#include "bufstream.h"
+#include "lz.h"
+
+#define DEFAULT_DIR        "_loadgen.dir"
+#define DEFAULT_PORT       (6582)
+#define JOIN_TIMEOUT_US    (30000000LL)
+#define DRAIN_TIMEOUT_US   (10000000LL)
+#define SCRIPT_SETUP_END   "--"
+// script lines before a "--" line are only sent once (e.g. "setdoc"); the
+// lines after it are sent over and over
+
+enum {
+	WS_CONTINUATION_FRAME = 0,
+	WS_BINARY_FRAME       = 2,
+	WS_CONNECTION_CLOSE   = 8,
+	WS_PING               = 9,
+	WS_PONG               = 10,
+};
+
+enum phase {
+	JOINING = 0, // connecting, and waiting for everybody's snapshot
+	MEASURING,   // artists are sending mims
+	DRAINING,    // waiting for the last records to reach everybody
+	DONE,
+};
+
+struct client {
+	int fd;
+	unsigned got_101 :1;
+	unsigned is_bootstrapped :1;
+	int artist_id;
+	uint8_t* rx_arr;      // received data that's not a complete frame yet
+	uint8_t* tx_arr;      // data not yet written
+	uint8_t* msg_arr;     // the message being assembled from fragments
+	uint8_t* journal_arr; // received journal data that's not whole records yet
+	uint8_t* lz_window_arr;
+	int64_t connect_us;
+	int64_t num_records;  // records committed since MEASURING
+	int64_t num_bytes_received;
+	// artists only:
+	int64_t next_mim_us;
+	int64_t* scheduled_us_arr; // when each mim was due, by tracer-1
+	int script_line;
+};
+
+static struct {
+	// arguments
+	const char* dir;
+	const char* mimrate; // see webserv_set_mim_rate_limit()
+	int port;
+	int num_conns;
+	int num_artists;
+	double mims_per_second;
+	double seconds;
+	int use_lz;
+	char** script_line_arr; // (NULL for randomized typing)
+	int num_script_setup_lines;
+
+	pthread_t host_thread;
+	int64_t jam_time_offset_us;
+	_Atomic(int) phase;
+	uint64_t rng;
+	struct client* clients;
+	int num_bootstrapped;
+	int64_t num_mims_sent;
+	int64_t t0_us;
+	int64_t t1_us;
+	int64_t t2_us;
+	int64_t num_bytes_received_at_t0;
+	int64_t host_cpu_ns;
+	int64_t journal_bytes;
+	int64_t* join_latency_us_arr;
+	int64_t* broadcast_latency_us_arr;
+	int64_t* roundtrip_latency_us_arr;
+	uint8_t* bb_arr;
+} g;
+
+int64_t get_nanoseconds_monotonic(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL;
+}
+
+int64_t get_microseconds_epoch(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000LL + (int64_t)tv.tv_usec;
+}
+
+void sleep_microseconds(int64_t us)
+{
+	struct timespec t = {
+		.tv_sec  = us / 1000000LL,
+		.tv_nsec = (us % 1000000LL) * 1000LL,
+	};
+	nanosleep(&t, NULL);
+}
+
+void transmit_mim(int mim_session_id, int64_t tracer, uint8_t* data, int count)
+{
+	assert(!"loadgen is host only; its artists talk to the host over websockets");
+}
+
+static int64_t get_host_cpu_ns(void)
+{
+	clockid_t clock_id;
+	assert(0 == pthread_getcpuclockid(g.host_thread, &clock_id));
+	struct timespec t;
+	clock_gettime(clock_id, &t);
+	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL;
+}
+
+// xorshift64*; rand() isn't ours to use from another thread
+static uint64_t rng_next(void)
+{
+	g.rng ^= g.rng >> 12;
+	g.rng ^= g.rng << 25;
+	g.rng ^= g.rng >> 27;
+	return g.rng * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_uniform(void)
+{
+	return (double)(rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Poisson arrivals at -rate
+static int64_t next_mim_delay_us(void)
+{
+	return (int64_t)(-log(1.0 - rng_uniform()) * 1e6 / g.mims_per_second);
+}
+
+static void client_flush(struct client* c)
+{
+	uint8_t** tx = &c->tx_arr;
+	int64_t n = arrlen(*tx);
+	int64_t cursor = 0;
+	while (cursor < n) {
+		const ssize_t nw = write(c->fd, *tx + cursor, n - cursor);
+		if (nw == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			fprintf(stderr, "write(): %s\n", strerror(errno));
+			abort();
+		}
+		cursor += nw;
+	}
+	if (cursor > 0) arrdeln(*tx, 0, cursor);
+}
+
+// client=>server frames must be masked (RFC6455 5.3)
+static void client_send_frame(struct client* c, int opcode, const uint8_t* payload, int64_t count)
+{
+	uint8_t** f = &c->tx_arr;
+	bb_append_u8(f, 0x80 | opcode);
+	if (count < 126) {
+		bb_append_u8(f, 0x80 | count);
+	} else if (count < 65536) {
+		bb_append_u8(f, 0x80 | 126);
+		for (int i=0; i<2; ++i) bb_append_u8(f, (count >> (8*(1-i))) & 0xff);
+	} else {
+		bb_append_u8(f, 0x80 | 127);
+		for (int i=0; i<8; ++i) bb_append_u8(f, (count >> (8*(7-i))) & 0xff);
+	}
+	uint8_t mask_key[4];
+	for (int i=0; i<4; ++i) mask_key[i] = rng_next();
+	bb_append(f, mask_key, 4);
+	uint8_t* p = arraddnptr(*f, count);
+	for (int64_t i=0; i<count; ++i) p[i] = payload[i] ^ mask_key[i&3];
+	client_flush(c);
+}
+
+static void client_send_mim(struct client* c, const char* mim, int64_t scheduled_us)
+{
+	arrput(c->scheduled_us_arr, scheduled_us);
+	const int64_t tracer = arrlen(c->scheduled_us_arr);
+	const int n = strlen(mim);
+	uint8_t** bb = &g.bb_arr;
+	arrreset(*bb);
+	bb_append_u8(bb, WS0_MIM);
+	bb_append_leb128(bb, 1); // mim session id
+	bb_append_leb128(bb, tracer);
+	bb_append_leb128(bb, n);
+	bb_append(bb, mim, n);
+	client_send_frame(c, WS_BINARY_FRAME, *bb, arrlen(*bb));
+	++g.num_mims_sent;
+}
+
+// one mim of randomized typing: mostly single characters, some newlines, and
+// the odd paste
+static void client_type(struct client* c, int64_t scheduled_us)
+{
+	char text[1<<11];
+	int n;
+	const double r = rng_uniform();
+	if (r < 0.01) {
+		n = 200 + (rng_next() % 1500);
+		for (int i=0; i<n; ++i) text[i] = ((i%40) == 39) ? '\n' : ('a' + (rng_next() % 26));
+	} else if (r < 0.05) {
+		n = 1;
+		text[0] = '\n';
+	} else {
+		n = 1;
+		text[0] = "abcdefghijklmnopqrstuvwxyz   "[rng_next() % 29];
+	}
+	char mim[sizeof(text) + 32];
+	snprintf(mim, sizeof mim, "0,%di%.*s", n, n, text);
+	client_send_mim(c, mim, scheduled_us);
+}
+
+static void client_send_next_mim(struct client* c, int64_t scheduled_us)
+{
+	const int is_first = (arrlen(c->scheduled_us_arr) == 0);
+	if (g.script_line_arr == NULL) {
+		if (is_first) {
+			// (doc 50 is in the default stub)
+			const char* ex = "setdoc 1 50";
+			char mim[1<<8];
+			snprintf(mim, sizeof mim, "%d:%s0,1,1c", (int)strlen(ex), ex);
+			client_send_mim(c, mim, scheduled_us);
+		} else {
+			client_type(c, scheduled_us);
+		}
+	} else {
+		const int n = arrlen(g.script_line_arr);
+		if (c->script_line >= n) c->script_line = g.num_script_setup_lines;
+		client_send_mim(c, g.script_line_arr[c->script_line++], scheduled_us);
+	}
+}
+
+static void client_handle_journal(struct client* c, const uint8_t* data, int64_t count, int64_t now_us)
+{
+	uint8_t** jj = &c->journal_arr;
+	bb_append(jj, data, count);
+	const int64_t n = get_whole_journal_records_size(*jj, arrlen(*jj));
+	if (n < 0) {
+		fprintf(stderr, "bad journal data from host\n");
+		abort();
+	}
+	struct bufstream bs;
+	bufstream_init_from_memory(&bs, *jj, n);
+	while (bs.offset < n) {
+		(void)bs_read_u8(&bs); // SYNC
+		const int64_t ts = bs_read_leb128(&bs);
+		const int artist_id = bs_read_leb128(&bs);
+		(void)bs_read_leb128(&bs); // mim session id
+		const int64_t tracer = bs_read_leb128(&bs);
+		const int64_t size = bs_read_leb128(&bs);
+		bs_skip(&bs, size);
+		// records committed before we started measuring (e.g. the tail
+		// of the journal after the bootstrap snapshot) aren't ours
+		const int64_t commit_us = ts - g.jam_time_offset_us;
+		if (commit_us < g.t0_us) continue;
+		++c->num_records;
+		arrput(g.broadcast_latency_us_arr, now_us - commit_us);
+		if (artist_id == c->artist_id) {
+			assert((1 <= tracer) && (tracer <= arrlen(c->scheduled_us_arr)));
+			arrput(g.roundtrip_latency_us_arr, now_us - c->scheduled_us_arr[tracer-1]);
+		}
+	}
+	assert(bs.offset == n);
+	arrdeln(*jj, 0, n);
+}
+
+static void lz_window_trim(struct client* c)
+{
+	uint8_t** w = &c->lz_window_arr;
+	const int64_t n = arrlen(*w);
+	if (n > LZ_MAX_DICT_SIZE) arrdeln(*w, 0, n - LZ_MAX_DICT_SIZE);
+}
+
+static void client_handle_msg(struct client* c, const uint8_t* data, int64_t count, int64_t now_us)
+{
+	struct bufstream bs;
+	bufstream_init_from_memory(&bs, data, count);
+	while (bs.offset < count) {
+		const uint8_t op = bs_read_u8(&bs);
+		switch (op) {
+
+		case WS1_HELLO2:
+			(void)bs_read_leb128(&bs); // WS_PROTOCOL_VERSION
+			c->artist_id = bs_read_leb128(&bs);
+			(void)bs_read_leb128(&bs); // WSFLAG_* flags
+			break;
+
+		case WS1_SNAPSHOT:
+		case WS1_SNAPSHOT_LZ: {
+			// we don't restore the snapshot; we only need to know
+			// where the journal continues, and that's implied
+			const int64_t size = bs_read_leb128(&bs);
+			bs_skip(&bs, (op == WS1_SNAPSHOT_LZ) ? bs_read_leb128(&bs) : size);
+			assert(!c->is_bootstrapped);
+			c->is_bootstrapped = 1;
+			++g.num_bootstrapped;
+			arrput(g.join_latency_us_arr, now_us - c->connect_us);
+			arrreset(c->lz_window_arr);
+		}	break;
+
+		case WS1_JOURNAL_UPDATE: {
+			const int64_t n = bs_read_leb128(&bs);
+			assert(!bs.error && (n <= (count - bs.offset)));
+			client_handle_journal(c, data + bs.offset, n, now_us);
+			if (g.use_lz) {
+				bb_append(&c->lz_window_arr, data + bs.offset, n);
+				lz_window_trim(c);
+			}
+			bs_skip(&bs, n);
+		}	break;
+
+		case WS1_JOURNAL_UPDATE_LZ: {
+			const int64_t n = bs_read_leb128(&bs);
+			const int64_t dict_size = bs_read_leb128(&bs);
+			const int64_t compressed_size = bs_read_leb128(&bs);
+			uint8_t** w = &c->lz_window_arr;
+			const int64_t n0 = arrlen(*w);
+			assert(!bs.error && (dict_size <= n0) && (compressed_size <= (count - bs.offset)));
+			arrsetlen(*w, n0 + n);
+			assert(lz_decompress(*w + (n0 - dict_size), dict_size, n, data + bs.offset, compressed_size) >= 0);
+			client_handle_journal(c, *w + n0, n, now_us);
+			lz_window_trim(c);
+			bs_skip(&bs, compressed_size);
+		}	break;
+
+		default:
+			fprintf(stderr, "bad opcode (%d) from host\n", op);
+			abort();
+
+		}
+	}
+	assert(bs.offset == count);
+}
+
+// parses frames in rx, and returns how many bytes of it were used
+static int64_t client_handle_frames(struct client* c, const uint8_t* rx, int64_t n, int64_t now_us)
+{
+	int64_t cursor = 0;
+	while ((n - cursor) >= 2) {
+		const uint8_t* p = &rx[cursor];
+		const int fin = !!(p[0] & 0x80);
+		const int opcode = p[0] & 0xf;
+		assert(((p[0] & 0x70) == 0) && ((p[1] & 0x80) == 0) && "bad frame header");
+		int header_size = 2;
+		int64_t payload_size = p[1] & 0x7f;
+		if (payload_size >= 126) {
+			const int nb = (payload_size == 126) ? 2 : 8;
+			header_size += nb;
+			if ((n - cursor) < header_size) break;
+			payload_size = 0;
+			for (int i=0; i<nb; ++i) payload_size = (payload_size << 8) | p[2+i];
+		}
+		if ((n - cursor) < (header_size + payload_size)) break;
+		const uint8_t* payload = p + header_size;
+		cursor += header_size + payload_size;
+
+		switch (opcode) {
+		case WS_CONTINUATION_FRAME:
+		case WS_BINARY_FRAME:
+			if (fin && (arrlen(c->msg_arr) == 0)) {
+				client_handle_msg(c, payload, payload_size, now_us);
+			} else {
+				bb_append(&c->msg_arr, payload, payload_size);
+				if (fin) {
+					client_handle_msg(c, c->msg_arr, arrlen(c->msg_arr), now_us);
+					arrreset(c->msg_arr);
+				}
+			}
+			break;
+		case WS_PING:
+			// spectators are quiet, so the host pings them (see
+			// webserv_set_websocket_timeout_ms())
+			client_send_frame(c, WS_PONG, payload, payload_size);
+			break;
+		case WS_PONG:
+			break;
+		default:
+			fprintf(stderr, "unexpected websocket opcode %d from host\n", opcode);
+			abort();
+		}
+	}
+	return cursor;
+}
+
+static void client_handle_rx(struct client* c, int64_t now_us)
+{
+	uint8_t** rx = &c->rx_arr;
+	int64_t cursor = 0;
+	if (!c->got_101) {
+		const int64_t n = arrlen(*rx);
+		for (int64_t i=3; i<n; ++i) {
+			if (memcmp(&(*rx)[i-3], "\r\n\r\n", 4) == 0) {
+				cursor = i+1;
+				break;
+			}
+		}
+		if (cursor == 0) return;
+		if (memcmp(*rx, "HTTP/1.1 101 ", 13) != 0) {
+			fprintf(stderr, "host said: %.*s\n", (int)strcspn((char*)*rx, "\r\n"), (char*)*rx);
+			abort();
+		}
+		c->got_101 = 1;
+		// say hello with journal cursor 0, like the web client, so we're
+		// bootstrapped with a snapshot
+		uint8_t** bb = &g.bb_arr;
+		arrreset(*bb);
+		bb_append_u8(bb, WS0_HELLO2);
+		bb_append_leb128(bb, WS_PROTOCOL_VERSION);
+		bb_append_leb128(bb, 0);
+		bb_append_leb128(bb, g.use_lz ? WSFLAG_LZ : 0);
+		client_send_frame(c, WS_BINARY_FRAME, *bb, arrlen(*bb));
+	}
+	cursor += client_handle_frames(c, *rx + cursor, arrlen(*rx) - cursor, now_us);
+	if (cursor > 0) arrdeln(*rx, 0, cursor);
+}
+
+static void client_drain(struct client* c, int64_t now_us)
+{
+	for (;;) {
+		uint8_t buf[1<<16];
+		const ssize_t n = read(c->fd, buf, sizeof buf);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			fprintf(stderr, "read(): %s\n", strerror(errno));
+			abort();
+		}
+		if (n == 0) {
+			fprintf(stderr, "host hung up\n");
+			abort();
+		}
+		c->num_bytes_received += n;
+		bb_append(&c->rx_arr, buf, n);
+		client_handle_rx(c, now_us);
+	}
+}
+
+static void client_connect(struct client* c)
+{
+	c->fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(c->fd >= 0);
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(g.port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	c->connect_us = get_microseconds_monotonic();
+	if (connect(c->fd, (struct sockaddr*)&addr, sizeof addr) == -1) {
+		fprintf(stderr, "connect(): %s\n", strerror(errno));
+		abort();
+	}
+	int yes = 1;
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+	assert(0 == fcntl(c->fd, F_SETFL, O_NONBLOCK));
+	bb_append_cstr(&c->tx_arr,
+		"GET /o/websocket HTTP/1.1\r\n"
+		"Host: localhost\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Version: 13\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"\r\n");
+	client_flush(c);
+}
+
+static int is_drained(void)
+{
+	for (int i=0; i<g.num_conns; ++i) {
+		if (g.clients[i].num_records < g.num_mims_sent) return 0;
+	}
+	return 1;
+}
+
+static void* clients_main(void* usr)
+{
+	const int num_conns = g.num_conns;
+	g.clients = calloc(num_conns, sizeof *g.clients);
+	for (int i=0; i<num_conns; ++i) client_connect(&g.clients[i]);
+	struct pollfd* pfds = calloc(num_conns, sizeof *pfds);
+	int64_t journal_size0 = 0;
+	int64_t host_cpu_ns0 = 0;
+	for (;;) {
+		const int64_t now_us = get_microseconds_monotonic();
+		const enum phase phase = atomic_load(&g.phase);
+		int64_t timeout_us = 10000;
+		if (phase == JOINING) {
+			if (g.num_bootstrapped == num_conns) {
+				g.t0_us = now_us;
+				journal_size0 = get_committed_journal_size(0);
+				host_cpu_ns0 = get_host_cpu_ns();
+				for (int i=0; i<num_conns; ++i) g.num_bytes_received_at_t0 += g.clients[i].num_bytes_received;
+				for (int i=0; i<g.num_artists; ++i) g.clients[i].next_mim_us = now_us;
+				atomic_store(&g.phase, MEASURING);
+				continue;
+			}
+			if ((now_us - g.clients[num_conns-1].connect_us) > JOIN_TIMEOUT_US) {
+				fprintf(stderr, "only %d of %d connections were bootstrapped in time\n", g.num_bootstrapped, num_conns);
+				abort();
+			}
+		} else if (phase == MEASURING) {
+			if (now_us >= (g.t0_us + (int64_t)(g.seconds * 1e6))) {
+				g.t1_us = now_us;
+				atomic_store(&g.phase, DRAINING);
+				continue;
+			}
+			for (int i=0; i<g.num_artists; ++i) {
+				struct client* c = &g.clients[i];
+				while (c->next_mim_us <= now_us) {
+					client_send_next_mim(c, c->next_mim_us);
+					c->next_mim_us += next_mim_delay_us();
+				}
+				const int64_t dt = c->next_mim_us - now_us;
+				if (dt < timeout_us) timeout_us = dt;
+			}
+		} else if (phase == DRAINING) {
+			const int is_timeout = (now_us - g.t1_us) > DRAIN_TIMEOUT_US;
+			if (is_drained() || is_timeout) {
+				if (is_timeout) fprintf(stderr, "WARNING: not every record reached every connection; invalid mims? (see host output)\n");
+				g.t2_us = now_us;
+				g.journal_bytes = get_committed_journal_size(0) - journal_size0;
+				g.host_cpu_ns = get_host_cpu_ns() - host_cpu_ns0;
+				break;
+			}
+		}
+
+		for (int i=0; i<num_conns; ++i) {
+			struct client* c = &g.clients[i];
+			pfds[i] = (struct pollfd) {
+				.fd = c->fd,
+				.events = POLLIN | ((arrlen(c->tx_arr) > 0) ? POLLOUT : 0),
+			};
+		}
+		const struct timespec ts = {
+			.tv_sec  = timeout_us / 1000000LL,
+			.tv_nsec = (timeout_us % 1000000LL) * 1000LL,
+		};
+		const int n = ppoll(pfds, num_conns, &ts, NULL);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "ppoll(): %s\n", strerror(errno));
+			abort();
+		}
+		if (n == 0) continue;
+		const int64_t t_us = get_microseconds_monotonic();
+		for (int i=0; i<num_conns; ++i) {
+			struct client* c = &g.clients[i];
+			const short re = pfds[i].revents;
+			if (re & POLLOUT) client_flush(c);
+			if (re & (POLLIN | POLLHUP | POLLERR)) client_drain(c, t_us);
+		}
+	}
+	for (int i=0; i<num_conns; ++i) close(g.clients[i].fd);
+	free(pfds);
+	atomic_store(&g.phase, DONE);
+	return NULL;
+}
+
+static int compare_int64(const void* va, const void* vb)
+{
+	const int64_t a = *(const int64_t*)va;
+	const int64_t b = *(const int64_t*)vb;
+	return (a>b) - (a<b);
+}
+
+static void print_latencies(const char* name, int64_t* us_arr)
+{
+	const int64_t n = arrlen(us_arr);
+	if (n == 0) {
+		printf("  %-22s (no samples)\n", name);
+		return;
+	}
+	qsort(us_arr, n, sizeof *us_arr, compare_int64);
+	#define P(F) ((double)us_arr[(int64_t)((double)(n-1)*(F))] * 1e-3)
+	printf("  %-22s p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f ms (%lld samples)\n",
+		name, P(0.5), P(0.9), P(0.99), P(1.0), (long long)n);
+	#undef P
+}
+
+NO_RETURN
+static void usage(const char* prg)
+{
+	fprintf(stderr, "Usage: %s [-conns COUNT] [-artists COUNT] [-rate MIMS_PER_SECOND] [-seconds SECONDS] [-script PATH] [-lz] [-mimrate MIMS_PER_SECOND[,BYTES_PER_SECOND]] [-port PORT] [-dir PATH]\n", prg);
+	exit(EXIT_FAILURE);
+}
+
+static void read_script(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: could not open\n", path);
+		exit(EXIT_FAILURE);
+	}
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t n;
+	while ((n = getline(&line, &cap, f)) != -1) {
+		if ((n > 0) && (line[n-1] == '\n')) line[--n] = 0;
+		if (strcmp(line, SCRIPT_SETUP_END) == 0) {
+			g.num_script_setup_lines = arrlen(g.script_line_arr);
+			continue;
+		}
+		if (n == 0) continue;
+		arrput(g.script_line_arr, strdup(line));
+	}
+	free(line);
+	fclose(f);
+	if (arrlen(g.script_line_arr) <= g.num_script_setup_lines) {
+		fprintf(stderr, "%s: no mims to repeat\n", path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void parse_loadgen_args(int argc, char** argv)
+{
+	g.dir = DEFAULT_DIR;
+	g.port = DEFAULT_PORT;
+	g.num_conns = 100;
+	g.num_artists = 10;
+	g.mims_per_second = 10;
+	g.seconds = 10;
+	for (int i=1; i<argc; ++i) {
+		const char* a = argv[i];
+		const char* v = (i+1 < argc) ? argv[i+1] : NULL;
+		if (strcmp(a, "-lz") == 0) {
+			g.use_lz = 1;
+			continue;
+		}
+		if (v == NULL) usage(argv[0]);
+		++i;
+		if      (strcmp(a, "-conns")   == 0) g.num_conns = atoi(v);
+		else if (strcmp(a, "-artists") == 0) g.num_artists = atoi(v);
+		else if (strcmp(a, "-rate")    == 0) g.mims_per_second = atof(v);
+		else if (strcmp(a, "-seconds") == 0) g.seconds = atof(v);
+		else if (strcmp(a, "-script")  == 0) read_script(v);
+		else if (strcmp(a, "-port")    == 0) g.port = atoi(v);
+		else if (strcmp(a, "-dir")     == 0) g.dir = v;
+		else if (strcmp(a, "-mimrate") == 0) g.mimrate = v;
+		else usage(argv[0]);
+	}
+	if ((g.num_conns <= 0) || (g.num_artists < 0) || (g.num_artists > g.num_conns) || (g.mims_per_second <= 0) || (g.seconds <= 0)) {
+		usage(argv[0]);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	parse_loadgen_args(argc, argv);
+	if (strcmp(g.dir, DEFAULT_DIR) == 0) {
+		// a fresh room every time, unless -dir says otherwise
+		assert(0 == system("rm -rf " DEFAULT_DIR));
+		assert(0 == io_mkdir(DEFAULT_DIR));
+	}
+
+	io_init();
+	webserv_set_port(g.port);
+	// (and a few to spare for browsers watching along)
+	webserv_set_max_conn_count(g.num_conns + 16);
+	if (g.mimrate != NULL) {
+		const char* bytes = strchr(g.mimrate, ',');
+		webserv_set_mim_rate_limit(atof(g.mimrate), (bytes != NULL) ? atof(bytes+1) : 0.0);
+	}
+	webserv_init();
+	mie_thread_init();
+	gig_init();
+	if (gig_configure_as_host_only(g.dir) < 0) {
+		fprintf(stderr, "configure failed\n");
+		return EXIT_FAILURE;
+	}
+	// record timestamps are jam time; this converts them back to our
+	// monotonic clock
+	g.jam_time_offset_us = get_monotonic_jam_time_us() - get_microseconds_monotonic();
+	g.rng = 0x9e3779b97f4a7c15ULL ^ (uint64_t)get_nanoseconds_monotonic();
+	g.host_thread = pthread_self();
+
+	pthread_t clients_thread;
+	assert(0 == pthread_create(&clients_thread, NULL, clients_main, NULL));
+	// same as main_headless.c, except that we wake up now and then to see
+	// if the clients are done
+	while (atomic_load(&g.phase) != DONE) {
+		int did_work = 0;
+		did_work |= host_tick();
+		did_work |= webserv_tick();
+		did_work |= io_tick();
+		if (!did_work) {
+			int64_t timeout_us = 10000L;
+			const int64_t gig_timeout_us = gig_get_wait_timeout_us();
+			if ((gig_timeout_us >= 0) && (gig_timeout_us < timeout_us)) timeout_us = gig_timeout_us;
+			const int64_t ws_timeout_us = webserv_get_wait_timeout_us();
+			if ((ws_timeout_us >= 0) && (ws_timeout_us < timeout_us)) timeout_us = ws_timeout_us;
+			io_wait(timeout_us);
+		}
+	}
+	assert(0 == pthread_join(clients_thread, NULL));
+
+	struct webserv_stats ws;
+	webserv_get_stats(&ws);
+	const double measure_s = (double)(g.t1_us - g.t0_us) * 1e-6;
+	const double total_s = (double)(g.t2_us - g.t0_us) * 1e-6;
+	int64_t num_bytes_received = 0;
+	for (int i=0; i<g.num_conns; ++i) num_bytes_received += g.clients[i].num_bytes_received;
+	printf("conns=%d artists=%d rate=%g mims/s/artist seconds=%g%s%s\n",
+		g.num_conns, g.num_artists, g.mims_per_second, g.seconds,
+		g.use_lz ? " lz" : "",
+		g.script_line_arr ? " (scripted)" : "");
+	print_latencies("join (snapshot):", g.join_latency_us_arr);
+	print_latencies("commit=>broadcast:", g.broadcast_latency_us_arr);
+	print_latencies("mim roundtrip:", g.roundtrip_latency_us_arr);
+	printf("  mims committed:        %8lld (%.1f/s)\n",
+		(long long)g.num_mims_sent, (double)g.num_mims_sent / measure_s);
+	printf("  journal:               %8.2f KB (%.2f KB/s)\n",
+		(double)g.journal_bytes / 1024.0, (double)g.journal_bytes / 1024.0 / measure_s);
+	num_bytes_received -= g.num_bytes_received_at_t0;
+	printf("  received by conns:     %8.2f MB (%.2f MB/s)\n",
+		(double)num_bytes_received / (1024.0*1024.0), (double)num_bytes_received / (1024.0*1024.0) / total_s);
+	printf("  host thread CPU:       %8.2f s (%.1f%% of %.2fs)\n",
+		(double)g.host_cpu_ns * 1e-9, (double)g.host_cpu_ns * 1e-7 / total_s, total_s);
+	printf("  connection buffers:    %8lld KB in use (%lld KB allocated)\n",
+		(long long)(ws.buffer_bytes_in_use >> 10), (long long)(ws.buffer_bytes_allocated >> 10));
+	printf("  rate limited:          %8lld mims deferred (%lld throttles)\n",
+		(long long)ws.num_mims_deferred, (long long)ws.num_ws_throttles);
+	return EXIT_SUCCESS;
+}
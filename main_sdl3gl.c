@@ -9,6 +9,7 @@
 #include "main.h"
 #include "io.h"
 #include "webserv.h"
+#include "udp.h"
 #include "jio.h"
 #include "arg.h"
 #include "gig.h"
@@ -69,10 +70,14 @@ static int io_thread_run(void* usr)
 		int did_work = 0;
 		did_work |= host_tick();
 		did_work |= webserv_tick();
+		did_work |= udp_host_tick();
+		did_work |= udp_peer_tick();
 		did_work |= io_tick();
 		if (!did_work) {
-			// sleep 500µs when idle-ing
-			sleep_microseconds(500L);
+			// sleep until there's I/O or a mim from the UI thread (see
+			// io_wake()). the timeout is for mims held back by
+			// peer_set_artificial_mim_latency()
+			io_wait(1000L);
 		}
 	}
 	return 0;
@@ -80,7 +85,8 @@ static int io_thread_run(void* usr)
 
 void transmit_mim(int mim_session_id, int64_t tracer, uint8_t* data, int count)
 {
-	FIXME(transmit mim via.. udp? ws?)
+	// (we're only a peer that transmits when we -join)
+	udp_peer_transmit_mim(mim_session_id, tracer, data, count);
 }
 
 int main(int argc, char** argv)
@@ -134,11 +140,27 @@ int main(int argc, char** argv)
 	mie_thread_init();
 	gig_init();
 
-	int e = gig_configure_as_host_and_peer(arg_dir ? arg_dir : ".");
+	// with -join we're a peer of somebody else's host (over UDP), and
+	// otherwise we host, optionally for UDP peers too (-udp)
+	if ((arg_join != NULL) && (arg_udp != NULL)) {
+		fprintf(stderr, "can't both -join and -udp\n");
+		return EXIT_FAILURE;
+	}
+	int e = (arg_join != NULL)
+		? gig_configure_as_peer_only(arg_dir ? arg_dir : ".")
+		: gig_configure_as_host_and_peer(arg_dir ? arg_dir : ".");
 	if (e<0) {
 		fprintf(stderr, "configure failed\n");
 		return EXIT_FAILURE;
 	}
+	if ((arg_join != NULL) && (udp_peer_init(arg_join, JOURNAL_HEADER_SIZE) < 0)) {
+		fprintf(stderr, "bad -join [%s]; expected HOST:PORT\n", arg_join);
+		return EXIT_FAILURE;
+	}
+	if ((arg_udp != NULL) && (udp_host_init(atoi(arg_udp)) < 0)) {
+		fprintf(stderr, "could not serve UDP on port %s\n", arg_udp);
+		return EXIT_FAILURE;
+	}
 	//gig_host(arg_dir ? arg_dir : "."); // XXX?!
 	//gig_maybe_setup_stub();
 
@@ -146,6 +168,9 @@ int main(int argc, char** argv)
 	SDL_DetachThread(SDL_CreateThread(io_thread_run, "I/O", NULL));
 
 	while (!g0.exiting && get_num_windows() > 0) {
+		// journal received by udp_peer_tick() on the I/O thread (with
+		// -join); the peer's snapshots belong to this thread
+		udp_peer_spool();
 		gui_begin_frame();
 		handle_events();
 		housekeep_our_windows();
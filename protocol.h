@@ -6,7 +6,8 @@ enum {
 	// ===========================
 
 	WS0_HELLO = 1,
-	// the first "hello" the peer sends to the host
+	// the first "hello" the peer sends to the host: journal cursor. a peer
+	// that wants any WSFLAG_* features says WS0_HELLO2 instead
 
 	WS0_MIM,
 	// peer mim (editor protocol) commands sent to host
@@ -17,11 +18,102 @@ enum {
 	// ===========================
 
 	WS1_HELLO,
-	// response to WS0_HELLO
+	// response to WS0_HELLO: artist id
 
 	WS1_JOURNAL_UPDATE,
 	// host sends new journal data to peer
+
+	WS1_SNAPSHOT,
+	// host sends a packed snapshot to bootstrap a peer that is new or far
+	// behind; the peer restores it and continues from the journal offset
+	// embedded in the snapshot (journal updates follow from there)
+
+	WS1_JOURNAL_UPDATE_LZ,
+	// like WS1_JOURNAL_UPDATE, but lz.h compressed (see WSFLAG_LZ): size,
+	// dictionary size, compressed size, compressed data. the dictionary is
+	// the last "dictionary size" bytes of journal data the peer has received
+	// since WS1_HELLO2 (including WS1_JOURNAL_UPDATE's)
+
+	WS1_SNAPSHOT_LZ,
+	// like WS1_SNAPSHOT, but lz.h compressed (see WSFLAG_LZ): size,
+	// compressed size, compressed data. no dictionary
+
+	WS0_HELLO2,
+	// like WS0_HELLO, but versioned and with feature negotiation:
+	// WS_PROTOCOL_VERSION, journal cursor, and the WSFLAG_* flags the peer
+	// supports. the host drops peers with a version it doesn't know
+
+	WS1_HELLO2,
+	// response to WS0_HELLO2: WS_PROTOCOL_VERSION, artist id, and the WSFLAG_*
+	// flags the host will use (a subset of the ones the peer sent)
+};
+
+#define WS_PROTOCOL_VERSION (1)
+// websocket protocol version (sent in WS0_HELLO2/WS1_HELLO2); bump it when a
+// message layout changes. optional features that don't change existing
+// layouts get a WSFLAG_* flag instead
+
+#define WS_LZ_BLOCK_SIZE (1L<<18)
+// compressed journal updates are split into blocks of at most this size
+// (each block being a WS1_JOURNAL_UPDATE_LZ), so peers can refuse bigger ones
+
+// WS0_HELLO2/WS1_HELLO2 flags
+#define WSFLAG_LZ (1<<0)
+// journal updates and snapshots may be compressed; the host only compresses
+// them when it helps, so WS1_JOURNAL_UPDATE/WS1_SNAPSHOT are still sent too
+
+#define WSFLAG_RELAY (1<<1)
+// the peer is a relay (see relay.h): it's read-only (no artist id, no
+// WS0_MIM), and it always continues from its journal cursor, so it's never
+// bootstrapped with a snapshot
+
+// UDP datagrams (see udp.h). every datagram is an op followed by the
+// connection id the peer picked (LEB128), so the host can tell peers apart
+// even if their address changes. all integers are LEB128
+enum {
+	// ============================
+	// === UDP0_* is peer=>host ===
+	// ============================
+
+	UDP0_HELLO = 1,
+	// the peer wants to join: journal cursor to continue from, and the
+	// cookie from the latest UDP1_CHALLENGE (u64le; 0 if it has none),
+	// padded with zeroes to UDP_HELLO_SIZE. sent again (with the same
+	// connection id) until UDP1_WELCOME arrives
+
+	UDP0_UPDATE,
+	// journal cursor (a cumulative ack: the peer has all journal data before
+	// it), followed by mims until the end of the datagram: session id,
+	// tracer, size, data. every UDP0_UPDATE has the oldest mims the host
+	// hasn't acked (as many as fit), so a lost datagram loses no mims; the
+	// host skips tracers it has already committed
+
+
+	// ============================
+	// === UDP1_* is host=>peer ===
+	// ============================
+
+	UDP1_WELCOME,
+	// response to UDP0_HELLO with a valid cookie: artist id, and the highest
+	// tracer committed from the peer (0 if the host doesn't know the
+	// connection id)
+
+	UDP1_UPDATE,
+	// the highest tracer committed from the peer (the mim ack), journal size,
+	// and a journal offset followed by journal data from there until the end
+	// of the datagram (maybe none). the data starts at the peer's last ack if
+	// it fits, so recently sent data is repeated until it's acked
+
+	UDP1_CHALLENGE,
+	// response to UDP0_HELLO without a valid cookie, or to UDP0_UPDATE from
+	// an address that isn't the peer's: a cookie (u64le) for the peer to
+	// say hello with. the cookie is derived from the address, so a peer
+	// that has it can receive there; until then, the host sends nothing else
+	// to the address, and never more than it received from it
 };
 
+#define UDP_HELLO_SIZE (64)
+// so UDP1_CHALLENGE is always smaller than what it's a response to
+
 #define PROTOCOL_H
 #endif
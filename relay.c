@@ -0,0 +1,477 @@
+// see relay.h. this is a minimal RFC6455 websocket client; it only speaks
+// what the upstream webserv speaks (binary messages, maybe fragmented, and
+// close/ping)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "relay.h"
+#include "main.h"
+#include "io.h"
+#include "sha1.h"
+#include "base64.h"
+#include "stb_ds_sysalloc.h"
+#include "gig.h"
+#include "bufstream.h"
+#include "protocol.h"
+#include "bb.h"
+#include "lz.h"
+
+#define DEFAULT_PATH          "/o/websocket"
+#define CONNECT_TIMEOUT_NS    (3000000000LL)
+#define RECONNECT_INTERVAL_NS (1000000000LL)
+#define READ_BUFFER_SIZE      (1L<<16)
+#define MAX_RESPONSE_SIZE     (1L<<13)
+#define MAX_PENDING_JOURNAL   (1L<<22)
+// upstream isn't read from while this much journal data is waiting for
+// relay_append_journal() (the relay journal's ring buffer fills up faster
+// than it's written when catching up)
+
+enum {
+	WS_CONTINUATION_FRAME = 0,
+	WS_BINARY_FRAME       = 2,
+	WS_CONNECTION_CLOSE   = 8,
+	WS_PING               = 9,
+	WS_PONG               = 10,
+};
+
+enum echo_type {
+	CONNECT = 1,
+	READ,
+	WRITE,
+	CLOSE,
+};
+
+enum relay_state {
+	DISCONNECTED = 0,
+	CONNECTING, // waiting for the CONNECT event
+	HANDSHAKE,  // waiting for "101 Switching Protocols"
+	CONNECTED,
+	CLOSING,
+};
+
+static struct {
+	char* host;
+	int port;
+	char* path;
+	struct io_addr addr; // resolved once, by relay_init()
+	int port_id;
+	enum relay_state state;
+	int file_id;
+	int seq;
+	// incremented for every connection, and put in echoes, so events from
+	// an old connection can be told apart
+	int64_t reconnect_at_ns;
+	int64_t connect_timeout_at_ns;
+	char accept_key[32]; // expected Sec-WebSocket-Accept
+	uint8_t read_buffer[READ_BUFFER_SIZE];
+	unsigned is_reading :1;
+	uint8_t* rx_arr;      // received data that's not a complete frame yet
+	uint8_t* msg_arr;     // the message being assembled from fragments
+	uint8_t** wbuf_arr;   // writes in flight, oldest first
+	uint8_t* journal_arr; // journal data not yet taken by relay_append_journal()
+	uint8_t* lz_window_arr;
+	// the most recent journal data received (since WS1_HELLO2); it's the
+	// dictionary for WS1_JOURNAL_UPDATE_LZ
+} g;
+
+int relay_init(const char* upstream)
+{
+	const char* colon = strchr(upstream, ':');
+	if (colon == NULL || colon == upstream) return -1;
+	const char* slash = strchr(colon, '/');
+	char* end = NULL;
+	const long port = strtol(colon+1, &end, 10);
+	if ((end == colon+1) || (end != (slash ? slash : colon+strlen(colon)))) return -1;
+	if ((port <= 0) || (port > 65535)) return -1;
+	g.host = strndup(upstream, colon-upstream);
+	g.port = port;
+	// (resolving blocks, so it's only done here, and not on every
+	// reconnect)
+	const int e = io_resolve(g.host, g.port, &g.addr);
+	if (e<0) {
+		fprintf(stderr, "relay: could not resolve %s\n", g.host);
+		free(g.host);
+		g.host = NULL;
+		return e;
+	}
+	g.path = strdup(slash ? slash : DEFAULT_PATH);
+	g.port_id = io_port_create();
+	return 0;
+}
+
+static io_echo make_echo(enum echo_type type)
+{
+	return (io_echo) { .ia32 = type, .ib32 = g.seq };
+}
+
+static void relay_drop(const char* why)
+{
+	if ((g.state == DISCONNECTED) || (g.state == CLOSING)) return;
+	fprintf(stderr, "relay: dropping upstream connection: %s\n", why);
+	g.state = CLOSING;
+	io_port_close(g.port_id, make_echo(CLOSE), g.file_id);
+}
+
+static void relay_write(uint8_t* data_arr)
+{
+	arrput(g.wbuf_arr, data_arr);
+	io_port_writeall(g.port_id, make_echo(WRITE), g.file_id, data_arr, arrlen(data_arr));
+}
+
+// client=>server frames must be masked (RFC6455 5.3)
+static void send_frame(int opcode, const uint8_t* payload, int64_t count)
+{
+	uint8_t* f = NULL;
+	bb_append_u8(&f, 0x80 | opcode);
+	if (count < 126) {
+		bb_append_u8(&f, 0x80 | count);
+	} else if (count < 65536) {
+		bb_append_u8(&f, 0x80 | 126);
+		for (int i=0; i<2; ++i) bb_append_u8(&f, (count >> (8*(1-i))) & 0xff);
+	} else {
+		bb_append_u8(&f, 0x80 | 127);
+		for (int i=0; i<8; ++i) bb_append_u8(&f, (count >> (8*(7-i))) & 0xff);
+	}
+	uint8_t mask_key[4];
+	for (int i=0; i<4; ++i) mask_key[i] = rand();
+	bb_append(&f, mask_key, 4);
+	uint8_t* p = arraddnptr(f, count);
+	for (int64_t i=0; i<count; ++i) p[i] = payload[i] ^ mask_key[i&3];
+	relay_write(f);
+}
+
+static void send_hello(void)
+{
+	uint8_t* bb = NULL;
+	bb_append_u8(&bb, WS0_HELLO2);
+	bb_append_leb128(&bb, WS_PROTOCOL_VERSION);
+	bb_append_leb128(&bb, relay_get_journal_cursor());
+	bb_append_leb128(&bb, WSFLAG_LZ | WSFLAG_RELAY);
+	send_frame(WS_BINARY_FRAME, bb, arrlen(bb));
+	arrfree(bb);
+}
+
+static void lz_window_trim(void)
+{
+	uint8_t** w = &g.lz_window_arr;
+	const int64_t n = arrlen(*w);
+	if (n > LZ_MAX_DICT_SIZE) arrdeln(*w, 0, n - LZ_MAX_DICT_SIZE);
+}
+
+static void lz_window_push(const uint8_t* data, int64_t count)
+{
+	if (count >= LZ_MAX_DICT_SIZE) {
+		arrreset(g.lz_window_arr);
+		data += (count - LZ_MAX_DICT_SIZE);
+		count = LZ_MAX_DICT_SIZE;
+	}
+	bb_append(&g.lz_window_arr, data, count);
+	lz_window_trim();
+}
+
+static void handle_msg(const uint8_t* data, int64_t count)
+{
+	struct bufstream bs;
+	bufstream_init_from_memory(&bs, data, count);
+	while (bs.offset < count) {
+		const uint8_t op = bs_read_u8(&bs);
+		switch (op) {
+
+		case WS1_HELLO2: {
+			(void)bs_read_leb128(&bs); // WS_PROTOCOL_VERSION
+			(void)bs_read_leb128(&bs); // artist id (0; we're read-only)
+			const int flags = bs_read_leb128(&bs);
+			if (!(flags & WSFLAG_RELAY)) {
+				relay_drop("upstream doesn't know about relays");
+				return;
+			}
+			printf("relay: following %s:%d%s\n", g.host, g.port, g.path);
+		}	break;
+
+		case WS1_JOURNAL_UPDATE: {
+			const int64_t n = bs_read_leb128(&bs);
+			if (bs.error || (n < 0) || (n > (count - bs.offset))) {
+				relay_drop("bad WS1_JOURNAL_UPDATE");
+				return;
+			}
+			bb_append(&g.journal_arr, data + bs.offset, n);
+			lz_window_push(data + bs.offset, n);
+			bs_skip(&bs, n);
+		}	break;
+
+		case WS1_JOURNAL_UPDATE_LZ: {
+			const int64_t n = bs_read_leb128(&bs);
+			const int64_t dict_size = bs_read_leb128(&bs);
+			const int64_t compressed_size = bs_read_leb128(&bs);
+			uint8_t** w = &g.lz_window_arr;
+			const int64_t n0 = arrlen(*w);
+			const int is_bad =
+				   bs.error
+				|| (n < 0) || (n > WS_LZ_BLOCK_SIZE)
+				|| (dict_size < 0) || (dict_size > n0)
+				|| (compressed_size < 0) || (compressed_size > (count - bs.offset));
+			if (is_bad) {
+				relay_drop("bad WS1_JOURNAL_UPDATE_LZ");
+				return;
+			}
+			arrsetlen(*w, n0 + n);
+			if (lz_decompress(*w + (n0 - dict_size), dict_size, n, data + bs.offset, compressed_size) < 0) {
+				relay_drop("lz decompression failed");
+				return;
+			}
+			bb_append(&g.journal_arr, *w + n0, n);
+			lz_window_trim();
+			bs_skip(&bs, compressed_size);
+		}	break;
+
+		case WS1_SNAPSHOT:
+		case WS1_SNAPSHOT_LZ:
+			// we said WSFLAG_RELAY, so this shouldn't happen; a
+			// snapshot has no journal data to relay
+			relay_drop("upstream sent a snapshot");
+			return;
+
+		default:
+			relay_drop("bad opcode");
+			return;
+
+		}
+	}
+}
+
+// returns the number of bytes of rx used for the response, 0 if it's not all
+// there yet, or -1 if it's not a good one
+static int handle_handshake_response(const uint8_t* rx, int64_t n)
+{
+	const char* end = NULL;
+	for (int64_t i=3; i<n; ++i) {
+		if (memcmp(&rx[i-3], "\r\n\r\n", 4) == 0) {
+			end = (const char*)&rx[i+1];
+			break;
+		}
+	}
+	if (end == NULL) return (n < MAX_RESPONSE_SIZE) ? 0 : -1;
+	const int size = end - (const char*)rx;
+	char* response = strndup((const char*)rx, size);
+	char accept_header[64];
+	snprintf(accept_header, sizeof accept_header, "\r\nSec-WebSocket-Accept: %s\r\n", g.accept_key);
+	const int ok = (strncmp(response, "HTTP/1.1 101 ", 13) == 0) && (strstr(response, accept_header) != NULL);
+	if (!ok) fprintf(stderr, "relay: upstream said: %.*s\n", (int)strcspn(response, "\r\n"), response);
+	free(response);
+	return ok ? size : -1;
+}
+
+// parses frames in rx, and returns how many bytes of it were used
+static int64_t handle_frames(const uint8_t* rx, int64_t n)
+{
+	int64_t cursor = 0;
+	while ((g.state == CONNECTED) && ((n - cursor) >= 2)) {
+		const uint8_t* p = &rx[cursor];
+		const int fin = !!(p[0] & 0x80);
+		const int opcode = p[0] & 0xf;
+		if ((p[0] & 0x70) || (p[1] & 0x80)) {
+			// reserved bits, and the mask bit (server=>client
+			// frames must not be masked)
+			relay_drop("bad frame header");
+			break;
+		}
+		int header_size = 2;
+		int64_t payload_size = p[1] & 0x7f;
+		if (payload_size >= 126) {
+			const int nb = (payload_size == 126) ? 2 : 8;
+			header_size += nb;
+			if ((n - cursor) < header_size) break;
+			payload_size = 0;
+			for (int i=0; i<nb; ++i) payload_size = (payload_size << 8) | p[2+i];
+			if (payload_size < 0) {
+				relay_drop("bad frame size");
+				break;
+			}
+		}
+		if ((n - cursor) < (header_size + payload_size)) break;
+		const uint8_t* payload = p + header_size;
+		cursor += header_size + payload_size;
+
+		switch (opcode) {
+		case WS_CONTINUATION_FRAME:
+		case WS_BINARY_FRAME:
+			bb_append(&g.msg_arr, payload, payload_size);
+			if (fin) {
+				handle_msg(g.msg_arr, arrlen(g.msg_arr));
+				arrreset(g.msg_arr);
+			}
+			break;
+		case WS_CONNECTION_CLOSE:
+			relay_drop("upstream closed the connection");
+			break;
+		case WS_PING:
+			send_frame(WS_PONG, payload, payload_size);
+			break;
+		case WS_PONG:
+			break;
+		default:
+			relay_drop("unexpected opcode");
+			break;
+		}
+	}
+	return cursor;
+}
+
+static void handle_rx(void)
+{
+	uint8_t** rx = &g.rx_arr;
+	int64_t cursor = 0;
+	if (g.state == HANDSHAKE) {
+		const int r = handle_handshake_response(*rx, arrlen(*rx));
+		if (r < 0) {
+			relay_drop("bad handshake response");
+			return;
+		}
+		if (r == 0) return;
+		cursor = r;
+		g.state = CONNECTED;
+		send_hello();
+	}
+	cursor += handle_frames(*rx + cursor, arrlen(*rx) - cursor);
+	if (cursor > 0) arrdeln(*rx, 0, cursor);
+}
+
+static void relay_connect(void)
+{
+	assert(g.state == DISCONNECTED);
+	const int64_t now = get_nanoseconds_monotonic();
+	g.reconnect_at_ns = now + RECONNECT_INTERVAL_NS;
+	++g.seq;
+	const int file_id = io_port_connect(g.port_id, make_echo(CONNECT), &g.addr);
+	if (file_id < 0) {
+		fprintf(stderr, "relay: could not connect to %s:%d: %s\n", g.host, g.port, io_error_to_string_safe(file_id));
+		return;
+	}
+	g.file_id = file_id;
+	g.state = CONNECTING;
+	g.connect_timeout_at_ns = now + CONNECT_TIMEOUT_NS;
+}
+
+static void send_handshake(void)
+{
+	assert(g.state == CONNECTING);
+	g.state = HANDSHAKE;
+
+	uint8_t nonce[16];
+	for (int i=0; i<16; ++i) nonce[i] = rand();
+	char key[32];
+	char* p = base64_encode(key, nonce, sizeof nonce);
+	*p = 0;
+	// see the rant in webserv.c
+	SHA1_CTX sha1;
+	SHA1_Init(&sha1);
+	SHA1_Update(&sha1, (uint8_t*)key, strlen(key));
+	SHA1_Update(&sha1, (uint8_t*)"258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36);
+	uint8_t digest[SHA1_DIGEST_SIZE];
+	SHA1_Final(&sha1, digest);
+	p = base64_encode(g.accept_key, digest, sizeof digest);
+	*p = 0;
+
+	uint8_t* req = NULL;
+	char line[1<<10];
+	snprintf(line, sizeof line,
+		"GET %s HTTP/1.1\r\n"
+		"Host: %s:%d\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Key: %s\r\n"
+		"Sec-WebSocket-Version: 13\r\n"
+		"\r\n",
+		g.path, g.host, g.port, key);
+	bb_append_cstr(&req, line);
+	relay_write(req);
+}
+
+static void relay_disconnected(void)
+{
+	g.state = DISCONNECTED;
+	g.is_reading = 0;
+	const int n = arrlen(g.wbuf_arr);
+	for (int i=0; i<n; ++i) arrfree(g.wbuf_arr[i]);
+	arrreset(g.wbuf_arr);
+	arrreset(g.rx_arr);
+	arrreset(g.msg_arr);
+	// we continue from our journal size on reconnect, so whatever upstream
+	// sent that we haven't taken yet is sent again
+	arrreset(g.journal_arr);
+	arrreset(g.lz_window_arr);
+}
+
+int relay_tick(void)
+{
+	int did_work = 0;
+	struct io_event ev;
+	while (io_port_poll(g.port_id, &ev)) {
+		did_work = 1;
+		if (ev.echo.ib32 != g.seq) continue;
+		switch (ev.echo.ia32) {
+		case CONNECT:
+			if (ev.status < 0) {
+				relay_drop("could not connect");
+				break;
+			}
+			if (g.state == CONNECTING) send_handshake();
+			break;
+		case READ:
+			g.is_reading = 0;
+			if (ev.status <= 0) {
+				relay_drop((ev.status < 0) ? "read error" : "upstream hung up");
+				break;
+			}
+			if (g.state == CLOSING) break;
+			bb_append(&g.rx_arr, g.read_buffer, ev.status);
+			handle_rx();
+			break;
+		case WRITE:
+			assert(arrlen(g.wbuf_arr) > 0);
+			arrfree(g.wbuf_arr[0]);
+			arrdel(g.wbuf_arr, 0);
+			if (ev.status < 0) relay_drop("write error");
+			break;
+		case CLOSE:
+			relay_disconnected();
+			break;
+		default: assert(!"unhandled echo type");
+		}
+	}
+
+	const int64_t n = arrlen(g.journal_arr);
+	if ((g.state == CONNECTED) && (n > 0)) {
+		const int64_t nn = relay_append_journal(g.journal_arr, n);
+		if (nn < 0) {
+			relay_drop("journal data didn't spool");
+		} else if (nn > 0) {
+			arrdeln(g.journal_arr, 0, nn);
+			did_work = 1;
+		}
+	}
+
+	const int can_read = (g.state == HANDSHAKE) || ((g.state == CONNECTED) && (arrlen(g.journal_arr) < MAX_PENDING_JOURNAL));
+	if (can_read && !g.is_reading) {
+		io_port_read(g.port_id, make_echo(READ), g.file_id, g.read_buffer, sizeof g.read_buffer);
+		g.is_reading = 1;
+	}
+
+	const int64_t now = get_nanoseconds_monotonic();
+	if ((g.state == CONNECTING) && (now >= g.connect_timeout_at_ns)) {
+		// nothing answered; this makes the CONNECT event arrive (with
+		// an error) now rather than when the kernel gives up
+		(void)io_shutdown(g.file_id);
+		g.connect_timeout_at_ns = INT64_MAX;
+	}
+
+	if ((g.state == DISCONNECTED) && (now >= g.reconnect_at_ns)) {
+		relay_connect();
+		did_work = 1;
+	}
+
+	return did_work;
+}
@@ -0,0 +1,21 @@
+#ifndef RELAY_H
+
+// a relay is a headless host that follows a room on an upstream host as a
+// read-only websocket peer (WSFLAG_RELAY), and serves it to its own
+// spectators with its own webserv. the upstream host then only sends its
+// journal once per relay, rather than once per spectator, and relays can
+// follow relays. see gig_configure_as_relay()
+
+int relay_init(const char* upstream);
+// upstream is "host:port", or "host:port/path" where path is the upstream's
+// websocket path (e.g. "/o/room/foo/websocket"; the default is
+// "/o/websocket"). upstream is resolved here, once; returns <0 if it can't
+// be parsed or resolved. nothing is connected until relay_tick()
+
+int relay_tick(void);
+// connects (and reconnects, after a second) to upstream, and moves journal
+// data from upstream into the relay room. call it from the I/O thread, like
+// webserv_tick(). returns 0 if there was nothing to do
+
+#define RELAY_H
+#endif
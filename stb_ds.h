@@ -1545,7 +1545,7 @@ void * stbds_hmdel_key(void *a, size_t elemsize, void *key, size_t keysize, size
         b->index[i] = STBDS_INDEX_DELETED;
 
         if (mode == STBDS_HM_STRING && table->string.mode == STBDS_SH_STRDUP)
-          STBDS_FREE(stbds_context(a), *(char**) ((char *) a+elemsize*old_index));
+          STBDS_FREE(stbds_context(raw_a), *(char**) ((char *) a+elemsize*old_index));
 
         // if indices are the same, memcpy is a no-op, but back-pointer-fixup will fail, so skip
         if (old_index != final_index) {
@@ -1566,12 +1566,12 @@ void * stbds_hmdel_key(void *a, size_t elemsize, void *key, size_t keysize, size
         stbds_header(raw_a)->length -= 1;
 
         if (table->used_count < table->used_count_shrink_threshold && table->slot_count > STBDS_BUCKET_LENGTH) {
-          stbds_header(raw_a)->hash_table = stbds_make_hash_index(table->slot_count>>1, table, stbds_context(a));
-          STBDS_FREE(stbds_context(a), table);
+          stbds_header(raw_a)->hash_table = stbds_make_hash_index(table->slot_count>>1, table, stbds_context(raw_a));
+          STBDS_FREE(stbds_context(raw_a), table);
           STBDS_STATS(++stbds_hash_shrink);
         } else if (table->tombstone_count > table->tombstone_count_threshold) {
-          stbds_header(raw_a)->hash_table = stbds_make_hash_index(table->slot_count   , table, stbds_context(a));
-          STBDS_FREE(stbds_context(a), table);
+          stbds_header(raw_a)->hash_table = stbds_make_hash_index(table->slot_count   , table, stbds_context(raw_a));
+          STBDS_FREE(stbds_context(raw_a), table);
           STBDS_STATS(++stbds_hash_rebuild);
         }
 
@@ -151,6 +151,18 @@ static void test_readwrite(int N)
 			assert(g.doc->docchar_arr[i].colorchar.codepoint == ("hello"[i%5]));
 		}
 
+		if (pass == 0) {
+			// the mim data is copied at most 3 times on its way to the
+			// journal (plus small headers); see gig_get_mim_stats()
+			struct gig_mim_stats ms;
+			gig_get_mim_stats(&ms);
+			assert(ms.num_mims == 2); // setup()'s stub, and ours
+			assert(ms.num_bytes_copied <= ((3*ms.num_bytes) + (64*ms.num_mims)));
+			if (VERBOSE) {
+				printf("  %lld mims, %lld bytes, %lld bytes copied, %lld allocations\n",
+					(long long)ms.num_mims, (long long)ms.num_bytes, (long long)ms.num_bytes_copied, (long long)ms.num_allocations);
+			}
+		}
 	}
 	teardown();
 }
@@ -452,6 +464,94 @@ static void test_caret_adjustment(void)
 	teardown();
 }
 
+static void commit_foreign_mim(int artist_id, const char* ex, const char* mim)
+{
+	char buf[1<<10];
+	if (ex != NULL) {
+		snprintf(buf, sizeof buf, "%d:%s%s", (int)strlen(ex), ex, mim);
+	} else {
+		snprintf(buf, sizeof buf, "%s", mim);
+	}
+	commit_mim_to_host(0, artist_id, 1, 0, (uint8_t*)buf, strlen(buf));
+}
+
+static void expect_doc(int book_id, int doc_id, const char* expected_doc)
+{
+	struct snapshot* snap = get_snapshot();
+	struct document* doc = NULL;
+	const int num_doc = arrlen(snap->document_arr);
+	for (int i=0; i<num_doc; ++i) {
+		struct document* d = &snap->document_arr[i];
+		if ((d->book_id==book_id) && (d->doc_id==doc_id)) doc = d;
+	}
+	assert(doc != NULL);
+	const int num_actual = arrlen(doc->docchar_arr);
+	int match = (num_actual == (int)strlen(expected_doc));
+	for (int i=0; match && i<num_actual; ++i) {
+		if (doc->docchar_arr[i].colorchar.codepoint != expected_doc[i]) match = 0;
+	}
+	if (!match) {
+		fprintf(stderr, "expected doc %d/%d to be [%s], got [", book_id, doc_id, expected_doc);
+		for (int i=0; i<num_actual; ++i) fprintf(stderr, "%c", doc->docchar_arr[i].colorchar.codepoint);
+		fprintf(stderr, "]\n");
+		abort();
+	}
+}
+
+// the fiddle snapshot must stay the upstream snapshot plus our unacked mims,
+// whether other artists' mims are rebased onto or spooled on top of them
+static void test_unackd_rebase(void)
+{
+	new_test("rebase");
+	setup(test_dir);
+	const int x = alloc_artist_id(0);
+	const int y = alloc_artist_id(0);
+	commit_foreign_mim(x, "newdoc 1 51 b.mie", "");
+	commit_foreign_mim(x, "setdoc 1 51", "0,1,1c0,3ixyz");
+	commit_foreign_mim(y, "setdoc 1 50", "0,1,1c");
+	all_the_ticking();
+	expect_doc(1,51,"xyz");
+
+	// our mims aren't acked until the clock moves
+	peer_set_artificial_mim_latency(1.0, 0.0);
+	peer_begin_mim(1);
+	mimex("setdoc 1 50");
+	mimf("0,1,1c");
+	mimi(0,"abc");
+	peer_end_mim();
+	all_the_ticking();
+	expect_col_and_doc(4,"abc");
+	commit_foreign_mim(x, NULL, "0,3i123");
+	all_the_ticking();
+	expect_col_and_doc(4,"abc");
+	expect_doc(1,51,"xyz123");
+	g.time_us_monotonic += 2000000;
+	all_the_ticking();
+	expect_col_and_doc(4,"abc");
+
+	// an edit in another document (which doesn't move our caret)...
+	peer_begin_mim(1);
+	mimi(0,"def");
+	peer_end_mim();
+	all_the_ticking();
+	commit_foreign_mim(x, NULL, "0M^0,1i\n");
+	all_the_ticking();
+	expect_col_and_doc(7,"abcdef");
+	expect_doc(1,51,"\nxyz123");
+
+	// ...and one in ours, ahead of our unacked edit
+	commit_foreign_mim(y, NULL, "0,1iQ");
+	all_the_ticking();
+	expect_col_and_doc(8,"Qabcdef");
+	g.time_us_monotonic += 2000000;
+	all_the_ticking();
+	expect_col_and_doc(8,"Qabcdef");
+	expect_doc(1,51,"\nxyz123");
+
+	peer_set_artificial_mim_latency(0.0, 0.0);
+	teardown();
+}
+
 static void test_time_travel(void)
 {
 	new_test("ttt1");
@@ -499,7 +599,387 @@ static void test_time_travel(void)
 	teardown();
 }
 
-int webserv_broadcast_journal(int64_t until_journal_cursor)
+static void test_snapshot_bootstrap(void)
+{
+	new_test("snapboot");
+	setup(test_dir);
+
+	peer_begin_mim(1);
+	mimex("setdoc 1 50");
+	mimf("0,1,1c");
+	mimi(0,"abc");
+	peer_end_mim();
+	all_the_ticking();
+	expect_col_and_doc(4,"abc");
+
+	size_t sz0, sz1;
+	int64_t jo0, jo1;
+	const void* d0 = acquire_present_snapshot_data(0, &sz0, &jo0);
+	const void* d1 = acquire_present_snapshot_data(0, &sz1, &jo1);
+	// not re-packed when nothing changed
+	assert(d0 == d1);
+	assert(sz0 == sz1);
+	assert(jo0 == jo1);
+	release_present_snapshot_data(d1);
+
+	peer_begin_mim(1);
+	mimi(0,"12");
+	peer_end_mim();
+	all_the_ticking();
+	expect_col_and_doc(6,"abc12");
+
+	d1 = acquire_present_snapshot_data(0, &sz1, &jo1);
+	assert(d1 != d0);
+	assert(jo1 > jo0);
+
+	// d0 is still referenced, so it must still be intact
+	const int64_t jo = restore_upstream_snapshot_from_data((void*)d0, sz0);
+	assert(jo == jo0);
+	expect_col_and_doc(4,"abc");
+	release_present_snapshot_data(d0);
+
+	assert(restore_upstream_snapshot_from_data((void*)d1, sz1) == jo1);
+	expect_col_and_doc(6,"abc12");
+	release_present_snapshot_data(d1);
+
+	teardown();
+}
+
+static void test_backpressure(void)
+{
+	new_test("backpressure");
+	setup(test_dir);
+
+	// more mims than fit in the peer2host ringbuf before the host gets to
+	// them (and more activitycache entries than fit in the host2peer
+	// ringbuf), and then one mim that's bigger than all of the ringbuf. caret
+	// movements (to where the caret already is) make the mims big without
+	// making the document big
+	const int N = 300;
+	for (int i=0; i<N; ++i) {
+		peer_begin_mim(1);
+		if (i == 0) {
+			mimex("setdoc 1 50");
+			mimf("0,1,1c");
+		}
+		for (int ii=0; ii<100; ++ii) mimf("0M$");
+		mimi(0,"x");
+		peer_end_mim();
+	}
+	peer_begin_mim(1);
+	for (int i=0; i<25000; ++i) mimf("0M$");
+	mimi(0,"!");
+	peer_end_mim();
+	all_the_ticking();
+
+	char expected[1<<10];
+	memset(expected, 'x', N);
+	expected[N] = '!';
+	expected[N+1] = 0;
+	expect_col_and_doc(N+2, expected);
+
+	struct gig_queue_stats p2h, h2p;
+	gig_get_queue_stats(&p2h, &h2p);
+	assert(p2h.num_spills > 0);
+	assert(p2h.max_depth <= p2h.size);
+	assert(p2h.size > (1<<16)); // it grew
+	assert(h2p.num_spills > 0);
+	assert(h2p.max_depth <= h2p.size);
+	if (VERBOSE) {
+		printf("peer2host: max depth %lld/%lld, max spill %lld (%lld spills)\n",
+			(long long)p2h.max_depth, (long long)p2h.size, (long long)p2h.max_spill, (long long)p2h.num_spills);
+		printf("host2peer: max depth %lld/%lld, max spill %lld (%lld spills)\n",
+			(long long)h2p.max_depth, (long long)h2p.size, (long long)h2p.max_spill, (long long)h2p.num_spills);
+	}
+
+	teardown();
+}
+
+static int file_equals(const char* path, const char* expected)
+{
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) return 0;
+	char buf[1<<10];
+	const size_t n = fread(buf, 1, sizeof buf, f);
+	fclose(f);
+	return (n == strlen(expected)) && (0 == memcmp(buf, expected, n));
+}
+
+// derived files are written by a background thread, so wait for it
+static void expect_file_eventually(const char* path, const char* expected)
+{
+	for (int i=0; i<5000; ++i) {
+		if (file_equals(path, expected)) return;
+		sleep_microseconds(1000L);
+	}
+	fprintf(stderr, "expected %s to contain [%s]\n", path, expected);
+	abort();
+}
+
+static void test_derived_files(void)
+{
+	new_test("derived");
+	setup(test_dir);
+	char path[1<<12];
+	snprintf(path, sizeof path, "%s/cache/book1-doc50-scene.mie.txt", test_dir);
+	// (setup() committed something too)
+	g.time_us_monotonic += 1000000;
+
+	peer_begin_mim(1);
+	mimex("setdoc 1 50");
+	mimf("0,1,1c");
+	mimi(0,"abc");
+	peer_end_mim();
+	all_the_ticking();
+	expect_file_eventually(path, "abc");
+
+	// within the interval; not written yet
+	g.time_us_monotonic += 100000;
+	peer_begin_mim(1);
+	mimi(0,"12");
+	peer_end_mim();
+	all_the_ticking();
+	sleep_microseconds(50000L);
+	assert(file_equals(path, "abc"));
+
+	// after the interval
+	g.time_us_monotonic += 500000;
+	all_the_ticking();
+	expect_file_eventually(path, "abc12");
+
+	// gig_unconfigure() writes what's left
+	peer_begin_mim(1);
+	mimi(0,"!");
+	peer_end_mim();
+	all_the_ticking();
+	teardown();
+	assert(file_equals(path, "abc12!"));
+	char tmp_path[1<<13];
+	snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path);
+	assert(access(tmp_path, F_OK) != 0);
+}
+
+static void test_rooms(void)
+{
+	new_test("rooms");
+	setup(test_dir);
+	char dir_a[1<<12], dir_b[1<<12], path[1<<13];
+	snprintf(dir_a, sizeof dir_a, "%s/a", test_dir);
+	snprintf(dir_b, sizeof dir_b, "%s/b", test_dir);
+
+	const int room_a = gig_add_room("a", dir_a);
+	const int room_b = gig_add_room("b", dir_b);
+	assert((room_a == 1) && (room_b == 2));
+	assert(gig_get_num_rooms() == 3);
+	assert(gig_find_room("") == 0);
+	assert(gig_find_room("a") == room_a);
+	assert(gig_find_room("b") == room_b);
+	assert(gig_find_room("c") < 0);
+	assert(gig_add_room("a", dir_b) < 0);
+	assert(gig_add_room("", dir_b) < 0);
+	assert(gig_add_room("../c", dir_b) < 0);
+	assert(gig_get_num_rooms() == 3);
+
+	struct gig_room_stats s0, sa, sb;
+	gig_get_room_stats(0, &s0);
+
+	// each room has its own artists and documents
+	assert(alloc_artist_id(room_a) == 1);
+	assert(alloc_artist_id(room_b) == 1);
+	static const char MIM_A[] = "11:setdoc 1 500,1,1c0,3iabc";
+	static const char MIM_B[] = "11:setdoc 1 500,1,1c0,3ixyz";
+	commit_mim_to_host(room_a, 1, 1, 0, (uint8_t*)MIM_A, sizeof(MIM_A)-1);
+	commit_mim_to_host(room_b, 1, 1, 0, (uint8_t*)MIM_B, sizeof(MIM_B)-1);
+	all_the_ticking();
+
+	struct gig_room_stats s;
+	gig_get_room_stats(0, &s);
+	assert(s.journal_size == s0.journal_size);
+	gig_get_room_stats(room_a, &sa);
+	gig_get_room_stats(room_b, &sb);
+	assert((sa.journal_size > 0) && (sa.journal_size == sb.journal_size));
+	assert((sa.num_documents == 1) && (sb.num_documents == 1));
+	assert((sa.snapshot_bytes > 0) && (sa.io_buffer_bytes > 0));
+
+	teardown();
+	snprintf(path, sizeof path, "%s/cache/book1-doc50-scene.mie.txt", dir_a);
+	assert(file_equals(path, "abc"));
+	snprintf(path, sizeof path, "%s/cache/book1-doc50-scene.mie.txt", dir_b);
+	assert(file_equals(path, "xyz"));
+
+	// rooms are restored from their journals when added again
+	setup(test_dir);
+	assert(gig_get_num_rooms() == 1);
+	assert(gig_add_room("b", dir_b) == 1);
+	gig_get_room_stats(1, &s);
+	assert(s.journal_size == sb.journal_size);
+	assert(s.num_documents == 1);
+	teardown();
+}
+
+// all_the_ticking() without the peer
+static void host_only_ticking(void)
+{
+	while (host_tick() | io_tick()) {}
+}
+
+static void test_relay(void)
+{
+	new_test("relay");
+	char dir_up[1<<12], dir_relay[1<<12], path[1<<13];
+	snprintf(dir_up, sizeof dir_up, "%s/up", test_dir);
+	snprintf(dir_relay, sizeof dir_relay, "%s/relay", test_dir);
+	assert(0 == mkdir(dir_up, 0777));
+	assert(0 == mkdir(dir_relay, 0777));
+
+	// an upstream host with some history
+	gig_init();
+	assert(gig_configure_as_host_only(dir_up) >= 0);
+	assert(alloc_artist_id(0) == 1);
+	static const char MIM0[] = "11:setdoc 1 500,1,1c0,3iabc";
+	static const char MIM1[] = "0,3idef";
+	commit_mim_to_host(0, 1, 1, 0, (uint8_t*)MIM0, sizeof(MIM0)-1);
+	for (int i=0; i<20; ++i) commit_mim_to_host(0, 1, 1, 0, (uint8_t*)MIM1, sizeof(MIM1)-1);
+	host_only_ticking();
+	struct gig_room_stats up;
+	gig_get_room_stats(0, &up);
+	const int64_t header_size = 32;
+	const int64_t n = up.journal_size - header_size;
+	uint8_t* journal = malloc(n);
+	assert(copy_journal(0, journal, n, header_size) >= 0);
+	gig_unconfigure();
+
+	// the relay starts out empty (no default stub), and takes the upstream
+	// journal in pieces that don't line up with its records
+	gig_init();
+	assert(gig_configure_as_relay(dir_relay) >= 0);
+	host_only_ticking();
+	assert(gig_is_relay_room(0));
+	assert(relay_get_journal_cursor() == header_size);
+	int64_t received = 0, taken = 0;
+	while (taken < n) {
+		received += 7;
+		if (received > n) received = n;
+		const int64_t nn = relay_append_journal(journal + taken, received - taken);
+		assert(nn >= 0);
+		taken += nn;
+		host_only_ticking();
+	}
+	assert(relay_get_journal_cursor() == up.journal_size);
+	struct gig_room_stats s;
+	gig_get_room_stats(0, &s);
+	assert(s.num_documents == up.num_documents);
+	assert(s.journal_size == up.journal_size);
+	snprintf(path, sizeof path, "%s/cache/book1-doc50-scene.mie.txt", dir_relay);
+	g.time_us_monotonic += 1000000;
+	host_only_ticking();
+	expect_file_eventually(path, "abcdefdefdefdefdefdefdefdefdefdefdefdefdefdefdefdefdefdefdefdef");
+
+	// it's a copy, so it rejects what isn't journal data
+	static const uint8_t GARBAGE[] = "garbage";
+	assert(relay_append_journal(GARBAGE, sizeof GARBAGE) < 0);
+	assert(relay_get_journal_cursor() == up.journal_size);
+	host_only_ticking();
+	gig_unconfigure();
+
+	// and it continues where it left off
+	gig_init();
+	assert(gig_configure_as_relay(dir_relay) >= 0);
+	assert(relay_get_journal_cursor() == up.journal_size);
+	gig_get_room_stats(0, &s);
+	assert(s.num_documents == up.num_documents);
+	host_only_ticking();
+	gig_unconfigure();
+
+	snprintf(path, sizeof path, "%s/DO_JAM_JOURNAL", dir_relay);
+	FILE* f = fopen(path, "rb");
+	assert(f != NULL);
+	uint8_t* copy = malloc(up.journal_size);
+	assert(fread(copy, 1, up.journal_size, f) == up.journal_size);
+	fclose(f);
+	assert(0 == memcmp(copy + header_size, journal, n));
+	free(copy);
+	free(journal);
+}
+
+static void tick_until_hibernating(int room_id, int expected)
+{
+	struct gig_room_stats s;
+	for (int i=0; i<5000; ++i) {
+		all_the_ticking();
+		gig_get_room_stats(room_id, &s);
+		if (s.is_hibernating == expected) return;
+		sleep_microseconds(1000L);
+	}
+	fprintf(stderr, "expected room %d to %s\n", room_id, expected ? "hibernate" : "stay awake");
+	abort();
+}
+
+static void test_hibernation(void)
+{
+	new_test("hibernation");
+	setup(test_dir);
+	gig_set_room_hibernation_timeout_us(1000000);
+	char dir_a[1<<12], path[1<<13];
+	snprintf(dir_a, sizeof dir_a, "%s/a", test_dir);
+	snprintf(path, sizeof path, "%s/cache/book1-doc50-scene.mie.txt", dir_a);
+	const int room_a = gig_add_room("a", dir_a);
+	assert(room_a == 1);
+
+	static const char MIM0[] = "11:setdoc 1 500,1,1c0,3iabc";
+	commit_mim_to_host(room_a, 1, 1, 0, (uint8_t*)MIM0, sizeof(MIM0)-1);
+	all_the_ticking();
+	struct gig_room_stats s0, s;
+	gig_get_room_stats(room_a, &s0);
+	assert(!s0.is_hibernating);
+	assert((s0.snapshot_bytes > 0) && (s0.io_buffer_bytes > 0));
+
+	// not idle for long enough
+	g.time_us_monotonic += 500000;
+	all_the_ticking();
+	gig_get_room_stats(room_a, &s);
+	assert(!s.is_hibernating);
+
+	g.time_us_monotonic += 600000;
+	tick_until_hibernating(room_a, 1);
+	gig_get_room_stats(room_a, &s);
+	assert(s.journal_size == s0.journal_size);
+	assert((s.num_documents == 0) && (s.snapshot_bytes == 0) && (s.io_buffer_bytes == 0));
+	expect_file_eventually(path, "abc");
+	// the local peer's room never hibernates
+	gig_get_room_stats(0, &s);
+	assert(!s.is_hibernating);
+
+	// resumes where it left off (the artist's caret included)
+	assert(gig_acquire_room(room_a) >= 0);
+	gig_get_room_stats(room_a, &s);
+	assert(!s.is_hibernating);
+	assert(s.journal_size == s0.journal_size);
+	assert(s.num_documents == 1);
+	static const char MIM1[] = "0,2i12";
+	commit_mim_to_host(room_a, 1, 1, 0, (uint8_t*)MIM1, sizeof(MIM1)-1);
+
+	// in use; doesn't hibernate
+	g.time_us_monotonic += 2000000;
+	all_the_ticking();
+	gig_get_room_stats(room_a, &s);
+	assert(!s.is_hibernating);
+
+	gig_release_room(room_a);
+	g.time_us_monotonic += 2000000;
+	tick_until_hibernating(room_a, 1);
+	expect_file_eventually(path, "abc12");
+	teardown();
+
+	setup(test_dir);
+	assert(gig_add_room("a", dir_a) == room_a);
+	gig_get_room_stats(room_a, &s);
+	assert(s.journal_size > s0.journal_size);
+	assert(s.num_documents == 1);
+	teardown();
+}
+
+int webserv_broadcast_journal(int room_id, int64_t until_journal_cursor)
 {
 	return 0;
 }
@@ -537,8 +1017,22 @@ int main(int argc, char** argv)
 
 		test_caret_adjustment();
 
+		test_unackd_rebase();
+
 		test_time_travel();
 
+		test_snapshot_bootstrap();
+
+		test_backpressure();
+
+		test_derived_files();
+
+		test_rooms();
+
+		test_relay();
+
+		test_hibernation();
+
 		printf("OK (gt=%d)\n", growth_threshold);
 	}
 
@@ -7,6 +7,7 @@
 #include <threads.h>
 
 #include "jio.h"
+#include "lockstat.h"
 
 #define PATH_IMPLEMENTATION
 #include "path.h"
@@ -24,8 +25,8 @@ void sleep_microseconds(int64_t us)
 static int io_thread(void* usr)
 {
 	for (;;) {
-		io_tick();
-		sleep_microseconds(500L);
+		// no timeout; if a submission fails to wake us up, the test hangs
+		if (!io_tick()) io_wait(-1);
 	}
 	return 0;
 }
@@ -112,6 +113,133 @@ static void blocking_append_and_read_back(int i, int N)
 	jio_close(jio);
 }
 
+static void flushed_size_and_reopen(int i)
+{
+	char pathbuf[1<<10];
+	char buf[1<<10];
+	snprintf(buf, sizeof buf, "flushed%d", i);
+	STATIC_PATH_JOIN(pathbuf, dir, buf)
+	int err=0;
+	const int port_id = io_port_create();
+	struct jio* jio = jio_open(pathbuf, IO_CREATE, port_id, 10, &err);
+	assert(jio != NULL);
+	assert(jio_get_flushed_size(jio) == 0);
+	const int N = 200;
+	for (int i=0; i<N; ++i) {
+		assert(0 == jio_append(jio, "0123456789", 10));
+		assert(jio_get_flushed_size(jio) <= jio_get_size(jio));
+		struct io_event ev = {0};
+		while ((jio_get_size(jio) - jio_get_flushed_size(jio)) > 512) {
+			while (io_port_poll(port_id, &ev)) assert(jio_ack(jio, ev.echo));
+		}
+	}
+	assert(jio_get_size(jio) == N*10);
+	while (jio_get_flushed_size(jio) < jio_get_size(jio)) {
+		struct io_event ev = {0};
+		while (io_port_poll(port_id, &ev)) assert(jio_ack(jio, ev.echo));
+	}
+	assert(jio_get_flushed_size(jio) == N*10);
+	assert(0 == jio_close(jio));
+
+	// existing data is already flushed, and appending must work even though
+	// the file is bigger than the ring buffer
+	jio = jio_open(pathbuf, IO_OPEN, port_id, 10, &err);
+	assert(jio != NULL);
+	assert(jio_get_size(jio) == N*10);
+	assert(jio_get_flushed_size(jio) == N*10);
+	assert(0 == jio_append(jio, "abc", 3));
+	assert(jio_get_size(jio) == (N*10+3));
+	char x[13];
+	assert(jio_pread(jio, x, 13, N*10-10) == 13);
+	assert(0 == memcmp(x, "0123456789abc", 13));
+	while (jio_get_flushed_size(jio) < jio_get_size(jio)) {
+		struct io_event ev = {0};
+		while (io_port_poll(port_id, &ev)) assert(jio_ack(jio, ev.echo));
+	}
+	assert(0 == jio_close(jio));
+}
+
+// writes with io_port_writeall()/io_port_writev() and io_port_pwrite()/
+// io_port_pwritev(), which io_tick() may coalesce into fewer syscalls, and
+// checks that every submission gets its own event, and that the data is right
+static void vectored_writes(int i)
+{
+	char pathbuf[1<<10];
+	char buf[1<<10];
+	snprintf(buf, sizeof buf, "vectored%d", i);
+	STATIC_PATH_JOIN(pathbuf, dir, buf)
+	const int port_id = io_port_create();
+	int64_t filesize = -1;
+	const int file_id = io_open(pathbuf, IO_CREATE, &filesize);
+	assert(file_id >= 0);
+	assert(filesize == 0);
+
+	enum { SIZE = 1<<15, MAX_SUBMISSIONS = 1000 };
+	static uint8_t data[SIZE];
+	for (int ii=0; ii<SIZE; ++ii) data[ii] = (ii*7) + i;
+	static struct io_vec vecs[MAX_SUBMISSIONS][3];
+	static int64_t sizes[MAX_SUBMISSIONS];
+
+	// the file's first half is written as a stream, and the second half
+	// with positional writes; both in pieces of varying size, alternating
+	// between plain and vectored
+	int num_submissions = 0;
+	for (int pass=0; pass<2; ++pass) {
+		int64_t cursor = 0;
+		while (cursor < SIZE) {
+			assert(num_submissions < MAX_SUBMISSIONS);
+			const int k = num_submissions++;
+			int64_t n = 1 + ((k*37) % 300);
+			if (n > (SIZE-cursor)) n = (SIZE-cursor);
+			sizes[k] = n;
+			const io_echo echo = { .u64 = k };
+			const int64_t offset = (SIZE + cursor);
+			if (k & 1) {
+				// split into 3 vecs (the middle one may be empty)
+				const int64_t n0 = n/3;
+				const int64_t n1 = (k & 2) ? 0 : n/3;
+				vecs[k][0] = (struct io_vec) { .ptr = data+cursor       , .count = n0       };
+				vecs[k][1] = (struct io_vec) { .ptr = data+cursor+n0    , .count = n1       };
+				vecs[k][2] = (struct io_vec) { .ptr = data+cursor+n0+n1 , .count = n-n0-n1  };
+				if (pass == 0) {
+					io_port_writev(port_id, echo, file_id, vecs[k], 3);
+				} else {
+					io_port_pwritev(port_id, echo, file_id, vecs[k], 3, offset);
+				}
+			} else {
+				if (pass == 0) {
+					io_port_writeall(port_id, echo, file_id, data+cursor, n);
+				} else {
+					io_port_pwrite(port_id, echo, file_id, data+cursor, n, offset);
+				}
+			}
+			cursor += n;
+		}
+	}
+
+	static uint8_t is_done[MAX_SUBMISSIONS];
+	memset(is_done, 0, sizeof is_done);
+	int num_done = 0;
+	while (num_done < num_submissions) {
+		struct io_event ev = {0};
+		while (io_port_poll(port_id, &ev)) {
+			const int k = ev.echo.u64;
+			assert((0 <= k) && (k < num_submissions));
+			assert(!is_done[k]);
+			assert(ev.status == sizes[k]);
+			is_done[k] = 1;
+			++num_done;
+		}
+		sleep_microseconds(100L);
+	}
+
+	static uint8_t readback[2*SIZE];
+	assert(io_pread(file_id, readback, 2*SIZE, 0) == 0);
+	assert(0 == memcmp(readback, data, SIZE));
+	assert(0 == memcmp(readback+SIZE, data, SIZE));
+	assert(io_close(file_id) == 0);
+}
+
 int main(int argc, char** argv)
 {
 	if (argc != 2) {
@@ -128,6 +256,19 @@ int main(int argc, char** argv)
 
 	for (int i=0; i<3; ++i) simple_test(i);
 	for (int i=0; i<5; ++i) blocking_append_and_read_back(i,(1+i)*2551);
+	for (int i=0; i<2; ++i) flushed_size_and_reopen(i);
+	for (int i=0; i<3; ++i) vectored_writes(i);
+
+	// the I/O thread and this thread share the io lock; the port event locks
+	// should rarely be contended
+	struct lock_stats ls, pls;
+	io_get_lock_stats(&ls, &pls);
+	assert((ls.num_acquired > 0) && (ls.num_contended <= ls.num_acquired));
+	assert((pls.num_acquired > 0) && (pls.num_contended <= pls.num_acquired));
+	printf("io lock: %lld/%lld contended (%.3f ms waiting, max %.3f ms)\n",
+		(long long)ls.num_contended, (long long)ls.num_acquired, (double)ls.wait_ns * 1e-6, (double)ls.max_wait_ns * 1e-6);
+	printf("port event locks: %lld/%lld contended (%.3f ms waiting, max %.3f ms)\n",
+		(long long)pls.num_contended, (long long)pls.num_acquired, (double)pls.wait_ns * 1e-6, (double)pls.max_wait_ns * 1e-6);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,153 @@
+// run with test_lz.sh
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#include "lz.h"
+
+static uint32_t rng_state = 1;
+static uint32_t rng(void)
+{
+	// xorshift32
+	uint32_t x = rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return rng_state = x;
+}
+
+// compresses buf[dict_size:dict_size+size] using buf[0:dict_size] as the
+// dictionary, decompresses it again, and checks that the result is the same.
+// returns the compressed size
+static int64_t roundtrip(const uint8_t* buf, int64_t dict_size, int64_t size)
+{
+	uint8_t* compressed = malloc(lz_compress_bound(size));
+	const int64_t n = lz_compress(compressed, buf, dict_size, size);
+	assert((0 < n) && (n <= lz_compress_bound(size)));
+
+	uint8_t* out = malloc(dict_size + size + 1);
+	memcpy(out, buf, dict_size);
+	out[dict_size + size] = 0xa5; // canary
+	assert(lz_decompress(out, dict_size, size, compressed, n) == size);
+	assert(0 == memcmp(out, buf, dict_size + size));
+	assert(out[dict_size + size] == 0xa5);
+
+	// wrong expected size must fail, not overrun
+	if (size > 0) assert(lz_decompress(out, dict_size, size-1, compressed, n) < 0);
+
+	free(out);
+	free(compressed);
+	return n;
+}
+
+static void test_basics(void)
+{
+	assert(roundtrip((const uint8_t*)"", 0, 0) == 1);
+	assert(roundtrip((const uint8_t*)"a", 0, 1) == 2);
+	roundtrip((const uint8_t*)"abcd", 0, 4);
+	roundtrip((const uint8_t*)"abcdabcd", 0, 8);
+
+	uint8_t buf[1<<12];
+	memset(buf, 'x', sizeof buf);
+	// a run of the same byte is one literal and one long (overlapping) match
+	assert(roundtrip(buf, 0, sizeof buf) < 32);
+
+	const char* text =
+		"static void foo(int x)\n{\n\tprintf(\"%d\\n\", x);\n}\n"
+		"static void bar(int x)\n{\n\tprintf(\"%d\\n\", x);\n}\n";
+	const int64_t n = strlen(text);
+	assert(roundtrip((const uint8_t*)text, 0, n) < n);
+}
+
+static void test_dictionary(void)
+{
+	// the second half repeats the first half, so using the first half as
+	// the dictionary should compress the second half to almost nothing
+	uint8_t buf[2000];
+	for (int i=0; i<1000; ++i) buf[i] = rng();
+	memcpy(&buf[1000], buf, 1000);
+	assert(roundtrip(buf+1000, 0, 1000) > 1000);
+	assert(roundtrip(buf, 1000, 1000) < 16);
+
+	// a dictionary bigger than LZ_MAX_DICT_SIZE is clamped (only its tail is
+	// used)
+	const int64_t big = LZ_MAX_DICT_SIZE + 5000;
+	uint8_t* b = malloc(big + 100);
+	for (int64_t i=0; i<big; ++i) b[i] = rng();
+	memcpy(&b[big], &b[big-100], 100);
+	assert(roundtrip(b, big, 100) < 16);
+	free(b);
+}
+
+static void test_malformed(void)
+{
+	uint8_t out[64] = {0};
+	// empty input
+	assert(lz_decompress(out, 0, 0, out, 0) < 0);
+	// literal length exceeds input
+	const uint8_t a[] = { 0x50, 'a', 'b' };
+	assert(lz_decompress(out, 0, 5, a, sizeof a) < 0);
+	// offset points before the start of the buffer
+	const uint8_t b[] = { 0x10, 'a', 0x02, 0x00, 0x00 };
+	assert(lz_decompress(out, 0, 10, b, sizeof b) < 0);
+	// offset 0
+	const uint8_t c[] = { 0x10, 'a', 0x00, 0x00, 0x00 };
+	assert(lz_decompress(out, 0, 10, c, sizeof c) < 0);
+	// valid: "a" + match(offset=1,len=4) + empty last sequence
+	const uint8_t d[] = { 0x10, 'a', 0x01, 0x00, 0x00 };
+	assert(lz_decompress(out, 0, 5, d, sizeof d) == 5);
+	assert(0 == memcmp(out, "aaaaa", 5));
+	// truncated offset
+	const uint8_t e[] = { 0x10, 'a', 0x01 };
+	assert(lz_decompress(out, 0, 5, e, sizeof e) < 0);
+	// offset reaching into the dictionary is fine
+	memcpy(out, "xyz", 3);
+	const uint8_t f[] = { 0x00, 0x03, 0x00, 0x00 };
+	assert(lz_decompress(out, 3, 4, f, sizeof f) == 4);
+	assert(0 == memcmp(out, "xyzxyzx", 7));
+
+	// random garbage must never crash or write outside the output range
+	uint8_t garbage[256];
+	uint8_t buf[1024+8];
+	for (int i=0; i<100000; ++i) {
+		const int n = 1 + (rng() % sizeof garbage);
+		for (int ii=0; ii<n; ++ii) garbage[ii] = rng();
+		memset(buf, 0xa5, sizeof buf);
+		const int64_t r = lz_decompress(buf, 8, 1024-8, garbage, n);
+		assert((r < 0) || (r == (1024-8)));
+		for (int ii=1024; ii<(int)sizeof buf; ++ii) assert(buf[ii] == 0xa5);
+	}
+}
+
+static void test_fuzz(void)
+{
+	// data with varying degrees of redundancy: a small alphabet, and
+	// copies of earlier data
+	for (int iteration=0; iteration<2000; ++iteration) {
+		const int64_t dict_size = (iteration & 1) ? (rng() % 3000) : 0;
+		const int64_t size = rng() % ((iteration & 7) == 0 ? 100000 : 3000);
+		const int alphabet = 1 + (rng() % 256);
+		uint8_t* buf = malloc(dict_size + size + 1);
+		for (int64_t i=0; i<(dict_size+size); ++i) {
+			if ((i > 10) && ((rng() % 8) == 0)) {
+				const int64_t n = rng() % 300;
+				const int64_t src = rng() % i;
+				for (int64_t ii=0; (ii<n) && ((i+1)<(dict_size+size)); ++ii) buf[i++] = buf[src+ii];
+			}
+			buf[i] = rng() % alphabet;
+		}
+		roundtrip(buf, dict_size, size);
+		free(buf);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	test_basics();
+	test_dictionary();
+	test_malformed();
+	test_fuzz();
+	printf("OK\n");
+	return EXIT_SUCCESS;
+}
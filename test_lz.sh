@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+set -e
+cc -O0 -g -Wall lz.c test_lz.c -o _test_lz
+$RUNNER ./_test_lz
+# to run with gdb/gf2 or valgrind:
+# $ RUNNER="gdb --args" ./test_lz.sh
+# $ RUNNER="valgrind" ./test_lz.sh
@@ -0,0 +1,272 @@
+// run with test_udp.sh
+
+// a host and a peer talk over loopback with udp.c, with and without
+// udp_set_impairment(). gig is stubbed out below: the host "journal" is bytes
+// in memory with records like gig's (but simpler), and the peer checks that
+// what it spools is exactly what the host has
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "stb_ds_sysalloc.h"
+#include "io.h"
+#include "gig.h"
+#include "udp.h"
+#include "bb.h"
+#include "bufstream.h"
+#include "protocol.h"
+
+static struct {
+	uint8_t* journal_arr;  // the host's
+	int next_artist_id;
+	int num_acquired;
+	int64_t* last_tracer_arr; // per artist id; tracers must be committed in order, once
+	int64_t num_mims;
+	int64_t peer_cursor;      // the peer has spooled journal data before this
+	int my_artist_id;
+} g;
+
+int64_t get_nanoseconds_monotonic(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_nsec + (int64_t)t.tv_sec * 1000000000LL;
+}
+
+// gig stubs (host)
+
+int64_t get_committed_journal_size(int room_id)
+{
+	assert(room_id == 0);
+	return arrlen(g.journal_arr);
+}
+
+int copy_journal(int room_id, void* dst, int64_t count, int64_t offset)
+{
+	assert((offset+count) <= arrlen(g.journal_arr));
+	memcpy(dst, g.journal_arr + offset, count);
+	return 0;
+}
+
+int alloc_artist_id(int room_id)
+{
+	const int artist_id = ++g.next_artist_id;
+	arrput(g.last_tracer_arr, 0);
+	assert(arrlen(g.last_tracer_arr) == artist_id);
+	return artist_id;
+}
+
+void free_artist_id(int artist_id)
+{
+}
+
+int gig_acquire_room(int room_id)
+{
+	++g.num_acquired;
+	return 0;
+}
+
+void gig_release_room(int room_id)
+{
+	--g.num_acquired;
+}
+
+static void append_record(int artist_id, int session_id, int64_t tracer, const uint8_t* data, int count)
+{
+	uint8_t** bb = &g.journal_arr;
+	bb_append_leb128(bb, artist_id);
+	bb_append_leb128(bb, session_id);
+	bb_append_leb128(bb, tracer);
+	bb_append_leb128(bb, count);
+	bb_append(bb, data, count);
+}
+
+void commit_mim_to_host(int room_id, int artist_id, int session_id, int64_t tracer, uint8_t* data, int count)
+{
+	assert((1 <= artist_id) && (artist_id <= arrlen(g.last_tracer_arr)));
+	int64_t* last = &g.last_tracer_arr[artist_id-1];
+	assert((tracer == (*last + 1)) && "mim lost, duplicated or reordered");
+	*last = tracer;
+	++g.num_mims;
+	append_record(artist_id, session_id, tracer, data, count);
+}
+
+// gig stubs (peer)
+
+int64_t get_whole_journal_records_size(const void* data, int64_t count)
+{
+	struct bufstream bs;
+	bufstream_init_from_memory(&bs, data, count);
+	int64_t n = 0;
+	while (bs.offset < count) {
+		for (int i=0; i<3; ++i) bs_read_leb128(&bs);
+		const int64_t size = bs_read_leb128(&bs);
+		if (bs.error || ((bs.offset + size) > count)) break;
+		bs.cursor += size;
+		bs.offset += size;
+		n = bs.offset;
+	}
+	return n;
+}
+
+int peer_spool_raw_journal_into_upstream_snapshot(void* data, int64_t count)
+{
+	assert(get_whole_journal_records_size(data, count) == count);
+	assert((g.peer_cursor + count) <= arrlen(g.journal_arr));
+	assert(0 == memcmp(data, g.journal_arr + g.peer_cursor, count));
+	g.peer_cursor += count;
+	return 0;
+}
+
+void set_my_artist_id(int artist_id)
+{
+	g.my_artist_id = artist_id;
+}
+
+// returns 0 if done() didn't happen within timeout_s
+static int tick_until(int (*done)(void), double timeout_s)
+{
+	const int64_t t0 = get_nanoseconds_monotonic();
+	while (!done()) {
+		if ((get_nanoseconds_monotonic() - t0) > (int64_t)(timeout_s * 1e9)) return 0;
+		int did_work = 0;
+		did_work |= udp_host_tick();
+		did_work |= udp_peer_tick();
+		did_work |= udp_peer_spool();
+		if (!did_work) {
+			int64_t wait_us = udp_get_wait_timeout_us();
+			if ((wait_us < 0) || (wait_us > 10000)) wait_us = 10000;
+			io_wait(wait_us);
+		}
+	}
+	return 1;
+}
+
+static int is_welcomed(void)
+{
+	return g.my_artist_id > 0;
+}
+
+static int64_t num_expected_mims;
+static int has_all_mims(void)
+{
+	return (g.num_mims == num_expected_mims) && (g.peer_cursor == arrlen(g.journal_arr));
+}
+
+static int64_t tracer_sequence;
+static void transmit(int num_bytes)
+{
+	uint8_t* data = malloc(num_bytes);
+	for (int i=0; i<num_bytes; ++i) data[i] = 'a' + ((tracer_sequence+i) % 26);
+	udp_peer_transmit_mim(1, ++tracer_sequence, data, num_bytes);
+	++num_expected_mims;
+	free(data);
+}
+
+// mims from artists that aren't us (or anything else that makes the journal
+// grow without us)
+static void commit_foreign(int num_bytes)
+{
+	uint8_t* data = malloc(num_bytes);
+	memset(data, 'x', num_bytes);
+	append_record(1000, 1, 1, data, num_bytes);
+	free(data);
+}
+
+// a hello from an address that hasn't got a cookie (e.g. a spoofed one) gets
+// a challenge that's smaller than the hello, and nothing else
+static void test_hello_without_cookie(int port)
+{
+	const int file_id = io_open_udp(0);
+	assert(file_id >= 0);
+	struct io_addr host_addr;
+	assert(io_resolve("127.0.0.1", port, &host_addr) == 0);
+	const uint64_t cookies[] = { 0, 0x1234567890abcdefULL };
+	for (int i=0; i<2; ++i) {
+		uint8_t* bb = NULL;
+		bb_append_u8(&bb, UDP0_HELLO);
+		bb_append_leb128(&bb, 42);
+		bb_append_leb128(&bb, JOURNAL_HEADER_SIZE);
+		bb_append_leu64(&bb, cookies[i]);
+		while (arrlen(bb) < UDP_HELLO_SIZE) bb_append_u8(&bb, 0);
+		assert(io_udp_send(file_id, &host_addr, bb, arrlen(bb)) == 0);
+		arrfree(bb);
+
+		uint8_t buf[1<<11];
+		struct io_addr from;
+		int n = IO_PENDING;
+		const int64_t t0 = get_nanoseconds_monotonic();
+		while ((n == IO_PENDING) && ((get_nanoseconds_monotonic() - t0) < 1000000000LL)) {
+			udp_host_tick();
+			io_wait(1000);
+			n = io_udp_recv(file_id, buf, sizeof buf, &from);
+		}
+		assert((0 < n) && (n < UDP_HELLO_SIZE));
+		assert(buf[0] == UDP1_CHALLENGE);
+		assert(g.num_acquired == 0);
+	}
+	io_close(file_id);
+}
+
+static void run(const char* name, int num_bursts)
+{
+	const int64_t t0 = get_nanoseconds_monotonic();
+	struct udp_stats s0, s1;
+	udp_get_stats(&s0);
+	for (int burst=0; burst<num_bursts; ++burst) {
+		// typing...
+		for (int i=0; i<10; ++i) transmit(5 + (burst%7));
+		// ...the odd paste...
+		if ((burst % 10) == 3) transmit(5000);
+		// ...and other artists
+		if ((burst % 10) == 7) commit_foreign(100000);
+		assert(tick_until(has_all_mims, 30.0));
+	}
+	udp_get_stats(&s1);
+	printf("%-10s %5d mims, %8d journal bytes in %.2fs; datagrams: %lld sent, %lld received, %lld dropped; %lld resends\n",
+		name,
+		(int)g.num_mims,
+		(int)arrlen(g.journal_arr),
+		(double)(get_nanoseconds_monotonic() - t0) * 1e-9,
+		(long long)(s1.num_sent - s0.num_sent),
+		(long long)(s1.num_received - s0.num_received),
+		(long long)(s1.num_dropped - s0.num_dropped),
+		(long long)(s1.num_resends - s0.num_resends));
+}
+
+int main(int argc, char** argv)
+{
+	io_init();
+	arrsetlen(g.journal_arr, JOURNAL_HEADER_SIZE);
+	memset(g.journal_arr, 0, JOURNAL_HEADER_SIZE);
+	commit_foreign(3000); // there's history before the peer joins
+	g.peer_cursor = JOURNAL_HEADER_SIZE;
+
+	const int port = udp_host_init(0);
+	assert(port > 0);
+	test_hello_without_cookie(port);
+	char host[64];
+	snprintf(host, sizeof host, "127.0.0.1:%d", port);
+	assert(udp_peer_init(host, JOURNAL_HEADER_SIZE) >= 0);
+	assert(tick_until(is_welcomed, 5.0));
+	assert(g.my_artist_id == 1);
+	assert(g.num_acquired == 1);
+
+	run("clean", 30);
+
+	udp_set_impairment(0.2, 20000, 20000);
+	run("lossy", 30);
+
+	// half of the datagrams lost, both ways
+	udp_set_impairment(0.5, 5000, 0);
+	run("very lossy", 10);
+
+	udp_set_impairment(0, 0, 0);
+	run("clean", 5);
+
+	printf("OK\n");
+	return EXIT_SUCCESS;
+}
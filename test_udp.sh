@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+set -e
+cc -O0 -g -Wall allocator.c stb_ds.c io.c jio.c bufstream.c lonesha256.c udp.c test_udp.c -o _test_udp
+$RUNNER ./_test_udp
+# to run with gdb/gf2 or valgrind:
+# $ RUNNER="gdb --args" ./test_udp.sh
+# $ RUNNER="valgrind" ./test_udp.sh
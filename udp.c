@@ -0,0 +1,848 @@
+// see udp.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "udp.h"
+#include "main.h"
+#include "io.h"
+#include "stb_ds_sysalloc.h"
+#include "gig.h"
+#include "bufstream.h"
+#include "protocol.h"
+#include "bb.h"
+#include "lonesha256.h"
+
+#define MAX_DATAGRAM_SIZE     (1200)
+// what we try to stay below, so datagrams aren't fragmented on the way. a mim
+// that's bigger than this goes alone in a bigger datagram (up to
+// MAX_MIM_SIZE); journal data is split up, so that's never bigger
+#define MAX_MIM_SIZE          (60000)
+#define RECEIVE_BUFFER_SIZE   (1L<<16)
+#define MAX_CLIENTS           (256)
+#define SEND_WINDOW           (1L<<16)
+// journal data sent to a peer, but not acked yet, is at most this big
+#define KEEPALIVE_INTERVAL_NS (500000000LL)
+// both ends send at least this often, so the other end knows they're alive,
+// and lost acks are eventually repeated
+#define TIMEOUT_NS            (10000000000LL)
+// a host forgets peers it hasn't heard from for this long, and a peer that
+// hasn't heard from its host says hello again
+#define MIN_RTO_NS            (20000000LL)
+#define MAX_RTO_NS            (1000000000LL)
+#define INITIAL_RTO_NS        (200000000LL)
+#define MAX_SEGMENT_BYTES     (SEND_WINDOW)
+// a peer keeps at most this much journal data that arrived after a gap
+#define NUM_DUPACKS_TO_RESEND (3)
+// a peer acks every time it gets journal data, also when it's not the data
+// it's waiting for, so this many acks in a row for the same cursor probably
+// means a lost datagram; the host resends without waiting for the timeout
+#define COOKIE_EPOCH_NS       (30000000000LL)
+// cookies (see UDP1_CHALLENGE) are valid in the epoch they're made in, and
+// the next one
+
+struct delayed_datagram {
+	int64_t due_ns;
+	int file_id;
+	struct io_addr to;
+	uint8_t* data_arr;
+};
+
+// round-trip time estimate, and a probe for measuring it: the time something
+// was sent, and the ack that confirms it. resends cancel the probe, because an
+// ack can't tell which of the sends it's for (Karn's algorithm)
+struct rtt {
+	int64_t srtt_ns;
+	int64_t probe_ack;
+	int64_t probe_sent_ns;
+};
+
+struct segment {
+	int64_t offset;
+	uint8_t* data_arr;
+};
+
+struct client {
+	int64_t connection_id;
+	struct io_addr addr;
+	int artist_id;
+	int64_t max_tracer;   // highest tracer committed; the mim ack
+	int64_t acked_cursor; // the peer has all journal data before this
+	int64_t sent_cursor;  // journal data before this has been sent
+	int64_t resend_at_ns; // go back to acked_cursor if it hasn't moved by then
+	int64_t last_heard_ns;
+	int64_t last_sent_ns;
+	struct rtt rtt;
+	int num_dupacks; // acks that didn't move acked_cursor while data was in flight
+	unsigned must_reply    :1; // the peer sent something that wants an ack
+	unsigned has_gone_back :1; // sent_cursor went back, and acked_cursor hasn't moved since
+};
+
+static struct {
+	uint8_t* bb_arr;
+	uint8_t rxbuf[RECEIVE_BUFFER_SIZE];
+	double loss;
+	int64_t latency_us, jitter_us;
+	uint64_t rng_state;
+	struct delayed_datagram* delayed_arr;
+	struct udp_stats stats;
+} g;
+
+// host
+static struct {
+	int is_initialized;
+	int file_id;
+	uint8_t cookie_secret[32];
+	struct client* client_arr;
+} hg;
+
+// peer
+static struct {
+	int is_initialized;
+	int file_id;
+	struct io_addr host_addr;
+	int64_t connection_id;
+	uint64_t cookie;
+	int artist_id;
+	unsigned is_welcomed :1;
+	unsigned must_reply  :1; // new journal data arrived; ack it
+	int64_t journal_cursor; // all journal data before this has been received
+	uint8_t* journal_arr;   // received journal data that isn't whole records yet
+	struct segment* segment_arr; // received journal data after a gap
+	int64_t hello_at_ns;
+	int64_t last_heard_ns;
+	int64_t last_sent_ns;
+	int64_t resend_at_ns;
+	struct rtt rtt;
+	int64_t acked_tracer;
+	int64_t sent_tracer; // mims up to this tracer have been sent at least once
+	pthread_mutex_t mutex; // for unackd_mim_arr and spool_arr
+	uint8_t* unackd_mim_arr; // [session id, tracer, size, data] records
+	uint8_t* spool_arr;      // whole journal records for udp_peer_spool()
+	uint8_t* spooling_arr;
+} pg;
+
+static uint64_t rng_next(void)
+{
+	// xorshift64
+	uint64_t x = g.rng_state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	g.rng_state = x;
+	return x;
+}
+
+static double rng_unit(void)
+{
+	return (double)(rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int64_t get_rto_ns(struct rtt* rtt)
+{
+	if (rtt->srtt_ns == 0) return INITIAL_RTO_NS;
+	int64_t rto = 2*rtt->srtt_ns + 10000000LL;
+	if (rto < MIN_RTO_NS) rto = MIN_RTO_NS;
+	if (rto > MAX_RTO_NS) rto = MAX_RTO_NS;
+	return rto;
+}
+
+static void rtt_probe(struct rtt* rtt, int64_t ack, int64_t now)
+{
+	if (rtt->probe_sent_ns > 0) return;
+	rtt->probe_ack = ack;
+	rtt->probe_sent_ns = now;
+}
+
+static void rtt_ack(struct rtt* rtt, int64_t ack, int64_t now)
+{
+	if ((rtt->probe_sent_ns == 0) || (ack < rtt->probe_ack)) return;
+	const int64_t sample = now - rtt->probe_sent_ns;
+	rtt->srtt_ns = (rtt->srtt_ns == 0) ? sample : ((7*rtt->srtt_ns + sample) / 8);
+	rtt->probe_sent_ns = 0;
+}
+
+static void rtt_cancel_probe(struct rtt* rtt)
+{
+	rtt->probe_sent_ns = 0;
+}
+
+static void send_datagram(int file_id, const struct io_addr* to, const uint8_t* data, int64_t count)
+{
+	++g.stats.num_sent;
+	if ((g.loss > 0) && (rng_unit() < g.loss)) {
+		++g.stats.num_dropped;
+		return;
+	}
+	if ((g.latency_us > 0) || (g.jitter_us > 0)) {
+		const int64_t jitter_us = (g.jitter_us > 0) ? (int64_t)(rng_next() % (uint64_t)(g.jitter_us+1)) : 0;
+		struct delayed_datagram dd = {
+			.due_ns = get_nanoseconds_monotonic() + (g.latency_us + jitter_us) * 1000LL,
+			.file_id = file_id,
+			.to = *to,
+		};
+		bb_append(&dd.data_arr, data, count);
+		arrput(g.delayed_arr, dd);
+		return;
+	}
+	// IO_BUFFER_FULL is a lost datagram; the protocol deals with those
+	(void)io_udp_send(file_id, to, data, count);
+}
+
+static int send_delayed_datagrams(void)
+{
+	const int64_t now = get_nanoseconds_monotonic();
+	int did_work = 0;
+	for (int i=0; i<arrlen(g.delayed_arr); ) {
+		struct delayed_datagram* dd = &g.delayed_arr[i];
+		if (dd->due_ns > now) {
+			++i;
+			continue;
+		}
+		(void)io_udp_send(dd->file_id, &dd->to, dd->data_arr, arrlen(dd->data_arr));
+		arrfree(dd->data_arr);
+		arrdel(g.delayed_arr, i);
+		did_work = 1;
+	}
+	return did_work;
+}
+
+static int64_t get_timer_wait_us(int64_t at_ns, int64_t now)
+{
+	return (at_ns <= now) ? 0 : ((at_ns - now + 999) / 1000);
+}
+
+static void min_wait_us(int64_t* wait_us, int64_t us)
+{
+	if ((*wait_us < 0) || (us < *wait_us)) *wait_us = us;
+}
+
+// returns a datagram's connection id, and leaves bs after it. returns -1 if
+// it's malformed
+static int64_t read_header(struct bufstream* bs, uint8_t* out_op)
+{
+	*out_op = bs_read_u8(bs);
+	const int64_t connection_id = bs_read_leb128(bs);
+	return bs->error ? -1 : connection_id;
+}
+
+static int parse_host_port(const char* s, struct io_addr* out_addr)
+{
+	const char* colon = strrchr(s, ':');
+	if (colon == NULL || colon == s) return -1;
+	const int port = atoi(colon+1);
+	if ((port <= 0) || (port > 65535)) return -1;
+	char host[1<<8];
+	if ((colon - s) >= (int)sizeof host) return -1;
+	snprintf(host, sizeof host, "%.*s", (int)(colon - s), s);
+	return io_resolve(host, port, out_addr);
+}
+
+int udp_host_init(int bind_port)
+{
+	assert(!hg.is_initialized);
+	FILE* f = fopen("/dev/urandom", "rb");
+	const int has_secret = (f != NULL) && (fread(hg.cookie_secret, sizeof hg.cookie_secret, 1, f) == 1);
+	if (f != NULL) fclose(f);
+	if (!has_secret) {
+		fprintf(stderr, "udp: no /dev/urandom for the cookie secret\n");
+		return IO_ERROR;
+	}
+	const int file_id = io_open_udp(bind_port);
+	if (file_id < 0) return file_id;
+	hg.file_id = file_id;
+	hg.is_initialized = 1;
+	return io_get_local_port(file_id);
+}
+
+// a cookie proves that whoever says hello with it can receive at addr (where
+// UDP1_CHALLENGE sent it); that way the host never sends journal data to an
+// address a spoofed datagram came "from". it's a keyed hash, so the host
+// keeps no state for addresses it hasn't heard back from
+static uint64_t make_cookie(const struct io_addr* addr, int64_t connection_id, int64_t epoch)
+{
+	uint8_t* bb = NULL;
+	bb_append(&bb, hg.cookie_secret, sizeof hg.cookie_secret);
+	bb_append_leu64(&bb, epoch);
+	bb_append_leu32(&bb, addr->ipv4);
+	bb_append_leu16(&bb, addr->port);
+	bb_append_leu64(&bb, connection_id);
+	uint8_t hash[32];
+	lonesha256(hash, bb, arrlen(bb));
+	arrfree(bb);
+	uint64_t cookie = 0;
+	for (int i=0; i<8; ++i) cookie |= (uint64_t)hash[i] << (8*i);
+	return cookie | 1; // (0 is "no cookie")
+}
+
+static int is_valid_cookie(uint64_t cookie, const struct io_addr* addr, int64_t connection_id)
+{
+	const int64_t epoch = get_nanoseconds_monotonic() / COOKIE_EPOCH_NS;
+	return (cookie == make_cookie(addr, connection_id, epoch))
+	    || (cookie == make_cookie(addr, connection_id, epoch-1));
+}
+
+static int64_t get_challenge_size(int64_t connection_id)
+{
+	uint8_t buf[LEB128_MAX_LENGTH];
+	return 1 + (leb128_encode_int64_buf(buf, connection_id) - buf) + 8;
+}
+
+static void send_challenge(int64_t connection_id, const struct io_addr* to)
+{
+	uint8_t** bb = &g.bb_arr;
+	arrreset(*bb);
+	bb_append_u8(bb, UDP1_CHALLENGE);
+	bb_append_leb128(bb, connection_id);
+	bb_append_leu64(bb, make_cookie(to, connection_id, get_nanoseconds_monotonic() / COOKIE_EPOCH_NS));
+	assert(arrlen(*bb) == get_challenge_size(connection_id));
+	send_datagram(hg.file_id, to, *bb, arrlen(*bb));
+}
+
+static int is_same_addr(const struct io_addr* a, const struct io_addr* b)
+{
+	return (a->ipv4 == b->ipv4) && (a->port == b->port);
+}
+
+static struct client* find_client(int64_t connection_id)
+{
+	const int num_clients = arrlen(hg.client_arr);
+	for (int i=0; i<num_clients; ++i) {
+		struct client* c = &hg.client_arr[i];
+		if (c->connection_id == connection_id) return c;
+	}
+	return NULL;
+}
+
+static void go_back(struct client* c)
+{
+	c->sent_cursor = c->acked_cursor;
+	c->num_dupacks = 0;
+	c->has_gone_back = 1;
+	rtt_cancel_probe(&c->rtt);
+	++g.stats.num_resends;
+}
+
+static void host_handle_hello(int64_t connection_id, const struct io_addr* from, struct bufstream* bs, int64_t size)
+{
+	const int64_t cursor = bs_read_leb128(bs);
+	const uint64_t cookie = (uint64_t)bs_read_leu64(bs);
+	if (bs->error || (size < UDP_HELLO_SIZE)) return;
+	if ((cursor < JOURNAL_HEADER_SIZE) || (cursor > get_committed_journal_size(0))) {
+		// (not from our journal; maybe we were restarted with another
+		// one)
+		return;
+	}
+	if (!is_valid_cookie(cookie, from, connection_id)) {
+		send_challenge(connection_id, from);
+		return;
+	}
+	struct client* c = find_client(connection_id);
+	if (c == NULL) {
+		if (arrlen(hg.client_arr) >= MAX_CLIENTS) return;
+		if (gig_acquire_room(0) < 0) return;
+		arrput(hg.client_arr, ((struct client) {
+			.connection_id = connection_id,
+			.artist_id = alloc_artist_id(0),
+		}));
+		c = &arrlast(hg.client_arr);
+	}
+	// (again, if it's a peer we know that lost track of us, or that
+	// moved to another address)
+	c->acked_cursor = cursor;
+	c->sent_cursor = cursor;
+	rtt_cancel_probe(&c->rtt);
+	c->addr = *from;
+	c->last_heard_ns = get_nanoseconds_monotonic();
+
+	uint8_t** bb = &g.bb_arr;
+	arrreset(*bb);
+	bb_append_u8(bb, UDP1_WELCOME);
+	bb_append_leb128(bb, c->connection_id);
+	bb_append_leb128(bb, c->artist_id);
+	bb_append_leb128(bb, c->max_tracer);
+	send_datagram(hg.file_id, &c->addr, *bb, arrlen(*bb));
+	c->last_sent_ns = c->last_heard_ns;
+}
+
+static void host_handle_update(int64_t connection_id, const struct io_addr* from, struct bufstream* bs, const uint8_t* data, int64_t size)
+{
+	struct client* c = find_client(connection_id);
+	if (c == NULL) return; // it'll say hello again after TIMEOUT_NS
+	if (!is_same_addr(from, &c->addr)) {
+		// the peer moved (NAT rebinding, another network), or someone
+		// is pretending to be it. it can only take its session along
+		// by saying hello from there with a cookie
+		if (size >= get_challenge_size(connection_id)) send_challenge(connection_id, from);
+		return;
+	}
+	const int64_t now = get_nanoseconds_monotonic();
+	const int64_t cursor = bs_read_leb128(bs);
+	if (bs->error) return;
+	c->last_heard_ns = now;
+	if ((cursor > c->acked_cursor) && (cursor <= get_committed_journal_size(0))) {
+		// (the ack may be for data sent before going back to
+		// acked_cursor)
+		if (cursor > c->sent_cursor) c->sent_cursor = cursor;
+		c->acked_cursor = cursor;
+		c->resend_at_ns = now + get_rto_ns(&c->rtt);
+		c->num_dupacks = 0;
+		c->has_gone_back = 0;
+		rtt_ack(&c->rtt, cursor, now);
+	} else if ((cursor == c->acked_cursor) && (c->sent_cursor > c->acked_cursor) && !c->has_gone_back) {
+		if (++c->num_dupacks >= NUM_DUPACKS_TO_RESEND) go_back(c);
+	}
+	while (bs->offset < size) {
+		const int64_t session_id = bs_read_leb128(bs);
+		const int64_t tracer     = bs_read_leb128(bs);
+		const int64_t count      = bs_read_leb128(bs);
+		if (bs->error || (count < 0) || (count > (size - bs->offset))) return;
+		c->must_reply = 1;
+		if (tracer > c->max_tracer) {
+			commit_mim_to_host(0, c->artist_id, session_id, tracer, (uint8_t*)data + bs->offset, count);
+			c->max_tracer = tracer;
+		}
+		bs->cursor += count;
+		bs->offset += count;
+	}
+}
+
+static void host_send_update(struct client* c, int64_t journal_size, int64_t now)
+{
+	uint8_t** bb = &g.bb_arr;
+	arrreset(*bb);
+	bb_append_u8(bb, UDP1_UPDATE);
+	bb_append_leb128(bb, c->connection_id);
+	bb_append_leb128(bb, c->max_tracer);
+	bb_append_leb128(bb, journal_size);
+	const int64_t room = MAX_DATAGRAM_SIZE - arrlen(*bb) - LEB128_MAX_LENGTH;
+	int64_t o1 = c->sent_cursor;
+	if ((journal_size > o1) && ((o1 - c->acked_cursor) < SEND_WINDOW)) {
+		o1 += room;
+		if (o1 > journal_size) o1 = journal_size;
+	}
+	// unacked data is repeated if there's room for it
+	int64_t o0 = o1 - room;
+	if (o0 < c->acked_cursor) o0 = c->acked_cursor;
+	if (o0 > c->sent_cursor) o0 = c->sent_cursor;
+	bb_append_leb128(bb, o0);
+	if (o1 > o0) {
+		const int64_t n = o1 - o0;
+		if (copy_journal(0, arraddnptr(*bb, n), n, o0) < 0) {
+			fprintf(stderr, "udp: copy_journal() failed\n");
+			arrsetlen(*bb, arrlen(*bb) - n);
+			o1 = o0;
+		}
+	}
+	send_datagram(hg.file_id, &c->addr, *bb, arrlen(*bb));
+	if (o1 > c->sent_cursor) {
+		if (c->sent_cursor == c->acked_cursor) c->resend_at_ns = now + get_rto_ns(&c->rtt);
+		c->sent_cursor = o1;
+		rtt_probe(&c->rtt, o1, now);
+	}
+	c->last_sent_ns = now;
+	c->must_reply = 0;
+}
+
+int udp_host_tick(void)
+{
+	if (!hg.is_initialized) return 0;
+	int did_work = 0;
+	did_work |= send_delayed_datagrams();
+
+	for (;;) {
+		struct io_addr from;
+		const int n = io_udp_recv(hg.file_id, g.rxbuf, sizeof g.rxbuf, &from);
+		if (n == IO_PENDING) break;
+		did_work = 1;
+		if (n < 0) continue;
+		++g.stats.num_received;
+		struct bufstream bs;
+		bufstream_init_from_memory(&bs, g.rxbuf, n);
+		uint8_t op;
+		const int64_t connection_id = read_header(&bs, &op);
+		if (connection_id < 0) continue;
+		switch (op) {
+		case UDP0_HELLO:  host_handle_hello(connection_id, &from, &bs, n); break;
+		case UDP0_UPDATE: host_handle_update(connection_id, &from, &bs, g.rxbuf, n); break;
+		default: break;
+		}
+	}
+
+	const int64_t now = get_nanoseconds_monotonic();
+	const int64_t journal_size = get_committed_journal_size(0);
+	for (int i=0; i<arrlen(hg.client_arr); ) {
+		struct client* c = &hg.client_arr[i];
+		if ((now - c->last_heard_ns) > TIMEOUT_NS) {
+			free_artist_id(c->artist_id);
+			gig_release_room(0);
+			arrdelswap(hg.client_arr, i);
+			did_work = 1;
+			continue;
+		}
+		++i;
+		if ((c->sent_cursor > c->acked_cursor) && (now >= c->resend_at_ns)) go_back(c);
+		int num_sent = 0;
+		while ((c->sent_cursor < journal_size) && ((c->sent_cursor - c->acked_cursor) < SEND_WINDOW)) {
+			host_send_update(c, journal_size, now);
+			++num_sent;
+		}
+		if ((num_sent == 0) && (c->must_reply || ((now - c->last_sent_ns) >= KEEPALIVE_INTERVAL_NS))) {
+			host_send_update(c, journal_size, now);
+			++num_sent;
+		}
+		if (num_sent > 0) did_work = 1;
+	}
+
+	return did_work;
+}
+
+static void peer_say_hello(int64_t now)
+{
+	pg.is_welcomed = 0;
+	pg.hello_at_ns = 0;
+	pg.last_heard_ns = now;
+	rtt_cancel_probe(&pg.rtt);
+}
+
+int udp_peer_init(const char* host, int64_t journal_cursor)
+{
+	assert(!pg.is_initialized);
+	const int e = parse_host_port(host, &pg.host_addr);
+	if (e<0) return e;
+	const int file_id = io_open_udp(0);
+	if (file_id < 0) return file_id;
+	pg.file_id = file_id;
+	pg.journal_cursor = journal_cursor;
+	assert(0 == pthread_mutex_init(&pg.mutex, NULL));
+	if (g.rng_state == 0) g.rng_state = (uint64_t)get_nanoseconds_monotonic() | 1;
+	pg.connection_id = (int64_t)(rng_next() >> 2);
+	peer_say_hello(get_nanoseconds_monotonic());
+	pg.is_initialized = 1;
+	return 0;
+}
+
+void udp_peer_transmit_mim(int mim_session_id, int64_t tracer, uint8_t* data, int count)
+{
+	if (count > MAX_MIM_SIZE) {
+		fprintf(stderr, "udp: mim of %d bytes is too big; dropped\n", count);
+		return;
+	}
+	assert(0 == pthread_mutex_lock(&pg.mutex));
+	uint8_t** bb = &pg.unackd_mim_arr;
+	bb_append_leb128(bb, mim_session_id);
+	bb_append_leb128(bb, tracer);
+	bb_append_leb128(bb, count);
+	bb_append(bb, data, count);
+	assert(0 == pthread_mutex_unlock(&pg.mutex));
+	io_wake();
+}
+
+// removes mims the host has acked, and returns the highest tracer of the mims
+// that are left (or 0 if there are none). pg.mutex must be held
+static int64_t peer_prune_mims(void)
+{
+	uint8_t** bb = &pg.unackd_mim_arr;
+	const int64_t n = arrlen(*bb);
+	struct bufstream bs;
+	bufstream_init_from_memory(&bs, *bb, n);
+	int64_t trunc_to = 0;
+	int64_t max_tracer = 0;
+	while (bs.offset < n) {
+		(void)bs_read_leb128(&bs); // session id
+		const int64_t tracer = bs_read_leb128(&bs);
+		const int64_t count = bs_read_leb128(&bs);
+		bs.cursor += count;
+		bs.offset += count;
+		if (tracer <= pg.acked_tracer) trunc_to = bs.offset;
+		max_tracer = tracer;
+	}
+	if (trunc_to > 0) arrdeln(*bb, 0, trunc_to);
+	return (arrlen(*bb) > 0) ? max_tracer : 0;
+}
+
+static void peer_send_update(int64_t now)
+{
+	uint8_t** bb = &g.bb_arr;
+	arrreset(*bb);
+	bb_append_u8(bb, UDP0_UPDATE);
+	bb_append_leb128(bb, pg.connection_id);
+	bb_append_leb128(bb, pg.journal_cursor);
+	const int64_t n0 = arrlen(*bb);
+
+	// the oldest unacked mims; always at least one, even if it doesn't fit
+	const uint8_t* mims = pg.unackd_mim_arr;
+	const int64_t num_mim_bytes = arrlen(pg.unackd_mim_arr);
+	struct bufstream bs;
+	bufstream_init_from_memory(&bs, mims, num_mim_bytes);
+	int64_t take = 0;
+	int64_t last_tracer = 0;
+	while (bs.offset < num_mim_bytes) {
+		(void)bs_read_leb128(&bs); // session id
+		const int64_t tracer = bs_read_leb128(&bs);
+		const int64_t count = bs_read_leb128(&bs);
+		bs.cursor += count;
+		bs.offset += count;
+		if ((take > 0) && ((n0 + bs.offset) > MAX_DATAGRAM_SIZE)) break;
+		take = bs.offset;
+		last_tracer = tracer;
+	}
+	bb_append(bb, mims, take);
+	send_datagram(pg.file_id, &pg.host_addr, *bb, arrlen(*bb));
+
+	if (take > 0) {
+		if (last_tracer > pg.sent_tracer) {
+			pg.sent_tracer = last_tracer;
+			rtt_probe(&pg.rtt, last_tracer, now);
+		}
+		pg.resend_at_ns = now + get_rto_ns(&pg.rtt);
+	}
+	pg.last_sent_ns = now;
+	pg.must_reply = 0;
+}
+
+static void peer_append_journal(int64_t offset, const uint8_t* data, int64_t count)
+{
+	assert(offset <= pg.journal_cursor);
+	const int64_t end = offset + count;
+	if (end <= pg.journal_cursor) return;
+	const int64_t skip = pg.journal_cursor - offset;
+	bb_append(&pg.journal_arr, data + skip, count - skip);
+	pg.journal_cursor = end;
+}
+
+static void peer_drop_segments(void)
+{
+	const int num_segments = arrlen(pg.segment_arr);
+	for (int i=0; i<num_segments; ++i) arrfree(pg.segment_arr[i].data_arr);
+	arrreset(pg.segment_arr);
+}
+
+static int peer_handle_update(struct bufstream* bs, const uint8_t* data, int64_t size, int64_t now)
+{
+	const int64_t acked_tracer = bs_read_leb128(bs);
+	(void)bs_read_leb128(bs); // journal size
+	const int64_t offset = bs_read_leb128(bs);
+	if (bs->error) return 0;
+	if (acked_tracer > pg.acked_tracer) {
+		pg.acked_tracer = acked_tracer;
+		rtt_ack(&pg.rtt, acked_tracer, now);
+	}
+	const int64_t n = size - bs->offset;
+	if (n <= 0) return 0;
+	pg.must_reply = 1;
+	if (offset > pg.journal_cursor) {
+		// a datagram before it was lost (or is late); keep it for
+		// when the gap is filled, so the host doesn't have to resend it
+		const int num_segments = arrlen(pg.segment_arr);
+		int64_t num_bytes = 0;
+		for (int i=0; i<num_segments; ++i) {
+			struct segment* seg = &pg.segment_arr[i];
+			if (seg->offset == offset) return 0;
+			num_bytes += arrlen(seg->data_arr);
+		}
+		if ((num_bytes + n) > MAX_SEGMENT_BYTES) return 0;
+		struct segment seg = { .offset = offset };
+		bb_append(&seg.data_arr, data + bs->offset, n);
+		arrput(pg.segment_arr, seg);
+		return 0;
+	}
+	peer_append_journal(offset, data + bs->offset, n);
+	for (int i=0; i<arrlen(pg.segment_arr); ) {
+		struct segment* seg = &pg.segment_arr[i];
+		if (seg->offset > pg.journal_cursor) {
+			++i;
+			continue;
+		}
+		peer_append_journal(seg->offset, seg->data_arr, arrlen(seg->data_arr));
+		arrfree(seg->data_arr);
+		arrdelswap(pg.segment_arr, i);
+		i = 0;
+	}
+
+	uint8_t** jj = &pg.journal_arr;
+	const int64_t whole = get_whole_journal_records_size(*jj, arrlen(*jj));
+	if (whole < 0) {
+		fprintf(stderr, "udp: received bad journal data\n");
+		return -1;
+	}
+	if (whole > 0) {
+		assert(0 == pthread_mutex_lock(&pg.mutex));
+		bb_append(&pg.spool_arr, *jj, whole);
+		assert(0 == pthread_mutex_unlock(&pg.mutex));
+		arrdeln(*jj, 0, whole);
+	}
+	return 1;
+}
+
+int udp_peer_tick(void)
+{
+	if (!pg.is_initialized) return 0;
+	int did_work = 0;
+	did_work |= send_delayed_datagrams();
+
+	for (;;) {
+		struct io_addr from;
+		const int n = io_udp_recv(pg.file_id, g.rxbuf, sizeof g.rxbuf, &from);
+		if (n == IO_PENDING) break;
+		did_work = 1;
+		if (n < 0) continue;
+		if ((from.ipv4 != pg.host_addr.ipv4) || (from.port != pg.host_addr.port)) continue;
+		++g.stats.num_received;
+		const int64_t now = get_nanoseconds_monotonic();
+		struct bufstream bs;
+		bufstream_init_from_memory(&bs, g.rxbuf, n);
+		uint8_t op;
+		const int64_t connection_id = read_header(&bs, &op);
+		if (connection_id != pg.connection_id) continue;
+		pg.last_heard_ns = now;
+		switch (op) {
+		case UDP1_WELCOME: {
+			const int64_t artist_id = bs_read_leb128(&bs);
+			const int64_t max_tracer = bs_read_leb128(&bs);
+			if (bs.error || pg.is_welcomed) break;
+			if ((pg.artist_id > 0) && (artist_id != pg.artist_id)) {
+				// the host forgot about us (see TIMEOUT_NS), and it
+				// may have committed mims we never got the ack for;
+				// they're dropped rather than risk committing them
+				// twice
+				pg.acked_tracer = pg.sent_tracer;
+			} else {
+				// whatever the host hasn't got is sent again
+				pg.acked_tracer = max_tracer;
+				pg.sent_tracer = max_tracer;
+			}
+			pg.artist_id = artist_id;
+			set_my_artist_id(artist_id);
+			pg.is_welcomed = 1;
+			pg.must_reply = 1;
+			rtt_ack(&pg.rtt, 0, now);
+		}	break;
+		case UDP1_CHALLENGE: {
+			const uint64_t cookie = (uint64_t)bs_read_leu64(&bs);
+			if (bs.error) break;
+			pg.cookie = cookie;
+			// say hello (again) right away; if we were welcomed, the
+			// host saw us at another address
+			pg.is_welcomed = 0;
+			pg.hello_at_ns = 0;
+		}	break;
+		case UDP1_UPDATE:
+			if (!pg.is_welcomed) break;
+			if (peer_handle_update(&bs, g.rxbuf, n, now) < 0) {
+				// drop what we have of the bad record, and start over
+				// from the last whole record
+				pg.journal_cursor -= arrlen(pg.journal_arr);
+				arrreset(pg.journal_arr);
+				peer_drop_segments();
+				peer_say_hello(now);
+			}
+			break;
+		default: break;
+		}
+	}
+
+	const int64_t now = get_nanoseconds_monotonic();
+	if ((now - pg.last_heard_ns) > TIMEOUT_NS) {
+		peer_say_hello(now);
+		did_work = 1;
+	}
+
+	if (!pg.is_welcomed) {
+		if (now >= pg.hello_at_ns) {
+			uint8_t** bb = &g.bb_arr;
+			arrreset(*bb);
+			bb_append_u8(bb, UDP0_HELLO);
+			bb_append_leb128(bb, pg.connection_id);
+			bb_append_leb128(bb, pg.journal_cursor);
+			bb_append_leu64(bb, pg.cookie);
+			while (arrlen(*bb) < UDP_HELLO_SIZE) bb_append_u8(bb, 0);
+			send_datagram(pg.file_id, &pg.host_addr, *bb, arrlen(*bb));
+			if (pg.hello_at_ns == 0) rtt_probe(&pg.rtt, 0, now);
+			pg.hello_at_ns = now + get_rto_ns(&pg.rtt);
+			did_work = 1;
+		}
+		return did_work;
+	}
+
+	assert(0 == pthread_mutex_lock(&pg.mutex));
+	const int64_t max_tracer = peer_prune_mims();
+	const int has_unsent = (max_tracer > pg.sent_tracer);
+	const int has_unacked = (max_tracer > 0);
+	if (has_unacked && !has_unsent && (now >= pg.resend_at_ns)) {
+		rtt_cancel_probe(&pg.rtt);
+		++g.stats.num_resends;
+	}
+	if (has_unsent
+		|| (has_unacked && (now >= pg.resend_at_ns))
+		|| pg.must_reply
+		|| ((now - pg.last_sent_ns) >= KEEPALIVE_INTERVAL_NS))
+	{
+		peer_send_update(now);
+		did_work = 1;
+	}
+	assert(0 == pthread_mutex_unlock(&pg.mutex));
+
+	return did_work;
+}
+
+int udp_peer_spool(void)
+{
+	if (!pg.is_initialized) return 0;
+	assert(0 == pthread_mutex_lock(&pg.mutex));
+	uint8_t* tmp = pg.spooling_arr;
+	pg.spooling_arr = pg.spool_arr;
+	pg.spool_arr = tmp;
+	arrreset(pg.spool_arr);
+	assert(0 == pthread_mutex_unlock(&pg.mutex));
+	const int64_t n = arrlen(pg.spooling_arr);
+	if (n == 0) return 0;
+	if (peer_spool_raw_journal_into_upstream_snapshot(pg.spooling_arr, n) < 0) {
+		// (the records were whole, so it's not a transmission error)
+		fprintf(stderr, "udp: could not spool %lld bytes of journal\n", (long long)n);
+	}
+	return 1;
+}
+
+int64_t udp_get_wait_timeout_us(void)
+{
+	const int64_t now = get_nanoseconds_monotonic();
+	int64_t wait_us = -1;
+	const int num_delayed = arrlen(g.delayed_arr);
+	for (int i=0; i<num_delayed; ++i) {
+		min_wait_us(&wait_us, get_timer_wait_us(g.delayed_arr[i].due_ns, now));
+	}
+	if (hg.is_initialized) {
+		const int num_clients = arrlen(hg.client_arr);
+		for (int i=0; i<num_clients; ++i) {
+			struct client* c = &hg.client_arr[i];
+			if (c->sent_cursor > c->acked_cursor) min_wait_us(&wait_us, get_timer_wait_us(c->resend_at_ns, now));
+			min_wait_us(&wait_us, get_timer_wait_us(c->last_sent_ns + KEEPALIVE_INTERVAL_NS, now));
+		}
+	}
+	if (pg.is_initialized) {
+		if (!pg.is_welcomed) {
+			min_wait_us(&wait_us, get_timer_wait_us(pg.hello_at_ns, now));
+		} else {
+			if (pg.sent_tracer > pg.acked_tracer) min_wait_us(&wait_us, get_timer_wait_us(pg.resend_at_ns, now));
+			min_wait_us(&wait_us, get_timer_wait_us(pg.last_sent_ns + KEEPALIVE_INTERVAL_NS, now));
+		}
+	}
+	return wait_us;
+}
+
+void udp_set_impairment(double loss, int64_t latency_us, int64_t jitter_us)
+{
+	g.loss = loss;
+	g.latency_us = latency_us;
+	g.jitter_us = jitter_us;
+	if (g.rng_state == 0) g.rng_state = 0x9e3779b97f4a7c15ULL;
+}
+
+void udp_get_stats(struct udp_stats* out_stats)
+{
+	*out_stats = g.stats;
+}
@@ -0,0 +1,53 @@
+#ifndef UDP_H
+
+#include <stdint.h>
+
+// the journal protocol over UDP (see UDP0_*/UDP1_* in protocol.h), for
+// artists on lossy networks where one lost TCP segment holds up everything
+// behind it (head-of-line blocking). it's the same idea as the websocket
+// protocol: peers send mims with tracers, and the host sends journal data;
+// but every datagram repeats what hasn't been acked yet, so a lost datagram
+// is usually covered by the next one instead of by a retransmission timeout.
+// there's no snapshot bootstrap; a new peer gets the whole journal (or
+// continues from the journal offset of a snapshot it got over HTTP). a peer
+// must prove it can receive at its address (see UDP1_CHALLENGE) before the
+// host sends it anything bigger than what it sent
+
+int udp_host_init(int bind_port);
+// serves room 0 to UDP peers on :bind_port (0 picks a free port). returns the
+// port, or <0 on error
+int udp_host_tick(void);
+// receives mims, and sends journal data. call it from the I/O thread, like
+// webserv_tick(). returns 0 if there was nothing to do
+
+int udp_peer_init(const char* host, int64_t journal_cursor);
+// host is "host:port". journal_cursor is where the peer's upstream snapshot
+// is at (the journal header size for an empty one). returns <0 on error
+int udp_peer_tick(void);
+// like udp_host_tick(), for the peer
+void udp_peer_transmit_mim(int mim_session_id, int64_t tracer, uint8_t* data, int count);
+// queues a mim for the host (see transmit_mim()). thread-safe
+int udp_peer_spool(void);
+// spools the journal records received by udp_peer_tick() into the upstream
+// snapshot. call it from the thread that owns the peer's snapshots (that
+// calls peer_tick()); returns 0 if there was nothing to spool
+
+int64_t udp_get_wait_timeout_us(void);
+// how long io_wait() may sleep before a UDP timer expires (retransmissions,
+// keepalives, delayed datagrams); -1 if there are none
+
+void udp_set_impairment(double loss, int64_t latency_us, int64_t jitter_us);
+// for testing over loopback: drops outgoing datagrams with probability loss,
+// and delays the rest by latency_us plus a uniformly random [0;jitter_us]
+// (so datagrams may also arrive out of order)
+
+struct udp_stats {
+	int64_t num_sent;     // datagrams sent (or dropped by udp_set_impairment())
+	int64_t num_received;
+	int64_t num_dropped;  // by udp_set_impairment()
+	int64_t num_resends;  // retransmission timeouts
+};
+void udp_get_stats(struct udp_stats* out_stats);
+
+#define UDP_H
+#endif
@@ -29,6 +29,11 @@ for art in $ART ; do
 		DO_WASM="$dst"
 	fi
 	cp $art $dst
+	# precompressed variants (see serve_dok())
+	gzip -9 -n -c $dst > $dst.gz
+	if which brotli >/dev/null ; then
+		brotli -q 11 -c $dst > $dst.br
+	fi
 	echo "   X(\"${rname}\",\"${sum}.${ext}\") \\" >> $GEN
 done
 echo >> $GEN
@@ -27,6 +27,9 @@
 #include "bufstream.h"
 #include "protocol.h"
 #include "bb.h"
+#include "lz.h"
+#include "lonesha256.h"
+#include "main.h"
 
 #define CRLF "\r\n"
 
@@ -69,7 +72,7 @@ static inline int is_type(io_echo echo, int type, int* out_id)
 	return 1;
 }
 
-enum { CLOSE=1,READ,WRITE,SENDFILE };
+enum { CLOSE=1,READ,WRITE,SENDFILE,PWRITE,WSWRITE };
 
 static inline io_echo echo_write(int conn_id)
 {
@@ -81,6 +84,18 @@ static inline int is_echo_write(io_echo echo, int* out_conn_id)
 	return is_type(echo, WRITE, out_conn_id);
 }
 
+// a write of a websocket_send_msg() segment; unlike echo_write(), its
+// completion is credited to the conn's send queue (see websocket_ack_write())
+static inline io_echo echo_wswrite(int conn_id)
+{
+	return (io_echo) {.ia32=WSWRITE, .ib32=conn_id };
+}
+
+static inline int is_echo_wswrite(io_echo echo, int* out_conn_id)
+{
+	return is_type(echo, WSWRITE, out_conn_id);
+}
+
 static inline io_echo echo_read(int conn_id)
 {
 	return (io_echo) {.ia32=READ, .ib32=conn_id };
@@ -91,6 +106,16 @@ static inline int is_echo_read(io_echo echo, int* out_conn_id)
 	return is_type(echo, READ, out_conn_id);
 }
 
+static inline io_echo echo_pwrite(int conn_id)
+{
+	return (io_echo) {.ia32=PWRITE, .ib32=conn_id };
+}
+
+static inline int is_echo_pwrite(io_echo echo, int* out_conn_id)
+{
+	return is_type(echo, PWRITE, out_conn_id);
+}
+
 static inline io_echo echo_close(int conn_id)
 {
 	return (io_echo) {.ia32=CLOSE, .ib32=conn_id };
@@ -102,10 +127,45 @@ static inline int is_echo_close(io_echo echo, int* out_conn_id)
 }
 
 
-#define BUFFER_SIZE_LOG2     (14)
-#define BUFFER_SIZE          (1L << (BUFFER_SIZE_LOG2))
-#define MAX_CONN_COUNT_LOG2  (8)
-#define MAX_CONN_COUNT       (1L << (MAX_CONN_COUNT_LOG2))
+#define SMALL_BUFFER_SIZE_LOG2 (11)
+// idle websocket spectators only read the odd small message, so they hold a
+// small buffer
+#define LARGE_BUFFER_SIZE_LOG2 (14)
+// HTTP requests/responses, and websockets that fill their read buffer (e.g. a
+// peer sending a big mim) get a large buffer
+#define BUFFERS_PER_SLAB     (64)
+// buffers are carved out of slabs of this many buffers (see bufpool_alloc())
+#define DEFAULT_PORT         (6581)
+#define DEFAULT_MAX_CONN_COUNT (4096)
+#define MAX_UPLOAD_SIZE      (1LL<<30)
+#define DEFAULT_UPLOAD_BUDGET (1LL<<30)
+// see webserv_set_upload_budget()
+#define DEFAULT_WS_TIMEOUT_US (30000000LL)
+// websockets that haven't been heard from for half of this are pinged, and
+// they're dropped if they still haven't been heard from after all of it (see
+// websocket_keepalive())
+#define DEFAULT_MIM_RATE      (200.0)
+#define DEFAULT_MIM_BYTE_RATE (1024.0*1024.0)
+#define MIM_RATE_BURST_S      (2.0)
+// an artist may send this many seconds' worth of mims at once, on top of the
+// rate (see webserv_set_mim_rate_limit())
+#define MAX_CONTROL_PAYLOAD  (125)
+
+#define WSCHUNK_SIZE_LOG2    (13)
+#define WSCHUNK_SIZE         (1L << (WSCHUNK_SIZE_LOG2))
+// outgoing websocket frames are written to pooled chunks of this size;
+// messages that don't fit in one chunk are fragmented
+#define WSCHUNK_MAX_FRAGMENT_PAYLOAD (WSCHUNK_SIZE - 4) // 4=plen16 header
+#define MAX_POOLED_WSCHUNKS  (1024)
+#define MAX_QUEUED_WSMSGS    (16)
+// webserv_broadcast_journal() skips connections with this many messages
+// queued; they get a bigger journal update later instead
+#define SENDFILE_JOURNAL_THRESHOLD (1L<<16)
+// journal updates at least this big are sent with sendfile from the journal
+// file instead of being copied (see wsmsg_new_journal_update())
+#define LZ_MAX_UPDATE_SIZE   (1L<<24)
+// bigger journal updates aren't compressed, because it would stall the host
+// for too long (they're rare anyway; see should_bootstrap_with_snapshot())
 
 #define LIST_OF_METHODS \
 	X(HEAD) \
@@ -154,6 +214,22 @@ static const char R400proto[]=
 	"400 Bad Request (protocol error)"
 	;
 
+static const char R400hash[]=
+	"HTTP/1.1 400 Bad Request" CRLF
+	BLAHBLAHBLAH
+	"Content-Length: 28" CRLF
+	CRLF
+	"400 Bad Request (wrong hash)"
+	;
+
+static const char R411[]=
+	"HTTP/1.1 411 Length Required" CRLF
+	BLAHBLAHBLAH
+	"Content-Length: 19" CRLF
+	CRLF
+	"411 Length Required"
+	;
+
 static const char R413[]=
 	"HTTP/1.1 413 Payload Too Large" CRLF
 	BLAHBLAHBLAH
@@ -162,6 +238,27 @@ static const char R413[]=
 	"413 Payload Too Large"
 	;
 
+static const char R500[]=
+	"HTTP/1.1 500 Internal Server Error" CRLF
+	BLAHBLAHBLAH
+	"Content-Length: 25" CRLF
+	CRLF
+	"500 Internal Server Error"
+	;
+
+static const char R507[]=
+	"HTTP/1.1 507 Insufficient Storage" CRLF
+	BLAHBLAHBLAH
+	"Content-Length: 24" CRLF
+	CRLF
+	"507 Insufficient Storage"
+	;
+
+static const char R100[]=
+	"HTTP/1.1 100 Continue" CRLF
+	CRLF
+	;
+
 static const char R503[]=
 	"HTTP/1.1 503 Service Unavailable" CRLF
 	BLAHBLAHBLAH
@@ -173,6 +270,7 @@ static const char R503[]=
 enum conn_state {
 	NOT_ALLOCATED = 0,
 	HTTP_REQUEST,
+	HTTP_REQUEST_BODY,
 	HTTP_RESPONSE,
 	WEBSOCKET,
 	CLOSING,
@@ -187,10 +285,54 @@ enum websock_state {
 	PAYLOAD,
 };
 
+// token buckets for the mims of a websocket's artist (artist ids aren't shared
+// between connections, so it's a per-connection limit too); see
+// ratelimit_take()
+struct ratelimit {
+	double mim_tokens;
+	double byte_tokens;
+	int64_t last_refill_us;
+};
+
 struct conndo {
 	int64_t journal_cursor;
+	int64_t lz_dict_journal_cursor;
+	// the peer has journal data from here (since WS1_HELLO2); it's the
+	// dictionary for WS1_JOURNAL_UPDATE_LZ
 	int artist_id;
+	int flags; // WSFLAG_*
 	unsigned did_greet  :1;
+	struct ratelimit ratelimit;
+};
+
+struct wsseg {
+	const uint8_t* ptr;
+	int64_t size;
+	uint8_t* chunk; // non-NULL if ptr is a pooled chunk (see wschunk_alloc())
+	unsigned is_sendfile :1;
+	int sendfile_src_file_id;
+	int64_t sendfile_src_offset;
+	// if is_sendfile, size bytes are sent from sendfile_src_file_id instead
+	// of from ptr
+};
+
+// an outgoing websocket message; one or more frames written as a sequence of
+// segments. messages are refcounted so they can be shared between
+// connections, e.g. a journal update is encoded once and written to every
+// connection that needs it
+struct wsmsg {
+	int refcount;
+	int64_t journal_cursor0, journal_cursor1;
+	int64_t lz_dict_size; // -1 if not compressed
+	struct wsseg* seg_arr;
+	const void* snapshot_data; // released along with the message
+};
+
+// send queue entry; writes complete in submission order, so the head of the
+// queue is released once all of its segments have been written
+struct wsqueued {
+	struct wsmsg* msg;
+	int num_remaining_writes;
 };
 
 struct websock {
@@ -199,12 +341,45 @@ struct websock {
 	int64_t payload_length;
 	int64_t remaining;
 	uint8_t* msgbuf_arr;
+	uint8_t* deferred_arr;
+	// messages (or what's left of one) held back by the rate limit; the
+	// connection isn't read while there are any (see websocket_drain())
+	struct wsqueued* sendq_arr;
 	uint8_t mask_key[4];
 	unsigned  fin    :1;
 	unsigned  opcode :4;
+	unsigned  awaiting_pong :1;
+	int64_t last_heard_us; // when the last read completed
+	// (completed writes don't count; the kernel takes them whether the peer
+	// is there or not, until its send buffer is full)
+	uint8_t control_payload[MAX_CONTROL_PAYLOAD];
+	// control frames (ping/pong) may come between the fragments of a
+	// message, so their payload isn't put in msgbuf_arr
 	struct conndo conndo;
 };
 
+// a PUT/POST body being streamed to a temporary file in dok/, and renamed to
+// dok/<sha256>.<ext> when it's all there (see upload_begin()). the body is
+// read into one half of the connection buffer while the other half is being
+// written to the file, so it's never buffered as a whole
+struct upload {
+	int file_id;
+	char tmp_path[64];
+	char ext[16];
+	char expected_hash[65]; // PUT /dok/<hash>.<ext>; empty for POST
+	int64_t size;           // Content-Length; counted in g.upload_bytes
+	int64_t remaining;      // body bytes not read yet
+	int64_t offset;         // body bytes written, or being written
+	struct lonesha256_ctx sha;
+	int next_half;          // read into this half of the buffer next
+	int busy_mask;          // halves with pwrites in flight
+	int pwrite_masks[2];    // busy_mask bits of the pwrites in flight, oldest first
+	int pwrite_counts[2];   // and their sizes
+	int num_pwrites;
+	unsigned failed :1;
+	unsigned free_conn_when_done :1;
+};
+
 struct conn {
 	enum conn_state cstate;
 	int file_id;
@@ -215,17 +390,59 @@ struct conn {
 	unsigned enter_websocket_after_response :1;
 	unsigned inflight_sendfile :1;
 	unsigned inflight_read     :1;
+	unsigned has_large_buffer  :1;
+	uint8_t* buffer; // see conn_set_buffer_class()
 	union {
 		struct websock websock;
 	};
-	void* free_after_write_data;
+	const void* release_after_write_snapshot_data;
+	int room_id; // see gig_add_room()
+	unsigned has_acquired_room :1; // see gig_acquire_room()
+	struct upload* upload; // HTTP_REQUEST_BODY only
+};
+
+struct lz_snapshot {
+	int64_t journal_offset;
+	uint8_t* data_arr;
+};
+
+enum buffer_class {
+	SMALL_BUFFER = 0,
+	LARGE_BUFFER,
+	NUM_BUFFER_CLASSES
+};
+
+struct bufpool {
+	uint8_t** free_arr;
+	int num_slabs;
+	int num_in_use;
 };
 
 static struct {
 	int port_id;
+	int listen_port;
 	int listen_file_id;
-
-	uint8_t* buffer_storage;
+	int max_conn_count;
+
+	struct bufpool bufpools[NUM_BUFFER_CLASSES];
+	struct wsmsg** broadcast_wsmsg_arr;
+	uint8_t** wschunk_freelist_arr;
+	struct lz_snapshot* lz_snapshot_arr;
+	// compressed snapshot cache, one per room (see get_lz_snapshot())
+	int upload_serial;
+	int64_t upload_budget; // -1: no uploads
+	int64_t upload_bytes;
+	// uploaded to dok/ since webserv_init(), plus the sizes of the uploads in
+	// progress (see webserv_set_upload_budget())
+	int64_t ws_timeout_us;
+	int64_t last_keepalive_us;
+	int64_t num_ws_pings;
+	int64_t num_ws_evictions;
+	double mim_rate, mim_byte_rate; // 0 is unlimited
+	unsigned has_mim_rate_limit :1;
+	int num_throttled_conns; // with deferred mims
+	int64_t num_ws_throttles;
+	int64_t num_mims_deferred;
 	struct conn* conns;
 	int* freelist;
 	int num_free;
@@ -234,36 +451,94 @@ static struct {
 
 THREAD_LOCAL static struct {
 	uint8_t* bb;
+	uint8_t* lz_input_arr;
+	uint8_t* lz_output_arr;
 } tlg;
 
 static int alloc_conn(void)
 {
-	assert((0 <= g.num_free) && (g.num_free <= MAX_CONN_COUNT));
+	assert((0 <= g.num_free) && (g.num_free <= g.max_conn_count));
 	if (g.num_free > 0) {
 		--g.num_free;
 		assert(g.num_free >= 0);
 		return g.freelist[g.num_free];
 	}
-	if (g.next == MAX_CONN_COUNT) return -1;
-	assert((0 <= g.next) && (g.next < MAX_CONN_COUNT));
+	if (g.next == g.max_conn_count) return -1;
+	assert((0 <= g.next) && (g.next < g.max_conn_count));
 	return g.next++;
 }
 
 static int get_conn_id_by_conn(struct conn* conn)
 {
 	int64_t id = conn - g.conns;
-	assert((0 <= id) && (id < MAX_CONN_COUNT));
+	assert((0 <= id) && (id < g.max_conn_count));
 	return id;
 }
 
+static int get_buffer_size_log2(enum buffer_class bc)
+{
+	switch (bc) {
+	case SMALL_BUFFER: return SMALL_BUFFER_SIZE_LOG2;
+	case LARGE_BUFFER: return LARGE_BUFFER_SIZE_LOG2;
+	default: break;
+	}
+	assert(!"bad buffer class");
+	return -1;
+}
+
+// buffers are never returned to the system; memory is bounded by the peak
+// number of connections in each buffer class, which is bounded by
+// webserv_set_max_conn_count()
+static uint8_t* bufpool_alloc(enum buffer_class bc)
+{
+	assert((0 <= bc) && (bc < NUM_BUFFER_CLASSES));
+	struct bufpool* bp = &g.bufpools[bc];
+	if (arrlen(bp->free_arr) == 0) {
+		const size_t size = 1L << get_buffer_size_log2(bc);
+		uint8_t* slab = malloc(BUFFERS_PER_SLAB * size);
+		assert(slab != NULL);
+		for (int i=(BUFFERS_PER_SLAB-1); i>=0; --i) arrput(bp->free_arr, slab + i*size);
+		++bp->num_slabs;
+	}
+	++bp->num_in_use;
+	return arrpop(bp->free_arr);
+}
+
+static void bufpool_free(enum buffer_class bc, uint8_t* buf)
+{
+	struct bufpool* bp = &g.bufpools[bc];
+	assert(bp->num_in_use > 0);
+	--bp->num_in_use;
+	arrput(bp->free_arr, buf);
+}
+
+static void conn_release_buffer(struct conn* conn)
+{
+	if (conn->buffer == NULL) return;
+	assert(!conn->inflight_read);
+	bufpool_free(conn->has_large_buffer ? LARGE_BUFFER : SMALL_BUFFER, conn->buffer);
+	conn->buffer = NULL;
+	conn->has_large_buffer = 0;
+}
+
+// swaps the connection buffer for one of another class; the contents are
+// lost, so only call it between a request/message and the next read
+static void conn_set_buffer_class(struct conn* conn, enum buffer_class bc)
+{
+	if ((conn->buffer != NULL) && (conn->has_large_buffer == (bc == LARGE_BUFFER))) return;
+	conn_release_buffer(conn);
+	conn->buffer = bufpool_alloc(bc);
+	conn->has_large_buffer = (bc == LARGE_BUFFER);
+}
+
 static uint8_t* get_conn_buffer_raw(struct conn* conn, int divindex, int bufdiv_log2, size_t* out_size)
 {
-	const int id = get_conn_id_by_conn(conn);
-	assert((0 <= id) && (id < MAX_CONN_COUNT));
-	uint8_t* base = &g.buffer_storage[id << BUFFER_SIZE_LOG2];
+	uint8_t* base = conn->buffer;
+	assert(base != NULL);
+	const int buffer_size_log2 = get_buffer_size_log2(conn->has_large_buffer ? LARGE_BUFFER : SMALL_BUFFER);
 	const int bufdiv = (1 << bufdiv_log2);
 	assert((0 <= divindex) && (divindex < bufdiv));
-	int size_log2 = (BUFFER_SIZE_LOG2 - bufdiv_log2);
+	int size_log2 = (buffer_size_log2 - bufdiv_log2);
 	const size_t size = 1L << size_log2;
 	if (out_size) *out_size = size;
 	return base + (divindex << size_log2);
@@ -274,9 +549,13 @@ static uint8_t* get_conn_buffer_raw(struct conn* conn, int divindex, int bufdiv_
 // writing, never both at the same time, so we use the entire buffer for reads
 // or writes.
 
-#define WS_BUFDIV_LOG2 (1)
-// WebSockets are "full duplex", so the connection buffer is split into read
-// and write parts
+#define WS_BUFDIV_LOG2 (0)
+// WebSockets are "full duplex", but outgoing messages are written from pooled
+// chunks (see struct wsmsg), so the entire buffer is used for reads
+
+#define UPLOAD_BUFDIV_LOG2 (1)
+// request bodies are read into one half of the buffer while the other half is
+// written to file (see struct upload)
 
 static uint8_t* get_conn_http_read_buffer(struct conn* conn, size_t* out_size)
 {
@@ -296,32 +575,84 @@ static uint8_t* get_conn_ws_read_buffer(struct conn* conn, size_t* out_size)
 	return get_conn_buffer_raw(conn, 0, WS_BUFDIV_LOG2, out_size);
 }
 
-static uint8_t* get_conn_ws_write_buffer(struct conn* conn, size_t* out_size)
+static struct conn* get_conn(int id)
 {
-	assert(conn->cstate == WEBSOCKET);
-	return get_conn_buffer_raw(conn, 1, WS_BUFDIV_LOG2, out_size);
+	assert((0 <= id) && (id < g.max_conn_count));
+	return &g.conns[id];
 }
 
-static struct conn* get_conn(int id)
+static uint8_t* wschunk_alloc(void)
 {
-	assert((0 <= id) && (id < MAX_CONN_COUNT));
-	return &g.conns[id];
+	if (arrlen(g.wschunk_freelist_arr) > 0) {
+		uint8_t* chunk = arrpop(g.wschunk_freelist_arr);
+		assert(arrlen(chunk) == 0);
+		return chunk;
+	}
+	uint8_t* chunk = NULL;
+	arrsetcap(chunk, WSCHUNK_SIZE);
+	return chunk;
+}
+
+static void wschunk_free(uint8_t* chunk)
+{
+	if (arrlen(g.wschunk_freelist_arr) >= MAX_POOLED_WSCHUNKS) {
+		arrfree(chunk);
+		return;
+	}
+	arrreset(chunk);
+	arrput(g.wschunk_freelist_arr, chunk);
+}
+
+static void wsmsg_release(struct wsmsg* msg)
+{
+	assert(msg->refcount > 0);
+	if (--msg->refcount > 0) return;
+	const int num_segs = arrlen(msg->seg_arr);
+	for (int i=0; i<num_segs; ++i) {
+		struct wsseg* seg = &msg->seg_arr[i];
+		if (seg->chunk != NULL) wschunk_free(seg->chunk);
+	}
+	arrfree(msg->seg_arr);
+	if (msg->snapshot_data != NULL) release_present_snapshot_data(msg->snapshot_data);
+	free(msg);
 }
 
 static void conn_free_transient_data(struct conn* conn)
 {
-	if (conn->free_after_write_data == NULL) return;
-	free(conn->free_after_write_data);
-	conn->free_after_write_data = NULL;
+	if (conn->release_after_write_snapshot_data != NULL) {
+		release_present_snapshot_data(conn->release_after_write_snapshot_data);
+		conn->release_after_write_snapshot_data = NULL;
+	}
 }
 
 static void conn_free(struct conn* conn)
 {
 	const int id = get_conn_id_by_conn(conn);
-	assert((0 <= id) && (id < MAX_CONN_COUNT));
-	assert(g.num_free < MAX_CONN_COUNT);
+	assert((0 <= id) && (id < g.max_conn_count));
+	assert(g.num_free < g.max_conn_count);
 	g.freelist[g.num_free++] = id;
 	conn_free_transient_data(conn);
+	conn->inflight_read = 0; // (closes wait for reads, so it has completed)
+	conn_release_buffer(conn);
+	struct websock* ws = &conn->websock;
+	const int num_queued = arrlen(ws->sendq_arr);
+	for (int i=0; i<num_queued; ++i) wsmsg_release(ws->sendq_arr[i].msg);
+	arrfree(ws->sendq_arr);
+	arrfree(ws->msgbuf_arr);
+	if (arrlen(ws->deferred_arr) > 0) --g.num_throttled_conns;
+	arrfree(ws->deferred_arr);
+	if (conn->has_acquired_room) {
+		gig_release_room(conn->room_id);
+		conn->has_acquired_room = 0;
+	}
+	if (conn->upload != NULL) {
+		assert(conn->upload->num_pwrites == 0);
+		io_close(conn->upload->file_id);
+		(void)io_unlink(conn->upload->tmp_path);
+		g.upload_bytes -= conn->upload->size;
+		free(conn->upload);
+		conn->upload = NULL;
+	}
 	conn->cstate = NOT_ALLOCATED;
 }
 
@@ -378,13 +709,79 @@ static void conn_drop(struct conn* conn)
 	io_port_close(g.port_id, echo_close(get_conn_id_by_conn(conn)), conn->file_id);
 }
 
+void webserv_set_port(int port)
+{
+	assert(g.listen_file_id == 0 && "call webserv_set_port() before webserv_init()");
+	g.listen_port = port;
+}
+
+void webserv_set_max_conn_count(int max_conn_count)
+{
+	assert(g.listen_file_id == 0 && "call webserv_set_max_conn_count() before webserv_init()");
+	assert(max_conn_count > 0);
+	g.max_conn_count = max_conn_count;
+}
+
+void webserv_set_websocket_timeout_ms(int timeout_ms)
+{
+	assert(g.listen_file_id == 0 && "call webserv_set_websocket_timeout_ms() before webserv_init()");
+	g.ws_timeout_us = (timeout_ms > 0) ? (int64_t)timeout_ms*1000LL : -1;
+}
+
+void webserv_set_mim_rate_limit(double mims_per_second, double bytes_per_second)
+{
+	assert(g.listen_file_id == 0 && "call webserv_set_mim_rate_limit() before webserv_init()");
+	assert((mims_per_second >= 0) && (bytes_per_second >= 0));
+	g.mim_rate = mims_per_second;
+	g.mim_byte_rate = bytes_per_second;
+	g.has_mim_rate_limit = 1;
+}
+
+void webserv_set_upload_budget(int64_t num_bytes)
+{
+	assert(g.listen_file_id == 0 && "call webserv_set_upload_budget() before webserv_init()");
+	g.upload_budget = (num_bytes > 0) ? num_bytes : -1;
+}
+
 void webserv_init(void)
 {
 	g.port_id = io_port_create();
-	g.listen_file_id = io_listen_tcp(6581, g.port_id, LISTEN_ECHO);
-	g.buffer_storage = calloc(1L << (MAX_CONN_COUNT_LOG2 + BUFFER_SIZE_LOG2), sizeof *g.buffer_storage);
-	g.conns    = calloc(1L << MAX_CONN_COUNT_LOG2, sizeof *g.conns);
-	g.freelist = calloc(1L << MAX_CONN_COUNT_LOG2, sizeof *g.freelist);
+	g.listen_file_id = io_listen_tcp(g.listen_port > 0 ? g.listen_port : DEFAULT_PORT, g.port_id, LISTEN_ECHO);
+	if (g.max_conn_count == 0) g.max_conn_count = DEFAULT_MAX_CONN_COUNT;
+	if (g.ws_timeout_us == 0) g.ws_timeout_us = DEFAULT_WS_TIMEOUT_US;
+	if (g.upload_budget == 0) g.upload_budget = DEFAULT_UPLOAD_BUDGET;
+	if (!g.has_mim_rate_limit) {
+		g.mim_rate = DEFAULT_MIM_RATE;
+		g.mim_byte_rate = DEFAULT_MIM_BYTE_RATE;
+	}
+	g.conns    = calloc(g.max_conn_count, sizeof *g.conns);
+	g.freelist = calloc(g.max_conn_count, sizeof *g.freelist);
+}
+
+void webserv_get_stats(struct webserv_stats* out_stats)
+{
+	struct webserv_stats s = {0};
+	s.num_conns = (g.next - g.num_free);
+	s.max_conn_count = g.max_conn_count;
+	for (int i=0; i<NUM_BUFFER_CLASSES; ++i) {
+		struct bufpool* bp = &g.bufpools[i];
+		const int64_t size = 1L << get_buffer_size_log2(i);
+		s.buffer_bytes_in_use    += (int64_t)bp->num_in_use * size;
+		s.buffer_bytes_allocated += (int64_t)bp->num_slabs * BUFFERS_PER_SLAB * size;
+	}
+	s.num_small_buffers_in_use = g.bufpools[SMALL_BUFFER].num_in_use;
+	s.num_large_buffers_in_use = g.bufpools[LARGE_BUFFER].num_in_use;
+	s.num_ws_pings = g.num_ws_pings;
+	s.num_ws_evictions = g.num_ws_evictions;
+	s.num_throttled_conns = g.num_throttled_conns;
+	for (int i=0; (i<g.next) && (s.num_throttled_conns>0); ++i) {
+		struct conn* conn = &g.conns[i];
+		if (conn->cstate != WEBSOCKET) continue;
+		s.deferred_bytes += arrlen(conn->websock.deferred_arr);
+	}
+	s.num_ws_throttles = g.num_ws_throttles;
+	s.num_mims_deferred = g.num_mims_deferred;
+	*out_stats = s;
 }
 
 static void serve_static(struct conn* conn, const void* data, size_t size)
@@ -480,10 +877,10 @@ static void conn_respond(struct conn* conn)
 	conn_writeall_from_mem(conn, buf, conn->write_cursor);
 }
 
-static void conn_set_free_after_write_data(struct conn* conn, void* data)
+static void conn_set_release_after_write_snapshot_data(struct conn* conn, const void* data)
 {
-	assert((conn->free_after_write_data == NULL) && "already set; mistake, or need an array?");
-	conn->free_after_write_data = data;
+	assert((conn->release_after_write_snapshot_data == NULL) && "already set; mistake, or need an array?");
+	conn->release_after_write_snapshot_data = data;
 }
 
 static void serve405(struct conn* conn, int allow_method_set)
@@ -595,6 +992,89 @@ static int header_csv_contains(struct header_reader* hr, const char* s)
 	return 0;
 }
 
+// like header_csv_contains(), but for lists with parameters, like
+// "Accept-Encoding: gzip, br;q=0.5"; values with q=0 are not accepted
+static int header_csv_accepts(struct header_reader* hr, const char* s)
+{
+	const int ns = strlen(s);
+	const char* p = hr->colon;
+	assert(p != NULL);
+	++p;
+	const char* pend = hr->header_end;
+	assert(pend != NULL);
+	while (p<pend) {
+		while (p<pend && *p==' ') ++p;
+		const char* v0=p;
+		while (p<pend && *p && *p!=',' && *p!=';' && *p!=' ') ++p;
+		const char* v1=p;
+		int q_is_zero = 0;
+		while (p<pend && *p && *p!=',') {
+			if ((p[0]=='q') && ((p+1)<pend) && (p[1]=='=')) {
+				p += 2;
+				q_is_zero = (p<pend && *p=='0');
+				for (; p<pend && *p && *p!=',' && *p!=';' && *p!=' '; ++p) {
+					if ((*p!='0') && (*p!='.')) q_is_zero = 0;
+				}
+				continue;
+			}
+			++p;
+		}
+		if (((v1-v0) == ns) && case_insensitive_match(v0,s,ns) && !q_is_zero) {
+			return 1;
+		}
+		++p;
+	}
+	return 0;
+}
+
+// matches If-None-Match entity tags, like `"foo", W/"bar"` or `*`, against
+// etag (without quotes). weak tags (W/) match too, which is what If-None-Match
+// wants (RFC9110 13.1.2)
+static int header_etag_matches(struct header_reader* hr, const char* etag)
+{
+	const int ne = strlen(etag);
+	const char* p = hr->colon;
+	assert(p != NULL);
+	++p;
+	const char* pend = hr->header_end;
+	assert(pend != NULL);
+	while (p<pend) {
+		while (p<pend && *p==' ') ++p;
+		if (p<pend && *p=='*') return 1;
+		if (((p+1)<pend) && (p[0]=='W') && (p[1]=='/')) p+=2;
+		if (p<pend && *p=='"') {
+			const char* t0 = ++p;
+			while (p<pend && *p && *p!='"') ++p;
+			if (((p-t0) == ne) && (memcmp(t0,etag,ne)==0)) return 1;
+		}
+		while (p<pend && *p && *p!=',') ++p;
+		++p;
+	}
+	return 0;
+}
+
+// matches an If-Range entity tag against etag (without quotes). If-Range has
+// one tag (or a date), and only a strong match counts (RFC9110 13.1.5), so
+// weak tags, `*`, lists and dates never match (the full content is sent)
+static int header_if_range_matches(struct header_reader* hr, const char* etag)
+{
+	const int ne = strlen(etag);
+	const char* p = hr->colon;
+	assert(p != NULL);
+	++p;
+	const char* pend = hr->header_end;
+	assert(pend != NULL);
+	while (p<pend && *p==' ') ++p;
+	if (!(p<pend && *p=='"')) return 0;
+	const char* t0 = ++p;
+	while (p<pend && *p && *p!='"') ++p;
+	if (!(p<pend && *p=='"')) return 0;
+	if (!(((p-t0) == ne) && (memcmp(t0,etag,ne)==0))) return 0;
+	++p;
+	while (p<pend && *p==' ') ++p;
+	return (p==pend) || (*p==0);
+}
+
 static int get_header_value_length(struct header_reader* hr)
 {
 	const char* p = hr->colon;
@@ -624,37 +1104,382 @@ static const char* get_mime_from_ext(const char* ext)
 	return "application/octet-stream";
 }
 
-static void serve_dok(struct conn* conn, enum http_method method, const char* path0, const char* ext)
+static int parse_int64_digits(const char** pp, const char* pend, int64_t* out_value)
+{
+	const char* p = *pp;
+	int64_t v = 0;
+	int n = 0;
+	while (p<pend && ('0'<=*p) && (*p<='9')) {
+		if (v > ((INT64_MAX-9)/10)) return -1;
+		v = (v*10) + (*p-'0');
+		++p;
+		++n;
+	}
+	*pp = p;
+	*out_value = v;
+	return n;
+}
+
+// parses a Range header value like "bytes=0-499", "bytes=500-" or
+// "bytes=-500" (the last 500 bytes) for a resource of size bytes. returns 1
+// with the range in out_offset/out_count, 0 if the header is to be ignored
+// (including multiple ranges; the whole resource is served instead, which
+// RFC9110 allows), or -1 if the range isn't satisfiable (416)
+static int parse_range(const char* p, const char* pend, int64_t size, int64_t* out_offset, int64_t* out_count)
+{
+	static const char UNIT[] = "bytes=";
+	const int nu = sizeof(UNIT)-1;
+	if (((pend-p) < nu) || !case_insensitive_match(p, UNIT, nu)) return 0;
+	p += nu;
+	int64_t first=0, last=0;
+	const int nfirst = parse_int64_digits(&p, pend, &first);
+	if ((nfirst < 0) || (p==pend) || (*p!='-')) return 0;
+	++p;
+	const int nlast = parse_int64_digits(&p, pend, &last);
+	if ((nlast < 0) || (p!=pend)) return 0;
+	if (nfirst == 0) {
+		// suffix range
+		if (nlast == 0) return 0;
+		if (last == 0) return -1;
+		if (last > size) last = size;
+		*out_offset = (size - last);
+		*out_count = last;
+		return 1;
+	}
+	if ((nlast > 0) && (last < first)) return 0;
+	if (first >= size) return -1;
+	if ((nlast == 0) || (last >= size)) last = (size-1);
+	*out_offset = first;
+	*out_count = (last - first + 1);
+	return 1;
+}
+
+// hash is the <hash> part of /dok/<hash>.<ext> (64 hex digits, not
+// NUL-terminated), or NULL if the path isn't content addressed (then there's
+// no ETag). "<path>.br" and "<path>.gz" are served instead of <path> if they
+// exist, and the client accepts them (webpack.bash writes them)
+static void serve_dok(struct conn* conn, enum http_method method, const char* path0, const char* ext, const char* hash, struct header_reader* hr)
 {
 	// TODO allow override of "dok/", but probably also "shadow dok's".
 	// one use is to serve the web app, and not contaminate your main
 	// "dok"
 	char* p = (char*)path0;
 	while (*p=='/') ++p;
+
+	int accepts_br=0, accepts_gzip=0;
+	int has_if_none_match=0, has_range=0, has_if_range=0;
+	struct header_reader if_none_match_hr, range_hr, if_range_hr;
+	while (header_next(hr)) {
+		if (is_header(hr, "Accept-Encoding")) {
+			accepts_br   |= header_csv_accepts(hr, "br");
+			accepts_gzip |= header_csv_accepts(hr, "gzip");
+		} else if (is_header(hr, "If-None-Match")) {
+			if_none_match_hr = *hr;
+			has_if_none_match = 1;
+		} else if (is_header(hr, "Range")) {
+			range_hr = *hr;
+			has_range = 1;
+		} else if (is_header(hr, "If-Range")) {
+			if_range_hr = *hr;
+			has_if_range = 1;
+		}
+	}
+
 	int64_t size;
-	const int src_file_id = io_open(p, IO_OPEN_RDONLY, &size);
+	int src_file_id = -1;
+	const char* encoding = NULL;
+	const struct { const char* coding; const char* suffix; int accepted; } variants[] = {
+		// in order of preference
+		{ "br"   , "br" , accepts_br   },
+		{ "gzip" , "gz" , accepts_gzip },
+	};
+	for (int i=0; i<ARRAY_LENGTH(variants) && (src_file_id<0); ++i) {
+		if (!variants[i].accepted) continue;
+		char path[1<<10];
+		const int n = stbsp_snprintf(path, sizeof path, "%s.%s", p, variants[i].suffix);
+		if (n >= (sizeof(path)-1)) continue;
+		src_file_id = io_open(path, IO_OPEN_RDONLY, &size);
+		if (src_file_id >= 0) encoding = variants[i].coding;
+	}
+	if (src_file_id < 0) src_file_id = io_open(p, IO_OPEN_RDONLY, &size);
 	if (src_file_id < 0) {
 		// file actually not found
 		SERVE_STATIC_AND_RETURN(conn, R404)
 	}
 	assert(src_file_id >= 0);
 
-	// TODO range?
+	// each encoding is a different representation, so it needs its own
+	// entity tag
+	char etag[80] = {0};
+	if (hash != NULL) {
+		stbsp_snprintf(etag, sizeof etag, "%.64s%s%s", hash, (encoding ? "." : ""), (encoding ? encoding : ""));
+	}
+
+	// (the response is written over the request, so anything we need from
+	// it is copied or looked up before the first conn_print*())
+	const char* mime = get_mime_from_ext(ext);
+
+	#define DOK_HEADERS \
+		"Cache-Control: max-age=31536000, immutable" CRLF \
+		"Vary: Accept-Encoding" CRLF
+
+	if ((etag[0] != 0) && has_if_none_match && header_etag_matches(&if_none_match_hr, etag)) {
+		io_close(src_file_id);
+		conn_printf(conn,
+			"HTTP/1.1 304 Not Modified" CRLF
+			"ETag: \"%s\"" CRLF
+			DOK_HEADERS
+			CRLF
+			,
+			etag);
+		conn_respond(conn);
+		return;
+	}
+
+	int64_t offset=0, count=size;
+	int range = 0;
+	if (has_range && (!has_if_range || ((etag[0] != 0) && header_if_range_matches(&if_range_hr, etag)))) {
+		const int n = get_header_value_length(&range_hr);
+		range = parse_range(range_hr.header_end-n, range_hr.header_end, size, &offset, &count);
+	}
+	if (range < 0) {
+		io_close(src_file_id);
+		conn_printf(conn,
+			"HTTP/1.1 416 Range Not Satisfiable" CRLF
+			"Content-Range: bytes */%ld" CRLF
+			"Content-Length: 0" CRLF
+			CRLF
+			,
+			size);
+		conn_respond(conn);
+		return;
+	}
 
+	if (range > 0) {
+		conn_printf(conn,
+			"HTTP/1.1 206 Partial Content" CRLF
+			"Content-Range: bytes %ld-%ld/%ld" CRLF
+			,
+			offset, (offset+count-1), size);
+	} else {
+		conn_print(conn, "HTTP/1.1 200 OK" CRLF);
+	}
+	if (encoding != NULL) conn_printf(conn, "Content-Encoding: %s" CRLF, encoding);
+	if (etag[0] != 0) conn_printf(conn, "ETag: \"%s\"" CRLF, etag);
 	conn_printf(conn,
-		"HTTP/1.1 200 OK" CRLF
 		"Content-Type: %s" CRLF
 		"Content-Length: %ld" CRLF
-		"Cache-Control: max-age=31536000, immutable" CRLF
+		"Accept-Ranges: bytes" CRLF
+		DOK_HEADERS
 		CRLF
 		,
-		get_mime_from_ext(ext),
-		size);
+		mime,
+		count);
+	#undef DOK_HEADERS
 
 	conn_respond(conn);
-	if (method==GET) {
-		conn_sendfileall(conn, src_file_id, size, 0);
-	} else assert(method==HEAD);
+	if ((method==GET) && (count > 0)) {
+		conn_sendfileall(conn, src_file_id, count, offset);
+	} else {
+		assert((method==HEAD) || (count==0));
+		io_close(src_file_id);
+	}
+}
+
+static int is_dok_ext(const char* ext)
+{
+	const size_t n = strlen(ext);
+	if ((n < 1) || (n >= sizeof(((struct upload*)0)->ext))) return 0;
+	for (int i=0; i<n; ++i) {
+		const char c = ext[i];
+		if (!((('0'<=c) && (c<='9')) || ('a'<=c && c<='z'))) return 0;
+	}
+	return 1;
+}
+
+static void upload_pwrite(struct conn* conn, const uint8_t* data, int64_t count, int busy_mask)
+{
+	struct upload* up = conn->upload;
+	lonesha256_update(&up->sha, data, count);
+	if (up->failed || (count == 0)) return;
+	assert(up->num_pwrites < ARRAY_LENGTH(up->pwrite_masks));
+	assert((up->busy_mask & busy_mask) == 0);
+	up->busy_mask |= busy_mask;
+	up->pwrite_masks[up->num_pwrites] = busy_mask;
+	up->pwrite_counts[up->num_pwrites] = count;
+	++up->num_pwrites;
+	io_port_pwrite(g.port_id, echo_pwrite(get_conn_id_by_conn(conn)), up->file_id, data, count, up->offset);
+	up->offset += count;
+}
+
+static void upload_end(struct conn* conn)
+{
+	struct upload* up = conn->upload;
+	assert((up->remaining == 0) && (up->num_pwrites == 0));
+	uint8_t hash[32];
+	lonesha256_final(&up->sha, hash);
+	char hex[65];
+	for (int i=0; i<32; ++i) stbsp_snprintf(&hex[i*2], 3, "%02x", hash[i]);
+	char path[1<<7];
+	stbsp_snprintf(path, sizeof path, "dok/%s.%s", hex, up->ext);
+	const int failed = up->failed;
+	const int wrong_hash = (up->expected_hash[0] && (0 != strcmp(hex, up->expected_hash)));
+	io_close(up->file_id);
+	int err = 0;
+	if (!failed && !wrong_hash) {
+		// (the same content may already be there, which is fine)
+		err = io_rename(up->tmp_path, path);
+	}
+	if (failed || wrong_hash || (err < 0)) {
+		(void)io_unlink(up->tmp_path);
+		g.upload_bytes -= up->size;
+	}
+	free(up);
+	conn->upload = NULL;
+
+	conn_enter(conn, HTTP_RESPONSE);
+	if (wrong_hash) SERVE_STATIC_CLOSE_AND_RETURN(conn, R400hash)
+	if (failed || (err < 0)) SERVE_STATIC_CLOSE_AND_RETURN(conn, R500)
+	const char* name = &path[4];
+	conn_printf(conn,
+		"HTTP/1.1 201 Created" CRLF
+		"Location: /%s" CRLF
+		"Content-Type: text/plain; charset=utf-8" CRLF
+		"Content-Length: %zd" CRLF
+		CRLF
+		"%s"
+		,
+		path, strlen(name), name);
+	conn_respond(conn);
+}
+
+// reads more of the body when there's a free buffer half, or finishes the
+// upload when it's all written
+static void upload_pump(struct conn* conn)
+{
+	assert(conn->cstate == HTTP_REQUEST_BODY);
+	struct upload* up = conn->upload;
+	if (up->remaining > 0) {
+		if (conn->inflight_read) return;
+		const int half = up->next_half;
+		if (up->busy_mask & (1 << half)) return;
+		size_t size;
+		uint8_t* buf = get_conn_buffer_raw(conn, half, UPLOAD_BUFDIV_LOG2, &size);
+		if (size > up->remaining) size = up->remaining;
+		conn_read(conn, buf, size);
+	} else if (up->num_pwrites == 0) {
+		upload_end(conn);
+	}
+}
+
+static void upload_handle_read(struct conn* conn, int num_bytes)
+{
+	struct upload* up = conn->upload;
+	const int half = up->next_half;
+	size_t size;
+	uint8_t* buf = get_conn_buffer_raw(conn, half, UPLOAD_BUFDIV_LOG2, &size);
+	assert((num_bytes <= size) && (num_bytes <= up->remaining));
+	up->remaining -= num_bytes;
+	upload_pwrite(conn, buf, num_bytes, (1 << half));
+	up->next_half = !half;
+	upload_pump(conn);
+}
+
+static void upload_handle_pwrite(struct conn* conn, int status)
+{
+	struct upload* up = conn->upload;
+	assert((up != NULL) && (up->num_pwrites > 0));
+	// (pwrites to the same file complete in submission order)
+	const int count = up->pwrite_counts[0];
+	up->busy_mask &= ~up->pwrite_masks[0];
+	up->pwrite_masks[0] = up->pwrite_masks[1];
+	up->pwrite_counts[0] = up->pwrite_counts[1];
+	--up->num_pwrites;
+	if (status != count) {
+		// the hash is of what we read, not of what's in the file, so
+		// the file mustn't be kept unless all of it was written
+		fprintf(stderr, "upload to %s failed: %s\n", up->tmp_path, (status < 0) ? io_error_to_string_safe(status) : "short write");
+		up->failed = 1;
+	}
+	if (conn->cstate == CLOSING) {
+		if ((up->num_pwrites == 0) && up->free_conn_when_done) conn_free(conn);
+		return;
+	}
+	upload_pump(conn);
+}
+
+// starts streaming a request body to dok/ for `PUT /dok/<hash>.<ext>` (the
+// body must hash to <hash>) or `POST /dok/<ext>` (responds with the name).
+// body0/body_size is the part of the body that came with the headers
+static void upload_begin(struct conn* conn, enum http_method method, const char* tail, struct header_reader* hr, const uint8_t* body0, int64_t body_size)
+{
+	int64_t content_length = -1;
+	int expect_continue = 0;
+	while (header_next(hr)) {
+		if (is_header(hr, "Content-Length")) {
+			const int n = get_header_value_length(hr);
+			const char* v = (hr->header_end-n);
+			if ((parse_int64_digits(&v, hr->header_end, &content_length) <= 0) || (v != hr->header_end)) {
+				SERVE_STATIC_CLOSE_AND_RETURN(conn, R400proto)
+			}
+		} else if (is_header(hr, "Expect")) {
+			expect_continue = header_csv_contains(hr, "100-continue");
+		}
+	}
+	// (no Content-Length means chunked transfer coding, which we don't do)
+	if (content_length < 0) SERVE_STATIC_CLOSE_AND_RETURN(conn, R411)
+	if (content_length > MAX_UPLOAD_SIZE) SERVE_STATIC_CLOSE_AND_RETURN(conn, R413)
+	if ((g.upload_bytes + content_length) > g.upload_budget) SERVE_STATIC_CLOSE_AND_RETURN(conn, R507)
+	if (body_size > content_length) SERVE_STATIC_CLOSE_AND_RETURN(conn, R400proto)
+
+	const char* ext = tail;
+	const char* hash = NULL;
+	if (method == PUT) {
+		const char* dot = strchr(tail, '.');
+		if ((dot == NULL) || ((dot-tail) != 64)) SERVE_STATIC_CLOSE_AND_RETURN(conn, R404)
+		for (int i=0; i<64; ++i) {
+			const char c = tail[i];
+			if (!((('0'<=c) && (c<='9')) || ('a'<=c && c<='f'))) SERVE_STATIC_CLOSE_AND_RETURN(conn, R404)
+		}
+		hash = tail;
+		ext = dot+1;
+	} else {
+		assert(method == POST);
+	}
+	if (!is_dok_ext(ext)) SERVE_STATIC_CLOSE_AND_RETURN(conn, R404)
+
+	(void)io_mkdir("dok");
+	char tmp_path[sizeof(((struct upload*)0)->tmp_path)];
+	stbsp_snprintf(tmp_path, sizeof tmp_path, "dok/.upload.%d.%d.tmp", get_conn_id_by_conn(conn), ++g.upload_serial);
+	const int file_id = io_open(tmp_path, IO_CREATE, NULL);
+	if (file_id < 0) {
+		fprintf(stderr, "upload: io_open(\"%s\") failed: %s\n", tmp_path, io_error_to_string_safe(file_id));
+		SERVE_STATIC_CLOSE_AND_RETURN(conn, R500)
+	}
+
+	struct upload* up = calloc(1, sizeof *up);
+	up->file_id = file_id;
+	memcpy(up->tmp_path, tmp_path, sizeof tmp_path);
+	strcpy(up->ext, ext);
+	if (hash != NULL) {
+		memcpy(up->expected_hash, hash, 64);
+		up->expected_hash[64] = 0;
+	}
+	up->size = content_length;
+	g.upload_bytes += content_length;
+	up->remaining = (content_length - body_size);
+	lonesha256_init(&up->sha);
+	assert(conn->upload == NULL);
+	conn->upload = up;
+	conn_enter(conn, HTTP_REQUEST_BODY);
+
+	if (expect_continue && (up->remaining > 0)) {
+		serve_static(conn, R100, sizeof(R100)-1);
+	}
+	// the body that came with the headers may be anywhere in the buffer, so
+	// both halves are busy until it's written
+	upload_pwrite(conn, body0, body_size, (1<<(1<<UPLOAD_BUFDIV_LOG2))-1);
+	upload_pump(conn);
 }
 
 // serves HTTP/1.1 request between pstart/pend. the memory is modified.
@@ -743,7 +1568,9 @@ static void http_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 		SERVE_STATIC_CLOSE_AND_RETURN(conn, R400proto)
 	}
 
-	assert((remaining == 0) && "XXX we're not handling POST/PUT bodies yet");
+	// (bodies are only read by routes that want them, see upload_begin();
+	// elsewhere, a body is taken for the next request, which fails to parse
+	// and drops the connection)
 
 	struct header_reader hr = header_begin((char*)headers0, (char*)headers1);
 
@@ -753,6 +1580,27 @@ static void http_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 
 	printf("http [%s]\n", path0);
 
+	// "/o/room/<name>/..." is served like "/o/..." but in room <name> (see
+	// gig_add_room()); other paths are in the default room 0
+	{
+		static const char ROOM_PREFIX[] = "/o/room/";
+		const size_t n = sizeof(ROOM_PREFIX)-1;
+		char* path = (char*)path0;
+		conn->room_id = 0;
+		if (memcmp(path, ROOM_PREFIX, n) == 0) {
+			char* name = &path[n];
+			char* slash = strchr(name, '/');
+			if (slash == NULL) SERVE_STATIC_AND_RETURN(conn, R404)
+			*slash = 0;
+			const int room_id = gig_find_room(name);
+			*slash = '/';
+			if (room_id < 0) SERVE_STATIC_AND_RETURN(conn, R404)
+			conn->room_id = room_id;
+			// rewrite "/o/room/<name>/x" to "/o/x" in place
+			memmove(&path[2], slash, strlen(slash)+1);
+		}
+	}
+
 	const char* tail;
 	#define ROUTE(R) (method_set=0 , is_route(R,(char*)path0,&tail))
 	#define IS(M)    (assert(!(method_set&(1<<(M)))), (method_set|=(1<<(M))), method==(M))
@@ -794,8 +1642,12 @@ static void http_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 		}
 
 	} else if (ROUTE("/o/info")) {
+		// (the room is only needed while packing the snapshot; the
+		// snapshot data is reference counted)
+		if (gig_acquire_room(conn->room_id) < 0) SERVE_STATIC_CLOSE_AND_RETURN(conn, R500)
 		size_t size;
-		void* data = get_present_snapshot_data(&size);
+		const void* data = acquire_present_snapshot_data(conn->room_id, &size, NULL);
+		gig_release_room(conn->room_id);
 		conn_printf(conn,
 			"HTTP/1.1 200 OK" CRLF
 			"Content-Type: application/do-info" CRLF
@@ -804,11 +1656,14 @@ static void http_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 			, size);
 		conn_respond(conn);
 		conn_writeall_from_mem(conn, data, size);
-		conn_set_free_after_write_data(conn, data);
+		conn_set_release_after_write_snapshot_data(conn, data);
 		return;
 
 	} else if (ROUTE("/o/websocket")) {
 		if (IS(GET)) {
+			// the connection keeps the room awake until it's closed
+			if (gig_acquire_room(conn->room_id) < 0) SERVE_STATIC_CLOSE_AND_RETURN(conn, R500)
+			conn->has_acquired_room = 1;
 			upgrade_to_websocket = 1;
 		} else {
 			DO405_AND_RETURN
@@ -825,7 +1680,7 @@ static void http_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 	// still points at do.wasm.map
 	} else if (ROUTE("/dok/do.wasm.map")) {
 		if (IS(HEAD) || IS(GET)) {
-			serve_dok(conn, method, (char*)path0, "map");
+			serve_dok(conn, method, (char*)path0, "map", NULL, &hr);
 			return;
 		} else {
 			DO405_AND_RETURN
@@ -856,10 +1711,12 @@ static void http_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 				SERVE_STATIC_AND_RETURN(conn, R404)
 			}
 			const char* ext = p+65;
-			serve_dok(conn, method, (char*)path0, ext);
+			serve_dok(conn, method, (char*)path0, ext, p, &hr);
+			return;
+		} else if (IS(PUT) || IS(POST)) {
+			upload_begin(conn, method, tail, &hr, p, remaining);
 			return;
 		} else {
-			// TODO PUT?
 			DO405_AND_RETURN
 		}
 
@@ -1045,10 +1902,12 @@ static int websocket_read_header_u8(struct conn* conn, uint8_t b)
 			conn_drop(conn);
 			return 0;
 		case WS_PING:
-			TODO(websocket ping);
-			// TODO send opcode=10 (pong) back
-			conn_drop(conn);
-			return -1;
+		case WS_PONG:
+			if (!ws->fin) {
+				fprintf(stderr, "fragmented control frame\n");
+				return -1;
+			}
+			break;
 		default:
 			fprintf(stderr, "unexpected opcode %d\n", ws->opcode);
 			conn_drop(conn);
@@ -1069,6 +1928,10 @@ static int websocket_read_header_u8(struct conn* conn, uint8_t b)
 			return -1;
 		}
 		const uint8_t pl7 = (b&0x7f);
+		if ((ws->opcode >= WS_CONNECTION_CLOSE) && (pl7 > MAX_CONTROL_PAYLOAD)) {
+			fprintf(stderr, "control frame payload too long\n");
+			return -1;
+		}
 		if (pl7 < 126) {
 			ws->payload_length = pl7;
 			next_state = HEAD_MASKKEY;
@@ -1130,69 +1993,378 @@ static int websocket_read_header_u8(struct conn* conn, uint8_t b)
 	return 0;
 }
 
-static int websocket_send0(struct conn* conn, void* payload, int payload_size)
+static int websocket_get_frame_header_size(int64_t payload_size)
 {
-	assert(conn->cstate == WEBSOCKET);
-	assert((0 == conn->num_inflight_writes) && "cannot handle multiple inflight writes: buffer already in use");
-
-	size_t bufsize;
-	uint8_t* buf = get_conn_ws_write_buffer(conn, &bufsize);
-
-	int header_size=0;
-	int do_write_plen16=0;
-	int do_write_plen64=0;
-	// FIXME if payload_size is, say, 42MB, and the buffer size is less than
-	// 64kB, then we still could use the 16bit "plen16" approach, but we
-	// currently don't because payload_size is truncated later
 	if (payload_size < 126) {
-		header_size = 2;
+		return 2;
 	} else if (payload_size < 65536) {
-		header_size = 2+2;
-		do_write_plen16 = 1;
+		return 2+2;
 	} else {
-		header_size = 2+8;
-		do_write_plen64 = 1;
+		return 2+8;
 	}
-	assert(header_size >= 2);
-
-	const int payload_space = bufsize - header_size;
-	assert(payload_space > 0);
-	const int fin = payload_size <= payload_space;
+}
 
-	//const int opcode = WS_TEXT_FRAME; // XXX binary?
-	const int opcode = WS_BINARY_FRAME;
+// writes a server=>client (unmasked) frame header to buf, and returns the
+// number of bytes written (same as websocket_get_frame_header_size())
+static int websocket_encode_frame_header(uint8_t* buf, int fin, int opcode, int64_t payload_size)
+{
 	buf[0] = (fin ? 0x80 : 0) + opcode;
-
 	uint8_t* p = &buf[1];
-	if (!do_write_plen16 && !do_write_plen64) {
-		assert(payload_size < 126);
+	if (payload_size < 126) {
 		*(p++) = payload_size;
-	} else if (do_write_plen16 && !do_write_plen64) {
+	} else if (payload_size < 65536) {
 		*(p++) = 126;
 		for (int i=0; i<2; ++i) {
 			*(p++) = (payload_size >> (8*(1-i))) & 0xff;
 		}
-	} else if (do_write_plen64 && !do_write_plen16) {
+	} else {
 		*(p++) = 127;
 		for (int i=0; i<8; ++i) {
 			*(p++) = (payload_size >> (8*(7-i))) & 0xff;
 		}
-	} else {
-		assert(!"unreachable");
 	}
-	assert((bufsize-(p-buf)) == payload_space);
-	int num = payload_size;
-	if (num > payload_space) num = payload_space;
-	memcpy(p, payload, num);
-	p+=num;
+	const int n = (p-buf);
+	assert(n == websocket_get_frame_header_size(payload_size));
+	return n;
+}
+
+static void wsmsg_push_chunk(struct wsmsg* msg, uint8_t* chunk)
+{
+	assert(arrlen(chunk) <= WSCHUNK_SIZE);
+	arrput(msg->seg_arr, ((struct wsseg){ .ptr=chunk, .size=arrlen(chunk), .chunk=chunk }));
+}
+
+// builds a binary message whose payload is prefix, followed by journal data
+// in [journal_cursor0;journal_cursor1), followed by tail. prefix and journal
+// data are copied into pooled chunks, one fragment per chunk, whereas tail is
+// written straight from memory as the last fragment, so the caller must keep
+// it alive until the message is released (see wsmsg.snapshot_data)
+static struct wsmsg* wsmsg_new(int room_id, const void* prefix, int prefix_size, int64_t journal_cursor0, int64_t journal_cursor1, const void* tail, int64_t tail_size)
+{
+	const int64_t journal_count = (journal_cursor1 - journal_cursor0);
+	assert(prefix_size >= 0);
+	assert(journal_count >= 0);
+	assert(tail_size >= 0);
+
+	struct wsmsg* msg = calloc(1, sizeof *msg);
+	msg->refcount = 1;
+	msg->journal_cursor0 = journal_cursor0;
+	msg->journal_cursor1 = journal_cursor1;
+	msg->lz_dict_size = -1;
+
+	const uint8_t* pp = prefix;
+	int prefix_remaining = prefix_size;
+	int64_t journal_cursor = journal_cursor0;
+	int64_t remaining = (prefix_size + journal_count);
+	int opcode = WS_BINARY_FRAME;
+	// (an empty message is still one frame)
+	while ((remaining > 0) || ((opcode == WS_BINARY_FRAME) && (tail_size == 0))) {
+		int64_t n = remaining;
+		if (n > WSCHUNK_MAX_FRAGMENT_PAYLOAD) n = WSCHUNK_MAX_FRAGMENT_PAYLOAD;
+		const int fin = (n == remaining) && (tail_size == 0);
+		uint8_t* chunk = wschunk_alloc();
+		uint8_t* p = arraddnptr(chunk, websocket_get_frame_header_size(n) + n);
+		p += websocket_encode_frame_header(p, fin, opcode, n);
+		int np = prefix_remaining;
+		if (np > n) np = n;
+		memcpy(p, pp, np);
+		pp += np;
+		p += np;
+		prefix_remaining -= np;
+		const int64_t nj = (n - np);
+		if (nj > 0) {
+			copy_journal(room_id, p, nj, journal_cursor);
+			journal_cursor += nj;
+		}
+		wsmsg_push_chunk(msg, chunk);
+		remaining -= n;
+		opcode = WS_CONTINUATION_FRAME;
+	}
+	assert(prefix_remaining == 0);
+	assert(journal_cursor == journal_cursor1);
+
+	if (tail_size > 0) {
+		uint8_t* chunk = wschunk_alloc();
+		uint8_t* p = arraddnptr(chunk, websocket_get_frame_header_size(tail_size));
+		websocket_encode_frame_header(p, 1, opcode, tail_size);
+		wsmsg_push_chunk(msg, chunk);
+		arrput(msg->seg_arr, ((struct wsseg){ .ptr=tail,  .size=tail_size }));
+	}
+
+	return msg;
+}
+
+// like wsmsg_new() with a WS1_JOURNAL_UPDATE prefix, except that big updates
+// are sent as a single frame with the journal data sendfile()'d straight from
+// the journal file, so catching up a peer doesn't copy the journal through
+// userspace. data that's not yet flushed to the file is copied.
+static struct wsmsg* wsmsg_new_journal_update(int room_id, int64_t journal_cursor0, int64_t journal_cursor1)
+{
+	const int64_t count = (journal_cursor1 - journal_cursor0);
+	assert(count > 0);
+
+	uint8_t prefix[16];
+	uint8_t* pp = prefix;
+	*(pp++) = WS1_JOURNAL_UPDATE;
+	pp = leb128_encode_int64_buf(pp, count);
+	const int prefix_size = (pp - prefix);
+
+	int64_t flushed_size = 0;
+	const int file_id = (count >= SENDFILE_JOURNAL_THRESHOLD) ? get_journal_file_id(room_id, &flushed_size) : -1;
+	int64_t journal_cursor = journal_cursor0;
+	int64_t sendfile_count = 0;
+	if (file_id >= 0) {
+		sendfile_count = ((flushed_size < journal_cursor1) ? flushed_size : journal_cursor1) - journal_cursor0;
+	}
+	if (sendfile_count < SENDFILE_JOURNAL_THRESHOLD) {
+		return wsmsg_new(room_id, prefix, prefix_size, journal_cursor0, journal_cursor1, NULL, 0);
+	}
+
+	struct wsmsg* msg = calloc(1, sizeof *msg);
+	msg->refcount = 1;
+	msg->journal_cursor0 = journal_cursor0;
+	msg->journal_cursor1 = journal_cursor1;
+	msg->lz_dict_size = -1;
+
+	const int64_t payload_size = (prefix_size + count);
+	uint8_t* chunk = wschunk_alloc();
+	uint8_t* p = arraddnptr(chunk, websocket_get_frame_header_size(payload_size) + prefix_size);
+	p += websocket_encode_frame_header(p, 1, WS_BINARY_FRAME, payload_size);
+	memcpy(p, prefix, prefix_size);
+	wsmsg_push_chunk(msg, chunk);
+
+	arrput(msg->seg_arr, ((struct wsseg){
+		.size = sendfile_count,
+		.is_sendfile = 1,
+		.sendfile_src_file_id = file_id,
+		.sendfile_src_offset = journal_cursor,
+	}));
+	journal_cursor += sendfile_count;
+
+	while (journal_cursor < journal_cursor1) {
+		int64_t n = (journal_cursor1 - journal_cursor);
+		if (n > WSCHUNK_SIZE) n = WSCHUNK_SIZE;
+		uint8_t* chunk = wschunk_alloc();
+		copy_journal(room_id, arraddnptr(chunk, n), n, journal_cursor);
+		wsmsg_push_chunk(msg, chunk);
+		journal_cursor += n;
+	}
+	assert(journal_cursor == journal_cursor1);
 
-	assert((p-buf) <= bufsize);
-	conn_writeall_from_mem(conn, buf, p-buf);
+	return msg;
+}
+
+// compresses count bytes of journal data at journal_cursor, using the
+// dict_size bytes before it as dictionary. returns the compressed size, or -1
+// if compression doesn't help. the compressed data is in tlg.lz_output_arr
+static int64_t lz_compress_journal(int room_id, int64_t journal_cursor, int64_t count, int64_t dict_size)
+{
+	uint8_t** input = &tlg.lz_input_arr;
+	uint8_t** output = &tlg.lz_output_arr;
+	arrsetlen(*input, dict_size + count);
+	copy_journal(room_id, *input, dict_size + count, journal_cursor - dict_size);
+	arrsetlen(*output, lz_compress_bound(count));
+	const int64_t n = lz_compress(*output, *input, dict_size, count);
+	return (n < count) ? n : -1;
+}
 
-	return num;
+// like wsmsg_new_journal_update(), but the journal data is compressed in
+// blocks of WS_LZ_BLOCK_SIZE (blocks that don't compress are sent as
+// WS1_JOURNAL_UPDATE). dict_size is how much journal data before
+// journal_cursor0 the peer has
+static struct wsmsg* wsmsg_new_journal_update_lz(int room_id, int64_t journal_cursor0, int64_t journal_cursor1, int64_t dict_size)
+{
+	assert((0 <= dict_size) && (dict_size <= LZ_MAX_DICT_SIZE));
+	uint8_t** bb = &tlg.bb;
+	arrreset(*bb);
+	int64_t journal_cursor = journal_cursor0;
+	int64_t block_dict_size = dict_size;
+	while (journal_cursor < journal_cursor1) {
+		int64_t n = (journal_cursor1 - journal_cursor);
+		if (n > WS_LZ_BLOCK_SIZE) n = WS_LZ_BLOCK_SIZE;
+		const int64_t nc = lz_compress_journal(room_id, journal_cursor, n, block_dict_size);
+		if (nc >= 0) {
+			bb_append_u8(bb, WS1_JOURNAL_UPDATE_LZ);
+			bb_append_leb128(bb, n);
+			bb_append_leb128(bb, block_dict_size);
+			bb_append_leb128(bb, nc);
+			bb_append(bb, tlg.lz_output_arr, nc);
+		} else {
+			bb_append_u8(bb, WS1_JOURNAL_UPDATE);
+			bb_append_leb128(bb, n);
+			bb_append(bb, tlg.lz_input_arr + block_dict_size, n);
+		}
+		journal_cursor += n;
+		block_dict_size += n;
+		if (block_dict_size > LZ_MAX_DICT_SIZE) block_dict_size = LZ_MAX_DICT_SIZE;
+	}
+	struct wsmsg* msg = wsmsg_new(room_id, *bb, arrlen(*bb), 0, 0, NULL, 0);
+	msg->journal_cursor0 = journal_cursor0;
+	msg->journal_cursor1 = journal_cursor1;
+	msg->lz_dict_size = dict_size;
+	return msg;
+}
+
+// rounds the amount of journal data a peer has down to one of a few dictionary
+// sizes. peers at the same journal cursor share one broadcast message per
+// dictionary size (see webserv_broadcast_journal()), so with exact sizes each
+// recently joined peer would get its own message
+static int64_t get_lz_dict_size_class(int64_t available)
+{
+	assert(available >= 0);
+	if (available >= LZ_MAX_DICT_SIZE) return LZ_MAX_DICT_SIZE;
+	int64_t size = 0;
+	for (int64_t s = (1L<<10); s <= available; s <<= 2) size = s;
+	return size;
 }
 
-static void websocket_handle_msg(struct conn* conn, uint8_t* data, int count)
+// returns the compressed snapshot, or NULL if compression doesn't help. it's
+// cached because many peers often join at the same time (e.g. when a jam
+// starts), and a given room and journal offset always has the same snapshot
+static const uint8_t* get_lz_snapshot(int room_id, const void* snapshot, size_t snapshot_size, int64_t snapshot_journal_offset, int64_t* out_size)
+{
+	while (arrlen(g.lz_snapshot_arr) <= room_id) {
+		arrput(g.lz_snapshot_arr, ((struct lz_snapshot){0}));
+	}
+	struct lz_snapshot* lzs = &g.lz_snapshot_arr[room_id];
+	uint8_t** cache = &lzs->data_arr;
+	if ((*cache == NULL) || (lzs->journal_offset != snapshot_journal_offset)) {
+		arrsetlen(*cache, lz_compress_bound(snapshot_size));
+		const int64_t n = lz_compress(*cache, snapshot, 0, snapshot_size);
+		arrsetlen(*cache, n);
+		lzs->journal_offset = snapshot_journal_offset;
+	}
+	const int64_t n = arrlen(*cache);
+	if (n >= snapshot_size) return NULL;
+	if (out_size) *out_size = n;
+	return *cache;
+}
+
+static int websocket_is_congested(struct conn* conn)
+{
+	return arrlen(conn->websock.sendq_arr) >= MAX_QUEUED_WSMSGS;
+}
+
+static void websocket_send_msg(struct conn* conn, struct wsmsg* msg)
+{
+	assert(conn->cstate == WEBSOCKET);
+	struct websock* ws = &conn->websock;
+	const int num_segs = arrlen(msg->seg_arr);
+	assert(num_segs > 0);
+	++msg->refcount;
+	arrput(ws->sendq_arr, ((struct wsqueued){ .msg=msg, .num_remaining_writes=num_segs }));
+	const io_echo echo = echo_wswrite(get_conn_id_by_conn(conn));
+	for (int i=0; i<num_segs; ++i) {
+		struct wsseg* seg = &msg->seg_arr[i];
+		if (seg->is_sendfile) {
+			// (the journal file is borrowed; it's not closed when the
+			// write is done, unlike with conn_sendfileall())
+			io_port_sendfileall(g.port_id, echo, conn->file_id, seg->sendfile_src_file_id, seg->size, seg->sendfile_src_offset);
+		} else {
+			io_port_writeall(g.port_id, echo, conn->file_id, seg->ptr, seg->size);
+		}
+		++conn->num_inflight_writes;
+	}
+}
+
+// called for every completed websocket_send_msg() write (see echo_wswrite());
+// releases the head of the send queue when all of its segments have been
+// written. other writes, like the handshake response, aren't queued
+static void websocket_ack_write(struct conn* conn)
+{
+	struct websock* ws = &conn->websock;
+	assert(arrlen(ws->sendq_arr) > 0);
+	struct wsqueued* q = &ws->sendq_arr[0];
+	assert(q->num_remaining_writes > 0);
+	if (--q->num_remaining_writes > 0) return;
+	wsmsg_release(q->msg);
+	arrdel(ws->sendq_arr, 0);
+}
+
+static void websocket_send0(struct conn* conn, const void* payload, int payload_size)
+{
+	struct wsmsg* msg = wsmsg_new(conn->room_id, payload, payload_size, 0, 0, NULL, 0);
+	websocket_send_msg(conn, msg);
+	wsmsg_release(msg);
+}
+
+static void websocket_send_control(struct conn* conn, int opcode, const void* payload, int payload_size)
+{
+	assert((opcode >= WS_CONNECTION_CLOSE) && (payload_size <= MAX_CONTROL_PAYLOAD));
+	struct wsmsg* msg = calloc(1, sizeof *msg);
+	msg->refcount = 1;
+	msg->lz_dict_size = -1;
+	uint8_t* chunk = wschunk_alloc();
+	uint8_t* p = arraddnptr(chunk, websocket_get_frame_header_size(payload_size) + payload_size);
+	p += websocket_encode_frame_header(p, 1, opcode, payload_size);
+	memcpy(p, payload, payload_size);
+	wsmsg_push_chunk(msg, chunk);
+	websocket_send_msg(conn, msg);
+	wsmsg_release(msg);
+}
+
+// a peer is bootstrapped with a snapshot when it has nothing (cursor=0), or
+// when it's so far behind that the snapshot is smaller than the journal data
+// it would otherwise have to receive and spool
+static int should_bootstrap_with_snapshot(int64_t journal_cursor, int64_t snapshot_journal_offset, size_t snapshot_size)
+{
+	if (journal_cursor <= 0) return 1;
+	return (snapshot_journal_offset - journal_cursor) > (int64_t)snapshot_size;
+}
+
+static void ratelimit_refill_bucket(double* tokens, double rate, double dt_s)
+{
+	if (rate <= 0) return;
+	*tokens += (dt_s * rate);
+	const double burst = (rate * MIM_RATE_BURST_S);
+	if (*tokens > burst) *tokens = burst;
+}
+
+static void ratelimit_init(struct ratelimit* rl, int64_t now_us)
+{
+	rl->mim_tokens  = (g.mim_rate * MIM_RATE_BURST_S);
+	rl->byte_tokens = (g.mim_byte_rate * MIM_RATE_BURST_S);
+	rl->last_refill_us = now_us;
+}
+
+// takes a mim of num_bytes from the buckets, or returns 0 if it has to wait.
+// a mim is let through while neither bucket is empty, even if it costs more
+// than what's left, so a paste that's bigger than the burst isn't held back
+// forever; the mims after it pay off the debt
+static int ratelimit_take(struct ratelimit* rl, int num_bytes, int64_t now_us)
+{
+	const double dt_s = (double)(now_us - rl->last_refill_us) * 1e-6;
+	rl->last_refill_us = now_us;
+	ratelimit_refill_bucket(&rl->mim_tokens  , g.mim_rate      , dt_s);
+	ratelimit_refill_bucket(&rl->byte_tokens , g.mim_byte_rate , dt_s);
+	if ((g.mim_rate      > 0) && (rl->mim_tokens  <= 0)) return 0;
+	if ((g.mim_byte_rate > 0) && (rl->byte_tokens <= 0)) return 0;
+	if (g.mim_rate      > 0) rl->mim_tokens  -= 1.0;
+	if (g.mim_byte_rate > 0) rl->byte_tokens -= num_bytes;
+	return 1;
+}
+
+// how long until ratelimit_take() lets a mim through
+static int64_t ratelimit_get_wait_us(struct ratelimit* rl, int64_t now_us)
+{
+	double wait_s = 0;
+	if ((g.mim_rate > 0) && (rl->mim_tokens <= 0)) {
+		const double w = -rl->mim_tokens / g.mim_rate;
+		if (w > wait_s) wait_s = w;
+	}
+	if ((g.mim_byte_rate > 0) && (rl->byte_tokens <= 0)) {
+		const double w = -rl->byte_tokens / g.mim_byte_rate;
+		if (w > wait_s) wait_s = w;
+	}
+	// (+1 because the buckets must be above empty)
+	const int64_t wait_us = (int64_t)(wait_s * 1e6) + 1 - (now_us - rl->last_refill_us);
+	return (wait_us > 0) ? wait_us : 0;
+}
+
+// handles the ops in a message. WS0_MIM's are subject to the rate limit;
+// returns how many bytes were handled, which is less than count if the rest
+// has to wait for it (see websocket_drain()), or -1 if the conn was dropped
+static int websocket_handle_msg(struct conn* conn, uint8_t* data, int count, int is_deferred)
 {
 	assert(conn->cstate == WEBSOCKET);
 	struct websock* ws = &conn->websock;
@@ -1201,41 +2373,128 @@ static void websocket_handle_msg(struct conn* conn, uint8_t* data, int count)
 	struct bufstream bs;
 	bufstream_init_from_memory(&bs, data, count);
 	while (bs.offset < count) {
+		const int op_offset = bs.offset;
 		uint8_t op = bs_read_u8(&bs);
 		switch (op) {
 
-		case WS0_HELLO: {
+		case WS0_HELLO:
+		case WS0_HELLO2: {
 			if (cdo->did_greet) {
 				fprintf(stderr, "client said hello 2+ times\n");
 				conn_drop(conn);
+				return -1;
 			} else {
 				cdo->did_greet = 1;
+				const int is_hello2 = (op == WS0_HELLO2);
+				if (is_hello2) {
+					const int64_t version = bs_read_leb128(&bs);
+					if (version != WS_PROTOCOL_VERSION) {
+						fprintf(stderr, "client speaks protocol version %lld (we speak %d); dropping ws conn\n",
+							(long long)version,
+							WS_PROTOCOL_VERSION);
+						conn_drop(conn);
+						return -1;
+					}
+				}
 				cdo->journal_cursor = bs_read_leb128(&bs);
-				cdo->artist_id = alloc_artist_id();
+				cdo->flags = is_hello2 ? (bs_read_leb128(&bs) & (WSFLAG_LZ | WSFLAG_RELAY)) : 0;
+				const int is_relay = (cdo->flags & WSFLAG_RELAY);
+				if (is_relay) {
+					// a relay continues from its copy of our journal,
+					// so it can't start ahead of it
+					struct gig_room_stats stats;
+					gig_get_room_stats(conn->room_id, &stats);
+					if ((cdo->journal_cursor <= 0) || (cdo->journal_cursor > stats.journal_size)) {
+						fprintf(stderr, "relay said hello with bad journal cursor %lld (journal size is %lld); dropping ws conn\n",
+							(long long)cdo->journal_cursor,
+							(long long)stats.journal_size);
+						conn_drop(conn);
+						return -1;
+					}
+				}
+				// relays and the spectators of relays are read-only, so
+				// they get no artist id
+				const int is_read_only = is_relay || gig_is_relay_room(conn->room_id);
+				cdo->artist_id = is_read_only ? 0 : alloc_artist_id(conn->room_id);
 
 				uint8_t** bb = &tlg.bb;
 				arrreset(*bb);
-				bb_append_u8(bb, WS1_HELLO);
-				bb_append_leb128(bb, cdo->artist_id);
-				websocket_send0(conn, *bb, arrlen(*bb));
+				if (is_hello2) {
+					bb_append_u8(bb, WS1_HELLO2);
+					bb_append_leb128(bb, WS_PROTOCOL_VERSION);
+					bb_append_leb128(bb, cdo->artist_id);
+					bb_append_leb128(bb, cdo->flags);
+				} else {
+					bb_append_u8(bb, WS1_HELLO);
+					bb_append_leb128(bb, cdo->artist_id);
+				}
+
+				size_t snapshot_size;
+				int64_t snapshot_journal_offset;
+				const void* snapshot = acquire_present_snapshot_data(conn->room_id, &snapshot_size, &snapshot_journal_offset);
+				const uint8_t* lz_snapshot = NULL;
+				int64_t lz_snapshot_size = 0;
+				const int bootstrap = !is_relay && should_bootstrap_with_snapshot(cdo->journal_cursor, snapshot_journal_offset, snapshot_size);
+				if (bootstrap && (cdo->flags & WSFLAG_LZ)) {
+					lz_snapshot = get_lz_snapshot(conn->room_id, snapshot, snapshot_size, snapshot_journal_offset, &lz_snapshot_size);
+				}
+				if (lz_snapshot != NULL) {
+					bb_append_u8(bb, WS1_SNAPSHOT_LZ);
+					bb_append_leb128(bb, snapshot_size);
+					bb_append_leb128(bb, lz_snapshot_size);
+					bb_append(bb, lz_snapshot, lz_snapshot_size);
+					release_present_snapshot_data(snapshot);
+					websocket_send0(conn, *bb, arrlen(*bb));
+					cdo->journal_cursor = snapshot_journal_offset;
+				} else if (bootstrap) {
+					bb_append_u8(bb, WS1_SNAPSHOT);
+					bb_append_leb128(bb, snapshot_size);
+					struct wsmsg* msg = wsmsg_new(conn->room_id, *bb, arrlen(*bb), 0, 0, snapshot, snapshot_size);
+					msg->snapshot_data = snapshot;
+					websocket_send_msg(conn, msg);
+					wsmsg_release(msg);
+					// journal updates continue from the snapshot
+					cdo->journal_cursor = snapshot_journal_offset;
+				} else {
+					release_present_snapshot_data(snapshot);
+					websocket_send0(conn, *bb, arrlen(*bb));
+				}
+				cdo->lz_dict_journal_cursor = cdo->journal_cursor;
+				ratelimit_init(&cdo->ratelimit, get_microseconds_monotonic());
 			}
 		}	break;
 
 		case WS0_MIM: {
+			if (cdo->artist_id == 0) {
+				fprintf(stderr, "mim from read-only ws conn; dropping it\n");
+				conn_drop(conn);
+				return -1;
+			}
 			const int mim_session_id = bs_read_leb128(&bs);
 			const int64_t tracer = bs_read_leb128(&bs);
-			const int count = bs_read_leb128(&bs);
-			commit_mim_to_host(cdo->artist_id, mim_session_id, tracer, data+bs.offset, count);
-			bs_skip(&bs, count);
+			const int64_t num_bytes = bs_read_leb128(&bs);
+			if (bs.error || (num_bytes < 0) || (num_bytes > (count - bs.offset))) {
+				fprintf(stderr, "bad WS0_MIM; dropping ws conn\n");
+				conn_drop(conn);
+				return -1;
+			}
+			if (!ratelimit_take(&cdo->ratelimit, num_bytes, get_microseconds_monotonic())) {
+				return op_offset;
+			}
+			commit_mim_to_host(conn->room_id, cdo->artist_id, mim_session_id, tracer, data+bs.offset, num_bytes);
+			if (is_deferred) ++g.num_mims_deferred;
+			bs_skip(&bs, num_bytes);
 		}	break;
 
 		default: {
 			fprintf(stderr, "unhandled op (%d); dropping ws conn\n", op);
 			conn_drop(conn);
-		}	break;
+			return -1;
+		}
 
 		}
 	}
+	return count;
 }
 
 static void websocket_handle_data(struct conn* conn, int fin, uint8_t* data, int count)
@@ -1246,18 +2505,53 @@ static void websocket_handle_data(struct conn* conn, int fin, uint8_t* data, int
 	uint8_t* p = arraddnptr(ws->msgbuf_arr, count);
 	memcpy(p, data, count);
 	if (fin) {
-		websocket_handle_msg(conn, ws->msgbuf_arr, arrlen(ws->msgbuf_arr));
+		const int n = arrlen(ws->msgbuf_arr);
+		if (arrlen(ws->deferred_arr) > 0) {
+			// (in line behind the deferred mims)
+			memcpy(arraddnptr(ws->deferred_arr, n), ws->msgbuf_arr, n);
+		} else {
+			const int n0 = websocket_handle_msg(conn, ws->msgbuf_arr, n, 0);
+			if ((0 <= n0) && (n0 < n)) {
+				memcpy(arraddnptr(ws->deferred_arr, n-n0), ws->msgbuf_arr+n0, n-n0);
+				++g.num_throttled_conns;
+				++g.num_ws_throttles;
+			}
+		}
 		arrreset(ws->msgbuf_arr);
 	}
 }
 
+static void websocket_handle_control_data(struct conn* conn, int fin, uint8_t* data, int count)
+{
+	if (conn->cstate == CLOSING) return;
+	struct websock* ws = &conn->websock;
+	const int64_t offset = (ws->payload_length - ws->remaining);
+	assert((offset + count) <= MAX_CONTROL_PAYLOAD);
+	memcpy(&ws->control_payload[offset], data, count);
+	if (!fin) return;
+	switch (ws->opcode) {
+	case WS_PING:
+		// RFC6455 5.5.3: "A Pong frame sent in response to a Ping frame
+		// must have identical "Application data" as found in the message
+		// body of the Ping frame being replied to."
+		websocket_send_control(conn, WS_PONG, ws->control_payload, ws->payload_length);
+		break;
+	case WS_PONG:
+		ws->awaiting_pong = 0;
+		break;
+	default: assert(!"unhandled control frame");
+	}
+}
+
 static void websocket_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 {
 	if (conn->cstate == CLOSING) return;
 	assert(conn->cstate == WEBSOCKET);
 	struct websock* ws = &conn->websock;
 	uint8_t* p = pstart;
-	while (p < pend) {
+	// (a frame with an empty payload is handled right after its header,
+	// instead of when the next frame arrives)
+	while ((p < pend) || ((ws->wstate == PAYLOAD) && (ws->remaining == 0))) {
 		if (ws->wstate == PAYLOAD) {
 			int64_t r = (pend - p);
 			if (r > ws->remaining) r = ws->remaining;
@@ -1270,7 +2564,12 @@ static void websocket_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 				p[i] ^= ws->mask_key[(o0+i)&3];
 			}
 
-			websocket_handle_data(conn, ws->fin, p, r);
+			// (the frame may continue in the next read)
+			if (ws->opcode >= WS_CONNECTION_CLOSE) {
+				websocket_handle_control_data(conn, (r == ws->remaining), p, r);
+			} else {
+				websocket_handle_data(conn, ws->fin && (r == ws->remaining), p, r);
+			}
 
 			//for (int i=0; i<r; ++i) printf("%c", p[i]);
 			//printf("]\n");
@@ -1283,7 +2582,8 @@ static void websocket_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 			}
 		} else {
 			if (-1 == websocket_read_header_u8(conn, *(p++))) {
-				conn_drop(conn);
+				// (it may have dropped the conn already)
+				if (conn->cstate != CLOSING) conn_drop(conn);
 				return;
 			}
 		}
@@ -1291,9 +2591,89 @@ static void websocket_serve(struct conn* conn, uint8_t* pstart, uint8_t* pend)
 	assert(p == pend);
 }
 
+// pings websockets we haven't heard from in a while, and drops those that
+// don't answer; otherwise a peer that went away without closing (a half-open
+// connection) holds on to its conn forever
+static int websocket_keepalive(int64_t now_us)
+{
+	const int64_t timeout_us = g.ws_timeout_us;
+	if (timeout_us <= 0) return 0;
+	// (timeouts are checked with quarter-timeout precision)
+	if ((now_us - g.last_keepalive_us) < (timeout_us/4)) return 0;
+	g.last_keepalive_us = now_us;
+	int did_work = 0;
+	for (int i=0; i<g.next; ++i) {
+		struct conn* conn = &g.conns[i];
+		if (conn->cstate != WEBSOCKET) continue;
+		struct websock* ws = &conn->websock;
+		// (we're not listening to throttled conns; see websocket_drain())
+		if (arrlen(ws->deferred_arr) > 0) continue;
+		const int64_t silence_us = (now_us - ws->last_heard_us);
+		if (silence_us >= timeout_us) {
+			fprintf(stderr, "evicting unresponsive ws conn %d\n", i);
+			++g.num_ws_evictions;
+			// (the pending read won't complete by itself, and neither will
+			// writes when the peer's receive window is full)
+			io_shutdown(conn->file_id);
+			conn_drop(conn);
+			did_work = 1;
+		} else if ((silence_us >= (timeout_us/2)) && !ws->awaiting_pong) {
+			websocket_send_control(conn, WS_PING, NULL, 0);
+			ws->awaiting_pong = 1;
+			++g.num_ws_pings;
+			did_work = 1;
+		}
+	}
+	return did_work;
+}
+
+// handles the deferred mims of throttled conns as the rate limit lets them
+// through, and reads from a conn again once it has none left
+static int websocket_drain(int64_t now_us)
+{
+	if (g.num_throttled_conns == 0) return 0;
+	int did_work = 0;
+	for (int i=0; i<g.next; ++i) {
+		struct conn* conn = &g.conns[i];
+		if (conn->cstate != WEBSOCKET) continue;
+		struct websock* ws = &conn->websock;
+		const int num_deferred = arrlen(ws->deferred_arr);
+		if (num_deferred == 0) continue;
+		const int n = websocket_handle_msg(conn, ws->deferred_arr, num_deferred, 1);
+		if (n <= 0) continue;
+		did_work = 1;
+		arrdeln(ws->deferred_arr, 0, n);
+		if (arrlen(ws->deferred_arr) > 0) continue;
+		--g.num_throttled_conns;
+		// (the silence was ours, so the keepalive clock starts over)
+		ws->last_heard_us = now_us;
+		conn_set_buffer_class(conn, SMALL_BUFFER);
+		size_t size;
+		uint8_t* buf = get_conn_ws_read_buffer(conn, &size);
+		conn_read(conn, buf, size);
+	}
+	return did_work;
+}
+
+int64_t webserv_get_wait_timeout_us(void)
+{
+	if (g.num_throttled_conns == 0) return -1;
+	const int64_t now_us = get_microseconds_monotonic();
+	int64_t wait_us = -1;
+	for (int i=0; i<g.next; ++i) {
+		struct conn* conn = &g.conns[i];
+		if (conn->cstate != WEBSOCKET) continue;
+		if (arrlen(conn->websock.deferred_arr) == 0) continue;
+		const int64_t w = ratelimit_get_wait_us(&conn->websock.conndo.ratelimit, now_us);
+		if ((wait_us < 0) || (w < wait_us)) wait_us = w;
+	}
+	return wait_us;
+}
+
 int webserv_tick(void)
 {
 	int did_work = 0;
+	const int64_t now_us = get_microseconds_monotonic();
 	struct io_event ev;
 	while (io_port_poll(g.port_id, &ev)) {
 		did_work = 1;
@@ -1313,6 +2693,7 @@ int webserv_tick(void)
 				memset(conn, 0, sizeof *conn);
 				conn->file_id = ev.status;
 				conn_enter(conn, HTTP_REQUEST);
+				conn_set_buffer_class(conn, LARGE_BUFFER);
 				size_t size;
 				uint8_t* buf = get_conn_http_read_buffer(conn, &size);
 				io_port_read(g.port_id, echo_read(conn_id), conn->file_id, buf, size);
@@ -1320,11 +2701,23 @@ int webserv_tick(void)
 		} else if (is_echo_close(ev.echo, &conn_id)) {
 			struct conn* conn = get_conn(conn_id);
 			assert(conn->cstate == CLOSING);
-			conn_free(conn);
+			if ((conn->upload != NULL) && (conn->upload->num_pwrites > 0)) {
+				// (the pwrites are from the conn buffer, so it's freed
+				// when they're done; see upload_handle_pwrite())
+				conn->upload->free_conn_when_done = 1;
+			} else {
+				conn_free(conn);
+			}
+		} else if (is_echo_pwrite(ev.echo, &conn_id)) {
+			upload_handle_pwrite(get_conn(conn_id), ev.status);
 		} else if (is_echo_read(ev.echo, &conn_id)) {
 			const int conn_id = ev.echo.ib32;
-			assert((0 <= conn_id) && (conn_id < MAX_CONN_COUNT));
+			assert((0 <= conn_id) && (conn_id < g.max_conn_count));
 			struct conn* conn = get_conn(conn_id);
+			conn->inflight_read=0;
+			// (a conn dropped with a read in flight, like one evicted by
+			// websocket_keepalive(), is already closing)
+			if (conn->cstate == CLOSING) continue;
 			if (ev.status <= 0) {
 				if (ev.status < 0) {
 					fprintf(stderr, "conn I/O error %d for echo %d:%d\n", ev.status, ev.echo.ia32, ev.echo.ib32);
@@ -1332,10 +2725,9 @@ int webserv_tick(void)
 				conn_drop(conn);
 				continue;
 			}
-			conn->inflight_read=0;
+			if (conn->cstate == WEBSOCKET) conn->websock.last_heard_us = now_us;
 			const int num_bytes = ev.status;
 			assert(num_bytes > 0);
-			assert(conn->cstate != CLOSING);
 
 			switch (conn->cstate) {
 			case HTTP_REQUEST: {
@@ -1344,20 +2736,36 @@ int webserv_tick(void)
 				assert(num_bytes <= size);
 				http_serve(conn, buf, buf+num_bytes);
 			}	break;
+			case HTTP_REQUEST_BODY: {
+				upload_handle_read(conn, num_bytes);
+			}	break;
 			case WEBSOCKET: {
 				size_t size;
 				uint8_t* buf = get_conn_ws_read_buffer(conn, &size);
 				assert(num_bytes <= size);
 				websocket_serve(conn, buf, buf+num_bytes);
-				conn_read(conn, buf, size);
+				// (a read queued after conn_drop() would keep the
+				// close from happening until the peer sends something.
+				// and a throttled conn isn't read until websocket_drain()
+				// has handled its deferred mims; the peer has to wait)
+				if ((conn->cstate != CLOSING) && (arrlen(conn->websock.deferred_arr) == 0)) {
+					// a full read means there's probably more where that
+					// came from, so read it in bigger chunks; otherwise
+					// go back to a small buffer
+					const int is_full = (num_bytes == size);
+					conn_set_buffer_class(conn, is_full ? LARGE_BUFFER : SMALL_BUFFER);
+					buf = get_conn_ws_read_buffer(conn, &size);
+					conn_read(conn, buf, size);
+				}
 			}	break;
 			default: assert(!"unhandled conn state");
 			}
 			assert((conn->cstate != HTTP_REQUEST) && "unexpected state");
-		} else if (is_echo_write(ev.echo, &conn_id)) {
+		} else if (is_echo_write(ev.echo, &conn_id) || is_echo_wswrite(ev.echo, &conn_id)) {
 			struct conn* conn = get_conn(conn_id);
 			assert(conn->num_inflight_writes > 0);
 			--conn->num_inflight_writes;
+			if (is_echo_wswrite(ev.echo, NULL)) websocket_ack_write(conn);
 			if (conn->num_inflight_writes == 0) {
 				conn_free_transient_data(conn);
 				if (conn->cstate == HTTP_RESPONSE) {
@@ -1369,6 +2777,8 @@ int webserv_tick(void)
 					if (conn->enter_websocket_after_response) {
 						conn_enter(conn, WEBSOCKET);
 						conn->enter_websocket_after_response = 0;
+						conn->websock.last_heard_us = now_us;
+						conn_set_buffer_class(conn, SMALL_BUFFER);
 						size_t size;
 						uint8_t* buf = get_conn_ws_read_buffer(conn, &size);
 						conn_read(conn, buf, size);
@@ -1386,37 +2796,79 @@ int webserv_tick(void)
 			}
 		}
 	}
+	did_work |= websocket_drain(now_us);
+	did_work |= websocket_keepalive(now_us);
 	return did_work;
 }
 
-int webserv_broadcast_journal(int64_t until_journal_cursor)
+int webserv_broadcast_journal(int room_id, int64_t until_journal_cursor)
 {
+	// connections at the same journal cursor (and with the same lz dictionary
+	// size class) share the same message; usually all spectators are caught
+	// up, so there's only one message per broadcast (or a few, with WSFLAG_LZ)
+	struct wsmsg*** msgs = &g.broadcast_wsmsg_arr;
+	assert(arrlen(*msgs) == 0);
 	int did_work = 0;
 	for (int i=0; i<g.next; ++i) {
 		struct conn* conn = &g.conns[i];
 		if (conn->cstate != WEBSOCKET) continue;
-		if (conn->num_inflight_writes) continue;
+		if (conn->room_id != room_id) continue;
+		if (websocket_is_congested(conn)) continue;
 		struct websock* ws = &conn->websock;
 		struct conndo* cdo = &ws->conndo;
 		if (!cdo->did_greet) continue;
 		int64_t count = (until_journal_cursor - cdo->journal_cursor);
 		if (count <= 0) continue;
 
-		uint8_t** bb = &tlg.bb;
-		arrreset(*bb);
-		bb_append_u8(bb, WS1_JOURNAL_UPDATE);
-		bb_append_leb128(bb, count);
-		uint8_t* p = arraddnptr(*bb, count);
-		copy_journal(p, count, cdo->journal_cursor);
+		int64_t lz_dict_size = -1;
+		if ((cdo->flags & WSFLAG_LZ) && (count <= LZ_MAX_UPDATE_SIZE)) {
+			lz_dict_size = get_lz_dict_size_class(cdo->journal_cursor - cdo->lz_dict_journal_cursor);
+		}
+
+		struct wsmsg* msg = NULL;
+		const int num_msgs = arrlen(*msgs);
+		for (int ii=0; ii<num_msgs; ++ii) {
+			struct wsmsg* m = (*msgs)[ii];
+			if (m->journal_cursor0 != cdo->journal_cursor) continue;
+			if (m->lz_dict_size != lz_dict_size) continue;
+			assert(m->journal_cursor1 == until_journal_cursor);
+			msg = m;
+			break;
+		}
+		if (msg == NULL) {
+			if (lz_dict_size >= 0) {
+				msg = wsmsg_new_journal_update_lz(room_id, cdo->journal_cursor, until_journal_cursor, lz_dict_size);
+			} else {
+				msg = wsmsg_new_journal_update(room_id, cdo->journal_cursor, until_journal_cursor);
+			}
+			arrput(*msgs, msg);
+		}
+
 		cdo->journal_cursor = until_journal_cursor;
-		websocket_send0(conn, *bb, arrlen(*bb));
+		websocket_send_msg(conn, msg);
 		did_work = 1;
 	}
+
+	// drop our references; messages are freed when the writes complete
+	const int num_msgs = arrlen(*msgs);
+	for (int i=0; i<num_msgs; ++i) wsmsg_release((*msgs)[i]);
+	arrreset(*msgs);
+
 	return did_work;
 }
 
 void webserv_selftest(void)
 {
+	{
+		assert(get_lz_dict_size_class(0) == 0);
+		assert(get_lz_dict_size_class(1023) == 0);
+		assert(get_lz_dict_size_class(1024) == 1024);
+		assert(get_lz_dict_size_class(5000) == 4096);
+		assert(get_lz_dict_size_class(65534) == 16384);
+		assert(get_lz_dict_size_class(65535) == LZ_MAX_DICT_SIZE);
+		assert(get_lz_dict_size_class(1L<<20) == LZ_MAX_DICT_SIZE);
+	}
+
 	{
 		assert(case_insensitive_match("foo", "foo", 3));
 		assert(case_insensitive_match("foo", "Foo", 3));
@@ -1461,9 +2913,105 @@ void webserv_selftest(void)
 
 		assert(!header_next(&hr));
 	}
-}
 
-// TODO: websocket_send0() should support multiple inflight writes, and should
-// probably have its own buffer pool serving this purpose. reusing the conn
-// buffer seems like bad design because http and ws are quite different
-// protocols, and they (and our usecase) have distinct needs.
+	{
+		static char h0[] =
+		"Accept-Encoding: gzip, deflate;q=0.5, br;q=0.0, zstd;q=0.01\0\0"
+		"If-None-Match: W/\"aaa\", \"bbb\"\0\0"
+		"If-None-Match: *\0\0"
+		"If-Range: \"aaa\"\0\0"
+		"If-Range: W/\"aaa\"\0\0"
+		"If-Range: *\0\0"
+		"If-Range: \"aaa\", \"bbb\"\0\0"
+		;
+		struct header_reader hr = header_begin(h0, h0+sizeof(h0)-1);
+
+		assert(header_next(&hr));
+		assert(header_csv_accepts(&hr, "gzip"));
+		assert(header_csv_accepts(&hr, "GZIP"));
+		assert(header_csv_accepts(&hr, "deflate"));
+		assert(header_csv_accepts(&hr, "zstd"));
+		assert(!header_csv_accepts(&hr, "br"));
+		assert(!header_csv_accepts(&hr, "gz"));
+
+		assert(header_next(&hr));
+		assert(header_etag_matches(&hr, "aaa"));
+		assert(header_etag_matches(&hr, "bbb"));
+		assert(!header_etag_matches(&hr, "aa"));
+		assert(!header_etag_matches(&hr, "bbbb"));
+
+		assert(header_next(&hr));
+		assert(header_etag_matches(&hr, "whatever"));
+
+		assert(header_next(&hr));
+		assert(header_if_range_matches(&hr, "aaa"));
+		assert(!header_if_range_matches(&hr, "aa"));
+		assert(!header_if_range_matches(&hr, "aaaa"));
+
+		assert(header_next(&hr));
+		assert(!header_if_range_matches(&hr, "aaa"));
+
+		assert(header_next(&hr));
+		assert(!header_if_range_matches(&hr, "whatever"));
+
+		assert(header_next(&hr));
+		assert(!header_if_range_matches(&hr, "aaa"));
+		assert(!header_if_range_matches(&hr, "bbb"));
+
+		assert(!header_next(&hr));
+	}
+
+	{
+		int64_t o=-1, n=-1;
+		#define R(S) parse_range(S, S+strlen(S), 1000, &o, &n)
+		assert(R("bytes=0-499") == 1 && o == 0 && n == 500);
+		assert(R("bytes=500-") == 1 && o == 500 && n == 500);
+		assert(R("bytes=-100") == 1 && o == 900 && n == 100);
+		assert(R("bytes=-5000") == 1 && o == 0 && n == 1000);
+		assert(R("bytes=900-5000") == 1 && o == 900 && n == 100);
+		assert(R("bytes=999-999") == 1 && o == 999 && n == 1);
+		assert(R("bytes=1000-") == -1);
+		assert(R("bytes=-0") == -1);
+		assert(R("bytes=5-4") == 0);
+		assert(R("bytes=0-1,5-6") == 0);
+		assert(R("bytes=-") == 0);
+		assert(R("items=0-1") == 0);
+		assert(R("bytes=99999999999999999999-") == 0);
+		#undef R
+	}
+
+	{
+		const double mim_rate0 = g.mim_rate;
+		const double mim_byte_rate0 = g.mim_byte_rate;
+		g.mim_rate = 10;
+		g.mim_byte_rate = 1000;
+		struct ratelimit rl;
+		ratelimit_init(&rl, 0);
+		// a burst of 2s' worth...
+		for (int i=0; i<20; ++i) assert(ratelimit_take(&rl, 1, 0));
+		assert(!ratelimit_take(&rl, 1, 0));
+		assert(ratelimit_get_wait_us(&rl, 0) == 1);
+		// ...and then the rate
+		assert(ratelimit_take(&rl, 1, 1));
+		assert(!ratelimit_take(&rl, 1, 1));
+		const int64_t w = ratelimit_get_wait_us(&rl, 50000);
+		assert((49990 <= w) && (w <= 50001));
+		assert(!ratelimit_take(&rl, 1, 99000));
+		assert(ratelimit_take(&rl, 1, 101000));
+		// a mim bigger than the burst gets through, and the next one waits
+		// until the debt is paid
+		ratelimit_init(&rl, 0);
+		assert(ratelimit_take(&rl, 5000, 0));
+		assert(!ratelimit_take(&rl, 1, 0));
+		assert(ratelimit_get_wait_us(&rl, 0) == 3000001);
+		assert(!ratelimit_take(&rl, 1, 3000000));
+		assert(ratelimit_take(&rl, 1, 3000001));
+		// 0 is unlimited
+		g.mim_rate = 0;
+		g.mim_byte_rate = 0;
+		ratelimit_init(&rl, 0);
+		for (int i=0; i<1000; ++i) assert(ratelimit_take(&rl, 1<<20, 0));
+		g.mim_rate = mim_rate0;
+		g.mim_byte_rate = mim_byte_rate0;
+	}
+}
@@ -2,12 +2,51 @@
 
 #include <stdint.h>
 
+void webserv_set_port(int port);
+// listen on port instead of the default (6581); call before webserv_init()
+void webserv_set_max_conn_count(int max_conn_count);
+// accept at most this many connections at a time (default 4096); more get a
+// 503. call before webserv_init()
+void webserv_set_websocket_timeout_ms(int timeout_ms);
+// websockets that haven't sent anything for half of timeout_ms are pinged,
+// and dropped if they still haven't after all of it (default 30s; 0 disables
+// it). call before webserv_init()
+void webserv_set_mim_rate_limit(double mims_per_second, double bytes_per_second);
+// each websocket artist may send this many mims (and mim bytes) per second,
+// with bursts of up to 2s' worth (default 200 mims/s and 1MiB/s; 0 is
+// unlimited). mims over the limit are deferred, not dropped: the connection
+// isn't read until they're committed, so the peer is slowed down by TCP flow
+// control instead of the host. call before webserv_init()
+void webserv_set_upload_budget(int64_t num_bytes);
+// PUT/POST /dok/ may add at most this many bytes to dok/ in all, counting the
+// uploads in progress (default 1GiB; 0 disables uploads). anyone who can
+// reach the webserv can upload, so this is what bounds the disk it takes;
+// bodies that would go over get a 507. call before webserv_init()
 void webserv_init(void);
 int webserv_tick(void);
+int64_t webserv_get_wait_timeout_us(void);
+// how long io_wait() may sleep before a deferred mim is let through; -1 if
+// there are none
 
 void webserv_selftest(void);
 
-int webserv_broadcast_journal(int64_t until_journal_cursor);
+int webserv_broadcast_journal(int room_id, int64_t until_journal_cursor);
+
+struct webserv_stats {
+	int num_conns;
+	int max_conn_count;
+	int num_small_buffers_in_use; // idle websockets
+	int num_large_buffers_in_use; // HTTP, and busy websockets
+	int64_t buffer_bytes_in_use;
+	int64_t buffer_bytes_allocated; // high-water mark; buffers are pooled
+	int64_t num_ws_pings;
+	int64_t num_ws_evictions; // see webserv_set_websocket_timeout_ms()
+	int num_throttled_conns; // with deferred mims; see webserv_set_mim_rate_limit()
+	int64_t deferred_bytes;
+	int64_t num_ws_throttles; // times a conn was throttled
+	int64_t num_mims_deferred;
+};
+void webserv_get_stats(struct webserv_stats* out_stats);
 
 #define WEBSERV_H
 #endif